@@ -0,0 +1,212 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+// contention benchmark and stress run of CRingQueue: 64 producers push
+// into a ring drained by blocking consumers, every item must come out
+// once. the burst phase lets the consumers go to sleep between items so
+// that a lost wake shows up as a stall. the wake phase runs a few threads
+// on a small ring, the queue is built with __RINGQUEUE_STRESS__ so that a
+// waker is paused between its look at the sleepers and its wake while a
+// sleeper leaves. exits 1 on a lost, duplicated or stalled item
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <iostream>
+
+#include <common/CObject.h>
+#include <common/CException.h>
+#include <common/thread/CRingQueue.h>
+
+using namespace std;
+
+#define BENCH_NUMPRODUCER	64
+#define BENCH_NUMCONSUMER	4
+#define BENCH_CAPACITY		1024
+#define BENCH_NUMITEM		20000
+#define BENCH_NUMBURST		200
+#define BENCH_WAKEPRODUCER	3
+#define BENCH_WAKECONSUMER	2
+#define BENCH_WAKECAPACITY	64
+#define BENCH_NUMWAKE		200000
+#define BENCH_STALLTIMEOUT	10
+
+struct SBench
+{
+	CRingQueue* pQueue;
+	unsigned long numItem;
+	bool isBurst;
+	volatile unsigned long numPopped;
+	volatile unsigned char* pSeen;
+};
+
+struct SProducer
+{
+	SBench* pBench;
+	unsigned long index;
+};
+
+static double GetTime()
+{
+	struct timespec Now;
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+
+	return Now.tv_sec + Now.tv_nsec / 1e9;
+}
+
+static void* ProducerJob(void* pvProducer)
+{
+	SProducer* pProducer = (SProducer*) pvProducer;
+	SBench* pBench = pProducer->pBench;
+
+	for(unsigned long i = 0 ; i < pBench->numItem ; i++)
+	{
+		// items are numbered from 1, NULL is not a valid item
+		unsigned long item = pProducer->index * pBench->numItem + i + 1;
+
+		if(!pBench->pQueue->Push((void*) item))
+		return NULL;
+
+		// a burst run leaves the consumers time to fall asleep
+		if(pBench->isBurst)
+		usleep(rand() % 200);
+	}
+
+	return NULL;
+}
+
+static void* ConsumerJob(void* pvBench)
+{
+	SBench* pBench = (SBench*) pvBench;
+	void* pItem;
+
+	while(pBench->pQueue->Pop(&pItem))
+	{
+		unsigned long item = (unsigned long) pItem;
+
+		if(__sync_lock_test_and_set(&pBench->pSeen[item - 1], 1) != 0)
+		cerr << "item " << item << " popped twice" << endl;
+
+		__sync_add_and_fetch(&pBench->numPopped, 1);
+	}
+
+	return NULL;
+}
+
+static bool Run(const char* name, int numProducer, int numConsumer, unsigned long capacity, unsigned long numItem, bool isBurst)
+{
+	CRingQueue Queue(capacity, true);
+	SBench Bench;
+	SProducer* ProducerList = new SProducer[numProducer];
+	pthread_t* producerThread = new pthread_t[numProducer];
+	pthread_t* consumerThread = new pthread_t[numConsumer];
+
+	unsigned long numTotal = numItem * numProducer;
+
+	Bench.pQueue = &Queue;
+	Bench.numItem = numItem;
+	Bench.isBurst = isBurst;
+	Bench.numPopped = 0;
+	Bench.pSeen = new unsigned char[numTotal];
+	memset((void*) Bench.pSeen, 0, numTotal);
+
+	double start = GetTime();
+
+	for(int i = 0 ; i < numConsumer ; i++)
+	pthread_create(&consumerThread[i], NULL, ConsumerJob, &Bench);
+
+	for(int i = 0 ; i < numProducer ; i++)
+	{
+		ProducerList[i].pBench = &Bench;
+		ProducerList[i].index = i;
+		pthread_create(&producerThread[i], NULL, ProducerJob, &ProducerList[i]);
+	}
+
+	// a consumer that misses its wake stalls the producers on a full ring
+	unsigned long numLast = Bench.numPopped;
+	double lastProgress = GetTime();
+
+	while(Bench.numPopped < numTotal && GetTime() - lastProgress < BENCH_STALLTIMEOUT)
+	{
+		usleep(1000);
+
+		if(Bench.numPopped != numLast)
+		{
+			numLast = Bench.numPopped;
+			lastProgress = GetTime();
+		}
+	}
+
+	double elapsed = GetTime() - start;
+	bool isOk = Bench.numPopped == numTotal;
+
+	for(unsigned long i = 0 ; isOk && i < numTotal ; i++)
+	isOk = Bench.pSeen[i] == 1;
+
+	printf("%-6s %d producers %d consumers: %lu/%lu items in %.3f s (%.2f Mitem/s) size %lu %s\n", name, numProducer, numConsumer, (unsigned long) Bench.numPopped, numTotal, elapsed, numTotal / elapsed / 1e6, (unsigned long) Queue.GetSize(), isOk ? "ok" : "FAILED");
+
+	Queue.Close();
+
+	for(int i = 0 ; i < numProducer ; i++)
+	pthread_join(producerThread[i], NULL);
+
+	for(int i = 0 ; i < numConsumer ; i++)
+	pthread_join(consumerThread[i], NULL);
+
+	delete[] Bench.pSeen;
+	delete[] ProducerList;
+	delete[] producerThread;
+	delete[] consumerThread;
+
+	return isOk;
+}
+
+int main(int argc, char** argv)
+{
+	int numRound = argc > 1 ? atoi(argv[1]) : 1;
+	bool isOk = true;
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	try
+	{
+		for(int i = 0 ; isOk && i < numRound ; i++)
+		{
+			isOk = Run("flood", BENCH_NUMPRODUCER, BENCH_NUMCONSUMER, BENCH_CAPACITY, BENCH_NUMITEM, false);
+
+			if(isOk)
+			isOk = Run("burst", BENCH_NUMPRODUCER, BENCH_NUMCONSUMER, BENCH_CAPACITY, BENCH_NUMBURST, true);
+
+			if(isOk)
+			isOk = Run("wake", BENCH_WAKEPRODUCER, BENCH_WAKECONSUMER, BENCH_WAKECAPACITY, BENCH_NUMWAKE, false);
+		}
+	}
+
+	catch(exception& e)
+	{
+		cerr << "exit on error: " << e.what() << endl;
+		return 1;
+	}
+
+	return isOk ? 0 : 1;
+}
@@ -0,0 +1,285 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+// throughput and cost of CTunRing on a real tun device, with io_uring and
+// with its plain read() and write() fallback. the read phase floods the
+// device with UDP datagrams routed into it, the write phase injects valid
+// IPv4/UDP packets addressed to a local port, in batches for the ring.
+// prints packets/s and the CPU time per packet of the thread doing the
+// tun I/O. skips (exit 77) without the right to create a tun device,
+// exits 1 when a phase moves no packet
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <iostream>
+
+#include <common/CObject.h>
+#include <common/CException.h>
+#include <common/tun/CTunRing.h>
+#include <common/tun/tun.h>
+
+using namespace std;
+
+#define BENCH_DEVICE		"tunbench0"
+#define BENCH_LOCALADDR		"10.254.77.1"
+#define BENCH_PEERADDR		"10.254.77.2"
+#define BENCH_NETMASK		"255.255.255.0"
+#define BENCH_FLOODPORT		9999
+#define BENCH_SINKPORT		9998
+#define BENCH_PACKETSIZE	1400
+#define BENCH_DURATION		1.0
+#define BENCH_SKIP		77
+
+struct SFlood
+{
+	volatile bool isStopped;
+	unsigned long numSent;
+};
+
+static double GetTime()
+{
+	struct timespec Now;
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+
+	return Now.tv_sec + Now.tv_nsec / 1e9;
+}
+
+static double GetThreadTime()
+{
+	struct timespec Now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &Now);
+
+	return Now.tv_sec + Now.tv_nsec / 1e9;
+}
+
+// returns -1 when we may not create the device
+static int OpenTun()
+{
+	char name[IFNAMSIZ] = BENCH_DEVICE;
+	int fd = tun_alloc(name, IFF_TUN | IFF_NO_PI);
+
+	if(fd < 0)
+	return -1;
+
+	// the link gets an address so that the peer address routes into it
+	if(set_ip(name, BENCH_LOCALADDR, BENCH_NETMASK) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void* FloodJob(void* pvFlood)
+{
+	SFlood* pFlood = (SFlood*) pvFlood;
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in Addr;
+	char data[BENCH_PACKETSIZE];
+
+	memset(&Addr, 0, sizeof(Addr));
+	Addr.sin_family = AF_INET;
+	Addr.sin_port = htons(BENCH_FLOODPORT);
+	inet_pton(AF_INET, BENCH_PEERADDR, &Addr.sin_addr);
+	memset(data, 1, sizeof(data));
+
+	while(!pFlood->isStopped)
+	{
+		if(sendto(sock, data, sizeof(data), 0, (struct sockaddr*) &Addr, sizeof(Addr)) > 0)
+		pFlood->numSent++;
+	}
+
+	close(sock);
+	return NULL;
+}
+
+static unsigned short GetChecksum(const unsigned char* pData, int size)
+{
+	unsigned long sum = 0;
+
+	for(int i = 0 ; i < size ; i += 2)
+	sum += (pData[i] << 8) | pData[i + 1];
+
+	while(sum >> 16)
+	sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return ~sum;
+}
+
+// an IPv4/UDP packet from the peer to our sink port, the UDP checksum is
+// left out
+static void BuildPacket(unsigned char* pPacket, int size)
+{
+	memset(pPacket, 0, size);
+
+	pPacket[0] = 0x45;
+	pPacket[2] = size >> 8;
+	pPacket[3] = size & 0xFF;
+	pPacket[8] = 64;
+	pPacket[9] = IPPROTO_UDP;
+	inet_pton(AF_INET, BENCH_PEERADDR, pPacket + 12);
+	inet_pton(AF_INET, BENCH_LOCALADDR, pPacket + 16);
+
+	unsigned short checksum = GetChecksum(pPacket, 20);
+	pPacket[10] = checksum >> 8;
+	pPacket[11] = checksum & 0xFF;
+
+	pPacket[20] = BENCH_FLOODPORT >> 8;
+	pPacket[21] = BENCH_FLOODPORT & 0xFF;
+	pPacket[22] = BENCH_SINKPORT >> 8;
+	pPacket[23] = BENCH_SINKPORT & 0xFF;
+	pPacket[24] = (size - 20) >> 8;
+	pPacket[25] = (size - 20) & 0xFF;
+}
+
+static bool RunRead(int fd, bool isUring, double duration)
+{
+	CTunRing TunRing;
+	TunRing.Open(fd, TUNRING_DEPTH, isUring);
+
+	SFlood Flood;
+	Flood.isStopped = false;
+	Flood.numSent = 0;
+
+	pthread_t floodThread;
+	pthread_create(&floodThread, NULL, FloodJob, &Flood);
+
+	unsigned long numRead = 0;
+	double start = GetTime();
+	double startCpu = GetThreadTime();
+	CObject::u32 size;
+
+	while(GetTime() - start < duration && TunRing.Read(&size) != NULL)
+	numRead++;
+
+	double elapsed = GetTime() - start;
+	double cpu = GetThreadTime() - startCpu;
+
+	Flood.isStopped = true;
+	pthread_join(floodThread, NULL);
+	TunRing.Close();
+
+	printf("read  %-6s          %8.0f pkt/s, %5.2f us cpu/pkt %s\n", isUring ? "uring" : "plain", numRead / elapsed, numRead ? cpu / numRead * 1e6 : 0, numRead ? "ok" : "FAILED");
+
+	return numRead > 0;
+}
+
+static bool RunWrite(int fd, bool isUring, int batchSize, double duration)
+{
+	CTunRing TunRing;
+	TunRing.Open(fd, TUNRING_DEPTH, isUring);
+
+	// the packets need a bound port or the stack answers each of them
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in Addr;
+
+	memset(&Addr, 0, sizeof(Addr));
+	Addr.sin_family = AF_INET;
+	Addr.sin_port = htons(BENCH_SINKPORT);
+	bind(sock, (struct sockaddr*) &Addr, sizeof(Addr));
+
+	unsigned char packet[BENCH_PACKETSIZE + 28];
+	BuildPacket(packet, sizeof(packet));
+
+	unsigned long numWrite = 0;
+	double start = GetTime();
+	double startCpu = GetThreadTime();
+
+	while(GetTime() - start < duration)
+	{
+		for(int i = 0 ; i < batchSize ; i++)
+		TunRing.Write(packet, sizeof(packet), i < batchSize - 1);
+
+		numWrite += batchSize;
+	}
+
+	TunRing.Flush();
+
+	double elapsed = GetTime() - start;
+	double cpu = GetThreadTime() - startCpu;
+
+	TunRing.Close();
+	close(sock);
+
+	printf("write %-6s batch %2d %8.0f pkt/s, %5.2f us cpu/pkt %s\n", isUring ? "uring" : "plain", batchSize, numWrite / elapsed, cpu / numWrite * 1e6, numWrite ? "ok" : "FAILED");
+
+	return numWrite > 0;
+}
+
+int main(int argc, char** argv)
+{
+	double duration = argc > 1 ? atof(argv[1]) : BENCH_DURATION;
+	bool isOk = true;
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	int fd = OpenTun();
+
+	if(fd < 0)
+	{
+		printf("no tun device, skipped\n");
+		return BENCH_SKIP;
+	}
+
+	try
+	{
+		CTunRing TunRing;
+		TunRing.Open(fd);
+
+		bool isUring = TunRing.IsUring();
+		TunRing.Close();
+
+		if(!isUring)
+		printf("no io_uring, only the plain path is measured\n");
+
+		isOk = RunRead(fd, false, duration) && isOk;
+
+		if(isUring)
+		isOk = RunRead(fd, true, duration) && isOk;
+
+		isOk = RunWrite(fd, false, 1, duration) && isOk;
+
+		if(isUring)
+		{
+			isOk = RunWrite(fd, true, 1, duration) && isOk;
+			isOk = RunWrite(fd, true, 4, duration) && isOk;
+			isOk = RunWrite(fd, true, 16, duration) && isOk;
+		}
+	}
+
+	catch(exception& e)
+	{
+		cerr << "exit on error: " << e.what() << endl;
+		close(fd);
+		return 1;
+	}
+
+	close(fd);
+	return isOk ? 0 : 1;
+}
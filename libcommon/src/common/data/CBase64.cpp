@@ -20,6 +20,17 @@
 
 #include <iostream>
 #include <stdio.h>
+#include <pthread.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#define __BASE64_X86__
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON) || defined(__aarch64__)
+#define __BASE64_NEON__
+#include <arm_neon.h>
+#endif
 
 #include <common/CException.h>
 #include <common/CObject.h>
@@ -28,70 +39,437 @@
 
 using namespace std;
 
-CBase64::CBase64()
+typedef CObject::u8 u8;
+typedef CObject::u32 u32;
+
+// a kernel only handles whole 3 bytes / 4 chars groups and returns the
+// number of input bytes it consumed, the remaining tail (and on decode
+// the padded last group) is done by the scalar code
+typedef u32 (*To64Kernel)(const u8* pIn, u32 inSize, char* pOut);
+typedef u32 (*From64Kernel)(const char* pIn, u32 inSize, u8* pOut);
+
+static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const u8 padOffset = 0xFE;
+static const u8 badOffset = 0xFF;
+
+static u8 offsetTable[256];
+
+static To64Kernel pTo64Kernel = NULL;
+static From64Kernel pFrom64Kernel = NULL;
+static const char* codecName = "scalar";
+
+static pthread_once_t codecOnce = PTHREAD_ONCE_INIT;
+
+static u32 To64Scalar(const u8* pIn, u32 inSize, char* pOut)
 {
-	int k = 0;
-	
-	for(int i = 0 ; i < 26 ; i++)
-	base64[k++] = 'A' + i;
+	u32 i = 0;
+
+	for( ; i + 3 <= inSize ; i += 3)
+	{
+		u32 group = (pIn[i] << 16) | (pIn[i + 1] << 8) | pIn[i + 2];
 
-	for(int i = 0 ; i < 26 ; i++)
-	base64[k++] = 'a' + i;
+		*pOut++ = base64[(group >> 18) & 0x3F];
+		*pOut++ = base64[(group >> 12) & 0x3F];
+		*pOut++ = base64[(group >> 6) & 0x3F];
+		*pOut++ = base64[group & 0x3F];
+	}
 
-	for(int i = 0 ; i < 10 ; i++)
-	base64[k++] = '0' + i;
+	return i;
+}
 
-	base64[k++] = '+';
-	base64[k++] = '/';
-	base64[k++] = '=';
-	
-	padOffset = 64;
+static u32 From64Scalar(const char* pIn, u32 inSize, u8* pOut)
+{
+	u32 i = 0;
+
+	for( ; i + 4 <= inSize ; i += 4)
+	{
+		u8 offset1 = offsetTable[(u8)pIn[i + 0]];
+		u8 offset2 = offsetTable[(u8)pIn[i + 1]];
+		u8 offset3 = offsetTable[(u8)pIn[i + 2]];
+		u8 offset4 = offsetTable[(u8)pIn[i + 3]];
+
+		// pad and bad offsets both have the two high bits set
+		if((offset1 | offset2 | offset3 | offset4) & 0xC0)
+		break;
+
+		u32 group = (offset1 << 18) | (offset2 << 12) | (offset3 << 6) | offset4;
+
+		*pOut++ = group >> 16;
+		*pOut++ = group >> 8;
+		*pOut++ = group;
+	}
+
+	return i;
+}
+
+#ifdef __BASE64_X86__
+
+// vector codecs from W. Mula and D. Lemire, "Faster Base64 Encoding and
+// Decoding using AVX2 Instructions"
+
+__attribute__((target("sse4.1")))
+static inline __m128i To64LookupSSE(__m128i indices)
+{
+	const __m128i shiftLUT = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+	__m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+	__m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+
+	result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+	result = _mm_shuffle_epi8(shiftLUT, result);
+
+	return _mm_add_epi8(result, indices);
+}
+
+__attribute__((target("sse4.1")))
+static u32 To64SSE(const u8* pIn, u32 inSize, char* pOut)
+{
+	const __m128i shuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+
+	u32 i = 0;
+
+	// 16 bytes are loaded but only 12 are encoded
+	for( ; inSize - i >= 16 ; i += 12)
+	{
+		__m128i in = _mm_loadu_si128((const __m128i*)(pIn + i));
+		in = _mm_shuffle_epi8(in, shuffle);
+
+		__m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+		__m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+
+		_mm_storeu_si128((__m128i*)pOut, To64LookupSSE(_mm_or_si128(t0, t1)));
+		pOut += 16;
+	}
+
+	return i;
+}
+
+__attribute__((target("sse4.1")))
+static u32 From64SSE(const char* pIn, u32 inSize, u8* pOut)
+{
+	const __m128i shiftLUT = _mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i maskLUT = _mm_setr_epi8((char)0xA8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF0, 0x54, 0x50, 0x50, 0x50, 0x54);
+	const __m128i bitposLUT = _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+	u32 i = 0;
+
+	// 16 bytes are stored but only 12 are decoded, stay clear of the end
+	for( ; inSize - i >= 24 ; i += 16)
+	{
+		__m128i in = _mm_loadu_si128((const __m128i*)(pIn + i));
+
+		__m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0F));
+		__m128i loNibbles = _mm_and_si128(in, _mm_set1_epi8(0x0F));
+
+		__m128i mask = _mm_shuffle_epi8(maskLUT, loNibbles);
+		__m128i bitpos = _mm_shuffle_epi8(bitposLUT, hiNibbles);
+
+		// leave the bad group to the scalar code which reports it
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(mask, bitpos), _mm_setzero_si128())))
+		break;
+
+		__m128i shift = _mm_shuffle_epi8(shiftLUT, hiNibbles);
+		shift = _mm_blendv_epi8(shift, _mm_set1_epi8(16), _mm_cmpeq_epi8(in, _mm_set1_epi8('/')));
+
+		__m128i values = _mm_add_epi8(in, shift);
+		values = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+		values = _mm_madd_epi16(values, _mm_set1_epi32(0x00011000));
+
+		_mm_storeu_si128((__m128i*)pOut, _mm_shuffle_epi8(values, pack));
+		pOut += 12;
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i To64LookupAVX2(__m256i indices)
+{
+	const __m256i shiftLUT = _mm256_broadcastsi128_si256(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0));
+
+	__m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+	__m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+
+	result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+	result = _mm256_shuffle_epi8(shiftLUT, result);
+
+	return _mm256_add_epi8(result, indices);
+}
+
+__attribute__((target("avx2")))
+static u32 To64AVX2(const u8* pIn, u32 inSize, char* pOut)
+{
+	const __m256i shuffle = _mm256_broadcastsi128_si256(_mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+
+	u32 i = 0;
+
+	// each lane loads 16 bytes and encodes 12 of them
+	for( ; inSize - i >= 28 ; i += 24)
+	{
+		__m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(pIn + i))), _mm_loadu_si128((const __m128i*)(pIn + i + 12)), 1);
+		in = _mm256_shuffle_epi8(in, shuffle);
+
+		__m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040));
+		__m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010));
+
+		_mm256_storeu_si256((__m256i*)pOut, To64LookupAVX2(_mm256_or_si256(t0, t1)));
+		pOut += 32;
+	}
+
+	return i + To64SSE(pIn + i, inSize - i, pOut);
+}
+
+__attribute__((target("avx2")))
+static u32 From64AVX2(const char* pIn, u32 inSize, u8* pOut)
+{
+	const __m256i shiftLUT = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0));
+	const __m256i maskLUT = _mm256_broadcastsi128_si256(_mm_setr_epi8((char)0xA8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF0, 0x54, 0x50, 0x50, 0x50, 0x54));
+	const __m256i bitposLUT = _mm256_broadcastsi128_si256(_mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80, 0, 0, 0, 0, 0, 0, 0, 0));
+	const __m256i pack = _mm256_broadcastsi128_si256(_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+	const __m256i permute = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+	u32 i = 0;
+
+	// 32 bytes are stored but only 24 are decoded, stay clear of the end
+	for( ; inSize - i >= 48 ; i += 32)
+	{
+		__m256i in = _mm256_loadu_si256((const __m256i*)(pIn + i));
+
+		__m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), _mm256_set1_epi8(0x0F));
+		__m256i loNibbles = _mm256_and_si256(in, _mm256_set1_epi8(0x0F));
+
+		__m256i mask = _mm256_shuffle_epi8(maskLUT, loNibbles);
+		__m256i bitpos = _mm256_shuffle_epi8(bitposLUT, hiNibbles);
+
+		if(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(mask, bitpos), _mm256_setzero_si256())))
+		break;
+
+		__m256i shift = _mm256_shuffle_epi8(shiftLUT, hiNibbles);
+		shift = _mm256_blendv_epi8(shift, _mm256_set1_epi8(16), _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/')));
+
+		__m256i values = _mm256_add_epi8(in, shift);
+		values = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+		values = _mm256_madd_epi16(values, _mm256_set1_epi32(0x00011000));
+		values = _mm256_shuffle_epi8(values, pack);
+
+		_mm256_storeu_si256((__m256i*)pOut, _mm256_permutevar8x32_epi32(values, permute));
+		pOut += 24;
+	}
+
+	return i + From64SSE(pIn + i, inSize - i, pOut);
+}
+
+#endif //__BASE64_X86__
+
+#ifdef __BASE64_NEON__
+
+static inline uint8x16_t To64LookupNEON(uint8x16_t indices)
+{
+	static const u8 shift[16] = {'a' - 26, '0' - 52 + 256, '0' - 52 + 256, '0' - 52 + 256, '0' - 52 + 256, '0' - 52 + 256, '0' - 52 + 256, '0' - 52 + 256, '0' - 52 + 256, '0' - 52 + 256, '0' - 52 + 256, '+' - 62 + 256, '/' - 63 + 256, 'A', 0, 0};
+
+	uint8x16_t result = vqsubq_u8(indices, vdupq_n_u8(51));
+	uint8x16_t less = vcltq_u8(indices, vdupq_n_u8(26));
+
+	result = vorrq_u8(result, vandq_u8(less, vdupq_n_u8(13)));
+
+	#ifdef __aarch64__
+	result = vqtbl1q_u8(vld1q_u8(shift), result);
+	#else
+	uint8x8x2_t shiftLUT = {{vld1_u8(shift), vld1_u8(shift + 8)}};
+	result = vcombine_u8(vtbl2_u8(shiftLUT, vget_low_u8(result)), vtbl2_u8(shiftLUT, vget_high_u8(result)));
+	#endif
+
+	return vaddq_u8(result, indices);
+}
+
+static u32 To64NEON(const u8* pIn, u32 inSize, char* pOut)
+{
+	const uint8x16_t mask = vdupq_n_u8(0x3F);
+
+	u32 i = 0;
+
+	for( ; inSize - i >= 48 ; i += 48)
+	{
+		uint8x16x3_t in = vld3q_u8(pIn + i);
+		uint8x16x4_t out;
+
+		out.val[0] = vshrq_n_u8(in.val[0], 2);
+		out.val[1] = vandq_u8(vorrq_u8(vshrq_n_u8(in.val[1], 4), vshlq_n_u8(in.val[0], 4)), mask);
+		out.val[2] = vandq_u8(vorrq_u8(vshrq_n_u8(in.val[2], 6), vshlq_n_u8(in.val[1], 2)), mask);
+		out.val[3] = vandq_u8(in.val[2], mask);
+
+		out.val[0] = To64LookupNEON(out.val[0]);
+		out.val[1] = To64LookupNEON(out.val[1]);
+		out.val[2] = To64LookupNEON(out.val[2]);
+		out.val[3] = To64LookupNEON(out.val[3]);
+
+		vst4q_u8((u8*)pOut, out);
+		pOut += 64;
+	}
+
+	return i;
+}
+
+static inline uint8x16_t From64LookupNEON(uint8x16_t in, uint8x16_t& valid)
+{
+	uint8x16_t upper = vandq_u8(vcgeq_u8(in, vdupq_n_u8('A')), vcleq_u8(in, vdupq_n_u8('Z')));
+	uint8x16_t lower = vandq_u8(vcgeq_u8(in, vdupq_n_u8('a')), vcleq_u8(in, vdupq_n_u8('z')));
+	uint8x16_t digit = vandq_u8(vcgeq_u8(in, vdupq_n_u8('0')), vcleq_u8(in, vdupq_n_u8('9')));
+	uint8x16_t plus = vceqq_u8(in, vdupq_n_u8('+'));
+	uint8x16_t slash = vceqq_u8(in, vdupq_n_u8('/'));
+
+	uint8x16_t result = vandq_u8(upper, vsubq_u8(in, vdupq_n_u8('A')));
+	result = vorrq_u8(result, vandq_u8(lower, vsubq_u8(in, vdupq_n_u8('a' - 26))));
+	result = vorrq_u8(result, vandq_u8(digit, vaddq_u8(in, vdupq_n_u8(52 - '0'))));
+	result = vorrq_u8(result, vandq_u8(plus, vdupq_n_u8(62)));
+	result = vorrq_u8(result, vandq_u8(slash, vdupq_n_u8(63)));
+
+	valid = vandq_u8(valid, vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(digit, vorrq_u8(plus, slash))));
+
+	return result;
+}
+
+static u32 From64NEON(const char* pIn, u32 inSize, u8* pOut)
+{
+	u32 i = 0;
+
+	for( ; inSize - i >= 64 ; i += 64)
+	{
+		uint8x16x4_t in = vld4q_u8((const u8*)(pIn + i));
+		uint8x16_t valid = vdupq_n_u8(0xFF);
+
+		uint8x16_t offset1 = From64LookupNEON(in.val[0], valid);
+		uint8x16_t offset2 = From64LookupNEON(in.val[1], valid);
+		uint8x16_t offset3 = From64LookupNEON(in.val[2], valid);
+		uint8x16_t offset4 = From64LookupNEON(in.val[3], valid);
+
+		// leave the bad group to the scalar code which reports it
+		uint8x8_t folded = vand_u8(vget_low_u8(valid), vget_high_u8(valid));
+		if(vget_lane_u64(vreinterpret_u64_u8(folded), 0) != 0xFFFFFFFFFFFFFFFFULL)
+		break;
+
+		uint8x16x3_t out;
+
+		out.val[0] = vorrq_u8(vshlq_n_u8(offset1, 2), vshrq_n_u8(offset2, 4));
+		out.val[1] = vorrq_u8(vshlq_n_u8(offset2, 4), vshrq_n_u8(offset3, 2));
+		out.val[2] = vorrq_u8(vshlq_n_u8(offset3, 6), offset4);
+
+		vst3q_u8(pOut, out);
+		pOut += 48;
+	}
+
+	return i;
+}
+
+#endif //__BASE64_NEON__
+
+CBase64::CBase64()
+{
+	pthread_once(&codecOnce, InitCodec);
 }
 
 CBase64::~CBase64()
 {}
 
-void CBase64::To64(CBuffer* pBufferIn, string& strOut)
+void CBase64::InitCodec()
+{
+	for(int i = 0 ; i < 256 ; i++)
+	offsetTable[i] = badOffset;
+
+	for(int i = 0 ; i < 64 ; i++)
+	offsetTable[(u8)base64[i]] = i;
+
+	offsetTable[(u8)'='] = padOffset;
+
+	pTo64Kernel = To64Scalar;
+	pFrom64Kernel = From64Scalar;
+
+	#ifdef __BASE64_X86__
+	__builtin_cpu_init();
+
+	if(__builtin_cpu_supports("avx2"))
+	{
+		pTo64Kernel = To64AVX2;
+		pFrom64Kernel = From64AVX2;
+		codecName = "avx2";
+	}
+
+	else if(__builtin_cpu_supports("sse4.1"))
+	{
+		pTo64Kernel = To64SSE;
+		pFrom64Kernel = From64SSE;
+		codecName = "sse4.1";
+	}
+	#endif //__BASE64_X86__
+
+	#ifdef __BASE64_NEON__
+	pTo64Kernel = To64NEON;
+	pFrom64Kernel = From64NEON;
+	codecName = "neon";
+	#endif //__BASE64_NEON__
+}
+
+const char* CBase64::GetCodecName()
+{
+	pthread_once(&codecOnce, InitCodec);
+
+	return codecName;
+}
+
+CObject::u32 CBase64::GetTo64Size(u32 dataInSize)
+{
+	return ((dataInSize + 2) / 3) * 4;
+}
+
+CObject::u32 CBase64::GetFrom64Size(const char* pDataIn, u32 dataInSize)
+{
+	if(dataInSize < 4)
+	return 0;
+
+	u32 dataOutSize = (dataInSize / 4) * 3;
+
+	if(pDataIn[dataInSize - 1] == '=')
+	dataOutSize--;
+
+	if(pDataIn[dataInSize - 2] == '=')
+	dataOutSize--;
+
+	return dataOutSize;
+}
+
+CObject::u32 CBase64::To64(const u8* pDataIn, u32 dataInSize, char* pDataOut)
 {
 	try
 	{
-		strOut = "";
-		pBufferIn->SetReadPos(0);
+		u32 i = pTo64Kernel(pDataIn, dataInSize, pDataOut);
+		i += To64Scalar(pDataIn + i, dataInSize - i, pDataOut + (i / 3) * 4);
 
-		u8 byte1, byte2, byte3;
+		char* pOut = pDataOut + (i / 3) * 4;
 
-		for(u32 i = 0 ; i < pBufferIn->GetBufferSize() / 3 ; i++)
+		if(dataInSize - i == 1)
 		{
-			pBufferIn->Read(&byte1);
-			pBufferIn->Read(&byte2);
-			pBufferIn->Read(&byte3);
-			
-			strOut += base64[byte1 >> 2];
-			strOut += base64[((byte1 & 0x03) << 4) | (byte2 >> 4)];
-			strOut += base64[((byte2 & 0xF) << 2) | (byte3 >> 6)];
-			strOut += base64[byte3 & 0x3F];
-		}
+			u8 byte1 = pDataIn[i];
 
-		if(pBufferIn->GetBufferSize() % 3 == 1)
-		{
-			pBufferIn->Read(&byte1);
-		
-			strOut += base64[byte1 >> 2];
-			strOut += base64[(byte1 & 0x03) << 4];
-			strOut += base64[padOffset];
-			strOut += base64[padOffset];
+			*pOut++ = base64[byte1 >> 2];
+			*pOut++ = base64[(byte1 & 0x03) << 4];
+			*pOut++ = '=';
+			*pOut++ = '=';
 		}
 
-		if(pBufferIn->GetBufferSize() % 3 == 2)
+		if(dataInSize - i == 2)
 		{
-			pBufferIn->Read(&byte1);
-			pBufferIn->Read(&byte2);
-			
-			strOut += base64[byte1 >> 2];
-			strOut += base64[((byte1 & 0x03) << 4) | (byte2 >> 4)];
-			strOut += base64[(byte2 & 0xF) << 2];
-			strOut += base64[padOffset];
+			u8 byte1 = pDataIn[i];
+			u8 byte2 = pDataIn[i + 1];
+
+			*pOut++ = base64[byte1 >> 2];
+			*pOut++ = base64[((byte1 & 0x03) << 4) | (byte2 >> 4)];
+			*pOut++ = base64[(byte2 & 0xF) << 2];
+			*pOut++ = '=';
 		}
+
+		return pOut - pDataOut;
 	}
 
 	catch(exception& e)
@@ -104,54 +482,47 @@ void CBase64::To64(CBuffer* pBufferIn, string& strOut)
 	}
 }
 
-void CBase64::To64(CBuffer* pBufferIn, CBuffer* pBufferOut)
+CObject::u32 CBase64::From64(const char* pDataIn, u32 dataInSize, u8* pDataOut)
 {
 	try
 	{
-		u32 bufferOutSize;
-		pBufferIn->SetReadPos(0);
+		if(dataInSize == 0)
+		return 0;
 
-		bufferOutSize = (pBufferIn->GetBufferSize() / 3) * 4;
+		if(dataInSize % 4)
+		throw CBase64Exception(CBase64Exception::B64EC_FROM64ERROR);
 
-		if(pBufferIn->GetBufferSize() % 3)
-		bufferOutSize += 4;
+		// the last group may be padded, keep it for the end
+		u32 bodySize = dataInSize - 4;
 
-		pBufferOut->Create(bufferOutSize);
+		u32 i = pFrom64Kernel(pDataIn, bodySize, pDataOut);
+		i += From64Scalar(pDataIn + i, bodySize - i, pDataOut + (i / 4) * 3);
 
-		u8 byte1, byte2, byte3;
+		if(i != bodySize)
+		throw CBase64Exception(CBase64Exception::B64EC_FROM64ERROR);
 
-		for(u32 i = 0 ; i < pBufferIn->GetBufferSize() / 3 ; i++)
-		{
-			pBufferIn->Read(&byte1);
-			pBufferIn->Read(&byte2);
-			pBufferIn->Read(&byte3);
-			
-			pBufferOut->Write(base64[byte1 >> 2]);
-			pBufferOut->Write(base64[((byte1 & 0x03) << 4) | (byte2 >> 4)]);
-			pBufferOut->Write(base64[((byte2 & 0xF) << 2) | (byte3 >> 6)]);
-			pBufferOut->Write(base64[byte3 & 0x3F]);
-		}
+		u8* pOut = pDataOut + (i / 4) * 3;
 
-		if(pBufferIn->GetBufferSize() % 3 == 1)
-		{
-			pBufferIn->Read(&byte1);
-		
-			pBufferOut->Write(base64[byte1 >> 2]);
-			pBufferOut->Write(base64[(byte1 & 0x03) << 4]);
-			pBufferOut->Write(base64[padOffset]);
-			pBufferOut->Write(base64[padOffset]);
-		}
+		u8 offset1 = offsetTable[(u8)pDataIn[i + 0]];
+		u8 offset2 = offsetTable[(u8)pDataIn[i + 1]];
+		u8 offset3 = offsetTable[(u8)pDataIn[i + 2]];
+		u8 offset4 = offsetTable[(u8)pDataIn[i + 3]];
 
-		if(pBufferIn->GetBufferSize() % 3 == 2)
-		{
-			pBufferIn->Read(&byte1);
-			pBufferIn->Read(&byte2);
-			
-			pBufferOut->Write(base64[byte1 >> 2]);
-			pBufferOut->Write(base64[((byte1 & 0x03) << 4) | (byte2 >> 4)]);
-			pBufferOut->Write(base64[(byte2 & 0xF) << 2]);
-			pBufferOut->Write(base64[padOffset]);
-		}
+		if(((offset1 | offset2) & 0xC0) || offset3 == badOffset || offset4 == badOffset)
+		throw CBase64Exception(CBase64Exception::B64EC_FROM64ERROR);
+
+		if(offset3 == padOffset && offset4 != padOffset)
+		throw CBase64Exception(CBase64Exception::B64EC_FROM64ERROR);
+
+		*pOut++ = (offset1 << 2) | (offset2 >> 4);
+
+		if(offset3 != padOffset)
+		*pOut++ = (offset2 << 4) | (offset3 >> 2);
+
+		if(offset4 != padOffset)
+		*pOut++ = (offset3 << 6) | offset4;
+
+		return pOut - pDataOut;
 	}
 
 	catch(exception& e)
@@ -160,74 +531,40 @@ void CBase64::To64(CBuffer* pBufferIn, CBuffer* pBufferOut)
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CBase64Exception(CBase64Exception::B64EC_TO64ERROR);
+		throw CBase64Exception(CBase64Exception::B64EC_FROM64ERROR);
 	}
 }
 
-void CBase64::From64(const string& strIn, CBuffer* pBufferOut)
+void CBase64::To64(CBuffer* pBufferIn, string& strOut)
 {
 	try
 	{
-		if(strIn.size() == 0)
-		return;
-		
-		if(strIn.size() % 4)
-		throw CBase64Exception(CBase64Exception::B64EC_FROM64ERROR);
-		
-		int offset1 = GetOffset(strIn[strIn.size() - 2]);
-		int offset2 = GetOffset(strIn[strIn.size() - 1]);
-		
-		uInt32 bufferOutSize;
-		
-		bufferOutSize = (strIn.size() /  4) * 3;
+		strOut.resize(GetTo64Size(pBufferIn->GetBufferSize()));
 
-		if(offset1 == padOffset && offset2 == padOffset)
-		bufferOutSize -= 2;
+		if(strOut.size())
+		To64(pBufferIn->GetBuffer(), pBufferIn->GetBufferSize(), &strOut[0]);
+	}
 
-		if(offset1 != padOffset && offset2 == padOffset)
-		bufferOutSize -= 1;
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CBase64Exception(CBase64Exception::B64EC_TO64ERROR);
+	}
+}
+
+void CBase64::To64(CBuffer* pBufferIn, CBuffer* pBufferOut)
+{
+	try
+	{
+		u32 bufferOutSize = GetTo64Size(pBufferIn->GetBufferSize());
 
 		pBufferOut->Create(bufferOutSize);
 
-		for(uInt32 i = 0 ; i < strIn.size() ; i += 4)
-		{
-			uByte byte;
-
-			/* convert each ascii char to offset */
-			int offset1 = GetOffset(strIn[i + 0]);
-			int offset2 = GetOffset(strIn[i + 1]);
-			int offset3 = GetOffset(strIn[i + 2]);
-			int offset4 = GetOffset(strIn[i + 3]);
-			
-			/* case if  */
-			if(offset3 == padOffset && offset4 == padOffset)
-			{
-				byte = (offset1 << 2) | (offset2 >> 4);
-				pBufferOut->Write(byte);
-				
-				return;
-			}
-
-			if(offset3 != padOffset && offset4 == padOffset)
-			{
-				byte = (offset1 << 2) | (offset2 >> 4);
-				pBufferOut->Write(byte);
-				
-				byte = (offset2 << 4) | (offset3 >> 2);
-				pBufferOut->Write(byte);
-			
-				return;
-			}
-			
-			byte = (offset1 << 2) | (offset2 >> 4);
-			pBufferOut->Write(byte);
-			
-			byte = (offset2 << 4) | (offset3 >> 2);
-			pBufferOut->Write(byte);
-			
-			byte = (offset3 << 6) | (offset4);
-			pBufferOut->Write(byte);
-		}
+		if(bufferOutSize)
+		To64(pBufferIn->GetBuffer(), pBufferIn->GetBufferSize(), (char*)pBufferOut->GetBuffer());
 	}
 
 	catch(exception& e)
@@ -236,78 +573,23 @@ void CBase64::From64(const string& strIn, CBuffer* pBufferOut)
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CBase64Exception(CBase64Exception::B64EC_FROM64ERROR);
+		throw CBase64Exception(CBase64Exception::B64EC_TO64ERROR);
 	}
 }
 
-void CBase64::From64(CBuffer* pBufferIn, CBuffer* pBufferOut)
+void CBase64::From64(const string& strIn, CBuffer* pBufferOut)
 {
 	try
 	{
-		if(pBufferIn->GetBufferSize() == 0)
+		if(strIn.size() == 0)
 		return;
-		
-		if(pBufferIn->GetBufferSize() % 4)
-		throw CBase64Exception(CBase64Exception::B64EC_FROM64ERROR);
-		
-		pBufferIn->SetReadPos(pBufferIn->GetBufferSize() - 2);
-
-		int offset1 = GetOffset(pBufferIn->GetByte());
-		int offset2 = GetOffset(pBufferIn->GetByte());
-		
-		uInt32 bufferOutSize;
-		
-		bufferOutSize = (pBufferIn->GetBufferSize() /  4) * 3;
 
-		if(offset1 == padOffset && offset2 == padOffset)
-		bufferOutSize -= 2;
-
-		if(offset1 != padOffset && offset2 == padOffset)
-		bufferOutSize -= 1;
-
-		pBufferOut->Create(bufferOutSize);
+		if(strIn.size() % 4)
+		throw CBase64Exception(CBase64Exception::B64EC_FROM64ERROR);
 
-		pBufferIn->SetReadPos(0);
+		pBufferOut->Create(GetFrom64Size(strIn.data(), strIn.size()));
 
-		for(uInt32 i = 0 ; i < pBufferIn->GetBufferSize() / 4; i++)
-		{
-			uByte byte;
-
-			/* convert each ascii char to offset */
-			int offset1 = GetOffset(pBufferIn->GetByte());
-			int offset2 = GetOffset(pBufferIn->GetByte());
-			int offset3 = GetOffset(pBufferIn->GetByte());
-			int offset4 = GetOffset(pBufferIn->GetByte());
-			
-			/* case if  */
-			if(offset3 == padOffset && offset4 == padOffset)
-			{
-				byte = (offset1 << 2) | (offset2 >> 4);
-				pBufferOut->Write(byte);
-				
-				return;
-			}
-
-			if(offset3 != padOffset && offset4 == padOffset)
-			{
-				byte = (offset1 << 2) | (offset2 >> 4);
-				pBufferOut->Write(byte);
-				
-				byte = (offset2 << 4) | (offset3 >> 2);
-				pBufferOut->Write(byte);
-			
-				return;
-			}
-			
-			byte = (offset1 << 2) | (offset2 >> 4);
-			pBufferOut->Write(byte);
-			
-			byte = (offset2 << 4) | (offset3 >> 2);
-			pBufferOut->Write(byte);
-			
-			byte = (offset3 << 6) | (offset4);
-			pBufferOut->Write(byte);
-		}
+		From64(strIn.data(), strIn.size(), pBufferOut->GetBuffer());
 	}
 
 	catch(exception& e)
@@ -320,39 +602,30 @@ void CBase64::From64(CBuffer* pBufferIn, CBuffer* pBufferOut)
 	}
 }
 
-
-int CBase64::GetOffset(char car)
+void CBase64::From64(CBuffer* pBufferIn, CBuffer* pBufferOut)
 {
 	try
 	{
-		if('A' <= car && car <= 'Z')
-		return car - 'A';
-
-		if('a' <= car && car <= 'z')
-		return (car - 'a') + 26;
+		if(pBufferIn->GetBufferSize() == 0)
+		return;
 
-		if('0' <= car && car <= '9')
-		return (car - '0') + 52;
+		if(pBufferIn->GetBufferSize() % 4)
+		throw CBase64Exception(CBase64Exception::B64EC_FROM64ERROR);
 
-		if(car == '+')
-		return 62;
+		const char* pDataIn = (const char*)pBufferIn->GetBuffer();
 
-		if(car == '/')
-		return 63;
-		
-		if(car == '=')
-		return padOffset;
+		pBufferOut->Create(GetFrom64Size(pDataIn, pBufferIn->GetBufferSize()));
 
-		throw CBase64Exception(CBase64Exception::B64EC_GETOFFSETERROR);
+		From64(pDataIn, pBufferIn->GetBufferSize(), pBufferOut->GetBuffer());
 	}
-	
+
 	catch(exception& e)
 	{
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CBase64Exception(CBase64Exception::B64EC_GETOFFSETERROR);
+		throw CBase64Exception(CBase64Exception::B64EC_FROM64ERROR);
 	}
 }
 
@@ -366,9 +639,6 @@ const char* CBase64Exception::what() const throw()
 {
 	switch(GetCode())
 	{
-	case B64EC_GETOFFSETERROR:
-		return "CBase64::GetOffset() error";
-	
 	case B64EC_FROM64ERROR:
 		return "CBase64::From64() error";
 
@@ -380,6 +650,3 @@ const char* CBase64Exception::what() const throw()
 	}
 
 }
-
-
-
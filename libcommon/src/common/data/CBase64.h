@@ -40,14 +40,19 @@ public:
 	void To64(CBuffer* pBufferIn, CBuffer* pBufferOut);
 	void From64(const string& strIn, CBuffer* pBufferOut);
 	void From64(CBuffer* pBufferIn, CBuffer* pBufferOut);
-	
-private :
-	int GetOffset(char car);
-	
+
+	// encode/decode into caller memory, pDataOut must hold at least
+	// GetTo64Size()/GetFrom64Size() bytes, return the number of bytes written
+	u32 To64(const u8* pDataIn, u32 dataInSize, char* pDataOut);
+	u32 From64(const char* pDataIn, u32 dataInSize, u8* pDataOut);
+
+	static u32 GetTo64Size(u32 dataInSize);
+	static u32 GetFrom64Size(const char* pDataIn, u32 dataInSize);
+
+	static const char* GetCodecName();
+
 private:
-	char base64[65];
-	int padOffset;
-	int badOffset;
+	static void InitCodec();
 };
 
 class CBase64Exception : public CException
@@ -56,8 +61,7 @@ public:
 	enum Base64ExceptionCode
 	{
 		B64EC_TO64ERROR,
-		B64EC_FROM64ERROR,
-		B64EC_GETOFFSETERROR
+		B64EC_FROM64ERROR
 	};
 
 public:
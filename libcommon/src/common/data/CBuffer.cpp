@@ -25,6 +25,7 @@
 
 #include <common/CException.h>
 #include <common/CObject.h>
+#include <common/data/CBufferPool.h>
 #include "common/data/CBuffer.h"
 
 using namespace std;
@@ -34,10 +35,22 @@ CBuffer::CBuffer()
 	Init();
 }
 
-CBuffer::CBuffer(u32 bufferSize)
+CBuffer::CBuffer(u32 bufferSize, u32 headRoom)
 {
 	Init();
-	Create(bufferSize);
+	Create(bufferSize, headRoom);
+}
+
+CBuffer::CBuffer(const CBuffer* pBuffer)
+{
+	Init();
+	Attach(pBuffer);
+}
+
+CBuffer::CBuffer(const CBuffer& rBuffer) : CObject()
+{
+	Init();
+	Attach(&rBuffer);
 }
 
 CBuffer::~CBuffer()
@@ -54,17 +67,34 @@ CBuffer::~CBuffer()
 		#endif //__DEBUG__
 	}
 }
-int CBuffer::Create(u32 bufferSize)
+
+CBuffer& CBuffer::operator=(const CBuffer& rBuffer)
 {
-	ReInit();
+	if(this != &rBuffer)
+	Attach(&rBuffer);
 
-	buffer = new u8[bufferSize];
-	
-	if(buffer == NULL)
-	return 0;
+	return *this;
+}
+
+int CBuffer::Create(u32 bufferSize, u32 headRoom)
+{
+	// we keep the storage when it is ours and large enough
+	if(pStorage == NULL || IsShared() || pStorage->storageSize < headRoom + bufferSize)
+	{
+		ReInit();
+
+		pStorage = AllocateStorage(headRoom + bufferSize);
 
+		if(pStorage == NULL)
+		return 0;
+	}
+
+	buffer = GetStorageData() + headRoom;
 	this->bufferSize = bufferSize;
 
+	readPos = 0;
+	writePos = 0;
+
 	SetNotEmpty();
 	return 1;
 }
@@ -77,31 +107,162 @@ int CBuffer::Affect(const char str[])
 
 int CBuffer::Affect(const string& str)
 {
-	return Affect(str.c_str());
+	Create(str.size());
+	return Write(str);
 }
 
 int CBuffer::Affect(const CBuffer* pBuffer)
 {
+	if(pBuffer->IsEmpty())
+	{
+		ReInit();
+		return 1;
+	}
 
-	ReInit();
+	if(pBuffer == this)
+	return Unshare();
+
+	if(!Create(pBuffer->GetBufferSize()))
+	return 0;
 
+	memcpy(buffer, pBuffer->GetBuffer(), bufferSize);
+
+	return 1;
+}
+
+int CBuffer::Attach(const CBuffer* pBuffer)
+{
 	if(pBuffer->IsEmpty())
+	{
+		ReInit();
+		return 1;
+	}
+
+	return pBuffer->Slice(this, 0, pBuffer->GetBufferSize());
+}
+
+int CBuffer::Slice(CBuffer* pSlice, u32 offset, u32 sliceSize) const
+{
+	if(IsEmpty())
+	return 0;
+
+	if(offset + sliceSize > GetBufferSize())
+	return 0;
+
+	SStorage* pSharedStorage = pStorage;
+	u8* pSliceBuffer = buffer + offset;
+
+	// we take our reference before pSlice may drop its own on the same storage
+	__sync_add_and_fetch(&pSharedStorage->refCount, 1);
+
+	pSlice->ReInit();
+
+	pSlice->pStorage = pSharedStorage;
+	pSlice->buffer = pSliceBuffer;
+	pSlice->bufferSize = sliceSize;
+	pSlice->SetNotEmpty();
+
+	return 1;
+}
+
+int CBuffer::Reserve(u32 capacity)
+{
+	if(IsEmpty())
+	{
+		if(!Create(capacity))
+		return 0;
+
+		bufferSize = 0;
+		return 1;
+	}
+
+	if(capacity <= GetCapacity() && !IsShared())
 	return 1;
-	
-	buffer = new u8[pBuffer->GetBufferSize()];
 
-	if(buffer == NULL)
+	if(capacity < GetBufferSize())
+	capacity = GetBufferSize();
+
+	return Reallocate(GetHeadRoom(), capacity);
+}
+
+int CBuffer::Resize(u32 bufferSize)
+{
+	if(IsEmpty())
+	return Create(bufferSize);
+
+	if(IsShared() || bufferSize > GetCapacity())
+	{
+		u32 capacity = bufferSize;
+
+		// we grow geometrically so that appends are amortized
+		if(bufferSize > GetCapacity() && capacity < 2 * GetCapacity())
+		capacity = 2 * GetCapacity();
+
+		if(!Reallocate(GetHeadRoom(), capacity))
+		return 0;
+	}
+
+	this->bufferSize = bufferSize;
+
+	if(readPos > bufferSize)
+	readPos = bufferSize;
+
+	if(writePos > bufferSize)
+	writePos = bufferSize;
+
+	return 1;
+}
+
+int CBuffer::Append(const u8* pData, u32 dataSize)
+{
+	if(pData == NULL || dataSize == 0)
 	return 0;
 
-	bufferSize = pBuffer->GetBufferSize();
+	u32 offset = IsEmpty() ? 0 : GetBufferSize();
 
-	for(u32 i = 0 ; i < pBuffer->GetBufferSize() ; i++)
-	buffer[i] = pBuffer->GetBuffer()[i];
+	if(!Resize(offset + dataSize))
+	return 0;
+
+	memcpy(buffer + offset, pData, dataSize);
+	writePos = GetBufferSize();
 
-	SetNotEmpty();
 	return 1;
 }
 
+int CBuffer::Append(const string& data)
+{
+	return Append((const u8*) data.data(), data.size());
+}
+
+int CBuffer::Append(const CBuffer* pBuffer)
+{
+	return Append(pBuffer->GetBuffer(), pBuffer->GetBufferSize());
+}
+
+int CBuffer::Prepend(const u8* pData, u32 dataSize)
+{
+	if(pData == NULL || dataSize == 0)
+	return 0;
+
+	if(IsEmpty() && !Create(0, dataSize))
+	return 0;
+
+	if(IsShared() || GetHeadRoom() < dataSize)
+	{
+		if(!Reallocate(dataSize, GetBufferSize()))
+		return 0;
+	}
+
+	buffer -= dataSize;
+	bufferSize += dataSize;
+
+	readPos += dataSize;
+	writePos += dataSize;
+
+	memcpy(buffer, pData, dataSize);
+
+	return 1;
+}
 
 int CBuffer::Write(const u8* pData, u32 dataSize)
 {
@@ -114,8 +275,10 @@ int CBuffer::Write(const u8* pData, u32 dataSize)
 	if(GetWritePos() + dataSize > GetBufferSize())
 	return 0;
 
-	for(u32 i = 0 ; i < dataSize ; i++)
-	buffer[GetWritePos() + i] = pData[i];
+	if(!Unshare())
+	return 0;
+
+	memcpy(buffer + GetWritePos(), pData, dataSize);
 
 	writePos += dataSize;
 	
@@ -129,17 +292,20 @@ int CBuffer::Write(const CBuffer* pBuffer)
 
 int CBuffer::Read(CBuffer* pBuffer)
 {
+	if(!pBuffer->Unshare())
+	return 0;
+
 	return Read(pBuffer->GetBuffer(), pBuffer->GetBufferSize());
 }
 
 int CBuffer::Write(const string& data)
 {
-	return Write(data.c_str());
+	return Write((const u8*) data.data(), data.size());
 }
 
 int CBuffer::Write(const string* pData)
 {
-	return Write(pData->c_str());
+	return Write(*pData);
 }
 
 int CBuffer::Read(u8* pData, u32 dataSize)
@@ -153,8 +319,7 @@ int CBuffer::Read(u8* pData, u32 dataSize)
 	if(GetReadPos() + dataSize > GetBufferSize())
 	return 0;
 
-	for(u32 i = 0 ; i < dataSize ; i++)
-	pData[i] = buffer[GetReadPos() + i];
+	memcpy(pData, buffer + GetReadPos(), dataSize);
 
 	readPos += dataSize;
 	
@@ -284,6 +449,27 @@ CObject::u32 CBuffer::GetBufferSize() const
 	return bufferSize;
 }
 
+CObject::u32 CBuffer::GetCapacity() const
+{
+	if(IsEmpty())
+	return 0;
+
+	return pStorage->storageSize - GetHeadRoom();
+}
+
+CObject::u32 CBuffer::GetHeadRoom() const
+{
+	if(IsEmpty())
+	return 0;
+
+	return buffer - GetStorageData();
+}
+
+CObject::u32 CBuffer::GetTailRoom() const
+{
+	return GetCapacity() - GetBufferSize();
+}
+
 CObject::u32 CBuffer::GetReadPos() const
 {
 	return readPos;
@@ -304,6 +490,11 @@ int CBuffer::IsNotEmpty() const
 	return !IsEmpty();
 }
 
+int CBuffer::IsShared() const
+{
+	return pStorage != NULL && pStorage->refCount > 1;
+}
+
 int CBuffer::SetReadPos(u32 readPos)
 {
 	if(IsEmpty())
@@ -336,13 +527,26 @@ void CBuffer::Wipe()
 	if(IsEmpty())
 	return;
 
-	for(u32 i = 0 ; i < GetBufferSize() ; i++)
-	buffer[i] = 0;
+	// a shared storage still holds the bytes of the other buffers, we
+	// drop our reference and wipe a storage of our own instead
+	if(IsShared())
+	{
+		u32 headRoom = GetHeadRoom();
+		u32 size = GetBufferSize();
+
+		ReInit();
+
+		if(!Create(size, headRoom))
+		return;
+	}
+
+	memset(buffer, 0, GetBufferSize());
 }
 
 
 void CBuffer::Init()
 {
+	pStorage = NULL;
 	buffer = NULL;
 	bufferSize = 0;
 	isEmpty = 1;
@@ -353,8 +557,8 @@ void CBuffer::Init()
 
 void CBuffer::ReInit()
 {
-	if(buffer)
-	delete[] buffer;
+	if(pStorage && __sync_sub_and_fetch(&pStorage->refCount, 1) == 0)
+	CBufferPool::Release(pStorage, sizeof(SStorage) + pStorage->storageSize);
 		
 	Init();
 }
@@ -368,3 +572,57 @@ void CBuffer::SetNotEmpty()
 {
 	isEmpty = 0;
 }
+
+CBuffer::SStorage* CBuffer::AllocateStorage(u32 storageSize)
+{
+	u32 blockSize;
+
+	// the pool rounds up to its size class, we keep the slack as tail room
+	SStorage* pNewStorage = (SStorage*) CBufferPool::Allocate(sizeof(SStorage) + storageSize, &blockSize);
+
+	pNewStorage->refCount = 1;
+	pNewStorage->storageSize = blockSize - sizeof(SStorage);
+
+	return pNewStorage;
+}
+
+CObject::u8* CBuffer::GetStorageData() const
+{
+	return (u8*) (pStorage + 1);
+}
+
+int CBuffer::Reallocate(u32 headRoom, u32 capacity)
+{
+	SStorage* pNewStorage = AllocateStorage(headRoom + capacity);
+
+	if(pNewStorage == NULL)
+	return 0;
+
+	u8* pNewBuffer = (u8*) (pNewStorage + 1) + headRoom;
+	u32 newBufferSize = GetBufferSize() < capacity ? GetBufferSize() : capacity;
+
+	if(newBufferSize)
+	memcpy(pNewBuffer, buffer, newBufferSize);
+
+	u32 oldReadPos = readPos;
+	u32 oldWritePos = writePos;
+
+	ReInit();
+
+	pStorage = pNewStorage;
+	buffer = pNewBuffer;
+	bufferSize = newBufferSize;
+	readPos = oldReadPos < newBufferSize ? oldReadPos : newBufferSize;
+	writePos = oldWritePos < newBufferSize ? oldWritePos : newBufferSize;
+
+	SetNotEmpty();
+	return 1;
+}
+
+int CBuffer::Unshare()
+{
+	if(!IsShared())
+	return 1;
+
+	return Reallocate(GetHeadRoom(), GetBufferSize());
+}
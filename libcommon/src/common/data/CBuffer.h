@@ -28,20 +28,36 @@
 
 using namespace std;
 
+// the bytes live in a reference counted storage with optional room
+// before (headroom) and after (tailroom) the data, Slice() and Attach()
+// share that storage and any write through the CBuffer API makes a
+// private copy first
 class CBuffer : public CObject
 {
 public:
 	CBuffer();
-	CBuffer(u32 bufferSize);
+	CBuffer(u32 bufferSize, u32 headRoom = 0);
 	CBuffer(const CBuffer* pBuffer);
+	CBuffer(const CBuffer& rBuffer);
 	virtual ~CBuffer();
+
+	CBuffer& operator=(const CBuffer& rBuffer);
  
  	void ReInit();
-	int Create(u32 bufferSize);
+	int Create(u32 bufferSize, u32 headRoom = 0);
 	int Affect(const char str[]);
 	int Affect(const string& str);	
 	int Affect(const CBuffer* pBuffer);
 	int Attach(const CBuffer* pBuffer);
+	int Slice(CBuffer* pSlice, u32 offset, u32 sliceSize) const;
+
+	int Reserve(u32 capacity);
+	int Resize(u32 bufferSize);
+
+	int Append(const u8* pData, u32 dataSize);
+	int Append(const string& data);
+	int Append(const CBuffer* pBuffer);
+	int Prepend(const u8* pData, u32 dataSize);
 
 	u8 GetByte();
 
@@ -75,28 +91,45 @@ public:
 	u8* GetBuffer() const;
 	u32 GetBufferSize() const;
 
+	u32 GetCapacity() const;
+	u32 GetHeadRoom() const;
+	u32 GetTailRoom() const;
+
 	u32 GetReadPos() const;
 	u32 GetWritePos() const;
 
 	int IsEmpty() const;
 	int IsNotEmpty() const;
+	int IsShared() const;
 
 	int SetReadPos(u32 readPos);
 	int SetWritePos(u32 writePos);
 
 	void Wipe();
 
+private:
+	struct SStorage
+	{
+		u32 refCount;
+		u32 storageSize;
+	};
+
 private:
 	void Init();
 
 	void SetEmpty();
 	void SetNotEmpty();
 
+	static SStorage* AllocateStorage(u32 storageSize);
+	u8* GetStorageData() const;
+	int Reallocate(u32 headRoom, u32 capacity);
+	int Unshare();
+
 private:
+	SStorage* pStorage;
 	u8* buffer;
 	u32 bufferSize;
 	bool isEmpty;
-	bool isAttached;
 	
 	u32 readPos;
 	u32 writePos;	
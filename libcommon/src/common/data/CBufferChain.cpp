@@ -0,0 +1,250 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <iostream>
+#include <cstring>
+#include <string>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
+
+using namespace std;
+
+// below this size a copy is cheaper than an extra iovec entry
+#define CHAIN_MINREFERENCE	256
+
+CBufferChain::CBufferChain()
+{
+	size = 0;
+}
+
+CBufferChain::~CBufferChain()
+{}
+
+void CBufferChain::Clear()
+{
+	SegmentVector.clear();
+
+	// we keep the markup storage for the next stanza
+	if(!Markup.IsEmpty())
+	Markup.Resize(0);
+
+	size = 0;
+}
+
+void CBufferChain::Write(const char* pData, u32 dataSize)
+{
+	try
+	{
+		if(dataSize == 0)
+		return;
+
+		u32 offset = Markup.GetBufferSize();
+
+		if(Markup.IsEmpty())
+		{
+			Markup.Create(1024);
+			Markup.Resize(0);
+		}
+
+		Markup.Append((const u8*) pData, dataSize);
+
+		// we extend the last segment when it already ends the markup
+		if(!SegmentVector.empty() && SegmentVector.back().isMarkup)
+		SegmentVector.back().dataSize += dataSize;
+		else
+		{
+			SSegment Segment;
+
+			Segment.isMarkup = true;
+			Segment.offset = offset;
+			Segment.pData = NULL;
+			Segment.dataSize = dataSize;
+
+			SegmentVector.push_back(Segment);
+		}
+
+		size += dataSize;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CBufferChainException(CBufferChainException::BCEC_WRITEERROR);
+	}
+}
+
+void CBufferChain::Write(const string& data)
+{
+	Write(data.data(), data.size());
+}
+
+void CBufferChain::Reference(const u8* pData, u32 dataSize)
+{
+	try
+	{
+		if(dataSize < CHAIN_MINREFERENCE)
+		{
+			Write((const char*) pData, dataSize);
+			return;
+		}
+
+		SSegment Segment;
+
+		Segment.isMarkup = false;
+		Segment.offset = 0;
+		Segment.pData = pData;
+		Segment.dataSize = dataSize;
+
+		SegmentVector.push_back(Segment);
+
+		size += dataSize;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CBufferChainException(CBufferChainException::BCEC_REFERENCEERROR);
+	}
+}
+
+void CBufferChain::Reference(const string& data)
+{
+	Reference((const u8*) data.data(), data.size());
+}
+
+void CBufferChain::Append(const CBufferChain* pBufferChain)
+{
+	try
+	{
+		// markup is copied, the other segments stay references to the
+		// data of the appended chain
+		for(u32 i = 0 ; i < pBufferChain->GetNumSegment() ; i++)
+		{
+			const SSegment& rSegment = pBufferChain->SegmentVector[i];
+
+			if(rSegment.isMarkup)
+			Write((const char*) pBufferChain->Markup.GetBuffer() + rSegment.offset, rSegment.dataSize);
+			else
+			Reference(rSegment.pData, rSegment.dataSize);
+		}
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CBufferChainException(CBufferChainException::BCEC_APPENDERROR);
+	}
+}
+
+CObject::u32 CBufferChain::GetNumSegment() const
+{
+	return SegmentVector.size();
+}
+
+CObject::u32 CBufferChain::GetSize() const
+{
+	return size;
+}
+
+void CBufferChain::GetSegment(u32 index, const u8** ppData, u32* pDataSize) const
+{
+	if(index >= SegmentVector.size())
+	throw CBufferChainException(CBufferChainException::BCEC_GETSEGMENTERROR);
+
+	const SSegment& rSegment = SegmentVector[index];
+
+	if(rSegment.isMarkup)
+	*ppData = Markup.GetBuffer() + rSegment.offset;
+	else
+	*ppData = rSegment.pData;
+
+	*pDataSize = rSegment.dataSize;
+}
+
+void CBufferChain::Flatten(CBuffer* pBuffer) const
+{
+	try
+	{
+		pBuffer->Create(size);
+
+		u8* pOut = pBuffer->GetBuffer();
+
+		for(u32 i = 0 ; i < GetNumSegment() ; i++)
+		{
+			const u8* pData;
+			u32 dataSize;
+
+			GetSegment(i, &pData, &dataSize);
+			memcpy(pOut, pData, dataSize);
+			pOut += dataSize;
+		}
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CBufferChainException(CBufferChainException::BCEC_FLATTENERROR);
+	}
+}
+
+CBufferChainException::CBufferChainException(int code) : CException(code)
+{}
+
+CBufferChainException::~CBufferChainException() throw()
+{}
+	
+const char* CBufferChainException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case BCEC_WRITEERROR:
+		return "CBufferChain::Write() error";
+
+	case BCEC_REFERENCEERROR:
+		return "CBufferChain::Reference() error";
+
+	case BCEC_APPENDERROR:
+		return "CBufferChain::Append() error";
+
+	case BCEC_GETSEGMENTERROR:
+		return "CBufferChain::GetSegment() error";
+
+	case BCEC_FLATTENERROR:
+		return "CBufferChain::Flatten() error";
+		
+	default:
+		return "CBufferChain: Unknown error";
+	}
+}
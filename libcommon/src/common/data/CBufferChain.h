@@ -0,0 +1,92 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CBUFFERCHAIN_H__
+#define __CBUFFERCHAIN_H__
+
+#include <string>
+#include <vector>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/data/CBuffer.h>
+
+using namespace std;
+
+// ordered list of output segments handed to writev / SSL_write without
+// being concatenated first, small pieces are copied into a private markup
+// buffer while large ones are only referenced and must stay alive until
+// the chain has been sent
+class CBufferChain : public CObject
+{
+public:
+	CBufferChain();
+	virtual ~CBufferChain();
+
+	void Clear();
+
+	void Write(const char* pData, u32 dataSize);
+	void Write(const string& data);
+	void Reference(const u8* pData, u32 dataSize);
+	void Reference(const string& data);
+	void Append(const CBufferChain* pBufferChain);
+
+	u32 GetNumSegment() const;
+	u32 GetSize() const;
+	void GetSegment(u32 index, const u8** ppData, u32* pDataSize) const;
+
+	void Flatten(CBuffer* pBuffer) const;
+
+private:
+	struct SSegment
+	{
+		// markup segments point into Markup by offset as it may move
+		bool isMarkup;
+		u32 offset;
+		const u8* pData;
+		u32 dataSize;
+	};
+
+private:
+	vector<SSegment> SegmentVector;
+	CBuffer Markup;
+	u32 size;
+};
+
+class CBufferChainException : public CException
+{
+public:
+	enum BufferChainExceptionCode
+	{
+		BCEC_WRITEERROR,
+		BCEC_REFERENCEERROR,
+		BCEC_APPENDERROR,
+		BCEC_GETSEGMENTERROR,
+		BCEC_FLATTENERROR
+	};
+
+public:
+	CBufferChainException(int code);
+	virtual ~CBufferChainException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif // __CBUFFERCHAIN_H__
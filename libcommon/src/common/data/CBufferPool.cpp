@@ -0,0 +1,383 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <iostream>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/data/CBufferPool.h>
+
+using namespace std;
+
+typedef CObject::u8 u8;
+typedef CObject::u32 u32;
+
+#define POOL_MINSHIFT		8
+#define POOL_NUMCLASS		9
+#define POOL_MAXCACHED		32
+#define POOL_SLABBLOCKS		32
+#define POOL_HUGEPAGESIZE	(2 * 1024 * 1024)
+
+struct SBlock
+{
+	SBlock* pNext;
+};
+
+struct SThreadCache
+{
+	SBlock* pFreeList[POOL_NUMCLASS];
+	u32 numFree[POOL_NUMCLASS];
+
+	// only the owner counts, others read them with the depot held, both
+	// sides go through atomics
+	u32 hits;
+	u32 misses;
+
+	SThreadCache* pPrev;
+	SThreadCache* pNext;
+};
+
+struct SClassDepot
+{
+	SBlock* pFreeList;
+
+	// blocks not yet handed out from the last slab
+	u8* pSlabCursor;
+	u8* pSlabEnd;
+};
+
+static pthread_mutex_t mutexDepot = PTHREAD_MUTEX_INITIALIZER;
+static SClassDepot classDepot[POOL_NUMCLASS];
+static SThreadCache* pThreadCacheList = NULL;
+
+static u32 retiredHits = 0;
+static u32 retiredMisses = 0;
+static bool isHugePages = false;
+
+static pthread_key_t threadCacheKey;
+static pthread_once_t threadCacheOnce = PTHREAD_ONCE_INIT;
+
+static int GetClass(u32 size)
+{
+	for(int c = 0 ; c < POOL_NUMCLASS ; c++)
+	{
+		if(size <= ((u32) 1 << (POOL_MINSHIFT + c)))
+		return c;
+	}
+
+	return -1;
+}
+
+static u32 GetClassSize(int c)
+{
+	return (u32) 1 << (POOL_MINSHIFT + c);
+}
+
+static u8* AllocateSlab(u32 slabSize)
+{
+	#ifdef MAP_HUGETLB
+	if(isHugePages)
+	{
+		void* pSlab = mmap(NULL, slabSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+		if(pSlab != MAP_FAILED)
+		return (u8*) pSlab;
+	}
+	#endif //MAP_HUGETLB
+
+	return new u8[slabSize];
+}
+
+// must be called with mutexDepot held
+static SBlock* TakeFromDepot(int c)
+{
+	SClassDepot* pDepot = &classDepot[c];
+	u32 blockSize = GetClassSize(c);
+
+	if(pDepot->pFreeList != NULL)
+	{
+		SBlock* pBlock = pDepot->pFreeList;
+		pDepot->pFreeList = pBlock->pNext;
+		return pBlock;
+	}
+
+	if(pDepot->pSlabCursor == NULL || pDepot->pSlabCursor + blockSize > pDepot->pSlabEnd)
+	{
+		u32 slabSize = isHugePages ? POOL_HUGEPAGESIZE : blockSize * POOL_SLABBLOCKS;
+
+		// slabs stay with the pool for the life of the process
+		pDepot->pSlabCursor = AllocateSlab(slabSize);
+		pDepot->pSlabEnd = pDepot->pSlabCursor + slabSize;
+	}
+
+	SBlock* pBlock = (SBlock*) pDepot->pSlabCursor;
+	pDepot->pSlabCursor += blockSize;
+
+	return pBlock;
+}
+
+// must be called with mutexDepot held
+static void GiveToDepot(int c, SBlock* pBlock)
+{
+	pBlock->pNext = classDepot[c].pFreeList;
+	classDepot[c].pFreeList = pBlock;
+}
+
+static void ReleaseThreadCache(void* pvThreadCache)
+{
+	SThreadCache* pCache = (SThreadCache*) pvThreadCache;
+
+	pthread_mutex_lock(&mutexDepot);
+
+	for(int c = 0 ; c < POOL_NUMCLASS ; c++)
+	{
+		while(pCache->pFreeList[c] != NULL)
+		{
+			SBlock* pBlock = pCache->pFreeList[c];
+			pCache->pFreeList[c] = pBlock->pNext;
+			GiveToDepot(c, pBlock);
+		}
+	}
+
+	retiredHits += __sync_fetch_and_add(&pCache->hits, 0);
+	retiredMisses += __sync_fetch_and_add(&pCache->misses, 0);
+
+	if(pCache->pPrev != NULL)
+	pCache->pPrev->pNext = pCache->pNext;
+	else
+	pThreadCacheList = pCache->pNext;
+
+	if(pCache->pNext != NULL)
+	pCache->pNext->pPrev = pCache->pPrev;
+
+	pthread_mutex_unlock(&mutexDepot);
+
+	delete pCache;
+}
+
+static void InitThreadCacheKey()
+{
+	pthread_key_create(&threadCacheKey, ReleaseThreadCache);
+}
+
+static SThreadCache* GetThreadCache()
+{
+	pthread_once(&threadCacheOnce, InitThreadCacheKey);
+
+	SThreadCache* pCache = (SThreadCache*) pthread_getspecific(threadCacheKey);
+
+	if(pCache != NULL)
+	return pCache;
+
+	pCache = new SThreadCache;
+
+	for(int c = 0 ; c < POOL_NUMCLASS ; c++)
+	{
+		pCache->pFreeList[c] = NULL;
+		pCache->numFree[c] = 0;
+	}
+
+	pCache->hits = 0;
+	pCache->misses = 0;
+	pCache->pPrev = NULL;
+
+	pthread_mutex_lock(&mutexDepot);
+
+	pCache->pNext = pThreadCacheList;
+
+	if(pThreadCacheList != NULL)
+	pThreadCacheList->pPrev = pCache;
+
+	pThreadCacheList = pCache;
+
+	pthread_mutex_unlock(&mutexDepot);
+
+	pthread_setspecific(threadCacheKey, pCache);
+
+	return pCache;
+}
+
+void* CBufferPool::Allocate(u32 size, u32* pCapacity)
+{
+	try
+	{
+		int c = GetClass(size);
+
+		if(c < 0)
+		{
+			*pCapacity = size;
+			return new u8[size];
+		}
+
+		SThreadCache* pCache = GetThreadCache();
+
+		*pCapacity = GetClassSize(c);
+
+		if(pCache->pFreeList[c] == NULL)
+		{
+			__sync_add_and_fetch(&pCache->misses, 1);
+
+			// we refill half of the thread cache in one lock
+			pthread_mutex_lock(&mutexDepot);
+
+			for(u32 i = 0 ; i < POOL_MAXCACHED / 2 ; i++)
+			{
+				SBlock* pBlock = TakeFromDepot(c);
+				pBlock->pNext = pCache->pFreeList[c];
+				pCache->pFreeList[c] = pBlock;
+			}
+
+			pthread_mutex_unlock(&mutexDepot);
+
+			pCache->numFree[c] = POOL_MAXCACHED / 2;
+		}
+		else
+		__sync_add_and_fetch(&pCache->hits, 1);
+
+		SBlock* pBlock = pCache->pFreeList[c];
+
+		pCache->pFreeList[c] = pBlock->pNext;
+		pCache->numFree[c]--;
+
+		return pBlock;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CBufferPoolException(CBufferPoolException::BPEC_ALLOCATEERROR);
+	}
+}
+
+void CBufferPool::Release(void* pBlock, u32 capacity)
+{
+	try
+	{
+		if(pBlock == NULL)
+		return;
+
+		// the size asked to Allocate is as good as the capacity it gave
+		int c = GetClass(capacity);
+
+		if(c < 0)
+		{
+			delete[] (u8*) pBlock;
+			return;
+		}
+
+		SThreadCache* pCache = GetThreadCache();
+
+		((SBlock*) pBlock)->pNext = pCache->pFreeList[c];
+		pCache->pFreeList[c] = (SBlock*) pBlock;
+		pCache->numFree[c]++;
+
+		if(pCache->numFree[c] <= POOL_MAXCACHED)
+		return;
+
+		// we give half of the thread cache back in one lock
+		pthread_mutex_lock(&mutexDepot);
+
+		for(u32 i = 0 ; i < POOL_MAXCACHED / 2 ; i++)
+		{
+			SBlock* pFreeBlock = pCache->pFreeList[c];
+			pCache->pFreeList[c] = pFreeBlock->pNext;
+			GiveToDepot(c, pFreeBlock);
+		}
+
+		pthread_mutex_unlock(&mutexDepot);
+
+		pCache->numFree[c] -= POOL_MAXCACHED / 2;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CBufferPoolException(CBufferPoolException::BPEC_RELEASEERROR);
+	}
+}
+
+void CBufferPool::SetHugePages(bool isHugePages)
+{
+	pthread_mutex_lock(&mutexDepot);
+	::isHugePages = isHugePages;
+	pthread_mutex_unlock(&mutexDepot);
+}
+
+bool CBufferPool::IsHugePages()
+{
+	return isHugePages;
+}
+
+CObject::u32 CBufferPool::GetHits()
+{
+	pthread_mutex_lock(&mutexDepot);
+
+	u32 hits = retiredHits;
+
+	for(SThreadCache* pCache = pThreadCacheList ; pCache != NULL ; pCache = pCache->pNext)
+	hits += __sync_fetch_and_add(&pCache->hits, 0);
+
+	pthread_mutex_unlock(&mutexDepot);
+
+	return hits;
+}
+
+CObject::u32 CBufferPool::GetMisses()
+{
+	pthread_mutex_lock(&mutexDepot);
+
+	u32 misses = retiredMisses;
+
+	for(SThreadCache* pCache = pThreadCacheList ; pCache != NULL ; pCache = pCache->pNext)
+	misses += __sync_fetch_and_add(&pCache->misses, 0);
+
+	pthread_mutex_unlock(&mutexDepot);
+
+	return misses;
+}
+
+CBufferPoolException::CBufferPoolException(int code) : CException(code)
+{}
+
+CBufferPoolException::~CBufferPoolException() throw()
+{}
+	
+const char* CBufferPoolException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case BPEC_ALLOCATEERROR:
+		return "CBufferPool::Allocate() error";
+
+	case BPEC_RELEASEERROR:
+		return "CBufferPool::Release() error";
+		
+	default:
+		return "CBufferPool: Unknown error";
+	}
+}
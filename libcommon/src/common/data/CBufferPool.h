@@ -0,0 +1,62 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CBUFFERPOOL_H__
+#define __CBUFFERPOOL_H__
+
+#include <common/CException.h>
+#include <common/CObject.h>
+
+using namespace std;
+
+// process wide pool of packet sized blocks, sizes are rounded up to a
+// power of two class (256 bytes .. 64 KB) and each thread keeps a small
+// cache per class so that steady state allocations take no lock, larger
+// blocks go straight to the heap
+class CBufferPool : public CObject
+{
+public:
+	static void* Allocate(u32 size, u32* pCapacity);
+	static void Release(void* pBlock, u32 capacity);
+
+	static void SetHugePages(bool isHugePages);
+	static bool IsHugePages();
+
+	static u32 GetHits();
+	static u32 GetMisses();
+};
+
+class CBufferPoolException : public CException
+{
+public:
+	enum BufferPoolExceptionCode
+	{
+		BPEC_ALLOCATEERROR,
+		BPEC_RELEASEERROR
+	};
+
+public:
+	CBufferPoolException(int code);
+	virtual ~CBufferPoolException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif // __CBUFFERPOOL_H__
@@ -22,6 +22,7 @@
 
 #include <common/CObject.h>
 #include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
 #include <common/socket/CAddress.h>
 #include <common/socket/CConnection.h>
 
@@ -55,8 +56,22 @@ bool CConnection::Send(const CBuffer* pBuffer)
 	return true;
 }
 
+bool CConnection::Send(const CBufferChain* pBufferChain)
+{
+	CBuffer Buffer;
+	pBufferChain->Flatten(&Buffer);
+
+	return Send(&Buffer);
+}
+
 bool CConnection::Receive(CBuffer* pBuffer)
 {
 	return true;
 }
 
+bool CConnection::Receive(u8* pData, u32 dataSize, u32* pReceiveSize)
+{
+	*pReceiveSize = 0;
+	return true;
+}
+
@@ -23,6 +23,7 @@
 
 #include <common/CObject.h>
 #include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
 #include <common/socket/CAddress.h>
 
 class CConnection : public CObject
@@ -38,7 +39,9 @@ public:
 	virtual bool IsConnected();
 	
 	virtual bool Send(const CBuffer* pBuffer);
+	virtual bool Send(const CBufferChain* pBufferChain);
 	virtual bool Receive(CBuffer* pBuffer);
+	virtual bool Receive(u8* pData, u32 dataSize, u32* pReceiveSize);
 };
 
 #endif // __CCONECTION_H__
@@ -0,0 +1,496 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <errno.h>
+#include <iostream>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <vector>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/socket/CReactor.h>
+#include <common/socket/CReactorHandler.h>
+#include <common/thread/CMutex.h>
+#include <common/thread/CThread.h>
+
+using namespace std;
+
+#define REACTOR_MAXEVENTS	64
+
+// set in the handler events while a thread runs it
+#define REACTOR_RUNNING		0x80000000
+
+// epoll data is the slot generation above the slot index, the wake
+// descriptor of a handler has the top bit of the index set
+#define REACTOR_WAKESOURCE	0x80000000
+#define REACTOR_INDEXMASK	0x7FFFFFFF
+#define REACTOR_STOPSOURCE	REACTOR_INDEXMASK
+
+CReactor::CReactor()
+{
+	epollFd = -1;
+	stopFd = -1;
+}
+
+CReactor::~CReactor()
+{
+	try
+	{
+		Stop();
+
+		for(u32 i = 0 ; i < SlotList.size() ; i++)
+		delete SlotList[i];
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+	}
+}
+
+void CReactor::Start(u32 numThread)
+{
+	try
+	{
+		epollFd = epoll_create(REACTOR_MAXEVENTS);
+		stopFd = eventfd(0, 0);
+
+		if(epollFd == -1 || stopFd == -1)
+		throw CReactorException(CReactorException::REC_STARTERROR);
+
+		// the stop descriptor is level triggered and never read, every
+		// thread sees it
+		struct epoll_event Event;
+		Event.events = EPOLLIN;
+		Event.data.u64 = REACTOR_STOPSOURCE;
+
+		if(epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &Event) == -1)
+		throw CReactorException(CReactorException::REC_STARTERROR);
+
+		for(u32 i = 0 ; i < numThread ; i++)
+		{
+			CThread* pThread = new CThread;
+			ThreadList.push_back(pThread);
+			pThread->Run(WorkJob, this);
+		}
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CReactorException(CReactorException::REC_STARTERROR);
+	}
+}
+
+void CReactor::Stop()
+{
+	try
+	{
+		if(epollFd == -1)
+		return;
+
+		uint64_t one = 1;
+
+		if(write(stopFd, &one, sizeof(one)) != sizeof(one))
+		throw CReactorException(CReactorException::REC_STOPERROR);
+
+		for(u32 i = 0 ; i < ThreadList.size() ; i++)
+		{
+			ThreadList[i]->Wait();
+			delete ThreadList[i];
+		}
+
+		ThreadList.clear();
+
+		close(stopFd);
+		close(epollFd);
+		stopFd = -1;
+		epollFd = -1;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CReactorException(CReactorException::REC_STOPERROR);
+	}
+}
+
+void CReactor::Add(CReactorHandler* pHandler, int fd)
+{
+	MutexReactor.Lock();
+
+	try
+	{
+		if(pHandler->wakeFd == -1)
+		pHandler->wakeFd = eventfd(0, EFD_NONBLOCK);
+
+		if(pHandler->wakeFd == -1)
+		throw CReactorException(CReactorException::REC_ADDERROR);
+
+		u32 index;
+
+		if(FreeSlotList.empty())
+		{
+			SSlot* pSlot = new SSlot;
+			pSlot->generation = 0;
+			pSlot->numBusy = 0;
+			pSlot->isRemoved = false;
+
+			index = SlotList.size();
+			SlotList.push_back(pSlot);
+		}
+		else
+		{
+			index = FreeSlotList.back();
+			FreeSlotList.pop_back();
+		}
+
+		// a new generation turns away events still queued for the slot
+		SSlot* pSlot = SlotList[index];
+		pSlot->pHandler = pHandler;
+		pSlot->generation++;
+		pSlot->isRemoved = false;
+
+		pHandler->fd = fd;
+		pHandler->slotIndex = index;
+		pHandler->events = 0;
+		pHandler->isAttached = true;
+
+		uint64_t source = ((uint64_t) pSlot->generation << 32) | index;
+
+		struct epoll_event Event;
+		Event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		Event.data.u64 = source;
+
+		struct epoll_event WakeEvent;
+		WakeEvent.events = EPOLLIN | EPOLLET;
+		WakeEvent.data.u64 = source | REACTOR_WAKESOURCE;
+
+		if(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &Event) == -1)
+		{
+			pSlot->pHandler = NULL;
+			pHandler->isAttached = false;
+			FreeSlotList.push_back(index);
+
+			throw CReactorException(CReactorException::REC_ADDERROR);
+		}
+
+		if(epoll_ctl(epollFd, EPOLL_CTL_ADD, pHandler->wakeFd, &WakeEvent) == -1)
+		{
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, &Event);
+			pSlot->pHandler = NULL;
+			pHandler->isAttached = false;
+			FreeSlotList.push_back(index);
+
+			throw CReactorException(CReactorException::REC_ADDERROR);
+		}
+
+		pHandler->isRegistered = true;
+
+		MutexReactor.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexReactor.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CReactorException(CReactorException::REC_ADDERROR);
+	}
+}
+
+void CReactor::Remove(CReactorHandler* pHandler)
+{
+	MutexReactor.Lock();
+
+	try
+	{
+		// the descriptors go first, the caller may close them right after
+		if(pHandler->isRegistered)
+		{
+			struct epoll_event Event;
+
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, pHandler->fd, &Event);
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, pHandler->wakeFd, &Event);
+			pHandler->isRegistered = false;
+		}
+
+		// a handler removing itself from OnEvent() cannot wait for its own
+		// thread, the last reactor thread to let go of it frees the slot
+		bool isRunner = (pHandler->events & REACTOR_RUNNING) && pthread_equal(pHandler->runner, pthread_self());
+
+		if(pHandler->isAttached)
+		{
+			SSlot* pSlot = SlotList[pHandler->slotIndex];
+			pSlot->pHandler = NULL;
+
+			if(isRunner)
+			pSlot->isRemoved = true;
+			else
+			{
+				while(pHandler->isAttached && pSlot->numBusy)
+				MutexReactor.Wait();
+
+				if(pHandler->isAttached)
+				{
+					pHandler->isAttached = false;
+					FreeSlotList.push_back(pHandler->slotIndex);
+				}
+			}
+		}
+
+		MutexReactor.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexReactor.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CReactorException(CReactorException::REC_REMOVEERROR);
+	}
+}
+
+void CReactor::Signal(CReactorHandler* pHandler, u32 events)
+{
+	// a handler with events pending already has a thread on its way
+	if(__sync_fetch_and_or(&pHandler->events, events) != 0)
+	return;
+
+	Wake(pHandler);
+}
+
+void CReactor::Dispatch(CReactorHandler* pHandler, u32 events)
+{
+	// whoever sets the running bit runs the handler for everybody until
+	// no event is left, the others only leave their events behind
+	if(__sync_fetch_and_or(&pHandler->events, events | REACTOR_RUNNING) & REACTOR_RUNNING)
+	return;
+
+	pHandler->runner = pthread_self();
+
+	while(true)
+	{
+		u32 pending = __sync_fetch_and_and(&pHandler->events, REACTOR_RUNNING) & ~REACTOR_RUNNING;
+
+		if(pending == 0)
+		{
+			if(__sync_bool_compare_and_swap(&pHandler->events, REACTOR_RUNNING, 0))
+			return;
+
+			continue;
+		}
+
+		try
+		{
+			pHandler->OnEvent(pending);
+		}
+
+		catch(exception& e)
+		{
+			// events signaled meanwhile found the running bit and sent no
+			// wake, we send it for them
+			if(__sync_and_and_fetch(&pHandler->events, ~REACTOR_RUNNING) != 0)
+			Wake(pHandler);
+
+			throw;
+		}
+	}
+}
+
+void CReactor::Wake(CReactorHandler* pHandler)
+{
+	uint64_t one = 1;
+
+	while(write(pHandler->wakeFd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+CReactorHandler* CReactor::AcquireHandler(uint64_t source)
+{
+	MutexReactor.Lock();
+
+	u32 index = source & REACTOR_INDEXMASK;
+	CReactorHandler* pHandler = NULL;
+
+	if(index < SlotList.size())
+	{
+		SSlot* pSlot = SlotList[index];
+
+		if(pSlot->pHandler != NULL && pSlot->generation == (u32) (source >> 32))
+		{
+			pHandler = pSlot->pHandler;
+			pSlot->numBusy++;
+		}
+	}
+
+	MutexReactor.UnLock();
+
+	return pHandler;
+}
+
+void CReactor::ReleaseHandler(CReactorHandler* pHandler, u32 index)
+{
+	MutexReactor.Lock();
+
+	SSlot* pSlot = SlotList[index];
+	pSlot->numBusy--;
+
+	// the handler was removed, from OnEvent() it is up to us to free the
+	// slot, otherwise somebody waits in Remove() for us to let go
+	if(pSlot->pHandler == NULL)
+	{
+		if(pSlot->isRemoved && pSlot->numBusy == 0)
+		{
+			pSlot->isRemoved = false;
+			FreeSlotList.push_back(index);
+
+			// unless it was added again meanwhile
+			if(pHandler->slotIndex == index)
+			pHandler->isAttached = false;
+		}
+
+		MutexReactor.Signal();
+	}
+
+	MutexReactor.UnLock();
+}
+
+void* CReactor::WorkJob(void* pvThis) throw()
+{
+	try
+	{
+		CReactor* pThis = (CReactor*) pvThis;
+		struct epoll_event EventList[REACTOR_MAXEVENTS];
+
+		while(true)
+		{
+			int numEvent = epoll_wait(pThis->epollFd, EventList, REACTOR_MAXEVENTS, -1);
+
+			if(numEvent < 0)
+			{
+				if(errno == EINTR)
+				continue;
+
+				return NULL;
+			}
+
+			for(int i = 0 ; i < numEvent ; i++)
+			{
+				uint64_t source = EventList[i].data.u64;
+
+				if(source == REACTOR_STOPSOURCE)
+				return NULL;
+
+				CReactorHandler* pHandler = pThis->AcquireHandler(source);
+
+				if(pHandler == NULL)
+				continue;
+
+				u32 events = 0;
+
+				if(source & REACTOR_WAKESOURCE)
+				{
+					// the signaled events already wait in the handler
+					uint64_t count;
+					while(read(pHandler->wakeFd, &count, sizeof(count)) > 0);
+				}
+				else
+				{
+					if(EventList[i].events & EPOLLIN)
+					events |= REACTOR_READ;
+
+					if(EventList[i].events & EPOLLOUT)
+					events |= REACTOR_WRITE;
+
+					if(EventList[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+					events |= REACTOR_ERROR;
+				}
+
+				try
+				{
+					pThis->Dispatch(pHandler, events);
+				}
+
+				catch(exception& e)
+				{
+					#ifdef __DEBUG__
+					cerr << e.what() << endl;
+					#endif //__DEBUG__
+				}
+
+				pThis->ReleaseHandler(pHandler, source & REACTOR_INDEXMASK);
+			}
+		}
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		return NULL;
+	}
+}
+
+CReactorException::CReactorException(int code) : CException(code)
+{}
+
+CReactorException::~CReactorException() throw()
+{}
+
+const char* CReactorException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case REC_STARTERROR:
+		return "CReactor::Start() error";
+
+	case REC_STOPERROR:
+		return "CReactor::Stop() error";
+
+	case REC_ADDERROR:
+		return "CReactor::Add() error";
+
+	case REC_REMOVEERROR:
+		return "CReactor::Remove() error";
+
+	default:
+		return "CReactor: Unknown error";
+	}
+}
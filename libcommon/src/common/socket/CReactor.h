@@ -0,0 +1,98 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CREACTOR_H__
+#define __CREACTOR_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/socket/CReactorHandler.h>
+#include <common/thread/CMutex.h>
+#include <common/thread/CThread.h>
+
+using namespace std;
+
+// edge triggered epoll loop run by a few threads for many descriptors.
+// epoll hands out slot indexes rather than handler pointers, so that a
+// handler removed while its events are in flight is never touched again
+class CReactor : public CObject
+{
+public:
+	CReactor();
+	virtual ~CReactor();
+
+	void Start(u32 numThread);
+	void Stop();
+
+	void Add(CReactorHandler* pHandler, int fd);
+	void Remove(CReactorHandler* pHandler);
+	void Signal(CReactorHandler* pHandler, u32 events);
+
+private:
+	void Dispatch(CReactorHandler* pHandler, u32 events);
+	void Wake(CReactorHandler* pHandler);
+	CReactorHandler* AcquireHandler(uint64_t source);
+	void ReleaseHandler(CReactorHandler* pHandler, u32 index);
+
+	static void* WorkJob(void* pvThis) throw();
+
+private:
+	struct SSlot
+	{
+		CReactorHandler* pHandler;
+		u32 generation;
+		u32 numBusy;
+
+		// removed from OnEvent(), freed once numBusy drops to 0
+		bool isRemoved;
+	};
+
+	int epollFd;
+	int stopFd;
+
+	vector<CThread*> ThreadList;
+	vector<SSlot*> SlotList;
+	vector<u32> FreeSlotList;
+	CMutex MutexReactor;
+};
+
+class CReactorException : public CException
+{
+public:
+	enum ReactorExceptionCode
+	{
+		REC_STARTERROR,
+		REC_STOPERROR,
+		REC_ADDERROR,
+		REC_REMOVEERROR
+	};
+
+public:
+	CReactorException(int code);
+	virtual ~CReactorException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif // __CREACTOR_H__
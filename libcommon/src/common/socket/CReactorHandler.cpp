@@ -0,0 +1,42 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <unistd.h>
+
+#include <common/CObject.h>
+#include <common/socket/CReactorHandler.h>
+
+CReactorHandler::CReactorHandler()
+{
+	fd = -1;
+	wakeFd = -1;
+	slotIndex = 0;
+	isRegistered = false;
+	isAttached = false;
+	events = 0;
+}
+
+CReactorHandler::~CReactorHandler()
+{
+	// the wake descriptor outlives the registration, senders may still
+	// signal a handler the reactor let go of
+	if(wakeFd != -1)
+	close(wakeFd);
+}
@@ -0,0 +1,58 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CREACTORHANDLER_H__
+#define __CREACTORHANDLER_H__
+
+#include <pthread.h>
+
+#include <common/CObject.h>
+
+// events handed to OnEvent(), a wake is what CReactor::Signal() sends
+#define REACTOR_READ	0x01
+#define REACTOR_WRITE	0x02
+#define REACTOR_ERROR	0x04
+#define REACTOR_WAKE	0x08
+
+// something a CReactor drives, OnEvent() is never run by two reactor
+// threads at once and must not block
+class CReactorHandler : public CObject
+{
+	friend class CReactor;
+
+public:
+	CReactorHandler();
+	virtual ~CReactorHandler();
+
+	virtual void OnEvent(u32 events) = 0;
+
+private:
+	int fd;
+	int wakeFd;
+	u32 slotIndex;
+	bool isRegistered;
+	bool isAttached;
+
+	// pending events, the top bit tells that a thread runs OnEvent()
+	volatile u32 events;
+	pthread_t runner;
+};
+
+#endif // __CREACTORHANDLER_H__
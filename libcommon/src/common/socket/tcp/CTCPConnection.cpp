@@ -28,14 +28,19 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <common/CException.h>
 #include <common/CObject.h>
 #include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
 #include <common/socket/tcp/CTCPAddress.h>
 #include <common/socket/tcp/CTCPConnection.h>
 
+// segments handed to a single writev, well under IOV_MAX
+#define TCP_MAXIOVEC	64
+
 CTCPConnection::CTCPConnection()
 {
 	isConnected = false;
@@ -233,22 +238,94 @@ bool CTCPConnection::Send(const CBuffer* pBuffer)
 	}
 }
 
-bool CTCPConnection::Receive(CBuffer* pBuffer)
+bool CTCPConnection::Send(const CBufferChain* pBufferChain)
 {
 	try
 	{
-		CBuffer Temp(pBuffer->GetBufferSize());
+		u32 numSegment = pBufferChain->GetNumSegment();
+		u32 index = 0;
+		u32 offset = 0;
 
-		int sizeReceive = read(TCPAddress.GetSocket(), Temp.GetBuffer(), Temp.GetBufferSize());
-
-		if(sizeReceive <= 0)
+		// we hand the segments to the kernel by batches of TCP_MAXIOVEC
+		while(index < numSegment)
 		{
-			isConnected = false;
-			return false;
+			struct iovec iov[TCP_MAXIOVEC];
+			int numIov = 0;
+
+			for(u32 i = index ; i < numSegment && numIov < TCP_MAXIOVEC ; i++)
+			{
+				const u8* pData;
+				u32 dataSize;
+
+				pBufferChain->GetSegment(i, &pData, &dataSize);
+
+				// the first segment may have been partly written already
+				if(i == index)
+				{
+					pData += offset;
+					dataSize -= offset;
+				}
+
+				iov[numIov].iov_base = (void*) pData;
+				iov[numIov].iov_len = dataSize;
+				numIov++;
+			}
+
+			ssize_t currentSizeSend = writev(TCPAddress.GetSocket(), iov, numIov);
+
+			if(currentSizeSend <= 0)
+			{
+				isConnected = false;
+				return false;
+			}
+
+			// we skip what the kernel took, a segment may be cut in the middle
+			for(int i = 0 ; i < numIov && currentSizeSend > 0 ; i++)
+			{
+				if((size_t) currentSizeSend < iov[i].iov_len)
+				{
+					offset += currentSizeSend;
+					break;
+				}
+
+				currentSizeSend -= iov[i].iov_len;
+				offset = 0;
+				index++;
+			}
 		}
 		
-		pBuffer->Create(sizeReceive);
-		pBuffer->Write(Temp.GetBuffer(), sizeReceive);
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTCPConnectionException(CTCPConnectionException::TCPCEC_SENDERROR);		
+	}
+}
+
+bool CTCPConnection::Receive(CBuffer* pBuffer)
+{
+	try
+	{
+		// we read straight into the caller buffer, up to the size it asked
+		// for, a shared storage is left to its other owners
+		u32 sizeRead = pBuffer->GetBufferSize();
+
+		if(sizeRead == 0)
+		sizeRead = TCPCONNECTION_RECEIVESIZE;
+
+		pBuffer->Create(sizeRead);
+
+		u32 sizeReceive;
+
+		if(!Receive(pBuffer->GetBuffer(), pBuffer->GetBufferSize(), &sizeReceive))
+		return false;
+		
+		pBuffer->Resize(sizeReceive);
 		
 		return true;
 	}
@@ -264,6 +341,21 @@ bool CTCPConnection::Receive(CBuffer* pBuffer)
 
 }
 
+bool CTCPConnection::Receive(u8* pData, u32 dataSize, u32* pReceiveSize)
+{
+	int sizeReceive = read(TCPAddress.GetSocket(), pData, dataSize);
+
+	if(sizeReceive <= 0)
+	{
+		isConnected = false;
+		return false;
+	}
+
+	*pReceiveSize = sizeReceive;
+	
+	return true;
+}
+
 bool CTCPConnection::IsConnected() const
 {
 	return isConnected;
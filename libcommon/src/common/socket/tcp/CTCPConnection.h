@@ -23,9 +23,13 @@
 
 #include <common/CException.h>
 #include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
 #include <common/socket/CConnection.h>
 #include <common/socket/tcp/CTCPAddress.h>
 
+// what Receive(CBuffer*) reads at most into an empty buffer
+#define TCPCONNECTION_RECEIVESIZE	4096
+
 class CTCPConnection : public CConnection
 {
 public:
@@ -44,7 +48,9 @@ public:
 	void Disconnect();
 	
 	bool Send(const CBuffer* pBuffer);
+	bool Send(const CBufferChain* pBufferChain);
 	bool Receive(CBuffer* pBuffer);
+	bool Receive(u8* pData, u32 dataSize, u32* pReceiveSize);
 
 	bool IsConnected() const;
 
@@ -18,6 +18,7 @@
  *
  */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <iostream>
 #include <netdb.h>
@@ -33,10 +34,14 @@
 #include <common/CException.h>
 #include <common/CObject.h>
 #include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
 #include <common/socket/tcp/CTCPAddress.h>
 #include <common/socket/tcp/CTCPConnection.h>
 #include <common/socket/tcp/tls/CTLSConnection.h>
 
+// largest TLS record payload
+#define TLS_RECORDSIZE	16384
+
 using namespace std;
 
 CTLSConnection::CTLSConnection() : CTCPConnection()
@@ -114,17 +119,146 @@ bool CTLSConnection::Send(const CBuffer* pBuffer)
 	}
 }
 
+bool CTLSConnection::Send(const CBufferChain* pBufferChain)
+{
+	try
+	{
+		if(IsNotSecured())
+		{
+			if(CTCPConnection::Send(pBufferChain))
+			return true;
+
+			Disconnect();
+			return false;
+		}
+
+		// we gather the segments into full records so that a stanza costs
+		// as few SSL_write calls and TLS records as possible
+		if(Record.IsEmpty())
+		Record.Create(TLS_RECORDSIZE);
+
+		u32 recordSize = 0;
+
+		for(u32 i = 0 ; i < pBufferChain->GetNumSegment() ; i++)
+		{
+			const u8* pData;
+			u32 dataSize;
+
+			pBufferChain->GetSegment(i, &pData, &dataSize);
+
+			while(dataSize)
+			{
+				// whole records are encrypted in place from the segment
+				if(recordSize == 0 && dataSize >= TLS_RECORDSIZE)
+				{
+					if(!WriteSecured(pData, TLS_RECORDSIZE))
+					return false;
+
+					pData += TLS_RECORDSIZE;
+					dataSize -= TLS_RECORDSIZE;
+					continue;
+				}
+
+				u32 copySize = TLS_RECORDSIZE - recordSize;
+
+				if(copySize > dataSize)
+				copySize = dataSize;
+
+				memcpy(Record.GetBuffer() + recordSize, pData, copySize);
+				recordSize += copySize;
+				pData += copySize;
+				dataSize -= copySize;
+
+				if(recordSize == TLS_RECORDSIZE)
+				{
+					if(!WriteSecured(Record.GetBuffer(), recordSize))
+					return false;
+
+					recordSize = 0;
+				}
+			}
+		}
+
+		if(recordSize && !WriteSecured(Record.GetBuffer(), recordSize))
+		return false;
+
+		return true;
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTLSConnectionException(CTLSConnectionException::TLSCEC_SENDERROR);		
+	}
+}
+
+bool CTLSConnection::WriteSecured(const u8* pData, u32 dataSize)
+{
+	u32 sizeSend = 0;
+
+	while(sizeSend < dataSize)
+	{
+		int currentSizeSend = SSL_write(ssl, pData + sizeSend, dataSize - sizeSend);
+
+		if(currentSizeSend <= 0)
+		{
+			Unsecure();
+			Disconnect();
+			return false;
+		}
+
+		sizeSend += currentSizeSend;
+	}
+
+	return true;
+}
+
 bool CTLSConnection::Receive(CBuffer* pBuffer)
 {
 	try
 	{
-		CBuffer Temp(pBuffer->GetBufferSize());
+		// we read straight into the caller buffer, up to the size it asked
+		// for, a shared storage is left to its other owners
+		u32 sizeRead = pBuffer->GetBufferSize();
+
+		if(sizeRead == 0)
+		sizeRead = TCPCONNECTION_RECEIVESIZE;
+
+		pBuffer->Create(sizeRead);
+
+		u32 sizeReceive;
+
+		if(!Receive(pBuffer->GetBuffer(), pBuffer->GetBufferSize(), &sizeReceive))
+		return false;
+
+		pBuffer->Resize(sizeReceive);
+		
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTLSConnectionException(CTLSConnectionException::TLSCEC_RECEIVEERROR);		
+	}
+}
+
+bool CTLSConnection::Receive(u8* pData, u32 dataSize, u32* pReceiveSize)
+{
+	try
+	{
 		int sizeReceive;
 
 		if(IsSecured())
-		sizeReceive = SSL_read(ssl, Temp.GetBuffer(), Temp.GetBufferSize());
+		sizeReceive = SSL_read(ssl, pData, dataSize);
 		else
-		sizeReceive = read(GetTCPAddress().GetSocket(), Temp.GetBuffer(), Temp.GetBufferSize());
+		sizeReceive = read(GetTCPAddress().GetSocket(), pData, dataSize);
 
 		if(sizeReceive <= 0)
 		{
@@ -135,8 +269,7 @@ bool CTLSConnection::Receive(CBuffer* pBuffer)
 			return false;
 		}
 
-		pBuffer->Create(sizeReceive);
-		pBuffer->Write(Temp.GetBuffer(), sizeReceive);
+		*pReceiveSize = sizeReceive;
 		
 		return true;
 	}
@@ -151,6 +284,144 @@ bool CTLSConnection::Receive(CBuffer* pBuffer)
 	}
 }
 
+void CTLSConnection::SetBlocking(bool isBlocking)
+{
+	try
+	{
+		int sock = GetTCPAddress().GetSocket();
+		int flags = fcntl(sock, F_GETFL);
+
+		if(flags == -1)
+		throw CTLSConnectionException(CTLSConnectionException::TLSCEC_SETBLOCKINGERROR);
+
+		if(isBlocking)
+		flags &= ~O_NONBLOCK;
+		else
+		flags |= O_NONBLOCK;
+
+		if(fcntl(sock, F_SETFL, flags) == -1)
+		throw CTLSConnectionException(CTLSConnectionException::TLSCEC_SETBLOCKINGERROR);
+
+		// a write cut short is retried from wherever the caller keeps the
+		// rest of its data
+		if(IsSecured())
+		SSL_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTLSConnectionException(CTLSConnectionException::TLSCEC_SETBLOCKINGERROR);
+	}
+}
+
+CObject::u32 CTLSConnection::TrySend(const u8* pData, u32 dataSize, u32* pSendSize)
+{
+	try
+	{
+		// unlike Send(), a closed connection is left for the caller to tear
+		// down so that it can unregister the socket first
+		int sizeSend;
+
+		if(IsSecured())
+		{
+			sizeSend = SSL_write(ssl, pData, dataSize);
+
+			if(sizeSend <= 0)
+			{
+				int error = SSL_get_error(ssl, sizeSend);
+
+				if(error == SSL_ERROR_WANT_READ)
+				return TLSCS_WANTREAD;
+
+				if(error == SSL_ERROR_WANT_WRITE)
+				return TLSCS_WANTWRITE;
+
+				return TLSCS_CLOSED;
+			}
+		}
+		else
+		{
+			do
+			sizeSend = write(GetTCPAddress().GetSocket(), pData, dataSize);
+			while(sizeSend < 0 && errno == EINTR);
+
+			if(sizeSend < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return TLSCS_WANTWRITE;
+
+			if(sizeSend <= 0)
+			return TLSCS_CLOSED;
+		}
+
+		*pSendSize = sizeSend;
+
+		return TLSCS_DONE;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTLSConnectionException(CTLSConnectionException::TLSCEC_TRYSENDERROR);
+	}
+}
+
+CObject::u32 CTLSConnection::TryReceive(u8* pData, u32 dataSize, u32* pReceiveSize)
+{
+	try
+	{
+		int sizeReceive;
+
+		if(IsSecured())
+		{
+			sizeReceive = SSL_read(ssl, pData, dataSize);
+
+			if(sizeReceive <= 0)
+			{
+				int error = SSL_get_error(ssl, sizeReceive);
+
+				if(error == SSL_ERROR_WANT_READ)
+				return TLSCS_WANTREAD;
+
+				if(error == SSL_ERROR_WANT_WRITE)
+				return TLSCS_WANTWRITE;
+
+				return TLSCS_CLOSED;
+			}
+		}
+		else
+		{
+			do
+			sizeReceive = read(GetTCPAddress().GetSocket(), pData, dataSize);
+			while(sizeReceive < 0 && errno == EINTR);
+
+			if(sizeReceive < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return TLSCS_WANTREAD;
+
+			if(sizeReceive <= 0)
+			return TLSCS_CLOSED;
+		}
+
+		*pReceiveSize = sizeReceive;
+
+		return TLSCS_DONE;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTLSConnectionException(CTLSConnectionException::TLSCEC_TRYRECEIVEERROR);
+	}
+}
+
 bool CTLSConnection::IsSecured()
 {
 	return isSecured == true;
@@ -257,6 +528,15 @@ const char* CTLSConnectionException::what() const throw()
 	case TLSCEC_RECEIVEERROR:
 		return "CTLSConnection::Receive() error";
 
+	case TLSCEC_SETBLOCKINGERROR:
+		return "CTLSConnection::SetBlocking() error";
+
+	case TLSCEC_TRYSENDERROR:
+		return "CTLSConnection::TrySend() error";
+
+	case TLSCEC_TRYRECEIVEERROR:
+		return "CTLSConnection::TryReceive() error";
+
 	default:
 		return "CTLSConnection: Unknown error";
 	}
@@ -26,11 +26,23 @@
 #include <common/CException.h>
 #include <common/CObject.h>
 #include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
 #include <common/socket/tcp/CTCPAddress.h>
 #include <common/socket/tcp/CTCPConnection.h>
 
 class CTLSConnection : public CTCPConnection
 {
+public:
+	// outcome of the non blocking calls, a call that wants the socket to
+	// be readable or writable is to be retried with the same arguments
+	enum TLSConnectionStatus
+	{
+		TLSCS_DONE,
+		TLSCS_WANTREAD,
+		TLSCS_WANTWRITE,
+		TLSCS_CLOSED
+	};
+
 public:
 	CTLSConnection();
 	CTLSConnection(CTCPAddress* pTCPAddress);
@@ -44,11 +56,21 @@ public:
 	bool IsNotSecured();
 
 	bool Send(const CBuffer* pBuffer);
+	bool Send(const CBufferChain* pBufferChain);
 	bool Receive(CBuffer* pBuffer);
+	bool Receive(u8* pData, u32 dataSize, u32* pReceiveSize);
+
+	void SetBlocking(bool isBlocking);
+	u32 TrySend(const u8* pData, u32 dataSize, u32* pSendSize);
+	u32 TryReceive(u8* pData, u32 dataSize, u32* pReceiveSize);
+
+private:
+	bool WriteSecured(const u8* pData, u32 dataSize);
 
 private:
 	bool isSecured;
 	SSL* ssl;
+	CBuffer Record;
 };
 
 class CTLSConnectionException : public CException
@@ -59,7 +81,10 @@ public:
 		TLSCEC_SECUREERROR,
 		TLSCEC_UNSECUREERROR,
 		TLSCEC_SENDERROR,
-		TLSCEC_RECEIVEERROR
+		TLSCEC_RECEIVEERROR,
+		TLSCEC_SETBLOCKINGERROR,
+		TLSCEC_TRYSENDERROR,
+		TLSCEC_TRYRECEIVEERROR
 	};
 
 public:
@@ -0,0 +1,520 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+#include <iostream>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CExecutor.h>
+#include <common/thread/CMutex.h>
+#include <common/thread/CTask.h>
+#include <common/thread/CThread.h>
+
+using namespace std;
+
+static pthread_key_t workerKey;
+static pthread_once_t workerOnce = PTHREAD_ONCE_INIT;
+
+static void InitWorkerKey()
+{
+	pthread_key_create(&workerKey, NULL);
+}
+
+CExecutor::CExecutor()
+{
+	numQueued = 0;
+	numSteal = 0;
+	numIdle = 0;
+	isStopped = false;
+}
+
+CExecutor::~CExecutor()
+{
+	try
+	{
+		Stop();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+	}
+}
+
+void CExecutor::Start(u32 numThread)
+{
+	try
+	{
+		if(!WorkerList.empty())
+		throw CExecutorException(CExecutorException::EXEC_STARTERROR);
+
+		// 0 gives a thread per online processor
+		if(numThread == 0)
+		{
+			long numProcessor = sysconf(_SC_NPROCESSORS_ONLN);
+			numThread = numProcessor > 0 ? numProcessor : 1;
+		}
+
+		if(numThread > EXECUTOR_MAXTHREAD)
+		numThread = EXECUTOR_MAXTHREAD;
+
+		pthread_once(&workerOnce, InitWorkerKey);
+
+		isStopped = false;
+
+		// every deque exists before a thread may steal from it
+		for(u32 i = 0 ; i < numThread ; i++)
+		{
+			SWorker* pWorker = new SWorker;
+
+			pWorker->pExecutor = this;
+			pWorker->index = i;
+			pWorker->isWoken = false;
+			pWorker->isIdle = false;
+
+			WorkerList.push_back(pWorker);
+		}
+
+		for(u32 i = 0 ; i < numThread ; i++)
+		WorkerList[i]->ThreadWorkerJob.Run(WorkerJob, WorkerList[i]);
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CExecutorException(CExecutorException::EXEC_STARTERROR);
+	}
+}
+
+void CExecutor::Stop()
+{
+	try
+	{
+		if(WorkerList.empty())
+		return;
+
+		// the threads run what is queued before they leave
+		MutexIdle.Lock();
+		isStopped = true;
+		IdleList.clear();
+		numIdle = 0;
+		MutexIdle.UnLock();
+
+		for(u32 i = 0 ; i < WorkerList.size() ; i++)
+		{
+			SWorker* pWorker = WorkerList[i];
+
+			pWorker->MutexWake.Lock();
+			pWorker->isWoken = true;
+			pWorker->MutexWake.Signal();
+			pWorker->MutexWake.UnLock();
+		}
+
+		for(u32 i = 0 ; i < WorkerList.size() ; i++)
+		WorkerList[i]->ThreadWorkerJob.Wait();
+
+		for(u32 i = 0 ; i < WorkerList.size() ; i++)
+		delete WorkerList[i];
+
+		WorkerList.clear();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CExecutorException(CExecutorException::EXEC_STOPERROR);
+	}
+}
+
+void CExecutor::Submit(CTask* pTask)
+{
+	try
+	{
+		while(true)
+		{
+			u32 state = pTask->state;
+
+			if(state == CTask::TS_IDLE)
+			{
+				if(!__sync_bool_compare_and_swap(&pTask->state, CTask::TS_IDLE, CTask::TS_QUEUED))
+				continue;
+
+				// a thread of ours keeps the task, the others may steal it
+				SWorker* pWorker = GetCurrentWorker();
+
+				if(pWorker != NULL && pWorker->pExecutor != this)
+				pWorker = NULL;
+
+				Push(pWorker, pTask, false);
+				return;
+			}
+
+			// the thread running the task runs it again once it is done
+			if(state == CTask::TS_RUNNING)
+			{
+				if(!__sync_bool_compare_and_swap(&pTask->state, CTask::TS_RUNNING, CTask::TS_RERUN))
+				continue;
+
+				return;
+			}
+
+			// already queued or to be run again
+			return;
+		}
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CExecutorException(CExecutorException::EXEC_SUBMITERROR);
+	}
+}
+
+CObject::u32 CExecutor::GetNumThread() const
+{
+	return WorkerList.size();
+}
+
+CObject::u32 CExecutor::GetNumSteal() const
+{
+	return numSteal;
+}
+
+void CExecutor::Push(SWorker* pWorker, CTask* pTask, bool isFront)
+{
+	try
+	{
+		CMutex* pMutex = pWorker != NULL ? &pWorker->MutexTaskQueue : &MutexInjectQueue;
+		deque<CTask*>* pTaskQueue = pWorker != NULL ? &pWorker->TaskQueue : &InjectQueue;
+
+		pMutex->Lock();
+
+		if(isFront)
+		pTaskQueue->push_front(pTask);
+		else
+		pTaskQueue->push_back(pTask);
+
+		pMutex->UnLock();
+
+		// the count is raised after the push and read by the sleepers
+		// after they declared themselves idle, one side sees the other
+		__sync_add_and_fetch(&numQueued, 1);
+
+		if(numIdle != 0)
+		Wake();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CExecutorException(CExecutorException::EXEC_PUSHERROR);
+	}
+}
+
+CTask* CExecutor::Take(SWorker* pWorker)
+{
+	try
+	{
+		CTask* pTask = NULL;
+
+		if(numQueued == 0)
+		return NULL;
+
+		// our newest task first, its data is the most likely in cache
+		pWorker->MutexTaskQueue.Lock();
+
+		if(!pWorker->TaskQueue.empty())
+		{
+			pTask = pWorker->TaskQueue.back();
+			pWorker->TaskQueue.pop_back();
+		}
+
+		pWorker->MutexTaskQueue.UnLock();
+
+		if(pTask == NULL)
+		{
+			MutexInjectQueue.Lock();
+
+			if(!InjectQueue.empty())
+			{
+				pTask = InjectQueue.front();
+				InjectQueue.pop_front();
+			}
+
+			MutexInjectQueue.UnLock();
+		}
+
+		// then the oldest task of the next busy thread
+		for(u32 i = 1 ; pTask == NULL && i < WorkerList.size() ; i++)
+		{
+			SWorker* pVictim = WorkerList[(pWorker->index + i) % WorkerList.size()];
+
+			pVictim->MutexTaskQueue.Lock();
+
+			if(!pVictim->TaskQueue.empty())
+			{
+				pTask = pVictim->TaskQueue.front();
+				pVictim->TaskQueue.pop_front();
+				__sync_add_and_fetch(&numSteal, 1);
+			}
+
+			pVictim->MutexTaskQueue.UnLock();
+		}
+
+		if(pTask != NULL)
+		__sync_sub_and_fetch(&numQueued, 1);
+
+		return pTask;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CExecutorException(CExecutorException::EXEC_TAKEERROR);
+	}
+}
+
+void CExecutor::RunTask(SWorker* pWorker, CTask* pTask)
+{
+	__sync_bool_compare_and_swap(&pTask->state, CTask::TS_QUEUED, CTask::TS_RUNNING);
+
+	bool isAlive;
+
+	// a failing task stays known, it runs again when submitted
+	try
+	{
+		isAlive = pTask->Run();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		isAlive = true;
+	}
+
+	if(!isAlive)
+	return;
+
+	if(__sync_bool_compare_and_swap(&pTask->state, CTask::TS_RUNNING, CTask::TS_IDLE))
+	return;
+
+	// submitted while it ran, the tasks already queued here go first
+	__sync_bool_compare_and_swap(&pTask->state, CTask::TS_RERUN, CTask::TS_QUEUED);
+	Push(pWorker, pTask, true);
+}
+
+bool CExecutor::Sleep(SWorker* pWorker)
+{
+	MutexIdle.Lock();
+
+	try
+	{
+		// false once stopped with nothing left to run
+		if(isStopped)
+		{
+			MutexIdle.UnLock();
+			return numQueued != 0;
+		}
+
+		// a late wake from a previous sleep only costs a spurious round
+		pWorker->MutexWake.Lock();
+		pWorker->isWoken = false;
+		pWorker->MutexWake.UnLock();
+
+		pWorker->isIdle = true;
+		IdleList.push_back(pWorker);
+		__sync_add_and_fetch(&numIdle, 1);
+
+		if(numQueued != 0)
+		{
+			// nobody took us from the list yet, we leave it ourselves
+			if(pWorker->isIdle)
+			{
+				pWorker->isIdle = false;
+				IdleList.pop_back();
+				__sync_sub_and_fetch(&numIdle, 1);
+			}
+
+			MutexIdle.UnLock();
+			return true;
+		}
+
+		MutexIdle.UnLock();
+
+		pWorker->MutexWake.Lock();
+
+		while(!pWorker->isWoken)
+		pWorker->MutexWake.Wait();
+
+		pWorker->MutexWake.UnLock();
+
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		MutexIdle.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CExecutorException(CExecutorException::EXEC_SLEEPERROR);
+	}
+}
+
+void CExecutor::Wake()
+{
+	SWorker* pWorker = NULL;
+
+	MutexIdle.Lock();
+
+	try
+	{
+		// the last thread to sleep is woken first, it is the warmest
+		if(!IdleList.empty())
+		{
+			pWorker = IdleList.back();
+			IdleList.pop_back();
+
+			pWorker->isIdle = false;
+			__sync_sub_and_fetch(&numIdle, 1);
+		}
+
+		MutexIdle.UnLock();
+
+		if(pWorker == NULL)
+		return;
+
+		pWorker->MutexWake.Lock();
+		pWorker->isWoken = true;
+		pWorker->MutexWake.Signal();
+		pWorker->MutexWake.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CExecutorException(CExecutorException::EXEC_WAKEERROR);
+	}
+}
+
+CExecutor::SWorker* CExecutor::GetCurrentWorker()
+{
+	return (SWorker*) pthread_getspecific(workerKey);
+}
+
+void* CExecutor::WorkerJob(void* pvWorker) throw()
+{
+	try
+	{
+		SWorker* pWorker = (SWorker*) pvWorker;
+		CExecutor* pThis = pWorker->pExecutor;
+
+		pthread_setspecific(workerKey, pWorker);
+
+		while(true)
+		{
+			CTask* pTask = pThis->Take(pWorker);
+
+			if(pTask != NULL)
+			{
+				pThis->RunTask(pWorker, pTask);
+				continue;
+			}
+
+			if(!pThis->Sleep(pWorker))
+			break;
+		}
+
+		return NULL;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		return NULL;
+	}
+}
+
+CExecutorException::CExecutorException(int code) : CException(code)
+{}
+
+CExecutorException::~CExecutorException() throw()
+{}
+
+const char* CExecutorException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case EXEC_STARTERROR:
+		return "CExecutor::Start() error";
+
+	case EXEC_STOPERROR:
+		return "CExecutor::Stop() error";
+
+	case EXEC_SUBMITERROR:
+		return "CExecutor::Submit() error";
+
+	case EXEC_PUSHERROR:
+		return "CExecutor::Push() error";
+
+	case EXEC_TAKEERROR:
+		return "CExecutor::Take() error";
+
+	case EXEC_SLEEPERROR:
+		return "CExecutor::Sleep() error";
+
+	case EXEC_WAKEERROR:
+		return "CExecutor::Wake() error";
+
+	default:
+		return "CExecutor: Unknown error";
+	}
+}
@@ -0,0 +1,123 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CEXECUTOR_H__
+#define __CEXECUTOR_H__
+
+#include <deque>
+#include <vector>
+
+#include <pthread.h>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CMutex.h>
+#include <common/thread/CTask.h>
+#include <common/thread/CThread.h>
+
+using namespace std;
+
+#define EXECUTOR_MAXTHREAD 256
+
+// a fixed set of threads running tasks. each thread has its own deque, a
+// task submitted from a thread of the executor goes to that thread, one
+// submitted from outside goes to a shared deque. a thread takes its newest
+// task first, when it has none it takes the oldest one of the shared deque
+// or steals the oldest one of another thread, it only sleeps when no task
+// is queued anywhere
+class CExecutor : public CObject
+{
+public:
+	CExecutor();
+	virtual ~CExecutor();
+
+	void Start(u32 numThread = 0);
+	void Stop();
+
+	void Submit(CTask* pTask);
+
+	u32 GetNumThread() const;
+	u32 GetNumSteal() const;
+
+private:
+	struct SWorker
+	{
+		CExecutor* pExecutor;
+		u32 index;
+
+		deque<CTask*> TaskQueue;
+		CMutex MutexTaskQueue;
+
+		// set by the thread that wakes us, under MutexWake
+		bool isWoken;
+		bool isIdle;
+		CMutex MutexWake;
+
+		CThread ThreadWorkerJob;
+	};
+
+private:
+	void Push(SWorker* pWorker, CTask* pTask, bool isFront);
+	CTask* Take(SWorker* pWorker);
+	void RunTask(SWorker* pWorker, CTask* pTask);
+	bool Sleep(SWorker* pWorker);
+	void Wake();
+
+	static SWorker* GetCurrentWorker();
+	static void* WorkerJob(void* pvWorker) throw();
+
+private:
+	vector<SWorker*> WorkerList;
+
+	deque<CTask*> InjectQueue;
+	CMutex MutexInjectQueue;
+
+	// tasks sitting in any deque, read without lock by the sleepers
+	volatile u32 numQueued;
+	volatile u32 numSteal;
+
+	vector<SWorker*> IdleList;
+	volatile u32 numIdle;
+	bool isStopped;
+	CMutex MutexIdle;
+};
+
+class CExecutorException : public CException
+{
+public:
+	enum ExecutorExceptionCode
+	{
+		EXEC_STARTERROR,
+		EXEC_STOPERROR,
+		EXEC_SUBMITERROR,
+		EXEC_PUSHERROR,
+		EXEC_TAKEERROR,
+		EXEC_SLEEPERROR,
+		EXEC_WAKEERROR
+	};
+
+public:
+	CExecutorException(int code);
+	virtual ~CExecutorException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif // __CEXECUTOR_H__
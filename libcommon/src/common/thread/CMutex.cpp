@@ -18,7 +18,9 @@
  *
  */
 
+#include <errno.h>
 #include <pthread.h>
+#include <time.h>
 #include <iostream>
 
 #include <common/CException.h>
@@ -114,6 +116,59 @@ bool CMutex::Wait()
 	}
 }
 
+CObject::u32 CMutex::Wait(u32 timeout)
+{
+	try
+	{
+		// 0 waits forever as everywhere else
+		if(timeout == 0)
+		return Wait() ? MWS_SIGNALED : MWS_DESTROYED;
+
+		// in microseconds, a caller that waits for a condition in a loop
+		// rather computes its deadline once and calls WaitUntil()
+		struct timespec Deadline;
+		GetDeadline(timeout, &Deadline);
+
+		return WaitUntil(Deadline);
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CMutexException(CMutexException::MEC_WAITERROR);
+	}
+}
+
+CObject::u32 CMutex::WaitUntil(const struct timespec& rDeadline)
+{
+	try
+	{
+		// the condition is on the monotonic clock so that a change of the
+		// wall clock does not move the deadline
+		int error = pthread_cond_timedwait(&cond, &mutex, &rDeadline);
+
+		if(error == ETIMEDOUT)
+		return MWS_TIMEDOUT;
+
+		if(error != 0)
+		throw CMutexException(CMutexException::MEC_WAITUNTILERROR);
+		
+		return isDestroyed ? MWS_DESTROYED : MWS_SIGNALED;
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CMutexException(CMutexException::MEC_WAITUNTILERROR);
+	}
+}
+
 void CMutex::Signal()
 {
 	try
@@ -140,6 +195,20 @@ void CMutex::SignalDestroy()
 	throw CMutexException(CMutexException::MEC_SIGNALERROR);
 }
 
+void CMutex::GetDeadline(u32 timeout, struct timespec* pDeadline)
+{
+	clock_gettime(CLOCK_MONOTONIC, pDeadline);
+
+	pDeadline->tv_sec += timeout / 1000000;
+	pDeadline->tv_nsec += (timeout % 1000000) * 1000;
+
+	if(pDeadline->tv_nsec >= 1000000000)
+	{
+		pDeadline->tv_sec++;
+		pDeadline->tv_nsec -= 1000000000;
+	}
+}
+
 void CMutex::Init()
 {
 	try
@@ -149,11 +218,24 @@ void CMutex::Init()
 		if(pthread_mutex_init(&mutex, NULL) != 0)
 		throw CMutexException(CMutexException::MEC_INITERROR);
 	
-		if(pthread_cond_init(&cond, NULL) != 0)
+		pthread_condattr_t CondAttr;
+
+		if(pthread_condattr_init(&CondAttr) != 0)
+		{
+			pthread_mutex_destroy(&mutex);
+			throw CMutexException(CMutexException::MEC_INITERROR);
+		}
+
+		pthread_condattr_setclock(&CondAttr, CLOCK_MONOTONIC);
+
+		if(pthread_cond_init(&cond, &CondAttr) != 0)
 		{
+			pthread_condattr_destroy(&CondAttr);
 			pthread_mutex_destroy(&mutex);
 			throw CMutexException(CMutexException::MEC_INITERROR);
 		}
+
+		pthread_condattr_destroy(&CondAttr);
 	}
 
 	catch(exception& e)
@@ -215,6 +297,9 @@ const char* CMutexException::what() const throw()
 	case MEC_WAITERROR:
 		return "CMutex::Wait() error";
 
+	case MEC_WAITUNTILERROR:
+		return "CMutex::WaitUntil() error";
+
 	default:
 		return "CMutex:Unknown error";
 	}
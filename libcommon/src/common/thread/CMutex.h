@@ -22,12 +22,22 @@
 #define __CMUTEX_H__
 
 #include <pthread.h>
+#include <time.h>
 
 #include <common/CException.h>
 #include <common/CObject.h>
 
 class CMutex : public CObject
 {
+public:
+	// outcome of the timed waits
+	enum MutexWaitStatus
+	{
+		MWS_SIGNALED,
+		MWS_TIMEDOUT,
+		MWS_DESTROYED
+	};
+
 public:
 	CMutex();
 	virtual ~CMutex();
@@ -40,9 +50,13 @@ public:
 	bool TryLock();
 	
 	bool Wait();
+	u32 Wait(u32 timeout);
+	u32 WaitUntil(const struct timespec& rDeadline);
 	void Signal();
 	void SignalDestroy();
 
+	static void GetDeadline(u32 timeout, struct timespec* pDeadline);
+
 private:
 	void Init();
 	void Destroy();
@@ -64,7 +78,8 @@ public:
 		MEC_LOCKERROR,
 		MEC_UNLOCKERROR,
 		MEC_SIGNALERROR,
-		MEC_WAITERROR
+		MEC_WAITERROR,
+		MEC_WAITUNTILERROR
 	};
 
 public:
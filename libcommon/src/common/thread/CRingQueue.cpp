@@ -0,0 +1,501 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <climits>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <queue>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CMutex.h>
+#include <common/thread/CRingQueue.h>
+
+using namespace std;
+
+// x86 keeps loads ordered with loads and stores with stores, only the
+// compiler has to be held back there, other cpus need a real barrier
+#if defined(__i386__) || defined(__x86_64__)
+#define RINGQUEUE_BARRIER() __asm__ __volatile__("" : : : "memory")
+#else
+#define RINGQUEUE_BARRIER() __sync_synchronize()
+#endif
+
+// ringqueue-bench builds its own copy with __RINGQUEUE_STRESS__, random
+// pauses then widen the windows between a waker and a sleeper
+#ifdef __RINGQUEUE_STRESS__
+#define RINGQUEUE_STRESS() if(rand() % 8 == 0) usleep(rand() % 20)
+#else
+#define RINGQUEUE_STRESS()
+#endif
+
+static void FutexWait(volatile CObject::u32* pWord, CObject::u32 value, const struct timespec* pTimeout)
+{
+	// EAGAIN, EINTR and ETIMEDOUT only mean that we have to look again
+	syscall(SYS_futex, pWord, FUTEX_WAIT_PRIVATE, value, pTimeout, NULL, 0);
+}
+
+static CObject::u32 GetElapsed(const struct timespec* pStart)
+{
+	struct timespec Now;
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+
+	return (Now.tv_sec - pStart->tv_sec) * 1000000 + (Now.tv_nsec - pStart->tv_nsec) / 1000;
+}
+
+static void FutexWake(volatile CObject::u32* pWord, int numWaiter)
+{
+	syscall(SYS_futex, pWord, FUTEX_WAKE_PRIVATE, numWaiter, NULL, NULL, 0);
+}
+
+CRingQueue::CRingQueue(u32 capacity, bool isBounded)
+{
+	try
+	{
+		u32 size = 2;
+
+		while(size < capacity)
+		size *= 2;
+
+		pCellArray = new SCell[size];
+		mask = size - 1;
+		this->isBounded = isBounded;
+
+		for(u32 i = 0 ; i < size ; i++)
+		{
+			pCellArray[i].sequence = i;
+			pCellArray[i].pItem = NULL;
+		}
+
+		pushPos = 0;
+		popPos = 0;
+		popEpoch = 0;
+		numPopWaiter = 0;
+		pushEpoch = 0;
+		numPushWaiter = 0;
+		isClosed = 0;
+		numOverflow = 0;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CRingQueueException(CRingQueueException::RQEC_CONSTRUCTORERROR);
+	}
+}
+
+CRingQueue::~CRingQueue()
+{
+	delete[] pCellArray;
+}
+
+void CRingQueue::ReInit()
+{
+	isClosed = 0;
+	__sync_synchronize();
+}
+
+bool CRingQueue::Push(void* pItem)
+{
+	try
+	{
+		while(true)
+		{
+			if(TryPush(pItem))
+			return true;
+
+			if(isClosed)
+			return false;
+
+			// we register before looking again, so that a consumer
+			// freeing a cell after our look is bound to wake us
+			u32 epoch = pushEpoch;
+			__sync_add_and_fetch(&numPushWaiter, 1);
+
+			if(TryPush(pItem))
+			{
+				__sync_sub_and_fetch(&numPushWaiter, 1);
+				return true;
+			}
+
+			if(!isClosed)
+			FutexWait(&pushEpoch, epoch, NULL);
+
+			__sync_sub_and_fetch(&numPushWaiter, 1);
+		}
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CRingQueueException(CRingQueueException::RQEC_PUSHERROR);
+	}
+}
+
+bool CRingQueue::TryPush(void* pItem)
+{
+	try
+	{
+		if(isClosed)
+		return false;
+
+		// once something spilled the ring waits until the list is drained
+		if(numOverflow == 0 && PushRing(pItem))
+		{
+			WakePopper();
+			return true;
+		}
+
+		if(isBounded)
+		return false;
+
+		MutexOverflow.Lock();
+		Overflow.push(pItem);
+		__sync_add_and_fetch(&numOverflow, 1);
+		MutexOverflow.UnLock();
+
+		WakePopper();
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CRingQueueException(CRingQueueException::RQEC_PUSHERROR);
+	}
+}
+
+bool CRingQueue::Pop(void** ppItem)
+{
+	try
+	{
+		while(true)
+		{
+			if(TryPop(ppItem))
+			return true;
+
+			if(isClosed)
+			return false;
+
+			u32 epoch = popEpoch;
+			__sync_add_and_fetch(&numPopWaiter, 1);
+			RINGQUEUE_STRESS();
+
+			bool isPopped = TryPop(ppItem);
+
+			if(!isPopped && !isClosed)
+			{
+				FutexWait(&popEpoch, epoch, NULL);
+				isPopped = TryPop(ppItem);
+			}
+
+			LeavePopWait(isPopped);
+
+			if(isPopped)
+			return true;
+		}
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CRingQueueException(CRingQueueException::RQEC_POPERROR);
+	}
+}
+
+bool CRingQueue::Pop(void** ppItem, u32 timeout)
+{
+	// 0 waits forever as everywhere else
+	if(timeout == 0)
+	return Pop(ppItem);
+
+	try
+	{
+		struct timespec Start;
+		clock_gettime(CLOCK_MONOTONIC, &Start);
+
+		while(true)
+		{
+			if(TryPop(ppItem))
+			return true;
+
+			u32 elapsed = GetElapsed(&Start);
+
+			if(isClosed || elapsed >= timeout)
+			return false;
+
+			struct timespec Timeout;
+			Timeout.tv_sec = (timeout - elapsed) / 1000000;
+			Timeout.tv_nsec = ((timeout - elapsed) % 1000000) * 1000;
+
+			u32 epoch = popEpoch;
+			__sync_add_and_fetch(&numPopWaiter, 1);
+			RINGQUEUE_STRESS();
+
+			bool isPopped = TryPop(ppItem);
+
+			if(!isPopped && !isClosed)
+			{
+				FutexWait(&popEpoch, epoch, &Timeout);
+				isPopped = TryPop(ppItem);
+			}
+
+			LeavePopWait(isPopped);
+
+			if(isPopped)
+			return true;
+		}
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CRingQueueException(CRingQueueException::RQEC_POPERROR);
+	}
+}
+
+bool CRingQueue::TryPop(void** ppItem)
+{
+	try
+	{
+		if(PopRing(ppItem))
+		{
+			WakePusher();
+			return true;
+		}
+
+		if(numOverflow == 0)
+		return false;
+
+		MutexOverflow.Lock();
+
+		if(Overflow.empty())
+		{
+			MutexOverflow.UnLock();
+			return false;
+		}
+
+		*ppItem = Overflow.front();
+		Overflow.pop();
+		__sync_sub_and_fetch(&numOverflow, 1);
+
+		MutexOverflow.UnLock();
+
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CRingQueueException(CRingQueueException::RQEC_POPERROR);
+	}
+}
+
+void CRingQueue::Close()
+{
+	isClosed = 1;
+
+	__sync_add_and_fetch(&popEpoch, 1);
+	__sync_add_and_fetch(&pushEpoch, 1);
+
+	FutexWake(&popEpoch, INT_MAX);
+	FutexWake(&pushEpoch, INT_MAX);
+}
+
+bool CRingQueue::IsClosed() const
+{
+	return isClosed != 0;
+}
+
+CObject::u32 CRingQueue::GetCapacity() const
+{
+	return mask + 1;
+}
+
+CObject::u32 CRingQueue::GetSize() const
+{
+	return (pushPos - popPos) + numOverflow;
+}
+
+// a cell is free for the push at position pos when its sequence is pos,
+// it holds the item of that push when its sequence is pos + 1
+bool CRingQueue::PushRing(void* pItem)
+{
+	u32 pos = pushPos;
+	SCell* pCell;
+
+	while(true)
+	{
+		pCell = &pCellArray[pos & mask];
+
+		u32 sequence = pCell->sequence;
+		RINGQUEUE_BARRIER();
+
+		int diff = (int) (sequence - pos);
+
+		if(diff == 0)
+		{
+			u32 currentPos = __sync_val_compare_and_swap(&pushPos, pos, pos + 1);
+
+			if(currentPos == pos)
+			break;
+
+			pos = currentPos;
+		}
+		else
+		if(diff < 0)
+		return false;
+		else
+		pos = pushPos;
+	}
+
+	pCell->pItem = pItem;
+	RINGQUEUE_BARRIER();
+	pCell->sequence = pos + 1;
+
+	return true;
+}
+
+bool CRingQueue::PopRing(void** ppItem)
+{
+	u32 pos = popPos;
+	SCell* pCell;
+
+	while(true)
+	{
+		pCell = &pCellArray[pos & mask];
+
+		u32 sequence = pCell->sequence;
+		RINGQUEUE_BARRIER();
+
+		int diff = (int) (sequence - (pos + 1));
+
+		if(diff == 0)
+		{
+			u32 currentPos = __sync_val_compare_and_swap(&popPos, pos, pos + 1);
+
+			if(currentPos == pos)
+			break;
+
+			pos = currentPos;
+		}
+		else
+		if(diff < 0)
+		return false;
+		else
+		pos = popPos;
+	}
+
+	*ppItem = pCell->pItem;
+	RINGQUEUE_BARRIER();
+	pCell->sequence = pos + mask + 1;
+
+	return true;
+}
+
+void CRingQueue::WakePopper()
+{
+	// the item must be visible before we look for sleepers
+	__sync_synchronize();
+
+	if(numPopWaiter == 0)
+	return;
+
+	RINGQUEUE_STRESS();
+
+	// every push wakes one sleeper while there are any, a consumer that
+	// registered but did not sleep yet sees the epoch move and looks again
+	__sync_add_and_fetch(&popEpoch, 1);
+	FutexWake(&popEpoch, 1);
+}
+
+void CRingQueue::LeavePopWait(bool isPopped)
+{
+	__sync_sub_and_fetch(&numPopWaiter, 1);
+	RINGQUEUE_STRESS();
+
+	// the wake we took may have been meant for an item another consumer
+	// got first, we pass it on to the other sleepers while items are left
+	if(isPopped && GetSize() > 0)
+	WakePopper();
+}
+
+void CRingQueue::WakePusher()
+{
+	if(!isBounded)
+	return;
+
+	__sync_synchronize();
+
+	// producers sleep on a full ring, we let them all go once half of it
+	// is free rather than waking one per cell
+	if(numPushWaiter == 0 || pushPos - popPos > (mask + 1) / 2)
+	return;
+
+	__sync_add_and_fetch(&pushEpoch, 1);
+	FutexWake(&pushEpoch, INT_MAX);
+}
+
+
+CRingQueueException::CRingQueueException(int code) : CException(code)
+{}
+
+CRingQueueException::~CRingQueueException() throw()
+{}
+
+const char* CRingQueueException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case RQEC_CONSTRUCTORERROR:
+		return "CRingQueue::Constructor() error";
+
+	case RQEC_PUSHERROR:
+		return "CRingQueue::Push() error";
+
+	case RQEC_POPERROR:
+		return "CRingQueue::Pop() error";
+
+	default:
+		return "CRingQueue: Unknown error";
+	}
+}
@@ -0,0 +1,113 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CRINGQUEUE_H__
+#define __CRINGQUEUE_H__
+
+#include <queue>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CMutex.h>
+
+using namespace std;
+
+// lock free ring of pointers, any number of producers and consumers, a
+// thread only sleeps (on a futex) when the ring is empty for a consumer or
+// full for a producer. timeouts are in microseconds. an unbounded ring
+// never blocks its producer, items that do not fit spill into a locked
+// list, this mode keeps the order only with a single producer. items left
+// in the ring are not freed
+class CRingQueue : public CObject
+{
+public:
+	CRingQueue(u32 capacity, bool isBounded);
+	virtual ~CRingQueue();
+
+	void ReInit();
+
+	bool Push(void* pItem);
+	bool TryPush(void* pItem);
+	bool Pop(void** ppItem);
+	bool Pop(void** ppItem, u32 timeout);
+	bool TryPop(void** ppItem);
+
+	void Close();
+	bool IsClosed() const;
+
+	u32 GetCapacity() const;
+	u32 GetSize() const;
+
+private:
+	bool PushRing(void* pItem);
+	bool PopRing(void** ppItem);
+
+	void LeavePopWait(bool isPopped);
+	void WakePopper();
+	void WakePusher();
+
+private:
+	struct SCell
+	{
+		volatile u32 sequence;
+		void* pItem;
+	};
+
+private:
+	SCell* pCellArray;
+	u32 mask;
+	bool isBounded;
+
+	// each end on its own cache line
+	u8 padding0[64];
+	volatile u32 pushPos;
+	u8 padding1[64];
+	volatile u32 popPos;
+	u8 padding2[64];
+
+	volatile u32 popEpoch;
+	volatile u32 numPopWaiter;
+	volatile u32 pushEpoch;
+	volatile u32 numPushWaiter;
+	volatile u32 isClosed;
+
+	queue<void*> Overflow;
+	volatile u32 numOverflow;
+	CMutex MutexOverflow;
+};
+
+class CRingQueueException : public CException
+{
+public:
+	enum RingQueueExceptionCode
+	{
+		RQEC_CONSTRUCTORERROR,
+		RQEC_PUSHERROR,
+		RQEC_POPERROR
+	};
+
+public:
+	CRingQueueException(int code);
+	virtual ~CRingQueueException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif // __CRINGQUEUE_H__
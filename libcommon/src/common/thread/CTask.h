@@ -0,0 +1,57 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CTASK_H__
+#define __CTASK_H__
+
+#include <common/CObject.h>
+
+class CExecutor;
+
+// a unit of work run by the threads of a CExecutor. a task is never run by
+// two threads at once, submitting it while it runs makes it run once more
+// afterwards and submitting it several times before it runs makes it run
+// once. Run() returns false when the executor must forget about the task,
+// the task may then have deleted itself
+class CTask : public CObject
+{
+public:
+	CTask();
+	virtual ~CTask();
+
+	bool IsIdle() const;
+
+	virtual bool Run() = 0;
+
+private:
+	friend class CExecutor;
+
+	enum TaskState
+	{
+		TS_IDLE,
+		TS_QUEUED,
+		TS_RUNNING,
+		TS_RERUN
+	};
+
+	volatile u32 state;
+};
+
+#endif // __CTASK_H__
@@ -0,0 +1,72 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <iostream>
+
+#include <common/CObject.h>
+#include <common/thread/CTimer.h>
+#include <common/thread/CTimerWheel.h>
+
+using namespace std;
+
+CTimer::CTimer()
+{
+	pTimerWheel = NULL;
+	pNext = NULL;
+	ppPrev = NULL;
+	expiry = 0;
+	level = 0;
+	slot = 0;
+}
+
+CTimer::~CTimer()
+{
+	try
+	{
+		// a callback already running in the wheel thread is waited for
+		if(pTimerWheel != NULL)
+		{
+			pTimerWheel->Cancel(this);
+			pTimerWheel->Wait(this);
+		}
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+	}
+}
+
+bool CTimer::IsArmed() const
+{
+	return ppPrev != NULL;
+}
+
+bool CTimer::Cancel()
+{
+	// true when the timer was taken back before OnTimer() was called
+	if(pTimerWheel == NULL)
+	return false;
+
+	return pTimerWheel->Cancel(this);
+}
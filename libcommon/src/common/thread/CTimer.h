@@ -0,0 +1,60 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CTIMER_H__
+#define __CTIMER_H__
+
+#include <stdint.h>
+
+#include <common/CObject.h>
+
+class CTimerWheel;
+
+// a callback armed on a CTimerWheel. OnTimer() runs in the wheel thread
+// once the delay is over, it holds up every other timer of the wheel so
+// it must not block, it may arm the timer again. the wheel must outlive
+// its timers, a derived class cancels the timer from its own destructor
+class CTimer : public CObject
+{
+public:
+	CTimer();
+	virtual ~CTimer();
+
+	bool IsArmed() const;
+	bool Cancel();
+
+	virtual void OnTimer() = 0;
+
+private:
+	friend class CTimerWheel;
+
+	// set by the first Arm(), the timer then belongs to that wheel
+	CTimerWheel* pTimerWheel;
+
+	// links of the slot list the timer waits in, ppPrev is NULL when
+	// the timer is not armed
+	CTimer* pNext;
+	CTimer** ppPrev;
+	uint64_t expiry;
+	u32 level;
+	u32 slot;
+};
+
+#endif // __CTIMER_H__
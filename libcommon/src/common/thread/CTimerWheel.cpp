@@ -0,0 +1,507 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <iostream>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CMutex.h>
+#include <common/thread/CThread.h>
+#include <common/thread/CTimer.h>
+#include <common/thread/CTimerWheel.h>
+
+using namespace std;
+
+#define TIMERWHEEL_SLOTMASK	(TIMERWHEEL_NUMSLOT - 1)
+#define TIMERWHEEL_RANGE	(1ULL << (TIMERWHEEL_SLOTBITS * TIMERWHEEL_NUMLEVEL))
+
+static uint64_t GetTime()
+{
+	struct timespec Now;
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+
+	return (uint64_t) Now.tv_sec * 1000000 + Now.tv_nsec / 1000;
+}
+
+CTimerWheel::CTimerWheel()
+{
+	for(u32 i = 0 ; i < TIMERWHEEL_NUMLEVEL ; i++)
+	{
+		for(u32 j = 0 ; j < TIMERWHEEL_NUMSLOT ; j++)
+		SlotList[i][j] = NULL;
+
+		occupied[i] = 0;
+	}
+
+	pExpiredList = NULL;
+	current = GetTick();
+	wakeTick = 0;
+	numArmed = 0;
+	pRunning = NULL;
+	isStopped = false;
+}
+
+CTimerWheel::~CTimerWheel()
+{
+	try
+	{
+		MutexWheel.Lock();
+		isStopped = true;
+		MutexWheel.Signal();
+		MutexWheel.UnLock();
+
+		ThreadTimerJob.Wait();
+
+		// the timers still armed never fire, they forget about us
+		for(u32 i = 0 ; i < TIMERWHEEL_NUMLEVEL ; i++)
+		{
+			for(u32 j = 0 ; j < TIMERWHEEL_NUMSLOT ; j++)
+			{
+				while(SlotList[i][j] != NULL)
+				{
+					SlotList[i][j]->pTimerWheel = NULL;
+					Unlink(SlotList[i][j]);
+				}
+			}
+		}
+
+		while(pExpiredList != NULL)
+		{
+			pExpiredList->pTimerWheel = NULL;
+			Unlink(pExpiredList);
+		}
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+	}
+}
+
+void CTimerWheel::Arm(CTimer* pTimer, u32 delay)
+{
+	MutexWheel.Lock();
+
+	try
+	{
+		// in microseconds, the timer fires on the first tick past the
+		// delay, arming an armed timer moves it
+		if(pTimer->pTimerWheel != NULL && pTimer->pTimerWheel != this)
+		throw CTimerWheelException(CTimerWheelException::TWEC_ARMERROR);
+
+		pTimer->pTimerWheel = this;
+
+		if(pTimer->ppPrev != NULL)
+		{
+			Unlink(pTimer);
+			numArmed--;
+		}
+
+		// an empty wheel may stand far behind, nothing is lost moving it
+		if(numArmed == 0)
+		current = GetTick();
+
+		pTimer->expiry = (GetTime() + delay + TIMERWHEEL_TICK - 1) / TIMERWHEEL_TICK;
+
+		Link(pTimer);
+		numArmed++;
+
+		if(!ThreadTimerJob.IsRunning())
+		ThreadTimerJob.Run(TimerJob, this);
+		else
+		if(pTimer->expiry < wakeTick)
+		MutexWheel.Signal();
+
+		MutexWheel.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexWheel.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTimerWheelException(CTimerWheelException::TWEC_ARMERROR);
+	}
+}
+
+bool CTimerWheel::Cancel(CTimer* pTimer)
+{
+	MutexWheel.Lock();
+
+	try
+	{
+		// does not wait for a callback already running, the caller may
+		// hold a lock that the callback takes
+		bool isArmed = pTimer->ppPrev != NULL;
+
+		if(isArmed)
+		{
+			Unlink(pTimer);
+			numArmed--;
+		}
+
+		MutexWheel.UnLock();
+		return isArmed;
+	}
+
+	catch(exception& e)
+	{
+		MutexWheel.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTimerWheelException(CTimerWheelException::TWEC_CANCELERROR);
+	}
+}
+
+void CTimerWheel::Wait(CTimer* pTimer)
+{
+	MutexWheel.Lock();
+
+	try
+	{
+		// returns at once when called from the callback itself
+		while(pRunning == pTimer && !pthread_equal(runningThread, pthread_self()))
+		MutexWheel.Wait();
+
+		MutexWheel.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexWheel.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTimerWheelException(CTimerWheelException::TWEC_WAITERROR);
+	}
+}
+
+CObject::u32 CTimerWheel::GetNumArmed() const
+{
+	return numArmed;
+}
+
+void CTimerWheel::Link(CTimer* pTimer)
+{
+	// must be called with MutexWheel held. the level is picked by how far
+	// the expiry is, the slot by the expiry itself, so that a slot is
+	// reached at the latest when its first timer is due
+	CTimer** ppList;
+
+	if(pTimer->expiry <= current)
+	{
+		pTimer->level = TIMERWHEEL_NUMLEVEL;
+		pTimer->slot = 0;
+		ppList = &pExpiredList;
+	}
+	else
+	{
+		uint64_t delta = pTimer->expiry - current;
+		uint64_t expiry = pTimer->expiry;
+		u32 level = 0;
+
+		// past the range of the wheel the timer comes back down from the
+		// last slot of the top level
+		if(delta >= TIMERWHEEL_RANGE)
+		{
+			delta = TIMERWHEEL_RANGE - 1;
+			expiry = current + delta;
+		}
+
+		while(delta >> (TIMERWHEEL_SLOTBITS * (level + 1)))
+		level++;
+
+		pTimer->level = level;
+		pTimer->slot = (expiry >> (TIMERWHEEL_SLOTBITS * level)) & TIMERWHEEL_SLOTMASK;
+		ppList = &SlotList[level][pTimer->slot];
+
+		occupied[level] |= 1ULL << pTimer->slot;
+	}
+
+	pTimer->pNext = *ppList;
+	pTimer->ppPrev = ppList;
+
+	if(*ppList != NULL)
+	(*ppList)->ppPrev = &pTimer->pNext;
+
+	*ppList = pTimer;
+}
+
+void CTimerWheel::Unlink(CTimer* pTimer)
+{
+	// must be called with MutexWheel held
+	*pTimer->ppPrev = pTimer->pNext;
+
+	if(pTimer->pNext != NULL)
+	pTimer->pNext->ppPrev = pTimer->ppPrev;
+
+	if(pTimer->level < TIMERWHEEL_NUMLEVEL && SlotList[pTimer->level][pTimer->slot] == NULL)
+	occupied[pTimer->level] &= ~(1ULL << pTimer->slot);
+
+	pTimer->pNext = NULL;
+	pTimer->ppPrev = NULL;
+}
+
+void CTimerWheel::Advance(uint64_t now)
+{
+	// must be called with MutexWheel held. the wheel jumps from one
+	// occupied slot to the next rather than walking every tick
+	while(current < now)
+	{
+		uint64_t next;
+
+		if(!GetNextTick(&next) || next > now)
+		{
+			current = now;
+			return;
+		}
+
+		current = next;
+
+		for(u32 level = 1 ; level < TIMERWHEEL_NUMLEVEL ; level++)
+		{
+			if(current & ((1ULL << (TIMERWHEEL_SLOTBITS * level)) - 1))
+			break;
+
+			Cascade(level, (current >> (TIMERWHEEL_SLOTBITS * level)) & TIMERWHEEL_SLOTMASK);
+		}
+
+		Cascade(0, current & TIMERWHEEL_SLOTMASK);
+	}
+}
+
+void CTimerWheel::Cascade(u32 level, u32 slot)
+{
+	// must be called with MutexWheel held, the timers of the slot go down
+	// a level or to the expired list
+	CTimer* pTimer = SlotList[level][slot];
+
+	SlotList[level][slot] = NULL;
+	occupied[level] &= ~(1ULL << slot);
+
+	while(pTimer != NULL)
+	{
+		CTimer* pNext = pTimer->pNext;
+		Link(pTimer);
+		pTimer = pNext;
+	}
+}
+
+bool CTimerWheel::GetNextTick(uint64_t* pTick) const
+{
+	// must be called with MutexWheel held. a slot of level n is reached
+	// when the ticks below it wrap, the earliest one over all levels wins
+	bool isFound = false;
+
+	for(u32 level = 0 ; level < TIMERWHEEL_NUMLEVEL ; level++)
+	{
+		if(occupied[level] == 0)
+		continue;
+
+		u32 shift = TIMERWHEEL_SLOTBITS * level;
+		uint64_t base = current >> shift;
+		u32 start = (base + 1) & TIMERWHEEL_SLOTMASK;
+
+		// the slots are looked at in the order the wheel reaches them
+		uint64_t rotated = start ? (occupied[level] >> start) | (occupied[level] << (TIMERWHEEL_NUMSLOT - start)) : occupied[level];
+		uint64_t tick = (base + __builtin_ctzll(rotated) + 1) << shift;
+
+		if(!isFound || tick < *pTick)
+		*pTick = tick;
+
+		isFound = true;
+	}
+
+	return isFound;
+}
+
+CTimer* CTimerWheel::TakeExpired()
+{
+	MutexWheel.Lock();
+
+	try
+	{
+		// sleeps until a timer is due, NULL once the wheel is stopped
+		while(!isStopped)
+		{
+			Advance(GetTick());
+
+			if(pExpiredList != NULL)
+			{
+				CTimer* pTimer = pExpiredList;
+
+				Unlink(pTimer);
+				numArmed--;
+
+				pRunning = pTimer;
+				runningThread = pthread_self();
+
+				MutexWheel.UnLock();
+				return pTimer;
+			}
+
+			uint64_t next;
+
+			if(!GetNextTick(&next))
+			{
+				wakeTick = (uint64_t) -1;
+				MutexWheel.Wait();
+			}
+			else
+			{
+				struct timespec Deadline;
+				Deadline.tv_sec = next * TIMERWHEEL_TICK / 1000000;
+				Deadline.tv_nsec = (next * TIMERWHEEL_TICK % 1000000) * 1000;
+
+				wakeTick = next;
+				MutexWheel.WaitUntil(Deadline);
+			}
+
+			// awake, Arm() has no need to signal us anymore
+			wakeTick = 0;
+		}
+
+		MutexWheel.UnLock();
+		return NULL;
+	}
+
+	catch(exception& e)
+	{
+		MutexWheel.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTimerWheelException(CTimerWheelException::TWEC_TAKEEXPIREDERROR);
+	}
+}
+
+void CTimerWheel::EndRun()
+{
+	MutexWheel.Lock();
+
+	try
+	{
+		pRunning = NULL;
+		MutexWheel.Signal();
+
+		MutexWheel.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexWheel.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTimerWheelException(CTimerWheelException::TWEC_ENDRUNERROR);
+	}
+}
+
+uint64_t CTimerWheel::GetTick()
+{
+	return GetTime() / TIMERWHEEL_TICK;
+}
+
+void* CTimerWheel::TimerJob(void* pvThis) throw()
+{
+	try
+	{
+		CTimerWheel* pThis = (CTimerWheel*) pvThis;
+		CTimer* pTimer;
+
+		while((pTimer = pThis->TakeExpired()) != NULL)
+		{
+			// a failing callback does not stop the other timers
+			try
+			{
+				pTimer->OnTimer();
+			}
+
+			catch(exception& e)
+			{
+				#ifdef __DEBUG__
+				cerr << e.what() << endl;
+				#endif //__DEBUG__
+
+			}
+
+			pThis->EndRun();
+		}
+
+		return NULL;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		return NULL;
+	}
+}
+
+CTimerWheelException::CTimerWheelException(int code) : CException(code)
+{}
+
+CTimerWheelException::~CTimerWheelException() throw()
+{}
+
+const char* CTimerWheelException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case TWEC_ARMERROR:
+		return "CTimerWheel::Arm() error";
+
+	case TWEC_CANCELERROR:
+		return "CTimerWheel::Cancel() error";
+
+	case TWEC_WAITERROR:
+		return "CTimerWheel::Wait() error";
+
+	case TWEC_TAKEEXPIREDERROR:
+		return "CTimerWheel::TakeExpired() error";
+
+	case TWEC_ENDRUNERROR:
+		return "CTimerWheel::EndRun() error";
+
+	default:
+		return "CTimerWheel: Unknown error";
+	}
+}
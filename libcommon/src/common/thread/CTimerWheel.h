@@ -0,0 +1,110 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CTIMERWHEEL_H__
+#define __CTIMERWHEEL_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CMutex.h>
+#include <common/thread/CThread.h>
+#include <common/thread/CTimer.h>
+
+// the wheel turns one slot per tick, in microseconds
+#define TIMERWHEEL_TICK		1000
+#define TIMERWHEEL_SLOTBITS	6
+#define TIMERWHEEL_NUMSLOT	(1 << TIMERWHEEL_SLOTBITS)
+#define TIMERWHEEL_NUMLEVEL	5
+
+// hierarchical timing wheel: level 0 holds the timers due within 64 ticks,
+// each level above covers 64 times the range of the one below and its
+// slots are spread down a level when the wheel reaches them. arming and
+// cancelling are O(1) whatever the number of timers, the thread sleeps
+// until the next slot holding a timer. the thread is started by the
+// first Arm()
+class CTimerWheel : public CObject
+{
+public:
+	CTimerWheel();
+	virtual ~CTimerWheel();
+
+	void Arm(CTimer* pTimer, u32 delay);
+	bool Cancel(CTimer* pTimer);
+	void Wait(CTimer* pTimer);
+
+	u32 GetNumArmed() const;
+
+private:
+	void Link(CTimer* pTimer);
+	void Unlink(CTimer* pTimer);
+	void Advance(uint64_t now);
+	void Cascade(u32 level, u32 slot);
+	bool GetNextTick(uint64_t* pTick) const;
+
+	CTimer* TakeExpired();
+	void EndRun();
+
+	static uint64_t GetTick();
+	static void* TimerJob(void* pvThis) throw();
+
+private:
+	CTimer* SlotList[TIMERWHEEL_NUMLEVEL][TIMERWHEEL_NUMSLOT];
+	uint64_t occupied[TIMERWHEEL_NUMLEVEL];
+
+	// due timers waiting for the thread to run them
+	CTimer* pExpiredList;
+
+	// the tick the wheel stands at, the thread sleeps until wakeTick
+	uint64_t current;
+	uint64_t wakeTick;
+	u32 numArmed;
+
+	// the timer whose OnTimer() runs, Wait() blocks on it
+	CTimer* pRunning;
+	pthread_t runningThread;
+
+	bool isStopped;
+	CMutex MutexWheel;
+	CThread ThreadTimerJob;
+};
+
+class CTimerWheelException : public CException
+{
+public:
+	enum TimerWheelExceptionCode
+	{
+		TWEC_ARMERROR,
+		TWEC_CANCELERROR,
+		TWEC_WAITERROR,
+		TWEC_TAKEEXPIREDERROR,
+		TWEC_ENDRUNERROR
+	};
+
+public:
+	CTimerWheelException(int code);
+	virtual ~CTimerWheelException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif // __CTIMERWHEEL_H__
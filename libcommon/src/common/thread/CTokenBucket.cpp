@@ -0,0 +1,272 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <ctime>
+#include <errno.h>
+#include <iostream>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CMutex.h>
+#include <common/thread/CTokenBucket.h>
+
+using namespace std;
+
+CTokenBucket::CTokenBucket()
+{
+	Init(0, 0);
+}
+
+CTokenBucket::CTokenBucket(u32 rate, u32 depth)
+{
+	Init(rate, depth);
+}
+
+CTokenBucket::~CTokenBucket()
+{}
+
+void CTokenBucket::Init(u32 rate, u32 depth)
+{
+	MutexBucket.Lock();
+
+	try
+	{
+		// a new bucket starts full, the first depth bytes go at once
+		this->rate = rate;
+		this->depth = depth;
+		tokens = depth;
+
+		numPaced = 0;
+		pacedTime = 0;
+		pacedRest = 0;
+
+		if(clock_gettime(CLOCK_MONOTONIC, &Last) != 0)
+		throw CTokenBucketException(CTokenBucketException::TBEC_INITERROR);
+
+		MutexBucket.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexBucket.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTokenBucketException(CTokenBucketException::TBEC_INITERROR);
+	}
+}
+
+void CTokenBucket::SetRate(u32 rate)
+{
+	MutexBucket.Lock();
+
+	try
+	{
+		// the time gone so far is still credited at the former rate, an
+		// unpaced bucket starts full
+		Refill();
+
+		if(this->rate == 0)
+		tokens = depth;
+
+		this->rate = rate;
+
+		MutexBucket.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexBucket.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTokenBucketException(CTokenBucketException::TBEC_SETRATEERROR);
+	}
+}
+
+void CTokenBucket::SetDepth(u32 depth)
+{
+	MutexBucket.Lock();
+
+	this->depth = depth;
+
+	if(tokens > depth)
+	tokens = depth;
+
+	MutexBucket.UnLock();
+}
+
+CObject::u32 CTokenBucket::GetRate() const
+{
+	return rate;
+}
+
+CObject::u32 CTokenBucket::GetDepth() const
+{
+	return depth;
+}
+
+CObject::u32 CTokenBucket::Reserve(u32 size)
+{
+	if(rate == 0)
+	return 0;
+
+	MutexBucket.Lock();
+
+	try
+	{
+		Refill();
+
+		tokens -= size;
+
+		// the delay is what the debt takes to refill, later sends queue
+		// up behind it
+		u32 delay = 0;
+
+		if(tokens < 0)
+		{
+			delay = (u32) (-tokens * 1000000 / rate);
+
+			numPaced++;
+			pacedRest += delay;
+			pacedTime += pacedRest / 1000;
+			pacedRest %= 1000;
+		}
+
+		MutexBucket.UnLock();
+
+		return delay;
+	}
+
+	catch(exception& e)
+	{
+		MutexBucket.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTokenBucketException(CTokenBucketException::TBEC_RESERVEERROR);
+	}
+}
+
+CObject::u32 CTokenBucket::GetDelay()
+{
+	if(rate == 0)
+	return 0;
+
+	MutexBucket.Lock();
+
+	try
+	{
+		Refill();
+
+		// what the debt of the sends so far still takes to refill,
+		// nothing is taken out of the bucket
+		u32 delay = 0;
+
+		if(tokens < 0)
+		delay = (u32) (-tokens * 1000000 / rate);
+
+		MutexBucket.UnLock();
+
+		return delay;
+	}
+
+	catch(exception& e)
+	{
+		MutexBucket.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTokenBucketException(CTokenBucketException::TBEC_GETDELAYERROR);
+	}
+}
+
+void CTokenBucket::Sleep(u32 delay)
+{
+	// in microseconds, as returned by Reserve()
+	struct timespec Delay;
+
+	Delay.tv_sec = delay / 1000000;
+	Delay.tv_nsec = (delay % 1000000) * 1000;
+
+	while(nanosleep(&Delay, &Delay) != 0 && errno == EINTR);
+}
+
+void CTokenBucket::Refill()
+{
+	struct timespec Now;
+
+	if(clock_gettime(CLOCK_MONOTONIC, &Now) != 0)
+	throw CTokenBucketException(CTokenBucketException::TBEC_RESERVEERROR);
+
+	double elapsed = (Now.tv_sec - Last.tv_sec) + (Now.tv_nsec - Last.tv_nsec) / 1e9;
+	Last = Now;
+
+	tokens += elapsed * rate;
+
+	if(tokens > depth)
+	tokens = depth;
+}
+
+CObject::u32 CTokenBucket::GetNumPaced() const
+{
+	return numPaced;
+}
+
+CObject::u32 CTokenBucket::GetPacedTime() const
+{
+	// in milliseconds
+	return pacedTime;
+}
+
+CTokenBucketException::CTokenBucketException(int code) : CException(code)
+{}
+
+CTokenBucketException::~CTokenBucketException() throw()
+{}
+
+const char* CTokenBucketException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case TBEC_INITERROR:
+		return "CTokenBucket::Init() error";
+
+	case TBEC_SETRATEERROR:
+		return "CTokenBucket::SetRate() error";
+
+	case TBEC_RESERVEERROR:
+		return "CTokenBucket::Reserve() error";
+
+	case TBEC_GETDELAYERROR:
+		return "CTokenBucket::GetDelay() error";
+
+	default:
+		return "CTokenBucket: Unknown error";
+	}
+}
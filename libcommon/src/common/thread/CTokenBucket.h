@@ -0,0 +1,91 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CTOKENBUCKET_H__
+#define __CTOKENBUCKET_H__
+
+#include <ctime>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CMutex.h>
+
+// paces a byte flow to a rate: the bucket fills at rate bytes per second
+// up to its depth and each send takes its size out of it. a send larger
+// than what is left runs the bucket into debt, the caller then sleeps the
+// returned delay, so the flow never goes over the rate for longer than
+// one depth. a caller that must not sleep asks GetDelay() first and only
+// reserves once the debt is repaid. a rate of 0 never paces
+class CTokenBucket : public CObject
+{
+public:
+	CTokenBucket();
+	CTokenBucket(u32 rate, u32 depth);
+	virtual ~CTokenBucket();
+
+	void Init(u32 rate, u32 depth);
+	void SetRate(u32 rate);
+	void SetDepth(u32 depth);
+
+	u32 GetRate() const;
+	u32 GetDepth() const;
+
+	u32 Reserve(u32 size);
+	u32 GetDelay();
+	static void Sleep(u32 delay);
+
+	u32 GetNumPaced() const;
+	u32 GetPacedTime() const;
+
+private:
+	void Refill();
+
+private:
+	u32 rate;
+	u32 depth;
+	double tokens;
+	struct timespec Last;
+
+	u32 numPaced;
+	u32 pacedTime;
+	u32 pacedRest;
+
+	CMutex MutexBucket;
+};
+
+class CTokenBucketException : public CException
+{
+public:
+	enum TokenBucketExceptionCode
+	{
+		TBEC_INITERROR,
+		TBEC_SETRATEERROR,
+		TBEC_RESERVEERROR,
+		TBEC_GETDELAYERROR
+	};
+
+public:
+	CTokenBucketException(int code);
+	virtual ~CTokenBucketException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif // __CTOKENBUCKET_H__
@@ -0,0 +1,727 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <errno.h>
+#include <iostream>
+#include <pthread.h>
+#include <stdint.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/data/CBufferPool.h>
+#include <common/tun/CTunRing.h>
+
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif //__NR_io_uring_setup
+
+// the ring relies on cancels and on a completion queue that never drops
+// entries, both came with 5.5 kernels
+#ifdef IORING_FEAT_NODROP
+#define TUNRING_URING
+#endif //IORING_FEAT_NODROP
+
+using namespace std;
+
+// slots are their own user data, cancels use one past any slot
+#define TUNRING_CANCELSLOT	0xFFFFFFFF
+#define TUNRING_NOSLOT		0xFFFFFFFF
+
+// the ring fields are shared with the kernel and always 32 bits wide
+struct CTunRing::SRing
+{
+	int ringFd;
+	u32 depth;
+
+	u8* pSqMap;
+	size_t sqMapSize;
+	u8* pCqMap;
+	size_t cqMapSize;
+	u8* pSqeMap;
+	size_t sqeMapSize;
+
+	volatile uint32_t* pSqHead;
+	volatile uint32_t* pSqTail;
+	uint32_t* pSqArray;
+	uint32_t sqMask;
+	uint32_t sqTail;
+
+	volatile uint32_t* pCqHead;
+	volatile uint32_t* pCqTail;
+	u8* pCqeArray;
+	uint32_t cqMask;
+
+	vector<u8*> SlotList;
+	vector<u32> CapacityList;
+	vector<bool> InFlightList;
+	vector<u32> FreeSlotList;
+	u32 numInFlight;
+
+	// the slot whose packet the reader is holding
+	u32 heldSlot;
+};
+
+CTunRing::CTunRing()
+{
+	fd = -1;
+	stopFd = -1;
+	pReadRing = NULL;
+	pWriteRing = NULL;
+	pFallbackBuffer = NULL;
+	fallbackCapacity = 0;
+}
+
+CTunRing::CTunRing(int fd, u32 depth)
+{
+	this->fd = -1;
+	stopFd = -1;
+	pReadRing = NULL;
+	pWriteRing = NULL;
+	pFallbackBuffer = NULL;
+	fallbackCapacity = 0;
+
+	try
+	{
+		Open(fd, depth);
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+	}
+}
+
+CTunRing::~CTunRing()
+{
+	try
+	{
+		Close();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+	}
+}
+
+void CTunRing::Open(int fd, u32 depth, bool isUring)
+{
+	try
+	{
+		Close();
+
+		this->fd = fd;
+
+		stopFd = eventfd(0, EFD_NONBLOCK);
+
+		if(stopFd == -1)
+		throw CTunRingException(CTunRingException::TREC_OPENERROR);
+
+		if(isUring)
+		{
+			pReadRing = OpenRing(depth);
+			pWriteRing = OpenRing(depth);
+
+			if(pReadRing == NULL || pWriteRing == NULL)
+			{
+				CloseRing(pReadRing, false);
+				CloseRing(pWriteRing, false);
+				pReadRing = NULL;
+				pWriteRing = NULL;
+			}
+		}
+
+		if(pReadRing == NULL)
+		{
+			pFallbackBuffer = (u8*) CBufferPool::Allocate(TUNRING_SLOTSIZE, &fallbackCapacity);
+			return;
+		}
+
+		#ifdef TUNRING_URING
+		// every slot starts as a pending read
+		for(u32 i = 0 ; i < pReadRing->depth ; i++)
+		Queue(pReadRing, IORING_OP_READ_FIXED, i, 0);
+
+		Enter(pReadRing, 0);
+		#endif //TUNRING_URING
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTunRingException(CTunRingException::TREC_OPENERROR);
+	}
+}
+
+void CTunRing::Close()
+{
+	try
+	{
+		// the reader and the writer must be done with the ring
+		CloseRing(pReadRing, true);
+		pReadRing = NULL;
+
+		CloseRing(pWriteRing, false);
+		pWriteRing = NULL;
+
+		if(pFallbackBuffer != NULL)
+		CBufferPool::Release(pFallbackBuffer, fallbackCapacity);
+
+		pFallbackBuffer = NULL;
+		fallbackCapacity = 0;
+		fd = -1;
+
+		if(stopFd != -1)
+		close(stopFd);
+
+		stopFd = -1;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTunRingException(CTunRingException::TREC_CLOSEERROR);
+	}
+}
+
+void CTunRing::Stop()
+{
+	try
+	{
+		// the descriptor stays readable until the ring is opened again
+		uint64_t one = 1;
+
+		if(stopFd != -1)
+		while(write(stopFd, &one, sizeof(one)) < 0 && errno == EINTR);
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTunRingException(CTunRingException::TREC_STOPERROR);
+	}
+}
+
+bool CTunRing::IsUring() const
+{
+	return pReadRing != NULL;
+}
+
+const CObject::u8* CTunRing::Read(u32* pSize)
+{
+	try
+	{
+		// NULL once Stop() was called
+		if(pReadRing == NULL)
+		{
+			if(!WaitReadable(fd))
+			return NULL;
+
+			ssize_t nread = read(fd, pFallbackBuffer, fallbackCapacity);
+
+			if(nread < 0)
+			throw CTunRingException(CTunRingException::TREC_READERROR);
+
+			*pSize = (u32) nread;
+			return pFallbackBuffer;
+		}
+
+		#ifdef TUNRING_URING
+		SRing* pRing = pReadRing;
+		u32 slot;
+		s32 result;
+
+		// the packet handed out last time is done with, its slot goes
+		// back to the kernel with the next submit
+		if(pRing->heldSlot != TUNRING_NOSLOT)
+		{
+			Queue(pRing, IORING_OP_READ_FIXED, pRing->heldSlot, 0);
+			pRing->heldSlot = TUNRING_NOSLOT;
+		}
+
+		// refills ride along with the next wait unless half the slots
+		// are already out of the kernel
+		if(2 * (pRing->sqTail - *pRing->pSqHead) >= pRing->depth)
+		Enter(pRing, 0);
+
+		// with none completed the refills go first, then we wait for one
+		while(!PopCompletion(pRing, &slot, &result))
+		{
+			Enter(pRing, 0);
+
+			if(!WaitReadable(pRing->ringFd))
+			return NULL;
+		}
+
+		if(result < 0)
+		{
+			Queue(pRing, IORING_OP_READ_FIXED, slot, 0);
+			throw CTunRingException(CTunRingException::TREC_READERROR);
+		}
+
+		pRing->heldSlot = slot;
+		*pSize = (u32) result;
+
+		return pRing->SlotList[slot];
+		#else
+		throw CTunRingException(CTunRingException::TREC_READERROR);
+		#endif //TUNRING_URING
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTunRingException(CTunRingException::TREC_READERROR);
+	}
+}
+
+void CTunRing::Write(const u8* pData, u32 dataSize, bool isMore)
+{
+	try
+	{
+		if(pWriteRing == NULL)
+		{
+			if(write(fd, pData, dataSize) < 0)
+			throw CTunRingException(CTunRingException::TREC_WRITEERROR);
+
+			return;
+		}
+
+		#ifdef TUNRING_URING
+		SRing* pRing = pWriteRing;
+		u32 slot;
+		s32 result;
+
+		// finished writes give their slot back, we only wait when none is left.
+		// a failed write belongs to a packet whose caller is gone, it is
+		// dropped as a lost packet rather than failing this one
+		while(true)
+		{
+			while(PopCompletion(pRing, &slot, &result))
+			{
+				pRing->FreeSlotList.push_back(slot);
+
+				#ifdef __DEBUG__
+				if(result < 0)
+				cerr << "CTunRing::Write() dropped a packet: " << strerror(-result) << endl;
+				#endif //__DEBUG__
+			}
+
+			if(!pRing->FreeSlotList.empty())
+			break;
+
+			Enter(pRing, 1);
+		}
+
+		slot = pRing->FreeSlotList.back();
+
+		if(dataSize > pRing->CapacityList[slot])
+		throw CTunRingException(CTunRingException::TREC_WRITEERROR);
+
+		pRing->FreeSlotList.pop_back();
+		memcpy(pRing->SlotList[slot], pData, dataSize);
+		Queue(pRing, IORING_OP_WRITE_FIXED, slot, dataSize);
+
+		// the caller tells us when more packets follow at once, they all
+		// go to the kernel in one submit
+		if(!isMore || pRing->FreeSlotList.empty())
+		Enter(pRing, 0);
+		#endif //TUNRING_URING
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTunRingException(CTunRingException::TREC_WRITEERROR);
+	}
+}
+
+void CTunRing::Flush()
+{
+	try
+	{
+		if(pWriteRing != NULL)
+		Enter(pWriteRing, 0);
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CTunRingException(CTunRingException::TREC_FLUSHERROR);
+	}
+}
+
+CTunRing::SRing* CTunRing::OpenRing(u32 depth)
+{
+	#ifdef TUNRING_URING
+	struct io_uring_params Params;
+	memset(&Params, 0, sizeof(Params));
+
+	// room for a cancel next to every slot
+	int ringFd = syscall(__NR_io_uring_setup, 2 * depth, &Params);
+
+	if(ringFd < 0)
+	return NULL;
+
+	SRing* pRing = new SRing;
+
+	pRing->ringFd = ringFd;
+	pRing->depth = depth;
+	pRing->pSqMap = NULL;
+	pRing->pCqMap = NULL;
+	pRing->pSqeMap = NULL;
+	pRing->numInFlight = 0;
+	pRing->heldSlot = TUNRING_NOSLOT;
+
+	if(!(Params.features & IORING_FEAT_NODROP))
+	{
+		CloseRing(pRing, false);
+		return NULL;
+	}
+
+	pRing->sqMapSize = Params.sq_off.array + Params.sq_entries * sizeof(uint32_t);
+	pRing->cqMapSize = Params.cq_off.cqes + Params.cq_entries * sizeof(struct io_uring_cqe);
+	pRing->sqeMapSize = Params.sq_entries * sizeof(struct io_uring_sqe);
+
+	void* pSqMap = mmap(NULL, pRing->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+	void* pCqMap = mmap(NULL, pRing->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+	void* pSqeMap = mmap(NULL, pRing->sqeMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+
+	pRing->pSqMap = pSqMap == MAP_FAILED ? NULL : (u8*) pSqMap;
+	pRing->pCqMap = pCqMap == MAP_FAILED ? NULL : (u8*) pCqMap;
+	pRing->pSqeMap = pSqeMap == MAP_FAILED ? NULL : (u8*) pSqeMap;
+
+	if(pRing->pSqMap == NULL || pRing->pCqMap == NULL || pRing->pSqeMap == NULL)
+	{
+		CloseRing(pRing, false);
+		return NULL;
+	}
+
+	pRing->pSqHead = (volatile uint32_t*) (pRing->pSqMap + Params.sq_off.head);
+	pRing->pSqTail = (volatile uint32_t*) (pRing->pSqMap + Params.sq_off.tail);
+	pRing->pSqArray = (uint32_t*) (pRing->pSqMap + Params.sq_off.array);
+	pRing->sqMask = *(uint32_t*) (pRing->pSqMap + Params.sq_off.ring_mask);
+	pRing->sqTail = *pRing->pSqTail;
+
+	pRing->pCqHead = (volatile uint32_t*) (pRing->pCqMap + Params.cq_off.head);
+	pRing->pCqTail = (volatile uint32_t*) (pRing->pCqMap + Params.cq_off.tail);
+	pRing->pCqeArray = pRing->pCqMap + Params.cq_off.cqes;
+	pRing->cqMask = *(uint32_t*) (pRing->pCqMap + Params.cq_off.ring_mask);
+
+	vector<struct iovec> IoVecList(depth);
+
+	for(u32 i = 0 ; i < depth ; i++)
+	{
+		u32 capacity;
+		u8* pSlot = (u8*) CBufferPool::Allocate(TUNRING_SLOTSIZE, &capacity);
+
+		pRing->SlotList.push_back(pSlot);
+		pRing->CapacityList.push_back(capacity);
+		pRing->InFlightList.push_back(false);
+		pRing->FreeSlotList.push_back(i);
+
+		IoVecList[i].iov_base = pSlot;
+		IoVecList[i].iov_len = capacity;
+	}
+
+	// registered buffers spare the kernel a page walk on every packet
+	if(syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, &IoVecList[0], depth) < 0)
+	{
+		CloseRing(pRing, false);
+		return NULL;
+	}
+
+	return pRing;
+	#else
+	return NULL;
+	#endif //TUNRING_URING
+}
+
+void CTunRing::CloseRing(SRing* pRing, bool isCancel)
+{
+	if(pRing == NULL)
+	return;
+
+	bool isDrained = true;
+
+	#ifdef TUNRING_URING
+	try
+	{
+		u32 slot;
+		s32 result;
+
+		// pending reads on a quiet tun never end by themselves, writes
+		// always do and are left to finish
+		if(isCancel)
+		{
+			for(u32 i = 0 ; i < pRing->InFlightList.size() ; i++)
+			{
+				if(pRing->InFlightList[i])
+				Queue(pRing, IORING_OP_ASYNC_CANCEL, i, 0);
+			}
+		}
+
+		while(pRing->numInFlight > 0)
+		{
+			if(!PopCompletion(pRing, &slot, &result))
+			Enter(pRing, 1);
+		}
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		isDrained = false;
+	}
+	#endif //TUNRING_URING
+
+	if(pRing->pSqeMap != NULL)
+	munmap(pRing->pSqeMap, pRing->sqeMapSize);
+
+	if(pRing->pCqMap != NULL)
+	munmap(pRing->pCqMap, pRing->cqMapSize);
+
+	if(pRing->pSqMap != NULL)
+	munmap(pRing->pSqMap, pRing->sqMapSize);
+
+	// closing the ring also drops the buffer registration
+	close(pRing->ringFd);
+
+	// a slot the kernel may still fill never goes back to the pool
+	if(isDrained)
+	{
+		for(u32 i = 0 ; i < pRing->SlotList.size() ; i++)
+		CBufferPool::Release(pRing->SlotList[i], pRing->CapacityList[i]);
+	}
+
+	delete pRing;
+}
+
+bool CTunRing::WaitReadable(int waitFd)
+{
+	struct pollfd PollList[2];
+
+	PollList[0].fd = waitFd;
+	PollList[0].events = POLLIN;
+	PollList[0].revents = 0;
+
+	PollList[1].fd = stopFd;
+	PollList[1].events = POLLIN;
+	PollList[1].revents = 0;
+
+	// false when Stop() was called, poll() stays a cancellation point
+	while(true)
+	{
+		if(poll(PollList, 2, -1) < 0)
+		{
+			if(errno == EINTR)
+			continue;
+
+			throw CTunRingException(CTunRingException::TREC_READERROR);
+		}
+
+		if(PollList[1].revents)
+		return false;
+
+		if(PollList[0].revents)
+		return true;
+	}
+}
+
+void CTunRing::Enter(SRing* pRing, u32 minComplete)
+{
+	#ifdef TUNRING_URING
+	uint32_t toSubmit = pRing->sqTail - *pRing->pSqHead;
+
+	if(toSubmit == 0 && minComplete == 0)
+	return;
+
+	int cancelType;
+	int ret;
+	int error;
+
+	// a wait stays a cancellation point, as the read() it replaces
+	if(minComplete > 0)
+	{
+		pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, &cancelType);
+		ret = syscall(__NR_io_uring_enter, pRing->ringFd, toSubmit, minComplete, IORING_ENTER_GETEVENTS, NULL, 0);
+		error = errno;
+		pthread_setcanceltype(cancelType, NULL);
+	}
+
+	else
+	{
+		ret = syscall(__NR_io_uring_enter, pRing->ringFd, toSubmit, 0, 0, NULL, 0);
+		error = errno;
+	}
+
+	// the caller simply looks at the completions again on these
+	if(ret < 0 && error != EINTR && error != EAGAIN && error != EBUSY)
+	throw CTunRingException(CTunRingException::TREC_ENTERERROR);
+	#endif //TUNRING_URING
+}
+
+void CTunRing::Queue(SRing* pRing, u32 opcode, u32 slot, u32 dataSize)
+{
+	#ifdef TUNRING_URING
+	uint32_t index = pRing->sqTail & pRing->sqMask;
+	struct io_uring_sqe* pSqe = (struct io_uring_sqe*) pRing->pSqeMap + index;
+
+	memset(pSqe, 0, sizeof(struct io_uring_sqe));
+	pSqe->opcode = opcode;
+
+	if(opcode == IORING_OP_ASYNC_CANCEL)
+	{
+		pSqe->fd = -1;
+		pSqe->addr = slot;
+		pSqe->user_data = TUNRING_CANCELSLOT;
+	}
+
+	else
+	{
+		pSqe->fd = fd;
+		pSqe->addr = (uintptr_t) pRing->SlotList[slot];
+		pSqe->len = opcode == IORING_OP_READ_FIXED ? pRing->CapacityList[slot] : dataSize;
+		pSqe->buf_index = slot;
+		pSqe->user_data = slot;
+
+		pRing->InFlightList[slot] = true;
+		pRing->numInFlight++;
+	}
+
+	pRing->pSqArray[index] = index;
+	pRing->sqTail++;
+
+	// the entry must be visible before the kernel sees the new tail
+	__sync_synchronize();
+	*pRing->pSqTail = pRing->sqTail;
+	#endif //TUNRING_URING
+}
+
+bool CTunRing::PopCompletion(SRing* pRing, u32* pSlot, s32* pResult)
+{
+	#ifdef TUNRING_URING
+	while(true)
+	{
+		uint32_t head = *pRing->pCqHead;
+		uint32_t tail = *pRing->pCqTail;
+
+		if(head == tail)
+		return false;
+
+		// the entry is read only once the tail says it is there
+		__sync_synchronize();
+
+		struct io_uring_cqe* pCqe = (struct io_uring_cqe*) pRing->pCqeArray + (head & pRing->cqMask);
+		uint64_t userData = pCqe->user_data;
+		s32 result = pCqe->res;
+
+		__sync_synchronize();
+		*pRing->pCqHead = head + 1;
+
+		if(userData == TUNRING_CANCELSLOT)
+		continue;
+
+		*pSlot = (u32) userData;
+		*pResult = result;
+
+		pRing->InFlightList[*pSlot] = false;
+		pRing->numInFlight--;
+
+		return true;
+	}
+	#else
+	return false;
+	#endif //TUNRING_URING
+}
+
+CTunRingException::CTunRingException(int code) : CException(code)
+{}
+
+CTunRingException::~CTunRingException() throw()
+{}
+
+const char* CTunRingException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case TREC_CONSTRUCTORERROR:
+		return "CTunRing::Constructor() error";
+
+	case TREC_OPENERROR:
+		return "CTunRing::Open() error";
+
+	case TREC_CLOSEERROR:
+		return "CTunRing::Close() error";
+
+	case TREC_STOPERROR:
+		return "CTunRing::Stop() error";
+
+	case TREC_READERROR:
+		return "CTunRing::Read() error";
+
+	case TREC_WRITEERROR:
+		return "CTunRing::Write() error";
+
+	case TREC_FLUSHERROR:
+		return "CTunRing::Flush() error";
+
+	case TREC_ENTERERROR:
+		return "CTunRing::Enter() error";
+
+	default:
+		return "CTunRing: Unknown error";
+	}
+}
@@ -0,0 +1,102 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CTUNRING_H__
+#define __CTUNRING_H__
+
+#include <vector>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+
+using namespace std;
+
+#define TUNRING_DEPTH		8
+#define TUNRING_SLOTSIZE	2048
+
+// keeps several reads and writes of a tun device in flight through
+// io_uring, on buffers taken from the pool and registered with the
+// kernel. each direction has its own ring so that one thread may read
+// while another writes. without io_uring it falls back to plain read()
+// and write() on the descriptor. Stop() wakes the reader, Read() then
+// returns NULL. a ring write that fails in the kernel is only known once
+// its caller has returned, the packet is then dropped as lost
+class CTunRing : public CObject
+{
+public:
+	CTunRing();
+	CTunRing(int fd, u32 depth = TUNRING_DEPTH);
+	virtual ~CTunRing();
+
+	void Open(int fd, u32 depth = TUNRING_DEPTH, bool isUring = true);
+	void Close();
+	void Stop();
+
+	bool IsUring() const;
+
+	const u8* Read(u32* pSize);
+	void Write(const u8* pData, u32 dataSize, bool isMore = false);
+	void Flush();
+
+private:
+	struct SRing;
+
+	SRing* OpenRing(u32 depth);
+	void CloseRing(SRing* pRing, bool isCancel);
+	void Enter(SRing* pRing, u32 minComplete);
+	void Queue(SRing* pRing, u32 opcode, u32 slot, u32 dataSize);
+	bool PopCompletion(SRing* pRing, u32* pSlot, s32* pResult);
+	bool WaitReadable(int waitFd);
+
+private:
+	int fd;
+	int stopFd;
+
+	SRing* pReadRing;
+	SRing* pWriteRing;
+
+	// used when the kernel has no io_uring
+	u8* pFallbackBuffer;
+	u32 fallbackCapacity;
+};
+
+class CTunRingException : public CException
+{
+public:
+	enum TunRingExceptionCode
+	{
+		TREC_CONSTRUCTORERROR,
+		TREC_OPENERROR,
+		TREC_CLOSEERROR,
+		TREC_STOPERROR,
+		TREC_READERROR,
+		TREC_WRITEERROR,
+		TREC_FLUSHERROR,
+		TREC_ENTERERROR
+	};
+
+public:
+	CTunRingException(int code);
+	virtual ~CTunRingException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif // __CTUNRING_H__
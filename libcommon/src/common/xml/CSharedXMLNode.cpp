@@ -0,0 +1,139 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <iostream>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/xml/CSharedXMLNode.h>
+#include <common/xml/CXMLNode.h>
+
+using namespace std;
+
+CSharedXMLNode::CSharedXMLNode()
+{
+	pXMLNode = NULL;
+	refCount = 0;
+}
+
+CSharedXMLNode::~CSharedXMLNode()
+{
+	if(pXMLNode != NULL)
+	delete pXMLNode;
+}
+
+CSharedXMLNode* CSharedXMLNode::Create(CXMLNode* pXMLNode, u32 numRef)
+{
+	try
+	{
+		if(numRef == 0)
+		throw CSharedXMLNodeException(CSharedXMLNodeException::SXNEC_CREATEERROR);
+
+		CSharedXMLNode* pSharedXMLNode = new CSharedXMLNode;
+		pSharedXMLNode->pXMLNode = pXMLNode;
+		pSharedXMLNode->refCount = numRef;
+
+		return pSharedXMLNode;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CSharedXMLNodeException(CSharedXMLNodeException::SXNEC_CREATEERROR);
+	}
+}
+
+const CXMLNode* CSharedXMLNode::GetXMLNode() const
+{
+	return pXMLNode;
+}
+
+CXMLNode* CSharedXMLNode::Take()
+{
+	CXMLNode* pCopyXMLNode = NULL;
+
+	try
+	{
+		// the last reference needs no copy, nobody else can read the tree
+		if(__sync_bool_compare_and_swap(&refCount, 1, 0))
+		{
+			CXMLNode* pTakenXMLNode = pXMLNode;
+			pXMLNode = NULL;
+			delete this;
+
+			return pTakenXMLNode;
+		}
+
+		// we copy before dropping our reference, the last holder
+		// may take the tree as soon as the count allows it
+		pCopyXMLNode = new CXMLNode;
+		pCopyXMLNode->CopyFrom(pXMLNode);
+
+		CXMLNode* pTakenXMLNode = pCopyXMLNode;
+		pCopyXMLNode = NULL;
+
+		Release();
+
+		return pTakenXMLNode;
+	}
+
+	catch(exception& e)
+	{
+		if(pCopyXMLNode != NULL)
+		delete pCopyXMLNode;
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CSharedXMLNodeException(CSharedXMLNodeException::SXNEC_TAKEERROR);
+	}
+}
+
+void CSharedXMLNode::Release()
+{
+	if(__sync_sub_and_fetch(&refCount, 1) == 0)
+	delete this;
+}
+
+
+CSharedXMLNodeException::CSharedXMLNodeException(int code) : CException(code)
+{}
+
+CSharedXMLNodeException::~CSharedXMLNodeException() throw()
+{}
+
+const char* CSharedXMLNodeException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case SXNEC_CREATEERROR:
+		return "CSharedXMLNode::Create() error";
+
+	case SXNEC_TAKEERROR:
+		return "CSharedXMLNode::Take() error";
+
+	default:
+		return "CSharedXMLNode: Unknown error";
+	}
+}
@@ -0,0 +1,68 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CSHAREDXMLNODE_H__
+#define __CSHAREDXMLNODE_H__
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/xml/CXMLNode.h>
+
+using namespace std;
+
+// a parsed tree handed to several readers at once, nobody writes to it while
+// it is shared. Take gives each reader a tree of its own: a copy as long as
+// other references remain, the shared tree itself for the last one
+class CSharedXMLNode : public CObject
+{
+public:
+	static CSharedXMLNode* Create(CXMLNode* pXMLNode, u32 numRef);
+
+	const CXMLNode* GetXMLNode() const;
+
+	CXMLNode* Take();
+	void Release();
+
+private:
+	CSharedXMLNode();
+	~CSharedXMLNode();
+
+private:
+	CXMLNode* pXMLNode;
+	u32 refCount;
+};
+
+class CSharedXMLNodeException : public CException
+{
+public:
+	enum SharedXMLNodeExceptionCode
+	{
+		SXNEC_CREATEERROR,
+		SXNEC_TAKEERROR
+	};
+
+public:
+	CSharedXMLNodeException(int code);
+	virtual ~CSharedXMLNodeException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif // __CSHAREDXMLNODE_H__
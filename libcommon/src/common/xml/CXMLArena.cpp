@@ -0,0 +1,172 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <iostream>
+#include <new>
+
+#include <common/CObject.h>
+#include <common/CException.h>
+#include <common/data/CBufferPool.h>
+#include <common/xml/CXMLArena.h>
+
+using namespace std;
+
+// a stream-data stanza and its nodes fit in the first chunk
+#define ARENA_CHUNKSIZE		4096
+#define ARENA_ALIGN		16
+
+static CObject::u32 AlignSize(CObject::u32 size)
+{
+	return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+CXMLArena::CXMLArena(SChunk* pFirstChunk)
+{
+	pChunkList = pFirstChunk;
+	pCursor = (u8*) pFirstChunk + AlignSize(sizeof(SChunk)) + AlignSize(sizeof(CXMLArena));
+	pEnd = (u8*) pFirstChunk + pFirstChunk->capacity;
+	refCount = 1;
+}
+
+CXMLArena::~CXMLArena()
+{}
+
+CXMLArena::SChunk* CXMLArena::AllocateChunk(u32 size)
+{
+	u32 capacity;
+	SChunk* pChunk = (SChunk*) CBufferPool::Allocate(size, &capacity);
+
+	pChunk->pNext = NULL;
+	pChunk->capacity = capacity;
+
+	return pChunk;
+}
+
+CXMLArena* CXMLArena::Create()
+{
+	try
+	{
+		// the arena lives at the head of its own first chunk
+		SChunk* pFirstChunk = AllocateChunk(ARENA_CHUNKSIZE);
+		void* pvArena = (u8*) pFirstChunk + AlignSize(sizeof(SChunk));
+
+		return new(pvArena) CXMLArena(pFirstChunk);
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMLArenaException(CXMLArenaException::XAEC_CREATEERROR);
+	}
+}
+
+void CXMLArena::AddRef()
+{
+	__sync_add_and_fetch(&refCount, 1);
+}
+
+void CXMLArena::Release()
+{
+	if(__sync_sub_and_fetch(&refCount, 1) != 0)
+	return;
+
+	SChunk* pChunk = pChunkList;
+
+	this->~CXMLArena();
+
+	// the first chunk, holding the arena, is the last of the list
+	while(pChunk != NULL)
+	{
+		SChunk* pNext = pChunk->pNext;
+		CBufferPool::Release(pChunk, pChunk->capacity);
+		pChunk = pNext;
+	}
+}
+
+void* CXMLArena::Allocate(u32 size)
+{
+	try
+	{
+		size = AlignSize(size);
+
+		if(pCursor + size <= pEnd)
+		{
+			void* pData = pCursor;
+			pCursor += size;
+			return pData;
+		}
+
+		u32 headerSize = AlignSize(sizeof(SChunk));
+
+		// large blocks get a chunk of their own, we keep the current one
+		if(size > ARENA_CHUNKSIZE / 4)
+		{
+			SChunk* pChunk = AllocateChunk(headerSize + size);
+
+			pChunk->pNext = pChunkList;
+			pChunkList = pChunk;
+
+			return (u8*) pChunk + headerSize;
+		}
+
+		SChunk* pChunk = AllocateChunk(ARENA_CHUNKSIZE);
+
+		pChunk->pNext = pChunkList;
+		pChunkList = pChunk;
+
+		pCursor = (u8*) pChunk + headerSize + size;
+		pEnd = (u8*) pChunk + pChunk->capacity;
+
+		return (u8*) pChunk + headerSize;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMLArenaException(CXMLArenaException::XAEC_ALLOCATEERROR);
+	}
+}
+
+CXMLArenaException::CXMLArenaException(int code) : CException(code)
+{}
+
+CXMLArenaException::~CXMLArenaException() throw()
+{}
+
+const char* CXMLArenaException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case XAEC_CREATEERROR:
+		return "CXMLArena::Create() error";
+
+	case XAEC_ALLOCATEERROR:
+		return "CXMLArena::Allocate() error";
+
+	default:
+		return "CXMLArena: Unknown error";
+	}
+}
@@ -0,0 +1,164 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CXMLARENA_H__
+#define __CXMLARENA_H__
+
+#include <cstddef>
+#include <new>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+
+using namespace std;
+
+// bump allocator holding one parsed stanza, chunks come from CBufferPool
+// and every one of them goes back in one shot when the last reference,
+// taken by the parser and by each node living in the arena, is released
+class CXMLArena : public CObject
+{
+public:
+	static CXMLArena* Create();
+
+	void AddRef();
+	void Release();
+
+	void* Allocate(u32 size);
+
+private:
+	struct SChunk
+	{
+		SChunk* pNext;
+		u32 capacity;
+	};
+
+private:
+	CXMLArena(SChunk* pFirstChunk);
+	~CXMLArena();
+
+	static SChunk* AllocateChunk(u32 size);
+
+private:
+	SChunk* pChunkList;
+	u8* pCursor;
+	u8* pEnd;
+	u32 refCount;
+};
+
+// std allocator handing out memory from an arena, or from the heap when
+// no arena is given, the arena memory is only given back with the arena
+template <class T> class CXMLArenaAllocator
+{
+public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+
+	template <class U> struct rebind
+	{
+		typedef CXMLArenaAllocator<U> other;
+	};
+
+public:
+	CXMLArenaAllocator(CXMLArena* pArena = NULL) : pArena(pArena)
+	{}
+
+	template <class U> CXMLArenaAllocator(const CXMLArenaAllocator<U>& rAllocator) : pArena(rAllocator.GetArena())
+	{}
+
+	CXMLArena* GetArena() const
+	{
+		return pArena;
+	}
+
+	pointer address(reference r) const
+	{
+		return &r;
+	}
+
+	const_pointer address(const_reference r) const
+	{
+		return &r;
+	}
+
+	pointer allocate(size_type n, const void* = 0)
+	{
+		if(pArena != NULL)
+		return (pointer) pArena->Allocate(n * sizeof(T));
+
+		return (pointer) ::operator new(n * sizeof(T));
+	}
+
+	void deallocate(pointer p, size_type)
+	{
+		if(pArena == NULL)
+		::operator delete(p);
+	}
+
+	size_type max_size() const
+	{
+		return ((size_type) -1) / sizeof(T);
+	}
+
+	void construct(pointer p, const T& rValue)
+	{
+		new((void*) p) T(rValue);
+	}
+
+	void destroy(pointer p)
+	{
+		p->~T();
+	}
+
+	template <class U> bool operator==(const CXMLArenaAllocator<U>& rAllocator) const
+	{
+		return pArena == rAllocator.GetArena();
+	}
+
+	template <class U> bool operator!=(const CXMLArenaAllocator<U>& rAllocator) const
+	{
+		return pArena != rAllocator.GetArena();
+	}
+
+private:
+	CXMLArena* pArena;
+};
+
+class CXMLArenaException : public CException
+{
+public:
+	enum XMLArenaExceptionCode
+	{
+		XAEC_CREATEERROR,
+		XAEC_ALLOCATEERROR
+	};
+
+public:
+	CXMLArenaException(int code);
+	virtual ~CXMLArenaException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif //__CXMLARENA_H__
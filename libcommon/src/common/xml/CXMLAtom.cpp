@@ -0,0 +1,215 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <iostream>
+#include <cstring>
+#include <pthread.h>
+#include <string>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/xml/CXMLAtom.h>
+
+using namespace std;
+
+typedef CObject::u32 u32;
+
+// the hash table is kept at most half full
+#define ATOM_MAXATOM		1024
+#define ATOM_TABLESIZE		(2 * ATOM_MAXATOM)
+#define ATOM_NOATOM		0
+
+// plain arrays, usable from static constructors of other units
+static pthread_mutex_t mutexAtom = PTHREAD_MUTEX_INITIALIZER;
+static const string* pNameTable[ATOM_MAXATOM + 1];
+static u32 hashTable[ATOM_MAXATOM + 1];
+static volatile u32 slotTable[ATOM_TABLESIZE];
+static u32 numAtom = 0;
+
+static u32 HashName(const char* name, u32 len)
+{
+	u32 hash = 2166136261UL;
+
+	for(u32 i = 0 ; i < len ; i++)
+	{
+		hash ^= (unsigned char) name[i];
+		hash = (hash * 16777619UL) & 0xFFFFFFFFUL;
+	}
+
+	return hash;
+}
+
+CXMLAtom::CXMLAtom()
+{
+	id = ATOM_NOATOM;
+}
+
+CXMLAtom::CXMLAtom(const string& name)
+{
+	id = Lookup(name.data(), name.size(), true);
+}
+
+CXMLAtom::CXMLAtom(const char* name)
+{
+	id = Lookup(name, strlen(name), true);
+}
+
+CXMLAtom::~CXMLAtom()
+{}
+
+CXMLAtom CXMLAtom::Find(const string& name)
+{
+	CXMLAtom Atom;
+	Atom.id = Lookup(name.data(), name.size(), false);
+	return Atom;
+}
+
+CXMLAtom CXMLAtom::Find(const char* name)
+{
+	CXMLAtom Atom;
+	Atom.id = Lookup(name, strlen(name), false);
+	return Atom;
+}
+
+bool CXMLAtom::IsValid() const
+{
+	return id != ATOM_NOATOM;
+}
+
+CObject::u32 CXMLAtom::GetId() const
+{
+	return id;
+}
+
+const string& CXMLAtom::GetName() const
+{
+	if(!IsValid())
+	throw CXMLAtomException(CXMLAtomException::XAEC_GETNAMEERROR);
+
+	return *pNameTable[id];
+}
+
+bool CXMLAtom::operator==(const CXMLAtom& rAtom) const
+{
+	return id == rAtom.id;
+}
+
+bool CXMLAtom::operator!=(const CXMLAtom& rAtom) const
+{
+	return id != rAtom.id;
+}
+
+CObject::u32 CXMLAtom::Lookup(const char* name, u32 len, bool isInsert)
+{
+	u32 hash = HashName(name, len);
+	u32 slot = hash % ATOM_TABLESIZE;
+
+	// readers go without lock, an atom is published once its name is set
+	while(true)
+	{
+		u32 currentId = slotTable[slot];
+
+		if(currentId == ATOM_NOATOM)
+		break;
+
+		__sync_synchronize();
+
+		if(hashTable[currentId] == hash && pNameTable[currentId]->size() == len && memcmp(pNameTable[currentId]->data(), name, len) == 0)
+		return currentId;
+
+		slot = (slot + 1) % ATOM_TABLESIZE;
+	}
+
+	if(!isInsert)
+	return ATOM_NOATOM;
+
+	try
+	{
+		pthread_mutex_lock(&mutexAtom);
+
+		// another thread may have inserted it meanwhile, we probe again
+		slot = hash % ATOM_TABLESIZE;
+
+		while(slotTable[slot] != ATOM_NOATOM)
+		{
+			u32 currentId = slotTable[slot];
+
+			if(hashTable[currentId] == hash && pNameTable[currentId]->size() == len && memcmp(pNameTable[currentId]->data(), name, len) == 0)
+			{
+				pthread_mutex_unlock(&mutexAtom);
+				return currentId;
+			}
+
+			slot = (slot + 1) % ATOM_TABLESIZE;
+		}
+
+		if(numAtom == ATOM_MAXATOM)
+		{
+			pthread_mutex_unlock(&mutexAtom);
+			return ATOM_NOATOM;
+		}
+
+		u32 newId = numAtom + 1;
+
+		pNameTable[newId] = new string(name, len);
+		hashTable[newId] = hash;
+
+		__sync_synchronize();
+
+		slotTable[slot] = newId;
+		numAtom = newId;
+
+		pthread_mutex_unlock(&mutexAtom);
+
+		return newId;
+	}
+
+	catch(exception& e)
+	{
+		pthread_mutex_unlock(&mutexAtom);
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMLAtomException(CXMLAtomException::XAEC_INTERNERROR);
+	}
+}
+
+CXMLAtomException::CXMLAtomException(int code) : CException(code)
+{}
+
+CXMLAtomException::~CXMLAtomException() throw()
+{}
+
+const char* CXMLAtomException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case XAEC_INTERNERROR:
+		return "CXMLAtom::Lookup() error";
+
+	case XAEC_GETNAMEERROR:
+		return "CXMLAtom::GetName() error";
+
+	default:
+		return "CXMLAtom: Unknown error";
+	}
+}
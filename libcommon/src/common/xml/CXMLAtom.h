@@ -0,0 +1,77 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CXMLATOM_H__
+#define __CXMLATOM_H__
+
+#include <string>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+
+using namespace std;
+
+// element and attribut names interned in a process wide table so that
+// they compare as integers. only names known locally (filters, stanza
+// builders, templates) are interned, the parsers look peer names up with
+// Find() and keep the unknown ones as strings. names past the limit give
+// an invalid atom and the caller falls back to comparing strings
+class CXMLAtom : public CObject
+{
+public:
+	CXMLAtom();
+	explicit CXMLAtom(const string& name);
+	explicit CXMLAtom(const char* name);
+	virtual ~CXMLAtom();
+
+	static CXMLAtom Find(const string& name);
+	static CXMLAtom Find(const char* name);
+
+	bool IsValid() const;
+	u32 GetId() const;
+	const string& GetName() const;
+
+	bool operator==(const CXMLAtom& rAtom) const;
+	bool operator!=(const CXMLAtom& rAtom) const;
+
+private:
+	static u32 Lookup(const char* name, u32 len, bool isInsert);
+
+private:
+	u32 id;
+};
+
+class CXMLAtomException : public CException
+{
+public:
+	enum XMLAtomExceptionCode
+	{
+		XAEC_INTERNERROR,
+		XAEC_GETNAMEERROR
+	};
+
+public:
+	CXMLAtomException(int code);
+	virtual ~CXMLAtomException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif //__CXMLATOM_H__
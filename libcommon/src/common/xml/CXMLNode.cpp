@@ -23,21 +23,29 @@
 #include <common/CObject.h>
 #include <common/CException.h>
 #include <common/data/CBuffer.h>
+#include <common/xml/CXMLAtom.h>
 #include <common/xml/CXMLNode.h>
 
 using namespace std;
 
-CXMLNode::CXMLNode()
+static const CXMLAtom AtomXmlns("xmlns");
+
+CXMLNode::CXMLNode() : pArena(NULL)
 {
 	SetParent(NULL);
 }
 
-CXMLNode::CXMLNode(const string& name)
+CXMLNode::CXMLNode(const string& name) : pArena(NULL)
 {
 	SetParent(NULL);
 	SetName(name);
 }
 
+CXMLNode::CXMLNode(CXMLArena* pArena) : pArena(pArena), childVector(ChildVector::allocator_type(pArena)), attrVector(AttrVector::allocator_type(pArena))
+{
+	SetParent(NULL);
+}
+
 CXMLNode::~CXMLNode()
 {
 	try
@@ -53,19 +61,68 @@ CXMLNode::~CXMLNode()
 
 	}
 }
+void* CXMLNode::operator new(size_t size)
+{
+	return operator new(size, (CXMLArena*) NULL);
+}
+
+void* CXMLNode::operator new(size_t size, CXMLArena* pArena)
+{
+	SNodeHeader* pHeader;
+
+	if(pArena != NULL)
+	{
+		pHeader = (SNodeHeader*) pArena->Allocate(sizeof(SNodeHeader) + size);
+		pArena->AddRef();
+	}
+	else
+	pHeader = (SNodeHeader*) ::operator new(sizeof(SNodeHeader) + size);
+
+	pHeader->pArena = pArena;
+
+	return pHeader + 1;
+}
+
+void CXMLNode::operator delete(void* pvXMLNode)
+{
+	if(pvXMLNode == NULL)
+	return;
+
+	SNodeHeader* pHeader = (SNodeHeader*) pvXMLNode - 1;
+
+	// arena nodes only drop their reference, the arena frees them all at once
+	if(pHeader->pArena != NULL)
+	pHeader->pArena->Release();
+	else
+	::operator delete(pHeader);
+}
+
+void CXMLNode::operator delete(void* pvXMLNode, CXMLArena* pArena)
+{
+	operator delete(pvXMLNode);
+}
+
+CXMLArena* CXMLNode::GetArena() const
+{
+	return pArena;
+}
+
 void CXMLNode::CopyFrom(CXMLNode* pXMLNode)
 {
 	Destroy();
 
-	SetName(pXMLNode->GetName());
+	NameAtom = pXMLNode->NameAtom;
+	name = pXMLNode->name;
 	SetData(pXMLNode->GetData().c_str(), pXMLNode->GetData().size());
 
-	for(u32 i = 0 ; i < pXMLNode->GetNumAttribut() ; i += 2)
-	SetAttribut(pXMLNode->GetAttribut(i), pXMLNode->GetAttribut(i + 1));
+	attrVector.reserve(pXMLNode->attrVector.size());
+
+	for(u32 i = 0 ; i < pXMLNode->attrVector.size() ; i++)
+	attrVector.push_back(pXMLNode->attrVector[i]);
 
 	for(u32 i = 0 ; i < pXMLNode->GetNumChild() ; i++)
 	{
-		CXMLNode* pCurrentChild = new CXMLNode;
+		CXMLNode* pCurrentChild = new(pArena) CXMLNode(pArena);
 		pCurrentChild->CopyFrom(pXMLNode->GetChild(i));
 		PushChild(pCurrentChild);
 	}
@@ -83,12 +140,12 @@ CXMLNode* CXMLNode::GetParent()
 
 void CXMLNode::SetNameSpace(const string& nameSpace)
 {
-	SetAttribut("xmlns", nameSpace);
+	SetAttribut(AtomXmlns, nameSpace);
 }
 
 const string& CXMLNode::GetNameSpace() const
 {
-	return GetAttribut("xmlns");
+	return GetAttribut(AtomXmlns);
 }
 
 void CXMLNode::PushChild(CXMLNode* pNode)
@@ -115,6 +172,12 @@ bool CXMLNode::IsExistChild(const string& name) const
 	return SearchChild(name, &index);
 }
 
+bool CXMLNode::IsExistChild(const CXMLAtom& rName) const
+{
+	u32 index;
+	return SearchChild(rName, &index);
+}
+
 bool CXMLNode::IsExistAttribut(const string& attr) const
 {
 	u32 index;
@@ -128,7 +191,23 @@ bool CXMLNode::IsExistAttribut(const string& attr, const string& value) const
 	if(!SearchAttribut(attr, &index))
 	return false;
 	
-	return attrVector[index + 1] == value;
+	return attrVector[index].value == value;
+}
+
+bool CXMLNode::IsExistAttribut(const CXMLAtom& rAttr) const
+{
+	u32 index;
+	return SearchAttribut(rAttr, &index);
+}
+
+bool CXMLNode::IsExistAttribut(const CXMLAtom& rAttr, const string& value) const
+{
+	u32 index;
+	
+	if(!SearchAttribut(rAttr, &index))
+	return false;
+	
+	return attrVector[index].value == value;
 }
 
 
@@ -175,6 +254,28 @@ CXMLNode* CXMLNode::GetChild(const string& name) const
 	}
 }
 
+CXMLNode* CXMLNode::GetChild(const CXMLAtom& rName) const
+{
+	try
+	{
+		u32 index;
+		
+		if(!SearchChild(rName, &index))
+		throw CXMLNodeException(CXMLNodeException::XNEC_GETCHILDERROR);
+		
+		return childVector[index];
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMLNodeException(CXMLNodeException::XNEC_GETCHILDERROR);
+	}
+}
+
 CXMLNode* CXMLNode::PopChild(u32 index)
 {
 	CXMLNode* pXMLNode = GetChild(index);
@@ -238,10 +339,17 @@ CObject::u32 CXMLNode::GetNumChild() const
 	return childVector.size();
 }
 
-void CXMLNode::SetName(const string& name)
+void CXMLNode::SetName(const string& name, bool isInterned)
 {
 	try
 	{
+		// names from the peer are only looked up, the string is kept for
+		// names out of the atom table
+		NameAtom = isInterned ? CXMLAtom(name) : CXMLAtom::Find(name);
+
+		if(NameAtom.IsValid())
+		this->name.clear();
+		else
 		this->name = name;
 	}
 	
@@ -257,9 +365,26 @@ void CXMLNode::SetName(const string& name)
 
 const string& CXMLNode::GetName() const
 {
+	if(NameAtom.IsValid())
+	return NameAtom.GetName();
+
 	return name;
 }
 
+const CXMLAtom& CXMLNode::GetNameAtom() const
+{
+	return NameAtom;
+}
+
+bool CXMLNode::IsSameName(const CXMLNode* pXMLNode) const
+{
+	if(NameAtom.IsValid() && pXMLNode->NameAtom.IsValid())
+	return NameAtom == pXMLNode->NameAtom;
+
+	// a name may have been interned after the other node kept it as string
+	return GetName() == pXMLNode->GetName();
+}
+
 void CXMLNode::SetData(const char data[], u32 len)
 {
 	try
@@ -294,6 +419,12 @@ void CXMLNode::AppendData(const char data[], u32 len)
 	}
 }
 
+void CXMLNode::SwapData(string& data)
+{
+	// we take the caller string without copying it
+	this->data.swap(data);
+}
+
 const string& CXMLNode::GetData() const
 {
 	return data;
@@ -307,12 +438,56 @@ void CXMLNode::SetAttribut(const string& attr, const string& value)
 		
 		if(SearchAttribut(attr, &index))
 		{
-			attrVector[index + 1] = value;
+			attrVector[index].value = value;
+		}
+		else
+		{
+			attrVector.push_back(SAttribut());
+
+			SAttribut& rAttribut = attrVector.back();
+			rAttribut.Atom = CXMLAtom(attr);
+
+			if(!rAttribut.Atom.IsValid())
+			rAttribut.name = attr;
+
+			rAttribut.value = value;
+		}
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMLNodeException(CXMLNodeException::XNEC_ADDATTRIBUTERROR);
+	}
+}
+
+void CXMLNode::SetAttribut(const char* attr, const char* value, bool isInterned)
+{
+	try
+	{
+		u32 index;
+		
+		CXMLAtom Atom = isInterned ? CXMLAtom(attr) : CXMLAtom::Find(attr);
+
+		if(Atom.IsValid() ? SearchAttribut(Atom, &index) : SearchAttribut(string(attr), &index))
+		{
+			attrVector[index].value = value;
 		}
 		else
 		{
-			attrVector.push_back(attr);
-			attrVector.push_back(value);
+			// we build the strings in place rather than copying temporaries
+			attrVector.push_back(SAttribut());
+
+			SAttribut& rAttribut = attrVector.back();
+			rAttribut.Atom = Atom;
+
+			if(!Atom.IsValid())
+			rAttribut.name.assign(attr);
+
+			rAttribut.value.assign(value);
 		}
 	}
 	
@@ -326,11 +501,79 @@ void CXMLNode::SetAttribut(const string& attr, const string& value)
 	}
 }
 
+void CXMLNode::SetAttribut(const CXMLAtom& rAttr, const string& value)
+{
+	try
+	{
+		u32 index;
+		
+		if(SearchAttribut(rAttr, &index))
+		{
+			attrVector[index].value = value;
+		}
+		else
+		{
+			attrVector.push_back(SAttribut());
+
+			SAttribut& rAttribut = attrVector.back();
+			rAttribut.Atom = rAttr;
+			rAttribut.value = value;
+		}
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMLNodeException(CXMLNodeException::XNEC_ADDATTRIBUTERROR);
+	}
+}
+
+void CXMLNode::ReserveAttribut(u32 numAttribut)
+{
+	try
+	{
+		attrVector.reserve(attrVector.size() + numAttribut);
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMLNodeException(CXMLNodeException::XNEC_ADDATTRIBUTERROR);
+	}
+}
+
 bool CXMLNode::SearchAttribut(const string& attr, u32* pIndex) const
 {
-	for(*pIndex = 0 ; *pIndex < GetNumAttribut() ; (*pIndex) += 2)
+	CXMLAtom Atom = CXMLAtom::Find(attr);
+
+	if(Atom.IsValid())
+	return SearchAttribut(Atom, pIndex);
+
+	// a name out of the atom table can only match a name kept as string
+	for(*pIndex = 0 ; *pIndex < attrVector.size() ; (*pIndex)++)
+	{
+		if(!attrVector[*pIndex].Atom.IsValid() && attrVector[*pIndex].name == attr)
+		return true;
+	}
+
+	return false;
+}
+
+bool CXMLNode::SearchAttribut(const CXMLAtom& rAttr, u32* pIndex) const
+{
+	if(!rAttr.IsValid())
+	return false;
+
+	// names kept as string were not interned yet when they were set
+	for(*pIndex = 0 ; *pIndex < attrVector.size() ; (*pIndex)++)
 	{
-		if(attrVector[*pIndex] == attr)
+		if(attrVector[*pIndex].Atom == rAttr || (!attrVector[*pIndex].Atom.IsValid() && attrVector[*pIndex].name == rAttr.GetName()))
 		return true;
 	}
 
@@ -344,7 +587,29 @@ const string& CXMLNode::GetAttribut(const string& attr) const
 		u32 index = 0;
 		
 		if(SearchAttribut(attr, &index))
-		return attrVector[index + 1];
+		return attrVector[index].value;
+
+		throw CXMLNodeException(CXMLNodeException::XNEC_GETATTRIBUTERROR);
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMLNodeException(CXMLNodeException::XNEC_GETATTRIBUTERROR);
+	}
+}
+
+const string& CXMLNode::GetAttribut(const CXMLAtom& rAttr) const
+{
+	try
+	{
+		u32 index = 0;
+		
+		if(SearchAttribut(rAttr, &index))
+		return attrVector[index].value;
 
 		throw CXMLNodeException(CXMLNodeException::XNEC_GETATTRIBUTERROR);
 	}
@@ -359,11 +624,23 @@ const string& CXMLNode::GetAttribut(const string& attr) const
 	}
 }
 
+// even indexes give the attribut names, odd ones their values
 const string& CXMLNode::GetAttribut(u32 index) const
 {
 	try
 	{
-		return attrVector[index];
+		if(index >= GetNumAttribut())
+		throw CXMLNodeException(CXMLNodeException::XNEC_GETATTRIBUTERROR);
+
+		const SAttribut& rAttribut = attrVector[index / 2];
+
+		if(index % 2)
+		return rAttribut.value;
+
+		if(rAttribut.Atom.IsValid())
+		return rAttribut.Atom.GetName();
+
+		return rAttribut.name;
 	}
 	
 	catch(exception& e)
@@ -376,16 +653,43 @@ const string& CXMLNode::GetAttribut(u32 index) const
 	}
 }
 
+const CXMLAtom& CXMLNode::GetAttributAtom(u32 index) const
+{
+	if(index >= GetNumAttribut())
+	throw CXMLNodeException(CXMLNodeException::XNEC_GETATTRIBUTERROR);
+
+	return attrVector[index / 2].Atom;
+}
+
 CObject::u32 CXMLNode::GetNumAttribut() const
 {
-	return attrVector.size();
+	return 2 * attrVector.size();
 }
 
 bool CXMLNode::SearchChild(const string& name, u32* pIndex) const
 {
+	CXMLAtom Atom = CXMLAtom::Find(name);
+
+	if(Atom.IsValid())
+	return SearchChild(Atom, pIndex);
+
+	for(*pIndex = 0 ; *pIndex < GetNumChild() ; (*pIndex)++)
+	{
+		if(!childVector[*pIndex]->NameAtom.IsValid() && childVector[*pIndex]->name == name)
+		return true;
+	}
+
+	return false;
+}
+
+bool CXMLNode::SearchChild(const CXMLAtom& rName, u32* pIndex) const
+{
+	if(!rName.IsValid())
+	return false;
+
 	for(*pIndex = 0 ; *pIndex < GetNumChild() ; (*pIndex)++)
 	{
-		if(childVector[*pIndex]->GetName() == name)
+		if(childVector[*pIndex]->NameAtom == rName || (!childVector[*pIndex]->NameAtom.IsValid() && childVector[*pIndex]->name == rName.GetName()))
 		return true;
 	}
 
@@ -427,14 +731,14 @@ void CXMLNode::BuildNode(CBuffer* pBuffer) const
 	try
 	{
 		pBuffer->Write("<");
-		pBuffer->Write(GetName().c_str());
+		pBuffer->Write(GetName());
 
 		for(u32 i = 0 ; i < GetNumAttribut() ; i += 2)
 		{
 			pBuffer->Write(" ");
-			pBuffer->Write(GetAttribut(i).c_str());
+			pBuffer->Write(GetAttribut(i));
 			pBuffer->Write("='");
-			pBuffer->Write(GetAttribut(i + 1).c_str());
+			pBuffer->Write(GetAttribut(i + 1));
 			pBuffer->Write("'");
 		}
 		
@@ -445,13 +749,13 @@ void CXMLNode::BuildNode(CBuffer* pBuffer) const
 		else
 		{
 			pBuffer->Write(">");
-			pBuffer->Write(GetData().c_str());
+			pBuffer->Write(GetData());
 
 			for(u32 i = 0 ; i < GetNumChild() ; i++)
 			GetChild(i)->BuildNode(pBuffer);
 		
 			pBuffer->Write("</");
-			pBuffer->Write(GetName().c_str());
+			pBuffer->Write(GetName());
 			pBuffer->Write(">");
 		}
 	}
@@ -467,6 +771,70 @@ void CXMLNode::BuildNode(CBuffer* pBuffer) const
 }
 
 
+void CXMLNode::Build(CBufferChain* pBufferChain) const
+{
+	try
+	{
+		pBufferChain->Clear();
+		BuildNode(pBufferChain);
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw e;
+	}
+}
+
+void CXMLNode::BuildNode(CBufferChain* pBufferChain) const
+{
+	try
+	{
+		pBufferChain->Write("<", 1);
+		pBufferChain->Write(GetName());
+
+		for(u32 i = 0 ; i < GetNumAttribut() ; i += 2)
+		{
+			pBufferChain->Write(" ", 1);
+			pBufferChain->Write(GetAttribut(i));
+			pBufferChain->Write("='", 2);
+			pBufferChain->Write(GetAttribut(i + 1));
+			pBufferChain->Write("'", 1);
+		}
+		
+		if(GetNumChild() == 0 && GetData().size() == 0)
+		{
+			pBufferChain->Write("/>", 2);
+		}
+		else
+		{
+			pBufferChain->Write(">", 1);
+
+			// the payload is sent from the node itself, not copied
+			pBufferChain->Reference(GetData());
+
+			for(u32 i = 0 ; i < GetNumChild() ; i++)
+			GetChild(i)->BuildNode(pBufferChain);
+		
+			pBufferChain->Write("</", 2);
+			pBufferChain->Write(GetName());
+			pBufferChain->Write(">", 1);
+		}
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw e;
+	}
+}
+
 CObject::u32 CXMLNode::GetXMLNodeSize() const
 {
 	try
@@ -512,6 +880,7 @@ CObject::u32 CXMLNode::GetXMLNodeSize() const
 
 void CXMLNode::Destroy()
 {
+	NameAtom = CXMLAtom();
 	name = "";
 	data = "";
 	
@@ -28,6 +28,9 @@
 #include <common/CObject.h>
 #include <common/CException.h>
 #include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
+#include <common/xml/CXMLArena.h>
+#include <common/xml/CXMLAtom.h>
 
 using namespace std;
 
@@ -36,7 +39,16 @@ class CXMLNode : public CObject
 public:
 	CXMLNode();
 	CXMLNode(const string& name);
+	CXMLNode(CXMLArena* pArena);
 	virtual ~CXMLNode();
+
+	// nodes created with new(pArena) live in the arena, plain new uses the heap
+	static void* operator new(size_t size);
+	static void* operator new(size_t size, CXMLArena* pArena);
+	static void operator delete(void* pvXMLNode);
+	static void operator delete(void* pvXMLNode, CXMLArena* pArena);
+
+	CXMLArena* GetArena() const;
 	
 	void CopyFrom(CXMLNode* pXMLNode);
 	
@@ -49,11 +61,15 @@ public:
 	void PushChild(CXMLNode* pXMLNode);
 	
 	bool IsExistChild(const string& name) const;
+	bool IsExistChild(const CXMLAtom& rName) const;
 	bool IsExistAttribut(const string& attr) const;
 	bool IsExistAttribut(const string& attr, const string& value) const;
+	bool IsExistAttribut(const CXMLAtom& rAttr) const;
+	bool IsExistAttribut(const CXMLAtom& rAttr, const string& value) const;
 	
 	CXMLNode* GetChild(u32 index) const;
 	CXMLNode* GetChild(const string& name) const;
+	CXMLNode* GetChild(const CXMLAtom& rName) const;
 
 	CXMLNode* PopChild(u32 index);
 	CXMLNode* PopChild(const string& name);
@@ -64,38 +80,69 @@ public:
 	u32 GetNumChild() const;
 
 	const string& GetName() const;
+	const CXMLAtom& GetNameAtom() const;
+	bool IsSameName(const CXMLNode* pXMLNode) const;
 	const string& GetData() const;
 
-	void SetName(const string& name);
+	void SetName(const string& name, bool isInterned = true);
 	void SetData(const char data[], u32 len);
 	void AppendData(const char data[], u32 len);
+	void SwapData(string& data);
 	
 	void SetAttribut(const string& attr, const string& value);
+	void SetAttribut(const char* attr, const char* value, bool isInterned = true);
+	void SetAttribut(const CXMLAtom& rAttr, const string& value);
+	void ReserveAttribut(u32 numAttribut);
 
 	const string& GetAttribut(u32 index) const;
 	const string& GetAttribut(const string& attr) const;
+	const string& GetAttribut(const CXMLAtom& rAttr) const;
+	const CXMLAtom& GetAttributAtom(u32 index) const;
 
 	u32 GetNumAttribut() const;
 	void Build(CBuffer* pBuffer) const;
+	void Build(CBufferChain* pBufferChain) const;
 
 	void Destroy();
 
 protected:
 	bool SearchChild(const string& name, u32* pIndex) const;
+	bool SearchChild(const CXMLAtom& rName, u32* pIndex) const;
 	bool SearchChild(const CXMLNode* pXMLNode, u32* pIndex) const;
 	bool SearchAttribut(const string& attr, u32* pIndex) const;
+	bool SearchAttribut(const CXMLAtom& rAttr, u32* pIndex) const;
 
 	void BuildNode(CBuffer* pBuffer) const;
+	void BuildNode(CBufferChain* pBufferChain) const;
 	u32 GetXMLNodeSize() const;
 
 private:
+	struct SNodeHeader
+	{
+		CXMLArena* pArena;
+		void* pReserved;
+	};
+
+	// names left out of the atom table are kept in the string beside
+	struct SAttribut
+	{
+		CXMLAtom Atom;
+		string name;
+		string value;
+	};
+
+	typedef vector<CXMLNode*, CXMLArenaAllocator<CXMLNode*> > ChildVector;
+	typedef vector<SAttribut, CXMLArenaAllocator<SAttribut> > AttrVector;
+
+private:
+	CXMLArena* pArena;
 	CXMLNode* pParent;
-	vector<CXMLNode*> childVector;
+	ChildVector childVector;
 
+	CXMLAtom NameAtom;
 	string name;
 	string data;
-	string nameSpaceView;
-	vector<string> attrVector;
+	AttrVector attrVector;
 };
 
 class CXMLNodeException : public CException
@@ -18,15 +18,57 @@
 
 #include <expat.h>
 #include <iostream>
+#include <pthread.h>
 
 #include <common/CObject.h>
 #include <common/CException.h>
 #include <common/data/CBuffer.h>
+#include <common/xml/CXMLArena.h>
 #include <common/xml/CXMLNode.h>
 #include <common/xml/CXMLParser.h>
 
 using namespace std;
 
+// each thread keeps the parser of its last Parse() and resets it
+static pthread_key_t parserKey;
+static pthread_once_t parserOnce = PTHREAD_ONCE_INIT;
+
+static void FreeParser(void* pvParser)
+{
+	XML_ParserFree((XML_Parser) pvParser);
+}
+
+static void CreateParserKey()
+{
+	pthread_key_create(&parserKey, FreeParser);
+}
+
+static XML_Parser AcquireParser()
+{
+	pthread_once(&parserOnce, CreateParserKey);
+
+	XML_Parser parser = (XML_Parser) pthread_getspecific(parserKey);
+
+	if(parser == NULL)
+	return XML_ParserCreate(NULL);
+
+	pthread_setspecific(parserKey, NULL);
+
+	if(XML_ParserReset(parser, NULL))
+	return parser;
+
+	XML_ParserFree(parser);
+	return XML_ParserCreate(NULL);
+}
+
+static void ReleaseParser(XML_Parser parser)
+{
+	if(pthread_getspecific(parserKey) == NULL && pthread_setspecific(parserKey, parser) == 0)
+	return;
+
+	XML_ParserFree(parser);
+}
+
 CXMLParser::CXMLParser()
 {}
 
@@ -35,10 +77,13 @@ CXMLParser::~CXMLParser()
 
 void CXMLParser::Parse(CBuffer* pBuffer, CXMLNode* pXMLNode)
 {
+	SContext Context;
+
+	Context.pArena = NULL;
+
 	try
 	{
-		SContext Context;
-		XML_Parser parser = XML_ParserCreate(NULL);
+		XML_Parser parser = AcquireParser();
 
 		if(parser == NULL)
 		throw CXMLParserException(CXMLParserException::XPEC_PARSEERROR);
@@ -49,21 +94,30 @@ void CXMLParser::Parse(CBuffer* pBuffer, CXMLNode* pXMLNode)
 		Context.pCurrentNode = pXMLNode;
 		Context.isRootNode = true;
 
+		// the sub nodes share one arena, we hold it for the time of the parsing
+		Context.pArena = CXMLArena::Create();
+
 		XML_SetUserData(parser, &Context);
 		XML_SetElementHandler(parser, EventStartElement, EventEndElement);
 		XML_SetCharacterDataHandler(parser, EventDataElement);
 	
-		if(XML_Parse(parser, (char*) pBuffer->GetBuffer(), pBuffer->GetBufferSize(), 0) == XML_STATUS_ERROR)
+		// the buffer holds the whole document, expat parses it in place
+		if(XML_Parse(parser, (char*) pBuffer->GetBuffer(), pBuffer->GetBufferSize(), 1) == XML_STATUS_ERROR)
 		{
-			XML_ParserFree(parser);
+			ReleaseParser(parser);
 			throw CXMLParserException(CXMLParserException::XPEC_PARSEERROR);
 		}
 		
-		XML_ParserFree(parser);	
+		ReleaseParser(parser);	
+
+		Context.pArena->Release();
 	}
 	
 	catch(exception& e)
 	{
+		if(Context.pArena != NULL)
+		Context.pArena->Release();
+
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
@@ -77,7 +131,7 @@ void CXMLParser::EventDataElement(void* pvContext, const char* name, int len)
 	{
 		SContext* pContext = (SContext*) pvContext;
 		
-		pContext->pCurrentNode->AppendData(name, len);
+		pContext->PendingData.append(name, len);
 	}
 	
 	catch(exception& e)
@@ -95,17 +149,29 @@ void CXMLParser::EventStartElement(void* pvContext, const char* name, const char
 	{
 		SContext* pContext = (SContext*) pvContext;
 		CXMLNode* pSubNode;
+
+		FlushData(pContext);
 		
 		if(pContext->isRootNode)
 		{
 			pSubNode = pContext->pCurrentNode;
-			pSubNode->SetName(name);
+			pSubNode->SetName(name, false);
 		}
 		else
-		pSubNode = new CXMLNode(name);
+		{
+			pSubNode = new(pContext->pArena) CXMLNode(pContext->pArena);
+			pSubNode->SetName(name, false);
+		}
+
+		u32 numAttribut = 0;
+
+		while(atts[2 * numAttribut] != NULL)
+		numAttribut++;
+
+		pSubNode->ReserveAttribut(numAttribut);
 
 		for(int i = 0 ; atts[i] != NULL ; i += 2)
-		pSubNode->SetAttribut(atts[i], atts[i + 1]);
+		pSubNode->SetAttribut(atts[i], atts[i + 1], false);
 
 		if(pContext->isRootNode)
 		{
@@ -132,6 +198,8 @@ void CXMLParser::EventEndElement(void* pvContext, const char* name)
 	try
 	{
 		SContext* pContext = (SContext*) pvContext;
+
+		FlushData(pContext);
 		pContext->pCurrentNode = pContext->pCurrentNode->GetParent();
 	}
 	
@@ -144,6 +212,14 @@ void CXMLParser::EventEndElement(void* pvContext, const char* name)
 	}
 }
 
+void CXMLParser::FlushData(SContext* pContext)
+{
+	if(pContext->PendingData.empty())
+	return;
+
+	pContext->pCurrentNode->AppendData(pContext->PendingData.data(), pContext->PendingData.size());
+	pContext->PendingData.clear();
+}
 
 CXMLParserException::CXMLParserException(int code) : CException(code)
 {}
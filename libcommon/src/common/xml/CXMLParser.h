@@ -26,6 +26,7 @@
 #include <common/CObject.h>
 #include <common/CException.h>
 #include <common/data/CBuffer.h>
+#include <common/xml/CXMLArena.h>
 #include <common/xml/CXMLNode.h>
 
 using namespace std;
@@ -37,6 +38,10 @@ private:
 	{
 		CXMLNode* pCurrentNode;
 		bool isRootNode;
+
+		// character data is gathered here and given to the node once
+		CXMLArena* pArena;
+		string PendingData;
 	};
 
 public:
@@ -49,6 +54,8 @@ protected:
 	static void EventDataElement(void* pvContext, const char* name, int len);
 	static void EventStartElement(void* pvContext, const char* name, const char** atts);
 	static void EventEndElement(void* pvContext, const char* name);
+
+	static void FlushData(SContext* pContext);
 };
 
 class CXMLParserException : public CException
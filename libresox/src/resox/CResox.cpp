@@ -28,6 +28,7 @@
 #include <common/CException.h>
 #include <common/socket/tcp/CTCPAddress.h>
 #include <common/thread/CThread.h>
+#include <common/tun/CTunRing.h>
 
 #include <xmpp/core/CHandler.h>
 #include <xmpp/core/CXMLFilter.h>
@@ -51,6 +52,8 @@ using namespace std;
 
 CResox::CResox()
 {
+	isRawData = false;
+	isUring = false;
 }
 
 CResox::CResox(const string pAddress, const string pMask)
@@ -58,6 +61,8 @@ CResox::CResox(const string pAddress, const string pMask)
 	char tun_name[] = "xmpp0";
 
 	pResox = this;
+	isRawData = false;
+	isUring = false;
 
 	/* Connect to the device */
 	tun_fd = tun_alloc(tun_name, IFF_TUN | IFF_NO_PI);
@@ -92,32 +97,45 @@ void CResox::ConnectToSSH(const CJid& sshJid)
 	XEPdisco.Disco(sshJid, &FeaturesList);
 
 	bool isResoxFeature = false;
+	bool isOpenFeature = false;
 
 	for(u32 i = 0 ; i < FeaturesList.size() ; i++)
 	{
 		if(FeaturesList[i] == "http://jabber.org/protocol/xmpp-ssh")
 		isResoxFeature = true;
+
+		// the peer accepts tun packets without the xmpp-ssh node
+		if(FeaturesList[i] == "http://jabber.org/protocol/xmpp-ssh#raw")
+		isRawData = true;
+
+		// the peer takes the shell stream along with the channel
+		if(FeaturesList[i] == "http://jabber.org/protocol/xibb#open")
+		isOpenFeature = true;
 	}
 
 	if(!isResoxFeature)
 	cerr << sshJid.GetFull() << " may not support xmpp-ssh " << endl;
 	
-	XEPssh.ConnectToSSH(sshJid);
+	XEPssh.ConnectToSSH(sshJid, isOpenFeature, isRawData);
 }
 
 
 void CResox::Login()
 {
-	XEPssh.Login();
+	XEPssh.Login(isRawData);
 
 	cerr << "Tunnel established" << endl;
 
 	try
 	{
+		// with io_uring a few packets are read ahead of the output
+		TunRing.Open(tun_fd, TUNRING_DEPTH, isUring);
+
 		ThreadInShellJob.Run(InShellJob, this);
 		ThreadOutShellJob.Run(OutShellJob, this);
 
 		ThreadInShellJob.Wait();
+		TunRing.Close();
 	}
 	
 	catch(exception& e)
@@ -129,6 +147,11 @@ void CResox::Login()
 	}
 }
 
+void CResox::SetUring(bool isUring)
+{
+	this->isUring = isUring;
+}
+
 void CResox::StartRosterEvent(CRoster* pRoster)
 {
 	 XMPPInstMsg.StartRosterEvent(pRoster);
@@ -148,21 +171,17 @@ bool CResox::OnRosterUpdated(CRoster* pRoster)
 void* CResox::InShellJob(void* pvThis) throw()
 {
 	CResox* pResox = (CResox*) pvThis;
-	int nread;
 
 	try
 	{		
-		CBuffer DataBuffer;
+		u8 buffer[2000];
 
 		while(true)
 		{
-			pResox->XEPssh.ReceiveData(&DataBuffer);
-			nread = write(pResox->tun_fd, DataBuffer.GetBuffer(), DataBuffer.GetBufferSize());
-			if(nread < 0) {
-				perror("Write to interface");
-				close(pResox->tun_fd);
-				exit(1);
-			}
+			u32 dataSize = pResox->XEPssh.ReceiveData(buffer, sizeof(buffer));
+
+			// packets already received behind this one go to the tun in one submit
+			pResox->TunRing.Write(buffer, dataSize, pResox->XEPssh.GetPendingData() > 0);
 		}
 	}
 	
@@ -180,21 +199,13 @@ void* CResox::OutShellJob(void* pvThis) throw()
 	
 	try
 	{	
-		CBuffer DataBuffer(1);
-		
-		char buffer[2000];
-		int nread;
-
-		while ((nread = read(pResox->tun_fd,buffer,sizeof(buffer)))) {
-			if(nread < 0) {
-				perror("Reading from interface");
-				close(pResox->tun_fd);
-				exit(1);
-			}
-			DataBuffer.Create((u32)nread);
-			DataBuffer.Write((const u8*)buffer, (u32)nread);
-			pResox->XEPssh.SendData(&DataBuffer);
-		}
+		const u8* pPacket;
+		u32 packetSize;
+
+		// we only read the tun once the output has room, meanwhile the
+		// kernel queue holds or drops the packets
+		while (pResox->XEPssh.WaitSendData() && (pPacket = pResox->TunRing.Read(&packetSize)) && packetSize)
+		pResox->XEPssh.SendData(pPacket, packetSize);
 
 		pResox->ThreadInShellJob.Stop();
 		pResox->XEPssh.Disconnect();
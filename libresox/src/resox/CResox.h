@@ -27,6 +27,7 @@
 #include <common/CException.h>
 #include <common/socket/tcp/CTCPAddress.h>
 #include <common/thread/CThread.h>
+#include <common/tun/CTunRing.h>
 
 #include <xmpp/im/CXMPPInstMsg.h>
 #include <xmpp/im/CRoster.h>
@@ -47,6 +48,7 @@ public:
 	void ConnectTo(const CJid& xmppJid, const CTCPAddress& rTCPAddress);
 	void ConnectToSSH(const CJid& sshJid);
 	void Login();
+	void SetUring(bool isUring);
 
 	void StartRosterEvent(CRoster* pRoster);
 	bool OnRosterUpdated(CRoster* pRoster);
@@ -63,8 +65,11 @@ private:
 	CXMPPInstMsg XMPPInstMsg;	
 	CXEPdisco XEPdisco;
 	CXEPssh XEPssh;
+	bool isRawData;
 
 	int tun_fd;
+	CTunRing TunRing;
+	bool isUring;
 	
 	CThread ThreadInShellJob;
 	CThread ThreadOutShellJob;
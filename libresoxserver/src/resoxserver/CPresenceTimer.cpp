@@ -0,0 +1,89 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <iostream>
+
+#include <common/CObject.h>
+#include <common/thread/CTimer.h>
+
+#include <xmpp/im/CXMPPInstMsg.h>
+
+#include <resoxserver/CPresenceTimer.h>
+
+using namespace std;
+
+CPresenceTimer::CPresenceTimer()
+{
+	pXMPPInstMsg = NULL;
+	numLeft = 0;
+	period = 0;
+}
+
+CPresenceTimer::~CPresenceTimer()
+{
+	try
+	{
+		// ~CTimer() would wait for a running OnTimer() on a dead object
+		Stop();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+	}
+}
+
+void CPresenceTimer::Start(CXMPPInstMsg* pXMPPInstMsg, u32 count, u32 period)
+{
+	// the first presence goes at once, a running series starts over
+	this->pXMPPInstMsg = pXMPPInstMsg;
+	this->period = period;
+	numLeft = count;
+
+	pXMPPInstMsg->GetTimerWheel()->Arm(this, 0);
+}
+
+void CPresenceTimer::Stop()
+{
+	if(pXMPPInstMsg == NULL)
+	return;
+
+	numLeft = 0;
+	__sync_synchronize();
+
+	// a callback running meanwhile may arm us once more before it sees
+	// numLeft, the second round takes that back
+	for(u32 i = 0 ; i < 2 ; i++)
+	{
+		Cancel();
+		pXMPPInstMsg->GetTimerWheel()->Wait(this);
+	}
+}
+
+void CPresenceTimer::OnTimer()
+{
+	pXMPPInstMsg->SendPresenceToAll("available", "Hi! I'm here", "0");
+
+	if(numLeft > 0 && --numLeft > 0)
+	pXMPPInstMsg->GetTimerWheel()->Arm(this, period);
+}
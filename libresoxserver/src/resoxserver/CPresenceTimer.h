@@ -0,0 +1,48 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CPRESENCETIMER_H__
+#define __CPRESENCETIMER_H__
+
+#include <common/CObject.h>
+#include <common/thread/CTimer.h>
+
+#include <xmpp/im/CXMPPInstMsg.h>
+
+// sends our presence to everyone a few times in a row, on the timer wheel
+// of the connection rather than from a sleeping thread
+class CPresenceTimer : public CTimer
+{
+public:
+	CPresenceTimer();
+	virtual ~CPresenceTimer();
+
+	void Start(CXMPPInstMsg* pXMPPInstMsg, u32 count, u32 period);
+	void Stop();
+
+	virtual void OnTimer();
+
+private:
+	CXMPPInstMsg* pXMPPInstMsg;
+	volatile u32 numLeft;
+	u32 period;
+};
+
+#endif // __CPRESENCETIMER_H__
@@ -75,34 +75,9 @@ CResoxServer::~CResoxServer()
 {
 }
 
-void* presense_thread(void* pvThis) throw()
+void CResoxServer::SetUring(bool isUring)
 {
-	CResoxServer* me = (CResoxServer*) pvThis;
-	for (int i=0 ; i<3 ; i++)
-	{
-		me->XMPPInstMsg.SendPresenceToAll("available", "Hi! I'm here", "0");
-		sleep(5);
-	}
-}
-
-void* keepalive_thread(void* pvThis) throw()
-{
-	CResoxServer* me = (CResoxServer*) pvThis;
-	vector<string> FeaturesList;
-	try
-	{
-	while(true)
-	{
-		// This is a hack to check for disconnection
-		me->XEPdisco.Disco(&FeaturesList);
-		sleep(300);
-	}
-	}
-	catch(exception& e)
-	{
-			cerr << "Disconnected !" << endl;
-			exit(0);
-	}
+	XEPsshd.SetUring(isUring);
 }
 
 void CResoxServer::Run(const CJid* pJid, const CTCPAddress* pTCPAddress)
@@ -126,25 +101,43 @@ void CResoxServer::Run(const CJid* pJid, const CTCPAddress* pTCPAddress)
 		XMPPInstMsg.SendPresenceToAll("available", "remote shell over xmpp - server init", "0");
 		cout << "sshd on " << XMPPInstMsg.GetJid().GetFull() << " is ready." << endl;
 		
-		CThread Presence;
-		CThread KeepAlive;
-		KeepAlive.Run(keepalive_thread, this);
-
-		while(XMPPInstMsg.Receive(&Stanza))
+		while(true)
 		{
+			// a connection quiet for too long is probed, a stalled one is
+			// dropped within seconds instead of hanging its sessions
+			if(!XMPPInstMsg.Receive(&Stanza, RESOXSERVER_IDLETIMEOUT))
+			{
+				if(!XMPPInstMsg.IsConnected())
+				break;
+
+				try
+				{
+					XEPdisco.Disco(&FeaturesList, RESOXSERVER_PROBETIMEOUT);
+				}
+
+				catch(exception& e)
+				{
+					cerr << "Disconnected !" << endl;
+					exit(0);
+				}
+
+				continue;
+			}
+
 			// This was needed to appear online on client connection on some servers
 			// need to investigate more on this issue
 			if (Stanza.GetKindOf() == CStanza::SKO_PRESENCE 
 				&& Stanza.GetFrom().find(pJid->GetShort()) == string::npos)
 			{
 				cout << "New friend :" << Stanza.GetFrom() << endl;
-				Presence.Run(presense_thread, this);
-				Presence.Wait();
+				PresenceTimer.Start(&XMPPInstMsg, RESOXSERVER_PRESENCECOUNT, RESOXSERVER_PRESENCEPERIOD);
 			} else {
 				cout << "Got my packet :" << Stanza.GetFrom() << endl;
 			}
 		}
-		KeepAlive.Wait();
+
+		// no presence may go out once the connection is torn down
+		PresenceTimer.Stop();
 
 		XEPsshd.Detach();
 		XEPdisco.Detach();
@@ -33,8 +33,19 @@
 #include <xmpp/xep/disco/CXEPdisco.h>
 #include <xmpp/xep/ssh/CXEPsshd.h>
 
+#include <resoxserver/CPresenceTimer.h>
+
 using namespace std;
 
+// in microseconds, an idle connection is probed after RESOXSERVER_IDLETIMEOUT
+// and dropped when the probe is not answered within RESOXSERVER_PROBETIMEOUT
+#define RESOXSERVER_IDLETIMEOUT (10 * 1000000)
+#define RESOXSERVER_PROBETIMEOUT (5 * 1000000)
+
+// a new friend is sent our presence this many times, period apart
+#define RESOXSERVER_PRESENCECOUNT 3
+#define RESOXSERVER_PRESENCEPERIOD (5 * 1000000)
+
 class CResoxServer : public CObject
 {
 public:
@@ -44,6 +55,7 @@ public:
 
 	void Run(const CJid* pJid, const CTCPAddress* pTCPAddress);
 	void Stop();
+	void SetUring(bool isUring);
 
 		
 	CXMPPInstMsg XMPPInstMsg;
@@ -53,6 +65,7 @@ public:
 	const CTCPAddress* TCPAddress;
 private:
 	CXEPsshd XEPsshd;
+	CPresenceTimer PresenceTimer;
 	int TunFd;
 };
 
@@ -0,0 +1,326 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+// dispatch benchmark of CHandlerIndex: 10k handlers shaped like the ones
+// of a busy tunnel, mostly stream-data handlers, are registered and a mix
+// of stanzas is matched through the index and through a linear scan of
+// every handler. exits 1 when both do not give the same handlers
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <common/CObject.h>
+#include <common/CException.h>
+#include <common/xml/CXMLNode.h>
+
+#include <xmpp/core/CHandler.h>
+#include <xmpp/core/CHandlerIndex.h>
+#include <xmpp/core/CXMLFilter.h>
+
+using namespace std;
+
+#define BENCH_NUMHANDLER	10000
+#define BENCH_NUMREMOVED	300
+#define BENCH_NUMSTANZA		2000
+#define BENCH_NUMJID		4
+#define BENCH_NUMCID		20
+#define BENCH_NUMSID		500
+#define BENCH_LINEARROUND	2
+#define BENCH_INDEXROUND	50
+
+#define BENCH_XMLNS		"http://jabber.org/protocol/xibb"
+
+enum BenchKind
+{
+	BK_STREAMDATA,
+	BK_CHANNELDATA,
+	BK_STREAMOPEN,
+	BK_IQ,
+	BK_PRESENCE,
+	BK_NUMKIND
+};
+
+static double GetTime()
+{
+	struct timespec Now;
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+
+	return Now.tv_sec + Now.tv_nsec / 1e9;
+}
+
+static string ToString(int value)
+{
+	ostringstream Stream;
+	Stream << value;
+
+	return Stream.str();
+}
+
+static string GetJid(int jid)
+{
+	return "peer" + ToString(jid) + "@example.org/tunnel";
+}
+
+static CHandler* CreateHandler(int kind, int jid, int cid, int sid)
+{
+	CHandler* pHandler = new CHandler;
+	CXMLFilter* pXMLFilter;
+	CXMLFilter* pChildFilter = NULL;
+
+	switch(kind)
+	{
+	case BK_STREAMDATA:
+		pXMLFilter = new CXMLFilter("message");
+		pXMLFilter->SetAttribut("from", GetJid(jid));
+		pChildFilter = new CXMLFilter("stream-data");
+		pChildFilter->SetAttribut("xmlns", BENCH_XMLNS);
+		pChildFilter->SetAttribut("cid", ToString(cid));
+		pChildFilter->SetAttribut("sid", ToString(sid));
+		break;
+
+	case BK_CHANNELDATA:
+		pXMLFilter = new CXMLFilter("message");
+		pXMLFilter->SetAttribut("from", GetJid(jid));
+		pChildFilter = new CXMLFilter("channel-data");
+		pChildFilter->SetAttribut("xmlns", BENCH_XMLNS);
+		pChildFilter->SetAttribut("cid", ToString(cid));
+		break;
+
+	case BK_STREAMOPEN:
+		pXMLFilter = new CXMLFilter("iq");
+		pXMLFilter->SetAttribut("type", "set");
+		pXMLFilter->SetAttribut("from", GetJid(jid));
+		pChildFilter = new CXMLFilter("stream-open");
+		pChildFilter->SetAttribut("xmlns", BENCH_XMLNS);
+		pChildFilter->SetAttribut("cid", ToString(cid));
+		break;
+
+	case BK_IQ:
+		pXMLFilter = new CXMLFilter("iq");
+		pXMLFilter->SetAttribut("from", GetJid(jid));
+		pXMLFilter->SetAttribut("id", "id" + ToString(cid));
+		break;
+
+	default:
+		// left to the generic list
+		pXMLFilter = new CXMLFilter("presence");
+		break;
+	}
+
+	if(pChildFilter != NULL)
+	pXMLFilter->PushChild(pChildFilter);
+
+	pHandler->AddXMLFilter(pXMLFilter);
+
+	return pHandler;
+}
+
+static CXMLNode* CreateStanza(int kind, int jid, int cid, int sid)
+{
+	CXMLNode* pXMLNode;
+	CXMLNode* pChild = NULL;
+
+	switch(kind)
+	{
+	case BK_STREAMDATA:
+		pXMLNode = new CXMLNode("message");
+		pXMLNode->SetAttribut("from", GetJid(jid));
+		pXMLNode->SetAttribut("to", "me@example.org/tunnel");
+		pChild = new CXMLNode("stream-data");
+		pChild->SetAttribut("xmlns", BENCH_XMLNS);
+		pChild->SetAttribut("cid", ToString(cid));
+		pChild->SetAttribut("sid", ToString(sid));
+		break;
+
+	case BK_CHANNELDATA:
+		pXMLNode = new CXMLNode("message");
+		pXMLNode->SetAttribut("from", GetJid(jid));
+		pChild = new CXMLNode("channel-data");
+		pChild->SetAttribut("xmlns", BENCH_XMLNS);
+		pChild->SetAttribut("cid", ToString(cid));
+		break;
+
+	case BK_STREAMOPEN:
+		pXMLNode = new CXMLNode("iq");
+		pXMLNode->SetAttribut("type", "set");
+		pXMLNode->SetAttribut("id", "open" + ToString(cid));
+		pXMLNode->SetAttribut("from", GetJid(jid));
+		pChild = new CXMLNode("stream-open");
+		pChild->SetAttribut("xmlns", BENCH_XMLNS);
+		pChild->SetAttribut("cid", ToString(cid));
+		pChild->SetAttribut("sid", ToString(sid));
+		break;
+
+	case BK_IQ:
+		pXMLNode = new CXMLNode("iq");
+		pXMLNode->SetAttribut("type", "result");
+		pXMLNode->SetAttribut("from", GetJid(jid));
+		pXMLNode->SetAttribut("id", "id" + ToString(cid));
+		break;
+
+	default:
+		pXMLNode = new CXMLNode("presence");
+		pXMLNode->SetAttribut("from", GetJid(jid));
+		break;
+	}
+
+	if(pChild != NULL)
+	pXMLNode->PushChild(pChild);
+
+	return pXMLNode;
+}
+
+static void GetLinearMatching(const vector<CHandler*>& rHandlerList, const CXMLNode* pXMLNode, vector<CHandler*>& rMatchingList)
+{
+	for(unsigned long i = 0 ; i < rHandlerList.size() ; i++)
+	{
+		if(rHandlerList[i]->IsMatching(pXMLNode))
+		rMatchingList.push_back(rHandlerList[i]);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	try
+	{
+		CHandlerIndex HandlerIndex;
+		vector<CHandler*> HandlerList;
+		vector<CXMLNode*> StanzaList;
+		bool isOk = true;
+
+		srand(1);
+
+		// nine handlers out of ten are stream-data ones, as with one
+		// channel per session and many streams each
+		for(int i = 0 ; i < BENCH_NUMHANDLER ; i++)
+		{
+			int kind = i < BENCH_NUMHANDLER * 9 / 10 ? BK_STREAMDATA : rand() % BK_NUMKIND;
+			CHandler* pHandler = CreateHandler(kind, rand() % BENCH_NUMJID, rand() % BENCH_NUMCID, rand() % BENCH_NUMSID);
+
+			HandlerList.push_back(pHandler);
+			HandlerIndex.Insert(pHandler);
+		}
+
+		// streams come and go
+		for(int i = 0 ; i < BENCH_NUMREMOVED ; i++)
+		{
+			unsigned long index = rand() % HandlerList.size();
+
+			HandlerIndex.Erase(HandlerList[index]);
+			delete HandlerList[index];
+			HandlerList.erase(HandlerList.begin() + index);
+		}
+
+		if(HandlerIndex.GetNumHandler() != HandlerList.size())
+		{
+			cerr << "index holds " << HandlerIndex.GetNumHandler() << " handlers for " << HandlerList.size() << endl;
+			isOk = false;
+		}
+
+		// the stanzas also come from a jid nobody waits for
+		for(int i = 0 ; i < BENCH_NUMSTANZA ; i++)
+		{
+			int kind = i % 10 < 7 ? BK_STREAMDATA : rand() % BK_NUMKIND;
+			StanzaList.push_back(CreateStanza(kind, rand() % (BENCH_NUMJID + 1), rand() % BENCH_NUMCID, rand() % BENCH_NUMSID));
+		}
+
+		unsigned long numDelivery = 0;
+
+		for(unsigned long i = 0 ; isOk && i < StanzaList.size() ; i++)
+		{
+			vector<CHandler*> LinearList;
+			vector<CHandler*> IndexList;
+
+			GetLinearMatching(HandlerList, StanzaList[i], LinearList);
+			HandlerIndex.GetMatching(StanzaList[i], IndexList);
+
+			sort(LinearList.begin(), LinearList.end());
+			sort(IndexList.begin(), IndexList.end());
+
+			if(LinearList != IndexList)
+			{
+				cerr << "stanza " << i << " matches " << LinearList.size() << " handlers, the index gives " << IndexList.size() << endl;
+				isOk = false;
+			}
+
+			numDelivery += LinearList.size();
+		}
+
+		if(isOk)
+		{
+			unsigned long numMatch = 0;
+			double start = GetTime();
+
+			for(int r = 0 ; r < BENCH_LINEARROUND ; r++)
+			for(unsigned long i = 0 ; i < StanzaList.size() ; i++)
+			{
+				vector<CHandler*> MatchingList;
+				GetLinearMatching(HandlerList, StanzaList[i], MatchingList);
+				numMatch += MatchingList.size();
+			}
+
+			double linear = (GetTime() - start) / (BENCH_LINEARROUND * StanzaList.size());
+
+			start = GetTime();
+
+			for(int r = 0 ; r < BENCH_INDEXROUND ; r++)
+			for(unsigned long i = 0 ; i < StanzaList.size() ; i++)
+			{
+				vector<CHandler*> MatchingList;
+				HandlerIndex.GetMatching(StanzaList[i], MatchingList);
+				numMatch += MatchingList.size();
+			}
+
+			double index = (GetTime() - start) / (BENCH_INDEXROUND * StanzaList.size());
+
+			printf("%lu handlers, %lu stanzas, %lu deliveries: linear scan %.2f us/stanza, index %.3f us/stanza (%.0fx) ok\n", (unsigned long) HandlerList.size(), (unsigned long) StanzaList.size(), numDelivery, linear * 1e6, index * 1e6, linear / index);
+
+			if(numMatch != numDelivery * (BENCH_LINEARROUND + BENCH_INDEXROUND))
+			isOk = false;
+		}
+		else
+		printf("%lu handlers: FAILED\n", (unsigned long) HandlerList.size());
+
+		for(unsigned long i = 0 ; i < HandlerList.size() ; i++)
+		{
+			HandlerIndex.Erase(HandlerList[i]);
+			delete HandlerList[i];
+		}
+
+		for(unsigned long i = 0 ; i < StanzaList.size() ; i++)
+		delete StanzaList[i];
+
+		return isOk ? 0 : 1;
+	}
+
+	catch(exception& e)
+	{
+		cerr << "exit on error: " << e.what() << endl;
+		return 1;
+	}
+}
@@ -22,14 +22,20 @@
 
 #include <common/CException.h>
 #include <common/CObject.h>
+#include <common/thread/CRingQueue.h>
+#include <common/xml/CSharedXMLNode.h>
 #include <common/xml/CXMLNode.h>
 
 #include <xmpp/core/CHandler.h>
+#include <xmpp/xml/CStreamDataRecord.h>
 
 using namespace std;
 
-CHandler::CHandler()
-{}
+CHandler::CHandler() : XMLNodeQueue(HANDLER_QUEUESIZE, false)
+{
+	pExecutor = NULL;
+	pTask = NULL;
+}
 
 CHandler::~CHandler()
 {
@@ -50,9 +56,9 @@ void CHandler::AddXMLFilter(CXMLFilter* pXMLFilter)
 {
 	try
 	{
-		MutexXMLNodeQueue.Lock();
+		MutexXMLFilterList.Lock();
 		XMLFilterList.push_back(pXMLFilter);
-		MutexXMLNodeQueue.UnLock();
+		MutexXMLFilterList.UnLock();
 	}
 
 	catch(exception& e)
@@ -71,18 +77,18 @@ bool CHandler::IsMatching(const CXMLNode* pXMLNode)
 	{
 		// for each filter in XMLFilterList, we check that
 		// pXMLNode is matching at least one of root filter
-		MutexXMLNodeQueue.Lock();
+		MutexXMLFilterList.Lock();
 
 		for(u32 i = 0 ; i < XMLFilterList.size() ; i++)
 		{
 			if(XMLFilterList[i]->IsMatching(pXMLNode))
 			{
-				MutexXMLNodeQueue.UnLock();
+				MutexXMLFilterList.UnLock();
 				return true;
 			}
 		}
 		
-		MutexXMLNodeQueue.UnLock();
+		MutexXMLFilterList.UnLock();
 		return false;
 	}
 
@@ -96,16 +102,48 @@ bool CHandler::IsMatching(const CXMLNode* pXMLNode)
 	}
 }
 
+CObject::u32 CHandler::GetNumXMLFilter()
+{
+	MutexXMLFilterList.Lock();
+	u32 numXMLFilter = XMLFilterList.size();
+	MutexXMLFilterList.UnLock();
+
+	return numXMLFilter;
+}
+
+const CXMLFilter* CHandler::GetXMLFilter(u32 index)
+{
+	try
+	{
+		MutexXMLFilterList.Lock();
+
+		if(index >= XMLFilterList.size())
+		{
+			MutexXMLFilterList.UnLock();
+			throw CHandlerException(CHandlerException::HEC_GETXMLFILTERERROR);
+		}
+
+		const CXMLFilter* pXMLFilter = XMLFilterList[index];
+		MutexXMLFilterList.UnLock();
+
+		return pXMLFilter;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CHandlerException(CHandlerException::HEC_GETXMLFILTERERROR);
+	}
+}
+
 void CHandler::PushXMLNode(CXMLNode* pXMLNode)
 {
 	try
 	{
-		MutexXMLNodeQueue.Lock();
-		
-		XMLNodeQueue.push(pXMLNode);
-		MutexXMLNodeQueue.Signal();
-		
-		MutexXMLNodeQueue.UnLock();
+		PushSharedXMLNode(CSharedXMLNode::Create(pXMLNode, 1));
 	}
 
 	catch(exception& e)
@@ -118,27 +156,88 @@ void CHandler::PushXMLNode(CXMLNode* pXMLNode)
 	}
 }
 
-CXMLNode* CHandler::PopXMLNode()
+void CHandler::PushSharedXMLNode(CSharedXMLNode* pSharedXMLNode)
 {
 	try
 	{
-		MutexXMLNodeQueue.Lock();
-		
-		while(XMLNodeQueue.empty())
+		// the ring never blocks the core input thread, a destroyed
+		// handler just drops what it gets
+		if(!XMLNodeQueue.Push(pSharedXMLNode))
 		{
-			if(!MutexXMLNodeQueue.Wait())
-			{
-				MutexXMLNodeQueue.UnLock();
-				return NULL;
-			}
+			pSharedXMLNode->Release();
+			return;
 		}
-		
-		CXMLNode* pXMLNode = XMLNodeQueue.front();
-		XMLNodeQueue.pop();
 
-		MutexXMLNodeQueue.UnLock();
-	
-		return pXMLNode;
+		Notify();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CHandlerException(CHandlerException::HEC_PUSHSHAREDXMLNODEERROR);
+	}
+}
+
+CXMLNode* CHandler::PopXMLNode()
+{
+	try
+	{
+		void* pvSharedXMLNode;
+
+		if(!XMLNodeQueue.Pop(&pvSharedXMLNode))
+		return NULL;
+
+		// the copy of a shared stanza is made here, by the reader
+		return ((CSharedXMLNode*) pvSharedXMLNode)->Take();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CHandlerException(CHandlerException::HEC_POPXMLNODEERROR);
+	}
+}
+
+CXMLNode* CHandler::PopXMLNode(u32 timeout)
+{
+	try
+	{
+		void* pvSharedXMLNode;
+
+		// in microseconds, NULL when nothing came in time, 0 waits forever
+		if(!XMLNodeQueue.Pop(&pvSharedXMLNode, timeout))
+		return NULL;
+
+		return ((CSharedXMLNode*) pvSharedXMLNode)->Take();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CHandlerException(CHandlerException::HEC_POPXMLNODEERROR);
+	}
+}
+
+CXMLNode* CHandler::TryPopXMLNode()
+{
+	try
+	{
+		void* pvSharedXMLNode;
+
+		// NULL at once when the queue is empty, see IsDestroyed()
+		if(!XMLNodeQueue.TryPop(&pvSharedXMLNode))
+		return NULL;
+
+		return ((CSharedXMLNode*) pvSharedXMLNode)->Take();
 	}
 
 	catch(exception& e)
@@ -155,22 +254,25 @@ void CHandler::SignalDestroy()
 {
 	try
 	{
-		MutexXMLNodeQueue.Lock();
-	
-		MutexXMLNodeQueue.SignalDestroy();
+		void* pvSharedXMLNode;
 
-		while(XMLNodeQueue.size() > 0)
-		{
-			delete XMLNodeQueue.front();
-			XMLNodeQueue.pop();
-		}
+		XMLNodeQueue.Close();
+
+		while(XMLNodeQueue.TryPop(&pvSharedXMLNode))
+		((CSharedXMLNode*) pvSharedXMLNode)->Release();
+
+		MutexXMLFilterList.Lock();
 
 		for(u32 i = 0 ; i < XMLFilterList.size() ; i++)
 		delete XMLFilterList[i];
 		
 		XMLFilterList.clear();
 
-		MutexXMLNodeQueue.UnLock();
+		MutexXMLFilterList.UnLock();
+
+		// the task learns about it once, then forgets about us
+		Notify();
+		pTask = NULL;
 	}
 
 	catch(exception& e)
@@ -183,6 +285,70 @@ void CHandler::SignalDestroy()
 	}
 }
 
+bool CHandler::IsDestroyed() const
+{
+	// a destroyed handler is empty and gets nothing anymore
+	return XMLNodeQueue.IsClosed();
+}
+
+void CHandler::SetTask(CExecutor* pExecutor, CTask* pTask)
+{
+	// what was pushed before is not notified, the task looks for it once
+	// it is set
+	this->pExecutor = pExecutor;
+	this->pTask = pTask;
+
+	__sync_synchronize();
+}
+
+void CHandler::Notify()
+{
+	CTask* pTask = this->pTask;
+
+	if(pTask != NULL)
+	pExecutor->Submit(pTask);
+}
+
+bool CHandler::GetStreamDataRoute(string* pFrom, u16* pChannelId, u16* pStreamId) const
+{
+	return false;
+}
+
+void CHandler::PushStreamData(CStreamDataRecord* pStreamData)
+{
+	CXMLNode* pXMLNode = NULL;
+
+	try
+	{
+		// a plain handler only knows about nodes, we unfold the record
+		pXMLNode = new CXMLNode;
+		pStreamData->BuildMessageNode(pXMLNode);
+		delete pStreamData;
+		pStreamData = NULL;
+
+		// the queue owns the node from now on
+		CXMLNode* pPushedNode = pXMLNode;
+		pXMLNode = NULL;
+
+		PushXMLNode(pPushedNode);
+	}
+
+	catch(exception& e)
+	{
+		if(pStreamData != NULL)
+		delete pStreamData;
+
+		if(pXMLNode != NULL)
+		delete pXMLNode;
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CHandlerException(CHandlerException::HEC_PUSHSTREAMDATAERROR);
+	}
+}
+
 CHandlerException::CHandlerException(int code) : CException(code)
 {}
 
@@ -205,15 +371,24 @@ const char* CHandlerException::what() const throw()
 	case HEC_ISMATCHINGERROR:
 		return "CHandler::IsMatching() error";
 	
+	case HEC_GETXMLFILTERERROR:
+		return "CHandler::GetXMLFilter() error";
+
 	case HEC_PUSHXMLNODEERROR:
 		return "CHandler::PushXMLNode() error";
 	
+	case HEC_PUSHSHAREDXMLNODEERROR:
+		return "CHandler::PushSharedXMLNode() error";
+
 	case HEC_POPXMLNODEERROR:
 		return "CHandler::PopXMLNode() error";
 
 	case HEC_SIGNALDESTROYERROR:
 		return "CHandler::SignalDestroy() error";	
 
+	case HEC_PUSHSTREAMDATAERROR:
+		return "CHandler::PushStreamData() error";
+
 	default:
 		return "CHandler: Unknown error";
 	}
@@ -21,16 +21,22 @@
 #ifndef __CHANDLER_H__
 #define __CHANDLER_H__
 
-#include <queue>
+#include <string>
 #include <vector>
 
 #include <common/CException.h>
 #include <common/CObject.h>
+#include <common/thread/CExecutor.h>
 #include <common/thread/CMutex.h>
+#include <common/thread/CRingQueue.h>
+#include <common/thread/CTask.h>
+#include <common/xml/CSharedXMLNode.h>
 #include <common/xml/CXMLNode.h>
 
 #include <xmpp/core/CXMLFilter.h>
+#include <xmpp/xml/CStreamDataRecord.h>
 
+#define HANDLER_QUEUESIZE 64
 
 class CHandler : public CObject
 {
@@ -40,19 +46,40 @@ public:
 		
 	void AddXMLFilter(CXMLFilter* pXMLFilter);	
 	bool IsMatching(const CXMLNode* pXMLNode);
+
+	u32 GetNumXMLFilter();
+	const CXMLFilter* GetXMLFilter(u32 index);
 	
-	void PushXMLNode(CXMLNode* pXMLNode);
+	virtual void PushXMLNode(CXMLNode* pXMLNode);
+	virtual void PushSharedXMLNode(CSharedXMLNode* pSharedXMLNode);
 	CXMLNode* PopXMLNode();
-	void SignalDestroy();
+	CXMLNode* PopXMLNode(u32 timeout);
+	CXMLNode* TryPopXMLNode();
+	virtual void SignalDestroy();
+	bool IsDestroyed() const;
+
+	void SetTask(CExecutor* pExecutor, CTask* pTask);
+
+	virtual bool GetStreamDataRoute(string* pFrom, u16* pChannelId, u16* pStreamId) const;
+	virtual void PushStreamData(CStreamDataRecord* pStreamData);
+
+protected:
+	void Notify();
 
 private:
 	void Destroy();
-	
+
 private:
 	vector<CXMLFilter*> XMLFilterList;
+	CMutex MutexXMLFilterList;
+
+	// stanzas are queued as shared nodes, a stanza of our own is one
+	// with a single reference
+	CRingQueue XMLNodeQueue;
 
-	queue<CXMLNode*> XMLNodeQueue;
-	CMutex MutexXMLNodeQueue;
+	// submitted when something is pushed and when the handler is destroyed
+	CExecutor* pExecutor;
+	CTask* volatile pTask;
 };
 
 class CHandlerException : public CException
@@ -64,9 +91,12 @@ public:
 		HEC_DESTRUCTORERROR,
 		HEC_ADDXMLFILTERERROR,
 		HEC_ISMATCHINGERROR,
+		HEC_GETXMLFILTERERROR,
 		HEC_PUSHXMLNODEERROR,
+		HEC_PUSHSHAREDXMLNODEERROR,
 		HEC_POPXMLNODEERROR,
-		HEC_SIGNALDESTROYERROR
+		HEC_SIGNALDESTROYERROR,
+		HEC_PUSHSTREAMDATAERROR
 	};
 
 public:
@@ -0,0 +1,436 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/xml/CXMLAtom.h>
+#include <common/xml/CXMLNode.h>
+
+#include <xmpp/core/CHandler.h>
+#include <xmpp/core/CHandlerIndex.h>
+#include <xmpp/core/CXMLFilter.h>
+#include <xmpp/xml/CStreamDataRecord.h>
+
+using namespace std;
+
+#define HANDLERINDEX_NOSID 0xFFFFFFFF
+
+CHandlerIndex::CHandlerIndex()
+{}
+
+CHandlerIndex::~CHandlerIndex()
+{}
+
+void CHandlerIndex::Insert(CHandler* pHandler)
+{
+	try
+	{
+		vector<SRoute> RouteList;
+
+		if(RouteMap.find(pHandler) != RouteMap.end())
+		Erase(pHandler);
+
+		bool isIndexed = pHandler->GetNumXMLFilter() > 0;
+
+		// a handler is only indexed when every one of its filters gives a route,
+		// otherwise a stanza matching the other filters would never find it
+		for(u32 i = 0 ; i < pHandler->GetNumXMLFilter() && isIndexed ; i++)
+		{
+			SRoute Route;
+
+			if(GetRoute(pHandler->GetXMLFilter(i), &Route))
+			RouteList.push_back(Route);
+			else
+			isIndexed = false;
+		}
+
+		if(!isIndexed)
+		{
+			GenericList.insert(GenericList.begin(), pHandler);
+			RouteMap[pHandler].clear();
+			return;
+		}
+
+		for(u32 i = 0 ; i < RouteList.size() ; i++)
+		{
+			if(RouteList[i].kind == RK_ANYFROM)
+			{
+				AnyFromMap[RouteList[i].name].push_back(pHandler);
+				continue;
+			}
+
+			SBucket& rBucket = BucketMap[RouteList[i].from];
+
+			switch(RouteList[i].kind)
+			{
+			case RK_ANYFROM:
+			case RK_NAME:
+				rBucket.NameMap[RouteList[i].name].push_back(pHandler);
+				break;
+
+			case RK_ID:
+				rBucket.IdMap[RouteList[i].id].push_back(pHandler);
+				break;
+
+			case RK_CHILD:
+				rBucket.ChildMap[RouteList[i].child].push_back(pHandler);
+				break;
+			}
+		}
+
+		RouteMap[pHandler] = RouteList;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CHandlerIndexException(CHandlerIndexException::HIEC_INSERTERROR);
+	}
+}
+
+void CHandlerIndex::Erase(CHandler* pHandler)
+{
+	try
+	{
+		map<CHandler*, vector<SRoute> >::iterator it = RouteMap.find(pHandler);
+
+		if(it == RouteMap.end())
+		return;
+
+		if(it->second.empty())
+		RemoveHandler(GenericList, pHandler);
+
+		for(u32 i = 0 ; i < it->second.size() ; i++)
+		{
+			const SRoute& rRoute = it->second[i];
+
+			if(rRoute.kind == RK_ANYFROM)
+			{
+				map<u32, vector<CHandler*> >::iterator itName = AnyFromMap.find(rRoute.name);
+
+				if(itName != AnyFromMap.end())
+				{
+					RemoveHandler(itName->second, pHandler);
+
+					if(itName->second.empty())
+					AnyFromMap.erase(itName);
+				}
+
+				continue;
+			}
+
+			map<string, SBucket>::iterator itBucket = BucketMap.find(rRoute.from);
+
+			if(itBucket == BucketMap.end())
+			continue;
+
+			SBucket& rBucket = itBucket->second;
+
+			if(rRoute.kind == RK_NAME)
+			{
+				map<u32, vector<CHandler*> >::iterator itName = rBucket.NameMap.find(rRoute.name);
+
+				if(itName != rBucket.NameMap.end())
+				{
+					RemoveHandler(itName->second, pHandler);
+
+					if(itName->second.empty())
+					rBucket.NameMap.erase(itName);
+				}
+			}
+
+			if(rRoute.kind == RK_ID)
+			{
+				map<string, vector<CHandler*> >::iterator itId = rBucket.IdMap.find(rRoute.id);
+
+				if(itId != rBucket.IdMap.end())
+				{
+					RemoveHandler(itId->second, pHandler);
+
+					if(itId->second.empty())
+					rBucket.IdMap.erase(itId);
+				}
+			}
+
+			if(rRoute.kind == RK_CHILD)
+			{
+				map<pair<u32, pair<u32, u32> >, vector<CHandler*> >::iterator itChild = rBucket.ChildMap.find(rRoute.child);
+
+				if(itChild != rBucket.ChildMap.end())
+				{
+					RemoveHandler(itChild->second, pHandler);
+
+					if(itChild->second.empty())
+					rBucket.ChildMap.erase(itChild);
+				}
+			}
+
+			if(rBucket.NameMap.empty() && rBucket.IdMap.empty() && rBucket.ChildMap.empty())
+			BucketMap.erase(itBucket);
+		}
+
+		RouteMap.erase(it);
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CHandlerIndexException(CHandlerIndexException::HIEC_ERASEERROR);
+	}
+}
+
+void CHandlerIndex::Clear()
+{
+	BucketMap.clear();
+	AnyFromMap.clear();
+	GenericList.clear();
+	RouteMap.clear();
+}
+
+void CHandlerIndex::GetMatching(const CXMLNode* pXMLNode, vector<CHandler*>& rHandlerList)
+{
+	try
+	{
+		vector<CHandler*> CandidateList;
+		const string* pFrom = FindAttribut(pXMLNode, "from");
+
+		// we gather the handlers filed under the fields of the stanza, the
+		// filters still have the last word so a collision only costs a check
+		if(pFrom != NULL && !BucketMap.empty())
+		{
+			map<string, SBucket>::iterator itBucket = BucketMap.find(*pFrom);
+
+			if(itBucket != BucketMap.end())
+			{
+				SBucket& rBucket = itBucket->second;
+
+				if(pXMLNode->GetNameAtom().IsValid())
+				{
+					map<u32, vector<CHandler*> >::iterator itName = rBucket.NameMap.find(pXMLNode->GetNameAtom().GetId());
+
+					if(itName != rBucket.NameMap.end())
+					AddCandidate(itName->second, CandidateList);
+				}
+
+				const string* pId = FindAttribut(pXMLNode, "id");
+
+				if(pId != NULL && !rBucket.IdMap.empty())
+				{
+					map<string, vector<CHandler*> >::iterator itId = rBucket.IdMap.find(*pId);
+
+					if(itId != rBucket.IdMap.end())
+					AddCandidate(itId->second, CandidateList);
+				}
+
+				for(u32 i = 0 ; i < pXMLNode->GetNumChild() && !rBucket.ChildMap.empty() ; i++)
+				{
+					pair<u32, pair<u32, u32> > ChildKey;
+
+					// a filter may pin the cid alone or the cid and the sid
+					for(u32 j = 0 ; j < 2 ; j++)
+					{
+						if(!GetChildKey(pXMLNode->GetChild(i), j == 0, &ChildKey))
+						continue;
+
+						map<pair<u32, pair<u32, u32> >, vector<CHandler*> >::iterator itChild = rBucket.ChildMap.find(ChildKey);
+
+						if(itChild != rBucket.ChildMap.end())
+						AddCandidate(itChild->second, CandidateList);
+					}
+				}
+			}
+		}
+
+		if(pXMLNode->GetNameAtom().IsValid() && !AnyFromMap.empty())
+		{
+			map<u32, vector<CHandler*> >::iterator itName = AnyFromMap.find(pXMLNode->GetNameAtom().GetId());
+
+			if(itName != AnyFromMap.end())
+			AddCandidate(itName->second, CandidateList);
+		}
+
+		AddCandidate(GenericList, CandidateList);
+
+		for(u32 i = 0 ; i < CandidateList.size() ; i++)
+		{
+			if(CandidateList[i]->IsMatching(pXMLNode))
+			rHandlerList.push_back(CandidateList[i]);
+		}
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CHandlerIndexException(CHandlerIndexException::HIEC_GETMATCHINGERROR);
+	}
+}
+
+void CHandlerIndex::GetHandlerList(vector<CHandler*>& rHandlerList) const
+{
+	map<CHandler*, vector<SRoute> >::const_iterator it;
+
+	for(it = RouteMap.begin() ; it != RouteMap.end() ; it++)
+	rHandlerList.push_back(it->first);
+}
+
+CObject::u32 CHandlerIndex::GetNumHandler() const
+{
+	return RouteMap.size();
+}
+
+const string* CHandlerIndex::FindAttribut(const CXMLNode* pXMLNode, const char* attr)
+{
+	for(u32 i = 0 ; i < pXMLNode->GetNumAttribut() ; i += 2)
+	{
+		if(pXMLNode->GetAttribut(i) == attr)
+		return &pXMLNode->GetAttribut(i + 1);
+	}
+
+	return NULL;
+}
+
+bool CHandlerIndex::GetRoute(const CXMLFilter* pXMLFilter, SRoute* pRoute)
+{
+	const string* pFrom = FindAttribut(pXMLFilter, "from");
+
+	if(!pXMLFilter->GetNameAtom().IsValid())
+	return false;
+
+	pRoute->name = pXMLFilter->GetNameAtom().GetId();
+
+	if(pFrom == NULL)
+	{
+		pRoute->kind = RK_ANYFROM;
+		return true;
+	}
+
+	pRoute->from = *pFrom;
+
+	// the most selective field wins, an iq id beats a xibb child
+	const string* pId = FindAttribut(pXMLFilter, "id");
+
+	if(pId != NULL)
+	{
+		pRoute->kind = RK_ID;
+		pRoute->id = *pId;
+		return true;
+	}
+
+	for(u32 i = 0 ; i < pXMLFilter->GetNumChild() ; i++)
+	{
+		const CXMLFilter* pChildFilter = pXMLFilter->GetChild(i);
+
+		if(GetChildKey(pChildFilter, FindAttribut(pChildFilter, "sid") != NULL, &pRoute->child))
+		{
+			pRoute->kind = RK_CHILD;
+			return true;
+		}
+	}
+
+	pRoute->kind = RK_NAME;
+	return true;
+}
+
+bool CHandlerIndex::GetChildKey(const CXMLNode* pXMLNode, bool isSid, pair<u32, pair<u32, u32> >* pChildKey)
+{
+	const string* pCid = FindAttribut(pXMLNode, "cid");
+	const string* pSid = NULL;
+	u16 channelId;
+	u16 streamId = 0;
+
+	if(pCid == NULL || !pXMLNode->GetNameAtom().IsValid())
+	return false;
+
+	if(!CStreamDataRecord::ParseId(pCid->c_str(), &channelId))
+	return false;
+
+	if(isSid)
+	{
+		pSid = FindAttribut(pXMLNode, "sid");
+
+		if(pSid == NULL || !CStreamDataRecord::ParseId(pSid->c_str(), &streamId))
+		return false;
+	}
+
+	pChildKey->first = pXMLNode->GetNameAtom().GetId();
+	pChildKey->second.first = channelId;
+	pChildKey->second.second = isSid ? streamId : HANDLERINDEX_NOSID;
+
+	return true;
+}
+
+void CHandlerIndex::AddCandidate(const vector<CHandler*>& rBucketList, vector<CHandler*>& rHandlerList)
+{
+	// a handler with several filters may sit in more than one bucket
+	for(u32 i = 0 ; i < rBucketList.size() ; i++)
+	{
+		if(find(rHandlerList.begin(), rHandlerList.end(), rBucketList[i]) == rHandlerList.end())
+		rHandlerList.push_back(rBucketList[i]);
+	}
+}
+
+void CHandlerIndex::RemoveHandler(vector<CHandler*>& rBucketList, CHandler* pHandler)
+{
+	vector<CHandler*>::iterator it = find(rBucketList.begin(), rBucketList.end(), pHandler);
+
+	if(it != rBucketList.end())
+	rBucketList.erase(it);
+}
+
+
+CHandlerIndexException::CHandlerIndexException(int code) : CException(code)
+{}
+
+CHandlerIndexException::~CHandlerIndexException() throw()
+{}
+
+const char* CHandlerIndexException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case HIEC_INSERTERROR:
+		return "CHandlerIndex::Insert() error";
+
+	case HIEC_ERASEERROR:
+		return "CHandlerIndex::Erase() error";
+
+	case HIEC_GETMATCHINGERROR:
+		return "CHandlerIndex::GetMatching() error";
+
+	default:
+		return "CHandlerIndex: Unknown error";
+	}
+}
@@ -0,0 +1,115 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CHANDLERINDEX_H__
+#define __CHANDLERINDEX_H__
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/xml/CXMLNode.h>
+
+#include <xmpp/core/CHandler.h>
+#include <xmpp/core/CXMLFilter.h>
+
+using namespace std;
+
+// handlers indexed on the fields their filters pin down: the from jid and
+// then the element name, the iq id or the xibb cid/sid of the child, or the
+// element name alone when no from jid is given. a stanza only gets matched
+// against the handlers found under its own fields, the few handlers left
+// stay in a generic list that is scanned as before. filters must be added
+// before the handler is inserted
+class CHandlerIndex : public CObject
+{
+public:
+	CHandlerIndex();
+	virtual ~CHandlerIndex();
+
+	void Insert(CHandler* pHandler);
+	void Erase(CHandler* pHandler);
+	void Clear();
+
+	void GetMatching(const CXMLNode* pXMLNode, vector<CHandler*>& rHandlerList);
+	void GetHandlerList(vector<CHandler*>& rHandlerList) const;
+	u32 GetNumHandler() const;
+
+private:
+	enum RouteKind
+	{
+		RK_ANYFROM,
+		RK_NAME,
+		RK_ID,
+		RK_CHILD
+	};
+
+	struct SRoute
+	{
+		RouteKind kind;
+		string from;
+		u32 name;
+		string id;
+		pair<u32, pair<u32, u32> > child;
+	};
+
+	struct SBucket
+	{
+		map<u32, vector<CHandler*> > NameMap;
+		map<string, vector<CHandler*> > IdMap;
+		map<pair<u32, pair<u32, u32> >, vector<CHandler*> > ChildMap;
+	};
+
+private:
+	static const string* FindAttribut(const CXMLNode* pXMLNode, const char* attr);
+	static bool GetRoute(const CXMLFilter* pXMLFilter, SRoute* pRoute);
+	static bool GetChildKey(const CXMLNode* pXMLNode, bool isSid, pair<u32, pair<u32, u32> >* pChildKey);
+
+	static void AddCandidate(const vector<CHandler*>& rBucketList, vector<CHandler*>& rHandlerList);
+	static void RemoveHandler(vector<CHandler*>& rBucketList, CHandler* pHandler);
+
+private:
+	map<string, SBucket> BucketMap;
+	map<u32, vector<CHandler*> > AnyFromMap;
+	vector<CHandler*> GenericList;
+	map<CHandler*, vector<SRoute> > RouteMap;
+};
+
+class CHandlerIndexException : public CException
+{
+public:
+	enum HandlerIndexExceptionCode
+	{
+		HIEC_INSERTERROR,
+		HIEC_ERASEERROR,
+		HIEC_GETMATCHINGERROR
+	};
+
+public:
+	CHandlerIndexException(int code);
+	virtual ~CHandlerIndexException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif //__CHANDLERINDEX_H__
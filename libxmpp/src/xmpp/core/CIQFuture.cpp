@@ -0,0 +1,173 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <iostream>
+#include <time.h>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CMutex.h>
+#include <common/xml/CXMLNode.h>
+
+#include <xmpp/core/CIQFuture.h>
+#include <xmpp/core/CIQRequest.h>
+#include <xmpp/stanza/CStanza.h>
+
+using namespace std;
+
+CIQFuture::CIQFuture()
+{
+	pXMLNode = NULL;
+	isDone = false;
+}
+
+CIQFuture::~CIQFuture()
+{
+	try
+	{
+		// an answer already on its way is waited for, it would land in
+		// a destroyed object
+		if(!Cancel() && IsAnswered())
+		{
+			Mutex.Lock();
+
+			while(!isDone)
+			Mutex.Wait();
+
+			Mutex.UnLock();
+		}
+
+		if(pXMLNode != NULL)
+		delete pXMLNode;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+	}
+}
+
+void CIQFuture::OnResult(CXMLNode* pXMLNode)
+{
+	Mutex.Lock();
+
+	try
+	{
+		this->pXMLNode = pXMLNode;
+		isDone = true;
+
+		Mutex.Signal();
+		Mutex.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		Mutex.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CIQFutureException(CIQFutureException::IQFEC_ONRESULTERROR);
+	}
+}
+
+bool CIQFuture::Wait(CStanza* pStanza, u32 timeout)
+{
+	struct timespec Deadline;
+
+	if(timeout)
+	CMutex::GetDeadline(timeout, &Deadline);
+
+	Mutex.Lock();
+
+	try
+	{
+		while(!isDone)
+		{
+			if(!timeout)
+			{
+				Mutex.Wait();
+				continue;
+			}
+
+			if(Mutex.WaitUntil(Deadline) != CMutex::MWS_TIMEDOUT || isDone)
+			continue;
+
+			// in microseconds, past it the request is given up unless its
+			// answer is being handed to us right now. the core never holds
+			// its table while it calls OnResult(), we may cancel under Mutex
+			if(Cancel())
+			{
+				Mutex.UnLock();
+				return false;
+			}
+
+			timeout = 0;
+		}
+
+		CXMLNode* pXMLNode = this->pXMLNode;
+		this->pXMLNode = NULL;
+
+		Mutex.UnLock();
+
+		// a timeout or a lost connection gives no answer
+		if(pXMLNode == NULL)
+		return false;
+
+		pStanza->AttachXMLNode(pXMLNode);
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		Mutex.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CIQFutureException(CIQFutureException::IQFEC_WAITERROR);
+	}
+}
+
+CIQFutureException::CIQFutureException(int code) : CException(code)
+{}
+
+CIQFutureException::~CIQFutureException() throw()
+{}
+
+const char* CIQFutureException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case IQFEC_ONRESULTERROR:
+		return "CIQFuture::OnResult() error";
+
+	case IQFEC_WAITERROR:
+		return "CIQFuture::Wait() error";
+
+	default:
+		return "CIQFuture: Unknown error";
+	}
+}
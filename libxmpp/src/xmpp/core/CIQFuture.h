@@ -0,0 +1,65 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CIQFUTURE_H__
+#define __CIQFUTURE_H__
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CMutex.h>
+#include <common/xml/CXMLNode.h>
+
+#include <xmpp/core/CIQRequest.h>
+#include <xmpp/stanza/CStanza.h>
+
+// a request whose caller blocks until the answer comes, for the flows
+// that cannot go on without it
+class CIQFuture : public CIQRequest
+{
+public:
+	CIQFuture();
+	virtual ~CIQFuture();
+
+	virtual void OnResult(CXMLNode* pXMLNode);
+	bool Wait(CStanza* pStanza, u32 timeout = 0);
+
+private:
+	CXMLNode* pXMLNode;
+	bool isDone;
+	CMutex Mutex;
+};
+
+class CIQFutureException : public CException
+{
+public:
+	enum IQFutureExceptionCode
+	{
+		IQFEC_ONRESULTERROR,
+		IQFEC_WAITERROR
+	};
+
+public:
+	CIQFutureException(int code);
+	virtual ~CIQFutureException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif // __CIQFUTURE_H__
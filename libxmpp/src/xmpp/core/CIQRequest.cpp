@@ -0,0 +1,74 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <iostream>
+
+#include <common/CObject.h>
+#include <common/xml/CXMLNode.h>
+
+#include <xmpp/core/CIQRequest.h>
+#include <xmpp/core/CXMPPCore.h>
+
+using namespace std;
+
+CIQRequest::CIQRequest()
+{
+	pXMPPCore = NULL;
+	slot = 0;
+	isAnswered = false;
+}
+
+CIQRequest::~CIQRequest()
+{
+	try
+	{
+		Cancel();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+	}
+}
+
+bool CIQRequest::IsPending() const
+{
+	return pXMPPCore != NULL;
+}
+
+bool CIQRequest::Cancel()
+{
+	// true when the request left the table before any answer or timeout
+	// reached it, OnResult() is then never called
+	CXMPPCore* pXMPPCore = this->pXMPPCore;
+
+	if(pXMPPCore == NULL)
+	return false;
+
+	return pXMPPCore->CancelIQ(this);
+}
+
+bool CIQRequest::IsAnswered() const
+{
+	return isAnswered;
+}
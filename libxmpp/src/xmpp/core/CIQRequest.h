@@ -0,0 +1,60 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CIQREQUEST_H__
+#define __CIQREQUEST_H__
+
+#include <common/CObject.h>
+#include <common/xml/CXMLNode.h>
+
+class CXMPPCore;
+
+// an iq sent with CXMPPCore::SendIQ(). the core calls OnResult() exactly
+// once, with the result or error stanza, or with NULL when the request
+// timed out or the connection went away. OnResult() runs in the thread
+// that parsed the answer or in the timer thread, it must not block and it
+// owns the node it gets. Cancel() takes a request back, a derived class
+// calls it from its own destructor
+class CIQRequest : public CObject
+{
+public:
+	CIQRequest();
+	virtual ~CIQRequest();
+
+	bool IsPending() const;
+	bool Cancel();
+
+	virtual void OnResult(CXMLNode* pXMLNode) = 0;
+
+protected:
+	bool IsAnswered() const;
+
+private:
+	friend class CXMPPCore;
+
+	// set by the core while the request waits in its table
+	CXMPPCore* volatile pXMPPCore;
+	u32 slot;
+
+	// set once the core took the request out to answer it
+	volatile bool isAnswered;
+};
+
+#endif // __CIQREQUEST_H__
@@ -0,0 +1,291 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <deque>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <string>
+#include <utility>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CMutex.h>
+
+#include <xmpp/core/COutScheduler.h>
+
+using namespace std;
+
+#define OUTSCHEDULER_QUANTUM		4096
+#define OUTSCHEDULER_DEFAULTWEIGHT	1
+
+COutScheduler::COutScheduler()
+{
+	numItem = 0;
+}
+
+COutScheduler::~COutScheduler()
+{
+	// the items belong to the caller, it pops them before we go
+	for(map<string, SPeer*>::iterator it = PeerMap.begin() ; it != PeerMap.end() ; it++)
+	{
+		for(map<u32, SFlow*>::iterator itFlow = it->second->FlowMap.begin() ; itFlow != it->second->FlowMap.end() ; itFlow++)
+		delete itFlow->second;
+
+		delete it->second;
+	}
+}
+
+void COutScheduler::SetPeerWeight(const string& peer, u32 weight)
+{
+	MutexPeerWeightMap.Lock();
+
+	try
+	{
+		// a peer already queued keeps its weight until it runs dry, 0 gives
+		// the default weight back
+		if(weight == 0 || weight == OUTSCHEDULER_DEFAULTWEIGHT)
+		PeerWeightMap.erase(peer);
+		else
+		PeerWeightMap[peer] = weight;
+
+		MutexPeerWeightMap.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexPeerWeightMap.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw COutSchedulerException(COutSchedulerException::OSEC_SETPEERWEIGHTERROR);
+	}
+}
+
+void COutScheduler::PushControl(void* pItem)
+{
+	try
+	{
+		ControlQueue.push(pItem);
+		numItem++;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw COutSchedulerException(COutSchedulerException::OSEC_PUSHCONTROLERROR);
+	}
+}
+
+void COutScheduler::Push(const string& peer, u32 flow, u32 weight, void* pItem, u32 cost)
+{
+	try
+	{
+		// peers and flows only exist while they have something queued
+		SPeer* pPeer;
+		map<string, SPeer*>::iterator it = PeerMap.find(peer);
+
+		if(it != PeerMap.end())
+		pPeer = it->second;
+		else
+		{
+			pPeer = new SPeer;
+			pPeer->peer = peer;
+			pPeer->weight = GetPeerWeight(peer);
+			pPeer->deficit = 0;
+			pPeer->isCredited = false;
+
+			PeerMap[peer] = pPeer;
+			ActiveList.push_back(pPeer);
+		}
+
+		SFlow* pFlow;
+		map<u32, SFlow*>::iterator itFlow = pPeer->FlowMap.find(flow);
+
+		if(itFlow != pPeer->FlowMap.end())
+		pFlow = itFlow->second;
+		else
+		{
+			pFlow = new SFlow;
+			pFlow->flow = flow;
+			pFlow->deficit = 0;
+			pFlow->isCredited = false;
+
+			pPeer->FlowMap[flow] = pFlow;
+			pPeer->ActiveList.push_back(pFlow);
+		}
+
+		pFlow->weight = weight ? weight : OUTSCHEDULER_DEFAULTWEIGHT;
+		pFlow->ItemQueue.push(make_pair(pItem, cost));
+		numItem++;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw COutSchedulerException(COutSchedulerException::OSEC_PUSHERROR);
+	}
+}
+
+bool COutScheduler::Pop(void** ppItem)
+{
+	try
+	{
+		if(!ControlQueue.empty())
+		{
+			*ppItem = ControlQueue.front();
+			ControlQueue.pop();
+			numItem--;
+			return true;
+		}
+
+		while(!ActiveList.empty())
+		{
+			SPeer* pPeer = ActiveList.front();
+
+			if(!pPeer->isCredited)
+			{
+				pPeer->deficit += pPeer->weight * OUTSCHEDULER_QUANTUM;
+				pPeer->isCredited = true;
+			}
+
+			SFlow* pFlow = SelectFlow(pPeer);
+			u32 cost = pFlow->ItemQueue.front().second;
+
+			// the peer spent its share, it waits for the next round
+			if(pPeer->deficit < cost)
+			{
+				pPeer->isCredited = false;
+				ActiveList.pop_front();
+				ActiveList.push_back(pPeer);
+				continue;
+			}
+
+			*ppItem = pFlow->ItemQueue.front().first;
+			pFlow->ItemQueue.pop();
+			pFlow->deficit -= cost;
+			pPeer->deficit -= cost;
+			numItem--;
+
+			// a flow or a peer going idle loses what credit it had left
+			if(pFlow->ItemQueue.empty())
+			{
+				pPeer->ActiveList.pop_front();
+				pPeer->FlowMap.erase(pFlow->flow);
+				delete pFlow;
+			}
+
+			if(pPeer->ActiveList.empty())
+			{
+				ActiveList.pop_front();
+				PeerMap.erase(pPeer->peer);
+				delete pPeer;
+			}
+
+			return true;
+		}
+
+		return false;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw COutSchedulerException(COutSchedulerException::OSEC_POPERROR);
+	}
+}
+
+bool COutScheduler::IsEmpty() const
+{
+	return numItem == 0;
+}
+
+COutScheduler::SFlow* COutScheduler::SelectFlow(SPeer* pPeer)
+{
+	// same round robin as among peers, the flow in front is credited once
+	// per round and keeps the front while its credit covers its next item
+	while(true)
+	{
+		SFlow* pFlow = pPeer->ActiveList.front();
+
+		if(!pFlow->isCredited)
+		{
+			pFlow->deficit += pFlow->weight * OUTSCHEDULER_QUANTUM;
+			pFlow->isCredited = true;
+		}
+
+		if(pFlow->deficit >= pFlow->ItemQueue.front().second)
+		return pFlow;
+
+		pFlow->isCredited = false;
+		pPeer->ActiveList.pop_front();
+		pPeer->ActiveList.push_back(pFlow);
+	}
+}
+
+CObject::u32 COutScheduler::GetPeerWeight(const string& peer)
+{
+	MutexPeerWeightMap.Lock();
+
+	map<string, u32>::const_iterator it = PeerWeightMap.find(peer);
+	u32 weight = it != PeerWeightMap.end() ? it->second : OUTSCHEDULER_DEFAULTWEIGHT;
+
+	MutexPeerWeightMap.UnLock();
+
+	return weight;
+}
+
+COutSchedulerException::COutSchedulerException(int code) : CException(code)
+{}
+
+COutSchedulerException::~COutSchedulerException() throw()
+{}
+
+const char* COutSchedulerException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case OSEC_SETPEERWEIGHTERROR:
+		return "COutScheduler::SetPeerWeight() error";
+
+	case OSEC_PUSHCONTROLERROR:
+		return "COutScheduler::PushControl() error";
+
+	case OSEC_PUSHERROR:
+		return "COutScheduler::Push() error";
+
+	case OSEC_POPERROR:
+		return "COutScheduler::Pop() error";
+
+	default:
+		return "COutScheduler: Unknown error";
+	}
+}
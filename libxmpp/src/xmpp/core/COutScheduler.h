@@ -0,0 +1,107 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __COUTSCHEDULER_H__
+#define __COUTSCHEDULER_H__
+
+#include <deque>
+#include <map>
+#include <queue>
+#include <string>
+#include <utility>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CMutex.h>
+
+using namespace std;
+
+// picks the order in which queued stanzas are written: the control lane
+// goes first, then peers share the link by deficit round robin and the
+// flows of a peer share what their peer gets the same way. a peer or a
+// flow gets weight times the quantum bytes per round. only the writer
+// pushes and pops, peer weights may be set from any thread
+class COutScheduler : public CObject
+{
+public:
+	COutScheduler();
+	virtual ~COutScheduler();
+
+	void SetPeerWeight(const string& peer, u32 weight);
+
+	void PushControl(void* pItem);
+	void Push(const string& peer, u32 flow, u32 weight, void* pItem, u32 cost);
+	bool Pop(void** ppItem);
+
+	bool IsEmpty() const;
+
+private:
+	struct SFlow
+	{
+		u32 flow;
+		u32 weight;
+		u32 deficit;
+		bool isCredited;
+		queue<pair<void*, u32> > ItemQueue;
+	};
+
+	struct SPeer
+	{
+		string peer;
+		u32 weight;
+		u32 deficit;
+		bool isCredited;
+		map<u32, SFlow*> FlowMap;
+		deque<SFlow*> ActiveList;
+	};
+
+private:
+	SFlow* SelectFlow(SPeer* pPeer);
+	u32 GetPeerWeight(const string& peer);
+
+private:
+	queue<void*> ControlQueue;
+	map<string, SPeer*> PeerMap;
+	deque<SPeer*> ActiveList;
+	u32 numItem;
+
+	map<string, u32> PeerWeightMap;
+	CMutex MutexPeerWeightMap;
+};
+
+class COutSchedulerException : public CException
+{
+public:
+	enum OutSchedulerExceptionCode
+	{
+		OSEC_SETPEERWEIGHTERROR,
+		OSEC_PUSHCONTROLERROR,
+		OSEC_PUSHERROR,
+		OSEC_POPERROR
+	};
+
+public:
+	COutSchedulerException(int code);
+	virtual ~COutSchedulerException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif //__COUTSCHEDULER_H__
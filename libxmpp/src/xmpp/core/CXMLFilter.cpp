@@ -22,6 +22,7 @@
 
 #include <common/CException.h>
 #include <common/CObject.h>
+#include <common/xml/CXMLAtom.h>
 #include <common/xml/CXMLNode.h>
 
 #include <xmpp/core/CXMLFilter.h>
@@ -39,23 +40,46 @@ CXMLFilter::~CXMLFilter()
 
 bool CXMLFilter::IsMatching(const CXMLNode* pXMLNode) const
 {
-	if(GetName() != pXMLNode->GetName())
+	// names are atoms, we only compare integers unless a name fell out of the table
+	if(!IsSameName(pXMLNode))
 	return false;
 
 	for(u32 i = 0 ; i < GetNumAttribut() ; i += 2)
 	{
+		const CXMLAtom& rAttr = GetAttributAtom(i);
+
+		if(rAttr.IsValid())
+		{
+			if(!pXMLNode->IsExistAttribut(rAttr, GetAttribut(i + 1)))
+			return false;
+		}
+		else
 		if(!pXMLNode->IsExistAttribut(GetAttribut(i), GetAttribut(i + 1)))
 		return false;
 	}
 
 	for(u32 i = 0 ; i < GetNumChild() ; i++)
 	{
-		string childName = GetChild(i)->GetName();
-	
-		if(!pXMLNode->IsExistChild(childName))
-		return false;
+		const CXMLFilter* pChildFilter = GetChild(i);
+		const CXMLAtom& rChildName = pChildFilter->GetNameAtom();
+		CXMLNode* pChild;
+
+		if(rChildName.IsValid())
+		{
+			if(!pXMLNode->IsExistChild(rChildName))
+			return false;
+
+			pChild = pXMLNode->GetChild(rChildName);
+		}
+		else
+		{
+			if(!pXMLNode->IsExistChild(pChildFilter->GetName()))
+			return false;
+
+			pChild = pXMLNode->GetChild(pChildFilter->GetName());
+		}
 		
-		if(!GetChild(i)->IsMatching(pXMLNode->GetChild(childName)))
+		if(!pChildFilter->IsMatching(pChild))
 		return false;
 	}
 
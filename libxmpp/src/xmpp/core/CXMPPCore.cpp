@@ -18,19 +18,38 @@
  *
  */
  
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <map>
 #include <string>
 #include <iostream>
+#include <utility>
+#include <stdint.h>
+#include <time.h>
 
 #include <common/CException.h>
 #include <common/CObject.h>
 #include <common/data/CBase64.h>
 #include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
+#include <common/socket/CReactor.h>
+#include <common/socket/CReactorHandler.h>
 #include <common/socket/tcp/CTCPAddress.h>
 #include <common/socket/tcp/tls/CTLSConnection.h>
+#include <common/thread/CRingQueue.h>
+#include <common/thread/CTimer.h>
+#include <common/thread/CTimerWheel.h>
+#include <common/xml/CSharedXMLNode.h>
 #include <common/xml/CXMLNode.h>
 
+#include <xmpp/core/CHandler.h>
+#include <xmpp/core/CHandlerIndex.h>
+#include <xmpp/core/CIQRequest.h>
+#include <xmpp/core/COutScheduler.h>
 #include <xmpp/jid/CJid.h>
 #include <xmpp/stanza/CStanza.h>
+#include <xmpp/stanza/CStanzaTemplate.h>
 #include <xmpp/stanza/iq/CIQStanza.h>
 #include <xmpp/stanza/iq/result/CIQResultStanza.h>
 #include <xmpp/stanza/iq/set/CIQSetStanza.h>
@@ -47,12 +66,88 @@
 #include <xmpp/stanza/stream/CStarttlsStanza.h>
 #include <xmpp/stanza/stream/CSuccessStanza.h>
 #include <xmpp/core/CXMPPCore.h>
+#include <xmpp/xml/CStreamDataRecord.h>
 #include <xmpp/xml/CXMPPParser.h>
 
 using namespace std;
 
-CXMPPCore::CXMPPCore()
+// bounds of the adaptive socket read size
+#define XMPP_MINREADSIZE	1024
+#define XMPP_MAXREADSIZE	65536
+
+// the output ring is shared by every session thread, a full ring makes
+// them wait for the socket, stanzas nobody reads are dropped past the
+// input ring size
+#define XMPP_OUTQUEUESIZE	4096
+#define XMPP_INQUEUESIZE	1024
+
+// OutJob gathers queued stanzas into a single write up to this size
+#define XMPP_MAXOUTPUTSIZE	65536
+
+// plain messages are scheduled as one more flow of their peer, their size
+// is not known before they are built so they are charged a fixed cost
+#define XMPP_MESSAGEFLOW	0xFFFFFFFF
+#define XMPP_MESSAGECOST	512
+
+// data stanzas the senders may leave queued before they wait for the
+// writer, over the whole connection and over one flow
+#define XMPP_MAXQUEUEDSIZE	(4 * 1024 * 1024)
+#define XMPP_MAXFLOWQUEUEDSIZE	(256 * 1024)
+
+// ids of the iq sent with SendIQ() carry the slot of their request and a
+// sequence number
+#define XMPP_IDPREFIX		"XMPPSSH_"
+
+static uint64_t GetIQTime()
+{
+	struct timespec Time;
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+
+	return (uint64_t) Time.tv_sec * 1000000 + Time.tv_nsec / 1000;
+}
+
+static string BuildIQId(CObject::u32 slot, CObject::u32 sequence)
+{
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), XMPP_IDPREFIX "%lx_%lx", slot, sequence);
+
+	return buffer;
+}
+
+static bool ParseIQId(const string& id, CObject::u32* pSlot, CObject::u32* pSequence)
+{
+	const char* pId = id.c_str();
+	char* pEnd;
+
+	if(id.compare(0, sizeof(XMPP_IDPREFIX) - 1, XMPP_IDPREFIX) != 0)
+	return false;
+
+	pId += sizeof(XMPP_IDPREFIX) - 1;
+	*pSlot = strtoul(pId, &pEnd, 16);
+
+	if(pEnd == pId || *pEnd != '_')
+	return false;
+
+	pId = pEnd + 1;
+	*pSequence = strtoul(pId, &pEnd, 16);
+
+	return pEnd != pId && *pEnd == '\0';
+}
+
+CXMPPCore::CXMPPCore() : InQueue(XMPP_INQUEUESIZE, true), OutQueue(XMPP_OUTQUEUESIZE, true)
 {
+	readSize = XMPP_MINREADSIZE;
+	maxOutputDelay = 0;
+	maxQueuedSize = XMPP_MAXQUEUEDSIZE;
+	maxFlowQueuedSize = XMPP_MAXFLOWQUEUEDSIZE;
+	queuedSize = 0;
+	numOutputWaiter = 0;
+	pReactor = NULL;
+	outputOffset = 0;
+	isInputWantWrite = false;
+	isOutputWantRead = false;
+	isOutputWantWrite = false;
+	nextIQSequence = 0;
 }
 
 CXMPPCore::~CXMPPCore()
@@ -61,6 +156,13 @@ CXMPPCore::~CXMPPCore()
 	{
 		if(IsConnected())
 		Disconnect();
+		else
+		if(pReactor != NULL)
+		pReactor->Remove(this);
+
+		// a deadline firing right now is waited for
+		for(u32 i = 0 ; i < PendingIQList.size() ; i++)
+		delete PendingIQList[i];
 	}
 
 	catch(exception& e)
@@ -76,6 +178,28 @@ const CJid& CXMPPCore::GetJid() const
 	return Jid;
 }
 
+void CXMPPCore::SetReactor(CReactor* pReactor)
+{
+	try
+	{
+		// taken into account at the next connection, NULL gives the
+		// connection its own input and output threads
+		if(IsConnected())
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_SETREACTORERROR);
+
+		this->pReactor = pReactor;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_SETREACTORERROR);
+	}
+}
+
 void CXMPPCore::Connect(const CJid* pJid, const CTCPAddress* pTCPAddress)
 {
 	try
@@ -86,14 +210,34 @@ void CXMPPCore::Connect(const CJid* pJid, const CTCPAddress* pTCPAddress)
 		TLSConnection.Connect(&TCPAddress);
 		
 		XMPPParser.ReInit();
+		readSize = XMPP_MINREADSIZE;
 		Negociate();
 		
-		MutexInQueue.ReInit();
-		MutexOutQueue.ReInit();
+		InQueue.ReInit();
+		OutQueue.ReInit();
 		MutexHandlerList.ReInit();
 
-		ThreadInJob.Run(&InJob, this);
-		ThreadOutJob.Run(&OutJob, this);
+		if(pReactor == NULL)
+		{
+			ThreadInJob.Run(&InJob, this);
+			ThreadOutJob.Run(&OutJob, this);
+			return;
+		}
+
+		// the negotiation is done blocking, the stream is then left to the
+		// reactor threads
+		OutputBuffer.Resize(0);
+		outputOffset = 0;
+		isInputWantWrite = false;
+		isOutputWantRead = false;
+		isOutputWantWrite = false;
+
+		TLSConnection.SetBlocking(false);
+		pReactor->Add(this, TLSConnection.GetTCPAddress().GetSocket());
+
+		// the negotiation may have read past its last stanza, nobody would
+		// tell us about what is already buffered
+		pReactor->Signal(this, REACTOR_READ);
 	}
 	
 	catch(exception& e)
@@ -113,180 +257,1044 @@ void CXMPPCore::Disconnect()
 		CCloseStanza CloseStanza;
 		CBuffer Buffer;
 
+		// past this point no reactor thread runs us anymore
+		if(pReactor != NULL)
+		pReactor->Remove(this);
+
 		if(TLSConnection.IsConnected())
 		{
+			if(pReactor != NULL)
+			FlushOutput();
+
 			SendStanza(&CloseStanza);
 			TLSConnection.Disconnect();
 		}
 
-		MutexInQueue.SignalDestroy();
-		MutexOutQueue.SignalDestroy();
+		InQueue.Close();
+		OutQueue.Close();
+		WakeSenders();
 
 		ThreadInJob.Wait();
 		ThreadOutJob.Wait();
 
+		ClearQueues();
+		FailIQ();
+
 		MutexHandlerList.Lock();
 
+		vector<CHandler*> HandlerList;
+		HandlerIndex.GetHandlerList(HandlerList);
+
 		for(u32 i = 0 ; i < HandlerList.size() ; i++)
 		HandlerList[i]->SignalDestroy();
 
-		HandlerList.clear();	
+		HandlerIndex.Clear();
+		StreamDataRouteMap.clear();
+
+		MutexHandlerList.UnLock();
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_DISCONNECTERROR);
+	}
+}
+
+bool CXMPPCore::IsConnected() const
+{
+	return TLSConnection.IsConnected();
+}
+
+void* CXMPPCore::InJob(void* pvThis) throw()
+{
+	try
+	{
+		CXMPPCore* pThis = (CXMPPCore*) pvThis;
+
+		while(pThis->IsConnected())
+		{
+			CStanza Stanza;
+			CStreamDataRecord* pStreamData;
+
+			if(!pThis->ReceiveStanza(&Stanza, &pStreamData))
+			break;
+
+			pThis->PushStanza(&Stanza, pStreamData);
+		}
+		
+		// no answer comes past the end of the stream
+		pThis->FailIQ();
+		return NULL;
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		return NULL;
+	}
+}
+
+void* CXMPPCore::OutJob(void* pvThis) throw()
+{
+	try
+	{
+		CXMPPCore* pThis = (CXMPPCore*) pvThis;
+		
+		while(pThis->IsConnected())
+		{
+			if(!pThis->SendOutItems())
+			break;
+		}
+
+		// nobody drains the output anymore, waiting senders give up
+		pThis->OutQueue.Close();
+		pThis->WakeSenders();
+
+		return NULL;
+	}
+	
+	catch(exception& e)
+	{
+		CXMPPCore* pThis = (CXMPPCore*) pvThis;
+
+		pThis->OutQueue.Close();
+		pThis->WakeSenders();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		return NULL;
+	}
+}
+
+void CXMPPCore::RequestHandler(CHandler* pHandler)
+{
+	try
+	{
+		string From;
+		u16 channelId;
+		u16 streamId;
+
+		MutexHandlerList.Lock();
+		HandlerIndex.Insert(pHandler);
+
+		if(pHandler->GetStreamDataRoute(&From, &channelId, &streamId))
+		StreamDataRouteMap[make_pair(From, ((u32) channelId << 16) | streamId)] = pHandler;
+
+		MutexHandlerList.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_REQUESTHANDLERERROR);	
+	}
+}
+
+void CXMPPCore::CommitHandler(CHandler* pHandler)
+{
+	try
+	{
+		MutexHandlerList.Lock();
+
+		HandlerIndex.Erase(pHandler);
+
+		map<pair<string, u32>, CHandler*>::iterator it = StreamDataRouteMap.begin();
+
+		while(it != StreamDataRouteMap.end())
+		{
+			if(it->second == pHandler)
+			StreamDataRouteMap.erase(it++);
+			else
+			it++;
+		}
+
+		pHandler->SignalDestroy();
+		MutexHandlerList.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_COMMITHANDLERERROR);	
+	}
+}
+
+void CXMPPCore::SetMaxOutputDelay(u32 maxOutputDelay)
+{
+	// in microseconds, 0 writes as soon as the queue runs dry
+	this->maxOutputDelay = maxOutputDelay;
+}
+
+void CXMPPCore::SetPeerWeight(const CJid& rJid, u32 weight)
+{
+	// the peer gets weight times the output share of a default peer
+	OutScheduler.SetPeerWeight(rJid.GetFull(), weight);
+}
+
+void CXMPPCore::SetMaxQueuedSize(u32 maxQueuedSize, u32 maxFlowQueuedSize)
+{
+	// in bytes of data stanzas, 0 leaves the output unbounded
+	this->maxQueuedSize = maxQueuedSize;
+	this->maxFlowQueuedSize = maxFlowQueuedSize;
+}
+
+bool CXMPPCore::SendIQ(CStanza* pStanza, CIQRequest* pRequest, u32 timeout)
+{
+	MutexIQ.Lock();
+
+	try
+	{
+		if(pRequest->pXMPPCore != NULL)
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_SENDIQERROR);
+
+		if(FreeIQList.empty())
+		{
+			SPendingIQ* pPendingIQ = new SPendingIQ;
+			pPendingIQ->pXMPPCore = this;
+			pPendingIQ->slot = PendingIQList.size();
+			pPendingIQ->pRequest = NULL;
+			pPendingIQ->sequence = 0;
+			pPendingIQ->deadline = 0;
+
+			FreeIQList.push_back(PendingIQList.size());
+			PendingIQList.push_back(pPendingIQ);
+		}
+
+		u32 slot = FreeIQList.back();
+		SPendingIQ& rPendingIQ = *PendingIQList[slot];
+
+		rPendingIQ.pRequest = pRequest;
+		rPendingIQ.sequence = __sync_add_and_fetch(&nextIQSequence, 1);
+		rPendingIQ.deadline = timeout ? GetIQTime() + timeout : 0;
+
+		// only the entity we asked may answer, a request to our server
+		// carries no to
+		if(pStanza->GetXMLNode()->IsExistAttribut("to"))
+		rPendingIQ.from = pStanza->GetTo();
+		else
+		rPendingIQ.from.clear();
+
+		pStanza->SetId(BuildIQId(slot, rPendingIQ.sequence));
+
+		// each slot is a timer of its own, arming and cancelling it does
+		// not depend on how many requests are in flight
+		if(rPendingIQ.deadline)
+		TimerWheel.Arm(&rPendingIQ, timeout);
+
+		FreeIQList.pop_back();
+
+		pRequest->pXMPPCore = this;
+		pRequest->slot = slot;
+		pRequest->isAnswered = false;
+
+		MutexIQ.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexIQ.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_SENDIQERROR);
+	}
+
+	try
+	{
+		// the answer may well come before Send() returns
+		if(Send(pStanza))
+		return true;
+
+		// when the lost connection already failed the request, its
+		// OnResult() was called and we report it as sent
+		return !CancelIQ(pRequest);
+	}
+
+	catch(exception& e)
+	{
+		CancelIQ(pRequest);
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_SENDIQERROR);
+	}
+}
+
+bool CXMPPCore::CancelIQ(CIQRequest* pRequest)
+{
+	MutexIQ.Lock();
+
+	try
+	{
+		if(pRequest->pXMPPCore != this)
+		{
+			MutexIQ.UnLock();
+			return false;
+		}
+
+		TakeIQ(pRequest->slot);
+
+		MutexIQ.UnLock();
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		MutexIQ.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_CANCELIQERROR);
+	}
+}
+
+CTimerWheel* CXMPPCore::GetTimerWheel()
+{
+	return &TimerWheel;
+}
+
+void CXMPPCore::GenerateId(string& id)
+{
+	try
+	{
+		// ids of our own stanzas only have to differ from each other
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), XMPP_IDPREFIX "%lx", (unsigned long) __sync_add_and_fetch(&nextIQSequence, 1));
+
+		id = buffer;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_GENERATEIDERROR);	
+	}
+}
+
+bool CXMPPCore::Receive(CStanza* pStanza, u32 timeout)
+{
+	try
+	{
+		if(!IsConnected())
+		return false;
+	
+		void* pvXMLNode;
+
+		// in microseconds, 0 waits until a stanza comes or the connection
+		// goes away
+		if(timeout == 0 && !InQueue.Pop(&pvXMLNode))
+		return false;
+
+		if(timeout != 0 && !InQueue.Pop(&pvXMLNode, timeout))
+		return false;
+		
+		pStanza->AttachXMLNode((CXMLNode*) pvXMLNode);
+		
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_RECEIVEERROR);	
+	}
+}
+
+bool CXMPPCore::Receive(CHandler* pHandler, CStanza* pStanza, u32 timeout)
+{
+	try
+	{
+		if(!IsConnected())
+		return false;
+		
+		CXMLNode* pXMLNode = timeout ? pHandler->PopXMLNode(timeout) : pHandler->PopXMLNode();
+		
+		if(pXMLNode == NULL)
+		return false;
+		
+		pStanza->AttachXMLNode(pXMLNode);
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_RECEIVEHANDLERERROR);	
+	}
+}
+
+bool CXMPPCore::TryReceive(CHandler* pHandler, CStanza* pStanza)
+{
+	try
+	{
+		if(!IsConnected())
+		return false;
+
+		// false at once when nothing is queued for the handler
+		CXMLNode* pXMLNode = pHandler->TryPopXMLNode();
+
+		if(pXMLNode == NULL)
+		return false;
+
+		pStanza->AttachXMLNode(pXMLNode);
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_RECEIVEHANDLERERROR);	
+	}
+}
+
+bool CXMPPCore::Send(CStanza* pStanza)
+{
+	try
+	{
+		if(!IsConnected())
+		return false;
+
+		// iq, presence and stream management take the control lane
+		SOutItem* pOutItem = new SOutItem;
+		pOutItem->isControl = pStanza->GetKindOf() != CStanza::SKO_MESSAGE;
+
+		if(!pOutItem->isControl)
+		pOutItem->peer = pStanza->GetTo();
+
+		pOutItem->pXMLNode = pStanza->DetachXMLNode();
+		pOutItem->pTemplate = NULL;
+		pOutItem->pPayload = NULL;
+
+		if(!OutQueue.Push(pOutItem))
+		{
+			delete pOutItem->pXMLNode;
+			delete pOutItem;
+			return false;
+		}
+
+		if(pReactor != NULL)
+		pReactor->Signal(this, REACTOR_WAKE);
+		
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_SENDERROR);	
+	}
+}
+
+bool CXMPPCore::Send(CStanzaTemplate* pTemplate, CBuffer* pPayload, bool isBlocking)
+{
+	try
+	{
+		// the queue takes over the template reference and the payload, a
+		// full output makes us wait for the writer or drop the packet
+		if(!IsConnected() || (IsOutputFull(pTemplate) && (!isBlocking || !WaitOutput(pTemplate))))
+		{
+			pTemplate->Release();
+			delete pPayload;
+			return false;
+		}
+
+		SOutItem* pOutItem = new SOutItem;
+		pOutItem->pXMLNode = NULL;
+		pOutItem->pTemplate = pTemplate;
+		pOutItem->pPayload = pPayload;
+		pOutItem->isControl = false;
+
+		u32 size = pTemplate->GetSize(pPayload->GetBufferSize());
+		__sync_add_and_fetch(&queuedSize, size);
+		pTemplate->AddQueuedSize(size);
+
+		if(!OutQueue.Push(pOutItem))
+		{
+			DeleteOutItem(pOutItem);
+			return false;
+		}
+
+		if(pReactor != NULL)
+		pReactor->Signal(this, REACTOR_WAKE);
+		
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_SENDERROR);	
+	}
+}
+
+bool CXMPPCore::IsOutputFull(const CStanzaTemplate* pTemplate) const
+{
+	// the bounds are checked before a packet is added, so concurrent senders
+	// may go over them by a packet each
+	if(maxQueuedSize && queuedSize >= maxQueuedSize)
+	return true;
+
+	return maxFlowQueuedSize && pTemplate->GetQueuedSize() >= maxFlowQueuedSize;
+}
+
+bool CXMPPCore::WaitOutput(const CStanzaTemplate* pTemplate)
+{
+	MutexOutput.Lock();
+
+	try
+	{
+		// the writer checks for waiters after it frees some room, we count
+		// ourselves before we check for it
+		__sync_add_and_fetch(&numOutputWaiter, 1);
+
+		while(IsOutputFull(pTemplate) && IsConnected() && !OutQueue.IsClosed())
+		MutexOutput.Wait();
+
+		__sync_sub_and_fetch(&numOutputWaiter, 1);
+
+		bool isOpen = IsConnected() && !OutQueue.IsClosed();
+
+		MutexOutput.UnLock();
+
+		return isOpen;
+	}
+
+	catch(exception& e)
+	{
+		__sync_sub_and_fetch(&numOutputWaiter, 1);
+		MutexOutput.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_WAITOUTPUTERROR);
+	}
+}
+
+bool CXMPPCore::RouteIQ(CStanza* pStanza)
+{
+	try
+	{
+		CXMLNode* pXMLNode = pStanza->GetXMLNode();
+		u32 slot;
+		u32 sequence;
+
+		if(pXMLNode == NULL || pStanza->GetKindOf() != CStanza::SKO_IQ)
+		return false;
+
+		if(!pXMLNode->IsExistAttribut("type", "result") && !pXMLNode->IsExistAttribut("type", "error"))
+		return false;
+
+		if(!pXMLNode->IsExistAttribut("id") || !ParseIQId(pStanza->GetId(), &slot, &sequence))
+		return false;
+
+		bool isFrom = pXMLNode->IsExistAttribut("from");
+
+		MutexIQ.Lock();
+
+		// anything we do not recognize goes on to the handlers
+		if(slot >= PendingIQList.size() || PendingIQList[slot]->pRequest == NULL || PendingIQList[slot]->sequence != sequence)
+		{
+			MutexIQ.UnLock();
+			return false;
+		}
+
+		const string& from = PendingIQList[slot]->from;
+
+		if(!from.empty() && (!isFrom || pStanza->GetFrom() != from))
+		{
+			MutexIQ.UnLock();
+			return false;
+		}
+
+		CIQRequest* pRequest = TakeIQ(slot);
+		pRequest->isAnswered = true;
+
+		MutexIQ.UnLock();
+
+		pRequest->OnResult(pStanza->DetachXMLNode());
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_ROUTEIQERROR);
+	}
+}
+
+CIQRequest* CXMPPCore::TakeIQ(u32 slot)
+{
+	try
+	{
+		// must be called with MutexIQ held
+		SPendingIQ& rPendingIQ = *PendingIQList[slot];
+		CIQRequest* pRequest = rPendingIQ.pRequest;
+
+		// does not wait for a deadline firing right now, ExpireIQ() then
+		// finds the slot answered
+		if(rPendingIQ.deadline)
+		TimerWheel.Cancel(&rPendingIQ);
+
+		rPendingIQ.pRequest = NULL;
+		FreeIQList.push_back(slot);
+
+		pRequest->pXMPPCore = NULL;
+		return pRequest;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_TAKEIQERROR);
+	}
+}
+
+void CXMPPCore::ExpireIQ(u32 slot)
+{
+	CIQRequest* pRequest;
+
+	MutexIQ.Lock();
+
+	try
+	{
+		// the slot may have been answered, and even sent again, while its
+		// deadline fired
+		SPendingIQ& rPendingIQ = *PendingIQList[slot];
+
+		if(rPendingIQ.pRequest == NULL || rPendingIQ.deadline == 0 || rPendingIQ.deadline > GetIQTime())
+		{
+			MutexIQ.UnLock();
+			return;
+		}
+
+		pRequest = TakeIQ(slot);
+		pRequest->isAnswered = true;
+
+		MutexIQ.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexIQ.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_EXPIREIQERROR);
+	}
+
+	// the request is out of the table, it learns about it outside of the lock
+	pRequest->OnResult(NULL);
+}
+
+void CXMPPCore::SPendingIQ::OnTimer()
+{
+	pXMPPCore->ExpireIQ(slot);
+}
+
+void CXMPPCore::FailIQ()
+{
+	vector<CIQRequest*> FailedList;
+
+	MutexIQ.Lock();
+
+	try
+	{
+		for(u32 i = 0 ; i < PendingIQList.size() ; i++)
+		{
+			if(PendingIQList[i]->pRequest == NULL)
+			continue;
+
+			CIQRequest* pRequest = TakeIQ(i);
+			pRequest->isAnswered = true;
+
+			FailedList.push_back(pRequest);
+		}
+
+		MutexIQ.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexIQ.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_FAILIQERROR);
+	}
+
+	// no answer will come on a closed connection
+	for(u32 i = 0 ; i < FailedList.size() ; i++)
+	FailedList[i]->OnResult(NULL);
+}
+
+void CXMPPCore::PushStanza(CStanza* pStanza, CStreamDataRecord* pStreamData)
+{
+	try
+	{
+		// stream data goes straight to its handler, the DOM is only
+		// built when nobody registered the route
+		if(pStreamData != NULL)
+		{
+			if(RouteStreamData(pStreamData))
+			return;
+
+			CXMLNode* pXMLNode = new CXMLNode;
+			pStreamData->BuildMessageNode(pXMLNode);
+			delete pStreamData;
+
+			pStanza->AttachXMLNode(pXMLNode);
+		}
+
+		// answers to our own requests go straight to their caller
+		if(RouteIQ(pStanza))
+		return;
+		
+		// If the stanza received is matching an existing handler
+		// we push it into the queue in this handler
+		vector<CHandler*> MatchList;
+		MutexHandlerList.Lock();
+
+		try
+		{
+			HandlerIndex.GetMatching(pStanza->GetXMLNode(), MatchList);
+
+			// a single reader gets the parsed tree itself, several readers
+			// share it and only copy it when they pop it
+			if(MatchList.size() == 1)
+			MatchList[0]->PushXMLNode(pStanza->DetachXMLNode());
+
+			if(MatchList.size() > 1)
+			{
+				CSharedXMLNode* pSharedXMLNode = CSharedXMLNode::Create(pStanza->DetachXMLNode(), MatchList.size());
+
+				for(u32 i = 0 ; i < MatchList.size() ; i++)
+				MatchList[i]->PushSharedXMLNode(pSharedXMLNode);
+			}
+		}
+
+		catch(exception&)
+		{
+			MutexHandlerList.UnLock();
+			throw;
+		}
+
+		MutexHandlerList.UnLock();
+		
+		// if the stanza does not match any handler we push it in the InQueue
+		if(MatchList.empty())
+		{
+			CXMLNode* pXMLNode = pStanza->DetachXMLNode();
+
+			if(!InQueue.TryPush(pXMLNode))
+			delete pXMLNode;
+		}
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_PUSHSTANZAERROR);
+	}
+}
+
+bool CXMPPCore::RouteStreamData(CStreamDataRecord* pStreamData)
+{
+	try
+	{
+		MutexHandlerList.Lock();
+
+		map<pair<string, u32>, CHandler*>::iterator it = StreamDataRouteMap.find(make_pair(pStreamData->GetFrom(), ((u32) pStreamData->GetChannelId() << 16) | pStreamData->GetStreamId()));
+
+		if(it == StreamDataRouteMap.end())
+		{
+			MutexHandlerList.UnLock();
+			return false;
+		}
+
+		it->second->PushStreamData(pStreamData);
+
+		MutexHandlerList.UnLock();
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		MutexHandlerList.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_ROUTESTREAMDATAERROR);	
+	}
+}
+
+void CXMPPCore::ClearQueues()
+{
+	try
+	{
+		// what the threads left behind belongs to the closed session
+		void* pvItem;
+
+		while(InQueue.TryPop(&pvItem))
+		delete (CXMLNode*) pvItem;
 
-		MutexHandlerList.UnLock();
+		while(OutQueue.TryPop(&pvItem))
+		DeleteOutItem((SOutItem*) pvItem);
+
+		while(OutScheduler.Pop(&pvItem))
+		DeleteOutItem((SOutItem*) pvItem);
 	}
-	
+
 	catch(exception& e)
 	{
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_DISCONNECTERROR);
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_CLEARQUEUESERROR);
 	}
 }
 
-bool CXMPPCore::IsConnected() const
+bool CXMPPCore::SendOutItems()
 {
-	return TLSConnection.IsConnected();
-}
+	vector<SOutItem*> OutItemList;
 
-void* CXMPPCore::InJob(void* pvThis) throw()
-{
 	try
 	{
-		CXMPPCore* pThis = (CXMPPCore*) pvThis;
+		void* pvOutItem;
 
-		while(pThis->IsConnected())
+		// the scheduler picks from everything the senders queued so far,
+		// we only sleep on the queue when it has nothing left
+		if(OutScheduler.IsEmpty())
 		{
-			CStanza Stanza;
+			if(!OutQueue.Pop(&pvOutItem))
+			return false;
 
-			if(!pThis->ReceiveStanza(&Stanza))
-			return NULL;
-			
-			// If the stanza received is matching an existing handler
-			// we push it into the queue in this handler
-			pThis->MutexHandlerList.Lock();
-			
-			u32 i = 0;
-			bool match = false;
-			
-			while(i < pThis->HandlerList.size())
+			ScheduleOutItem((SOutItem*) pvOutItem);
+		}
+
+		while(OutQueue.TryPop(&pvOutItem))
+		ScheduleOutItem((SOutItem*) pvOutItem);
+
+		// we write the picked items all at once, they are kept until then
+		// since the chain only references their data
+		CBufferChain BufferChain;
+		struct timespec Start;
+
+		if(maxOutputDelay)
+		clock_gettime(CLOCK_MONOTONIC, &Start);
+
+		while(BufferChain.GetSize() < XMPP_MAXOUTPUTSIZE)
+		{
+			if(!OutScheduler.Pop(&pvOutItem))
 			{
-				if(pThis->HandlerList[i]->IsMatching(Stanza.GetXMLNode()))
+				if(OutQueue.TryPop(&pvOutItem))
 				{
-					match = true;
-					CXMLNode* pXMLNode = new CXMLNode;
-					pXMLNode->CopyFrom(Stanza.GetXMLNode());
-					pThis->HandlerList[i]->PushXMLNode(pXMLNode);
+					ScheduleOutItem((SOutItem*) pvOutItem);
+					continue;
 				}
 
-				i++;
-			}
-			
-			pThis->MutexHandlerList.UnLock();
-			
-			// if the stanza does not match any handler we push it in the InQueue
-			if(match == false)
-			{
-				pThis->MutexInQueue.Lock();
+				if(maxOutputDelay == 0)
+				break;
+
+				// the queue ran dry, we may hold the write a little longer
+				struct timespec Now;
+				clock_gettime(CLOCK_MONOTONIC, &Now);
 
-				pThis->InQueue.insert(pThis->InQueue.end(), Stanza.DetachXMLNode());
-				
-				pThis->MutexInQueue.Signal();
-				
-				pThis->MutexInQueue.UnLock();
+				u32 elapsed = (Now.tv_sec - Start.tv_sec) * 1000000 + (Now.tv_nsec - Start.tv_nsec) / 1000;
+
+				if(elapsed >= maxOutputDelay || !OutQueue.Pop(&pvOutItem, maxOutputDelay - elapsed))
+				break;
+
+				ScheduleOutItem((SOutItem*) pvOutItem);
+				continue;
 			}
+
+			SOutItem* pOutItem = (SOutItem*) pvOutItem;
+			OutItemList.push_back(pOutItem);
+
+			BuildOutItem(pOutItem, &BufferChain);
 		}
-		
-		return NULL;
+
+		bool isSent = SendBufferChain(&BufferChain);
+
+		for(u32 i = 0 ; i < OutItemList.size() ; i++)
+		DeleteOutItem(OutItemList[i]);
+
+		WakeSenders();
+
+		return isSent;
 	}
-	
+
 	catch(exception& e)
 	{
+		for(u32 i = 0 ; i < OutItemList.size() ; i++)
+		DeleteOutItem(OutItemList[i]);
+
+		WakeSenders();
+
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		return NULL;
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_SENDOUTITEMSERROR);
 	}
 }
 
-void* CXMPPCore::OutJob(void* pvThis) throw()
+void CXMPPCore::ScheduleOutItem(SOutItem* pOutItem)
 {
 	try
 	{
-		CXMPPCore* pThis = (CXMPPCore*) pvThis;
-		
-		while(pThis->IsConnected())
+		if(pOutItem->isControl)
+		OutScheduler.PushControl(pOutItem);
+		else if(pOutItem->pTemplate != NULL)
 		{
-			CStanza Stanza;
-
-			pThis->MutexOutQueue.Lock();
-		
-			while(pThis->OutQueue.empty())
-			{
-				if(!pThis->MutexOutQueue.Wait())
-				{
-					pThis->MutexOutQueue.UnLock();
-					return NULL;
-				}
-			}
-			
-			Stanza.AttachXMLNode(pThis->OutQueue[0]);
-			pThis->OutQueue.erase(pThis->OutQueue.begin() + 0);
-
-			pThis->MutexOutQueue.UnLock();
-
-			if(!pThis->SendStanza(&Stanza))
-			return NULL;
+			CStanzaTemplate* pTemplate = pOutItem->pTemplate;
+			OutScheduler.Push(pTemplate->GetPeer(), pTemplate->GetFlow(), pTemplate->GetWeight(), pOutItem, pTemplate->GetSize(pOutItem->pPayload->GetBufferSize()));
 		}
-		
-		return NULL;
+		else
+		OutScheduler.Push(pOutItem->peer, XMPP_MESSAGEFLOW, 1, pOutItem, XMPP_MESSAGECOST);
 	}
-	
+
 	catch(exception& e)
 	{
+		DeleteOutItem(pOutItem);
+
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		return NULL;
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_SCHEDULEOUTITEMERROR);
 	}
 }
 
-void CXMPPCore::RequestHandler(CHandler* pHandler)
+void CXMPPCore::BuildOutItem(const SOutItem* pOutItem, CBufferChain* pBufferChain)
 {
-	try
+	if(pOutItem->pTemplate != NULL)
+	pOutItem->pTemplate->Build(pBufferChain, pOutItem->pPayload->GetBuffer(), pOutItem->pPayload->GetBufferSize());
+	else
 	{
-		MutexHandlerList.Lock();
-		HandlerList.insert(HandlerList.begin(), pHandler);
-		MutexHandlerList.UnLock();
+		CBufferChain StanzaChain;
+		pOutItem->pXMLNode->Build(&StanzaChain);
+		pBufferChain->Append(&StanzaChain);
 	}
+}
 
-	catch(exception& e)
+void CXMPPCore::WakeSenders()
+{
+	if(numOutputWaiter == 0)
+	return;
+
+	MutexOutput.Lock();
+	MutexOutput.Signal();
+	MutexOutput.UnLock();
+}
+
+void CXMPPCore::DeleteOutItem(SOutItem* pOutItem)
+{
+	if(pOutItem->pTemplate != NULL)
 	{
-		#ifdef __DEBUG__
-		cerr << e.what() << endl;
-		#endif //__DEBUG__
+		u32 size = pOutItem->pTemplate->GetSize(pOutItem->pPayload->GetBufferSize());
+		__sync_sub_and_fetch(&queuedSize, size);
+		pOutItem->pTemplate->SubQueuedSize(size);
 
-		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_REQUESTHANDLERERROR);	
+		pOutItem->pTemplate->Release();
+		delete pOutItem->pPayload;
 	}
+	else
+	delete pOutItem->pXMLNode;
+
+	delete pOutItem;
 }
 
-void CXMPPCore::CommitHandler(CHandler* pHandler)
+void CXMPPCore::OnEvent(u32 events)
 {
 	try
 	{
-		MutexHandlerList.Lock();
+		if(!IsConnected())
+		return;
 
-		for(u32 i = 0 ; i < HandlerList.size() ; i++)
+		// the TLS layer may need the other direction to go on, a read
+		// waiting for the socket to drain or a write for records to come
+		bool isOutputBlocked = isOutputWantRead || isOutputWantWrite;
+		bool isInput = (events & (REACTOR_READ | REACTOR_ERROR)) || (isInputWantWrite && (events & REACTOR_WRITE));
+		bool isOutput = (events & REACTOR_WRITE) || ((events & REACTOR_WAKE) && !isOutputBlocked) || (isOutputWantRead && (events & REACTOR_READ));
+
+		if(isInput && !ReceiveInput())
 		{
-			if(HandlerList[i] == pHandler)
-			HandlerList.erase(HandlerList.begin() + i);
+			Close();
+			return;
 		}
 
-		pHandler->SignalDestroy();
-		MutexHandlerList.UnLock();
+		if(isOutput)
+		{
+			if(!SendOutput())
+			Close();
+
+			return;
+		}
+
+		// a blocked socket still lets us take the senders items off the
+		// ring, the write itself waits for the socket to come back
+		void* pvOutItem;
+
+		while(OutQueue.TryPop(&pvOutItem))
+		ScheduleOutItem((SOutItem*) pvOutItem);
 	}
 
 	catch(exception& e)
@@ -295,34 +1303,61 @@ void CXMPPCore::CommitHandler(CHandler* pHandler)
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_COMMITHANDLERERROR);	
+		// the reactor drops the error, a connection left open here would
+		// never be served again and its requests never answered
+		CloseOnError();
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_ONEVENTERROR);
 	}
 }
 
-void CXMPPCore::GenerateId(string& id)
+bool CXMPPCore::ReceiveInput()
 {
 	try
 	{
-		MutexIDList.Lock();
-		
-		string randomId;
-		srand(time(NULL));
-		
-		do
+		// the events are edge triggered, we read until the socket runs dry
+		while(true)
 		{
-			randomId = "XMPPSSH_";
-			for(u8 i = 0 ; i < 10 ; i++)
+			while(XMPPParser.GetNumXMLNode())
 			{
-				int r = rand() % 36;
-				(r < 26) ? randomId += (char) (r + 'A') : randomId += (char) (r - 26 + '0');
+				CStanza Stanza;
+				CXMLNode* pXMLNode;
+				CStreamDataRecord* pStreamData;
+
+				XMPPParser.GetNext(&pXMLNode, &pStreamData);
+
+				if(pXMLNode != NULL)
+				Stanza.AttachXMLNode(pXMLNode);
+
+				PushStanza(&Stanza, pStreamData);
 			}
-		}while(IsIdExist(randomId));
-		
-		id = randomId;
 
-		IDList.push_back(randomId);
+			u8* pData = XMPPParser.GetWriteBuffer(readSize);
+			u32 receiveSize;
+			u32 status = TLSConnection.TryReceive(pData, readSize, &receiveSize);
+
+			isInputWantWrite = status == CTLSConnection::TLSCS_WANTWRITE;
+
+			if(status == CTLSConnection::TLSCS_CLOSED)
+			return false;
+
+			if(status != CTLSConnection::TLSCS_DONE)
+			return true;
+
+			#ifdef __DEBUG__
+			cout << "<-[";			
+			cout.write((const char*) pData, receiveSize);
+			cout << "]"<< endl;
+			#endif //__DEBUG__
+			
+			XMPPParser.WriteBuffer(receiveSize);
 
-		MutexIDList.UnLock();
+			if(receiveSize == readSize && readSize < XMPP_MAXREADSIZE)
+			readSize *= 2;
+			else
+			if(receiveSize < readSize / 4 && readSize > XMPP_MINREADSIZE)
+			readSize /= 2;
+		}
 	}
 
 	catch(exception& e)
@@ -331,28 +1366,33 @@ void CXMPPCore::GenerateId(string& id)
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_GENERATEIDERROR);	
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_RECEIVEINPUTERROR);
 	}
 }
 
-void CXMPPCore::RemoveId(const string& id)
+bool CXMPPCore::SendOutput()
 {
 	try
 	{
-		MutexIDList.Lock();
-		
-		for(u32 i = 0 ; i < IDList.size() ; i++)
+		while(true)
 		{
-			if(IDList[i] == id)
-			{
-				IDList.erase(IDList.begin() + i);
-				MutexIDList.UnLock();
-				return;
-			}
+			if(outputOffset == OutputBuffer.GetBufferSize() && !FillOutput())
+			return true;
+
+			u32 sendSize;
+			u32 status = TLSConnection.TrySend(OutputBuffer.GetBuffer() + outputOffset, OutputBuffer.GetBufferSize() - outputOffset, &sendSize);
+
+			isOutputWantRead = status == CTLSConnection::TLSCS_WANTREAD;
+			isOutputWantWrite = status == CTLSConnection::TLSCS_WANTWRITE;
+
+			if(status == CTLSConnection::TLSCS_CLOSED)
+			return false;
+
+			if(status != CTLSConnection::TLSCS_DONE)
+			return true;
+
+			outputOffset += sendSize;
 		}
-	
-		MutexIDList.UnLock();
-		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_REMOVEIDERROR);	
 	}
 
 	catch(exception& e)
@@ -361,60 +1401,93 @@ void CXMPPCore::RemoveId(const string& id)
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_REMOVEIDERROR);	
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_SENDOUTPUTERROR);
 	}
 }
 
-bool CXMPPCore::Receive(CStanza* pStanza)
+bool CXMPPCore::FillOutput()
 {
+	vector<SOutItem*> OutItemList;
+
 	try
 	{
-		if(!IsConnected())
+		// the same picking as SendOutItems() without ever waiting, output
+		// delays are left to the thread mode
+		void* pvOutItem;
+
+		while(OutQueue.TryPop(&pvOutItem))
+		ScheduleOutItem((SOutItem*) pvOutItem);
+
+		CBufferChain BufferChain;
+
+		while(BufferChain.GetSize() < XMPP_MAXOUTPUTSIZE && OutScheduler.Pop(&pvOutItem))
+		{
+			SOutItem* pOutItem = (SOutItem*) pvOutItem;
+			OutItemList.push_back(pOutItem);
+
+			BuildOutItem(pOutItem, &BufferChain);
+		}
+
+		if(OutItemList.empty())
 		return false;
-	
-		MutexInQueue.Lock();
 
-		while(InQueue.empty())
+		#ifdef __DEBUG__
+		cout << "->[";
+		for(u32 i = 0 ; i < BufferChain.GetNumSegment() ; i++)
 		{
-			if(!MutexInQueue.Wait())
-			{
-				MutexOutQueue.UnLock();
-				return false;
-			}
+			const u8* pData;
+			u32 dataSize;
+
+			BufferChain.GetSegment(i, &pData, &dataSize);
+			cout.write((const char*) pData, dataSize);
 		}
-		
-		pStanza->AttachXMLNode(InQueue[0]);
-		InQueue.erase(InQueue.begin() + 0);
+		cout << "]"<< endl;
+		#endif //__DEBUG__
+
+		// the socket may take only part of it, we keep the bytes rather
+		// than the items so that the senders get their room back now
+		BufferChain.Flatten(&OutputBuffer);
+		outputOffset = 0;
+
+		for(u32 i = 0 ; i < OutItemList.size() ; i++)
+		DeleteOutItem(OutItemList[i]);
+
+		WakeSenders();
 
-		MutexInQueue.UnLock();
-		
 		return true;
 	}
 
 	catch(exception& e)
 	{
+		for(u32 i = 0 ; i < OutItemList.size() ; i++)
+		DeleteOutItem(OutItemList[i]);
+
+		WakeSenders();
+
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_RECEIVEERROR);	
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_FILLOUTPUTERROR);
 	}
 }
 
-bool CXMPPCore::Receive(CHandler* pHandler, CStanza* pStanza)
+void CXMPPCore::FlushOutput()
 {
 	try
 	{
-		if(!IsConnected())
-		return false;
-		
-		CXMLNode* pXMLNode = pHandler->PopXMLNode();
-		
-		if(pXMLNode == NULL)
-		return false;
-		
-		pStanza->AttachXMLNode(pXMLNode);
-		return true;
+		// the rest of a write cut short goes before anything else
+		TLSConnection.SetBlocking(true);
+
+		while(outputOffset < OutputBuffer.GetBufferSize())
+		{
+			u32 sendSize;
+
+			if(TLSConnection.TrySend(OutputBuffer.GetBuffer() + outputOffset, OutputBuffer.GetBufferSize() - outputOffset, &sendSize) != CTLSConnection::TLSCS_DONE)
+			break;
+
+			outputOffset += sendSize;
+		}
 	}
 
 	catch(exception& e)
@@ -423,25 +1496,27 @@ bool CXMPPCore::Receive(CHandler* pHandler, CStanza* pStanza)
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_RECEIVEHANDLERERROR);	
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_FLUSHOUTPUTERROR);
 	}
 }
 
-bool CXMPPCore::Send(CStanza* pStanza)
+void CXMPPCore::Close()
 {
 	try
 	{
-		if(!IsConnected())
-		return false;
+		// the peer went away, we let go of the socket before closing it as
+		// the descriptor may be handed out again right after
+		pReactor->Remove(this);
 
-		MutexOutQueue.Lock();
-	
-		OutQueue.insert(OutQueue.end(), pStanza->DetachXMLNode());
-		MutexOutQueue.Signal();
+		if(TLSConnection.IsSecured())
+		TLSConnection.Unsecure();
 
-		MutexOutQueue.UnLock();
-		
-		return true;
+		TLSConnection.Disconnect();
+
+		// as in thread mode, senders give up and readers wait for Disconnect()
+		OutQueue.Close();
+		WakeSenders();
+		FailIQ();
 	}
 
 	catch(exception& e)
@@ -450,21 +1525,15 @@ bool CXMPPCore::Send(CStanza* pStanza)
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_SENDERROR);	
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_CLOSEERROR);
 	}
 }
 
-bool CXMPPCore::IsIdExist(const string& id)
+void CXMPPCore::CloseOnError() throw()
 {
 	try
 	{
-		for(u32 i = 0 ; i < IDList.size() ; i++)
-		{
-			if(IDList[i] == id)
-			return true;
-		}
-		
-		return false;
+		Close();
 	}
 
 	catch(exception& e)
@@ -473,7 +1542,18 @@ bool CXMPPCore::IsIdExist(const string& id)
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_ISIDEXISTERROR);	
+		// whatever failed, nobody waits for an answer past this point
+		try
+		{
+			FailIQ();
+		}
+
+		catch(exception& e)
+		{
+			#ifdef __DEBUG__
+			cerr << e.what() << endl;
+			#endif //__DEBUG__
+		}
 	}
 }
 
@@ -484,17 +1564,44 @@ bool CXMPPCore::SendStanza(const CStanza* pStanza)
 		if(!IsConnected())
 		return false;
 	
-		CBuffer Buffer;
-		pStanza->Build(&Buffer);
+		// the stanza payload is written from the node itself, not copied
+		CBufferChain BufferChain;
+		pStanza->Build(&BufferChain);
+
+		return SendBufferChain(&BufferChain);
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_SENDSTANZAERROR);
+	}
+}
+
+bool CXMPPCore::SendBufferChain(const CBufferChain* pBufferChain)
+{
+	try
+	{
+		if(!IsConnected())
+		return false;
 
 		#ifdef __DEBUG__
 		cout << "->[";
-		for(u32 i = 0 ; i < Buffer.GetBufferSize() ; i++)
-		cout << Buffer.GetBuffer()[i];
+		for(u32 i = 0 ; i < pBufferChain->GetNumSegment() ; i++)
+		{
+			const u8* pData;
+			u32 dataSize;
+
+			pBufferChain->GetSegment(i, &pData, &dataSize);
+			cout.write((const char*) pData, dataSize);
+		}
 		cout << "]"<< endl;
 		#endif //__DEBUG__
 		
-		if(!TLSConnection.Send(&Buffer))
+		if(!TLSConnection.Send(pBufferChain))
 		return false;
 
 		return true;
@@ -506,11 +1613,42 @@ bool CXMPPCore::SendStanza(const CStanza* pStanza)
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_SENDSTANZAERROR);
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_SENDBUFFERCHAINERROR);
 	}
 }
 
 bool CXMPPCore::ReceiveStanza(CStanza* pStanza)
+{
+	try
+	{
+		CStreamDataRecord* pStreamData;
+
+		if(!ReceiveStanza(pStanza, &pStreamData))
+		return false;
+
+		if(pStreamData != NULL)
+		{
+			CXMLNode* pXMLNode = new CXMLNode;
+			pStreamData->BuildMessageNode(pXMLNode);
+			delete pStreamData;
+
+			pStanza->AttachXMLNode(pXMLNode);
+		}
+
+		return true;
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPCoreException(CXMPPCoreException::XMPPCEC_RECEIVESTANZAERROR);
+	}
+}
+
+bool CXMPPCore::ReceiveStanza(CStanza* pStanza, CStreamDataRecord** ppStreamData)
 {
 	try
 	{
@@ -519,23 +1657,36 @@ bool CXMPPCore::ReceiveStanza(CStanza* pStanza)
 
 		while(XMPPParser.GetNumXMLNode() == 0)
 		{
-			CBuffer Buffer(1000);
+			// we read straight into the parser memory
+			u8* pData = XMPPParser.GetWriteBuffer(readSize);
+			u32 receiveSize;
 
-			if(!TLSConnection.Receive(&Buffer))
+			if(!TLSConnection.Receive(pData, readSize, &receiveSize))
 			return false;
 
 			#ifdef __DEBUG__
 			cout << "<-[";			
-			for(u32 i = 0 ; i < Buffer.GetBufferSize() ; i++)
-			cout << Buffer.GetBuffer()[i];
-			
-			 cout << "]"<< endl;
+			cout.write((const char*) pData, receiveSize);
+			cout << "]"<< endl;
 			#endif //__DEBUG__
 			
-			XMPPParser.Write(&Buffer);
+			XMPPParser.WriteBuffer(receiveSize);
+
+			// a full read means more is waiting, a small one that traffic calmed down
+			if(receiveSize == readSize && readSize < XMPP_MAXREADSIZE)
+			readSize *= 2;
+			else
+			if(receiveSize < readSize / 4 && readSize > XMPP_MINREADSIZE)
+			readSize /= 2;
 		}
-	
-		pStanza->AttachXMLNode(XMPPParser.GetXMLNode());
+
+		// the parser gives either a stanza or a stream data record
+		CXMLNode* pXMLNode;
+		XMPPParser.GetNext(&pXMLNode, ppStreamData);
+
+		if(pXMLNode != NULL)
+		pStanza->AttachXMLNode(pXMLNode);
+
 		return true;
 	}
 	
@@ -850,6 +2001,9 @@ const char* CXMPPCoreException::what() const throw()
 {
 	switch(GetCode())
 	{
+	case XMPPCEC_SETREACTORERROR:
+		return "CXMPPCore::SetReactor() error";
+
 	case XMPPCEC_CONNECTERROR:
 		return "CXMPPCore::Connect() error";
 
@@ -859,14 +2013,53 @@ const char* CXMPPCoreException::what() const throw()
 	case XMPPCEC_SENDSTANZAERROR:
 		return "CXMPPCore::SendStanza() error";
 
+	case XMPPCEC_SENDBUFFERCHAINERROR:
+		return "CXMPPCore::SendBufferChain() error";
+
+	case XMPPCEC_SCHEDULEOUTITEMERROR:
+		return "CXMPPCore::ScheduleOutItem() error";
+
+	case XMPPCEC_SENDOUTITEMSERROR:
+		return "CXMPPCore::SendOutItems() error";
+
+	case XMPPCEC_PUSHSTANZAERROR:
+		return "CXMPPCore::PushStanza() error";
+
+	case XMPPCEC_ONEVENTERROR:
+		return "CXMPPCore::OnEvent() error";
+
+	case XMPPCEC_RECEIVEINPUTERROR:
+		return "CXMPPCore::ReceiveInput() error";
+
+	case XMPPCEC_SENDOUTPUTERROR:
+		return "CXMPPCore::SendOutput() error";
+
+	case XMPPCEC_FILLOUTPUTERROR:
+		return "CXMPPCore::FillOutput() error";
+
+	case XMPPCEC_FLUSHOUTPUTERROR:
+		return "CXMPPCore::FlushOutput() error";
+
+	case XMPPCEC_CLOSEERROR:
+		return "CXMPPCore::Close() error";
+
 	case XMPPCEC_RECEIVESTANZAERROR:
 		return "CXMPPCore::ReceiveStanza() error";
 
+	case XMPPCEC_ROUTESTREAMDATAERROR:
+		return "CXMPPCore::RouteStreamData() error";
+
+	case XMPPCEC_CLEARQUEUESERROR:
+		return "CXMPPCore::ClearQueues() error";
+
 	case XMPPCEC_RECEIVEERROR:
 		return "CXMPPCore::Receive() error";
 		
 	case XMPPCEC_SENDERROR:
 		return "CXMPPCore::Send() error";
+
+	case XMPPCEC_WAITOUTPUTERROR:
+		return "CXMPPCore::WaitOutput() error";
 		
 	case XMPPCEC_REQUESTHANDLERERROR:
 		return "CXMPPCore::RequestHandler() error";
@@ -877,14 +2070,26 @@ const char* CXMPPCoreException::what() const throw()
 	case XMPPCEC_COMMITHANDLERERROR:
 		return "CXMPPCore::CommitHandler() error";
 
+	case XMPPCEC_SENDIQERROR:
+		return "CXMPPCore::SendIQ() error";
+
+	case XMPPCEC_CANCELIQERROR:
+		return "CXMPPCore::CancelIQ() error";
+
 	case XMPPCEC_GENERATEIDERROR:	
 		return "CXMPPCore::GenerateUniqueId() error";	
 
-	case XMPPCEC_REMOVEIDERROR:	
-		return "CXMPPCore::RemoveId() error";	
+	case XMPPCEC_ROUTEIQERROR:
+		return "CXMPPCore::RouteIQ() error";
+
+	case XMPPCEC_TAKEIQERROR:
+		return "CXMPPCore::TakeIQ() error";
+
+	case XMPPCEC_EXPIREIQERROR:
+		return "CXMPPCore::ExpireIQ() error";
 
-	case XMPPCEC_ISIDEXISTERROR:
-		return "CXMPPCore::IsIdExist() error";	
+	case XMPPCEC_FAILIQERROR:
+		return "CXMPPCore::FailIQ() error";
 
 	case XMPPCEC_NEGOCIATEERROR:
 		return "CXMPPCore::Negociate() error";
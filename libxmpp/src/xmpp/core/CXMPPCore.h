@@ -21,50 +21,87 @@
 #ifndef __CXMPPCORE_H__
 #define __CXMPPCORE_H__
 
+#include <map>
+#include <stdint.h>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <common/CException.h>
 #include <common/CObject.h>
+#include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
+#include <common/socket/CReactor.h>
+#include <common/socket/CReactorHandler.h>
 #include <common/socket/tcp/CTCPAddress.h>
 #include <common/socket/tcp/tls/CTLSConnection.h>
+#include <common/thread/CRingQueue.h>
 #include <common/thread/CThread.h>
+#include <common/thread/CTimer.h>
+#include <common/thread/CTimerWheel.h>
 #include <common/xml/CXMLNode.h>
 
 #include <xmpp/core/CHandler.h>
+#include <xmpp/core/CHandlerIndex.h>
+#include <xmpp/core/CIQRequest.h>
+#include <xmpp/core/COutScheduler.h>
 #include <xmpp/jid/CJid.h>
 #include <xmpp/stanza/CStanza.h>
+#include <xmpp/stanza/CStanzaTemplate.h>
 #include <xmpp/stanza/iq/CIQStanza.h>
+#include <xmpp/xml/CStreamDataRecord.h>
 #include <xmpp/xml/CXMPPParser.h>
 
 using namespace std;
 
-class CXMPPCore : public CObject
+// how long an iq sent with SendIQ() waits for its answer, in microseconds
+#define XMPPCORE_IQTIMEOUT (60 * 1000000)
+
+class CXMPPCore : public CReactorHandler
 {
 public:
 	CXMPPCore();
 	virtual ~CXMPPCore();
 
+	void SetReactor(CReactor* pReactor);
+
 	void Connect(const CJid* pJid, const CTCPAddress* pTCPAddress);
 	void Disconnect();
 	
 	bool IsConnected() const;
 
 	bool Send(CStanza* pStanza);
-	bool Receive(CStanza* pStanza);
-	bool Receive(CHandler* pHandler, CStanza* pStanza);
+	bool Send(CStanzaTemplate* pTemplate, CBuffer* pPayload, bool isBlocking = true);
+	bool Receive(CStanza* pStanza, u32 timeout = 0);
+	bool Receive(CHandler* pHandler, CStanza* pStanza, u32 timeout = 0);
+	bool TryReceive(CHandler* pHandler, CStanza* pStanza);
+
+	bool IsOutputFull(const CStanzaTemplate* pTemplate) const;
+	bool WaitOutput(const CStanzaTemplate* pTemplate);
 
 	const CJid& GetJid() const;
 
+	void SetMaxOutputDelay(u32 maxOutputDelay);
+	void SetPeerWeight(const CJid& rJid, u32 weight);
+	void SetMaxQueuedSize(u32 maxQueuedSize, u32 maxFlowQueuedSize);
+
 	void RequestHandler(CHandler* pHandler);
 	void CommitHandler(CHandler* pHandler);
 
+	bool SendIQ(CStanza* pStanza, CIQRequest* pRequest, u32 timeout = XMPPCORE_IQTIMEOUT);
+	bool CancelIQ(CIQRequest* pRequest);
+
+	CTimerWheel* GetTimerWheel();
+
 	void GenerateId(string& id);
-	void RemoveId(const string& id);
+
+	virtual void OnEvent(u32 events);
 
 protected:
 	bool SendStanza(const CStanza* pStanza);
+	bool SendBufferChain(const CBufferChain* pBufferChain);
 	bool ReceiveStanza(CStanza* pStanza);
+	bool ReceiveStanza(CStanza* pStanza, CStreamDataRecord** ppStreamData);
 	
 private:
 	void Negociate();
@@ -77,25 +114,93 @@ private:
 
 	static void* InJob(void* pvThis) throw();
 	static void* OutJob(void* pvThis) throw();
-	
-	bool IsIdExist(const string& id);
+
+	bool RouteIQ(CStanza* pStanza);
+	CIQRequest* TakeIQ(u32 slot);
+	void ExpireIQ(u32 slot);
+	void FailIQ();
+
+	void PushStanza(CStanza* pStanza, CStreamDataRecord* pStreamData);
+	bool RouteStreamData(CStreamDataRecord* pStreamData);
+	void ClearQueues();
+
+	bool SendOutItems();
+	void WakeSenders();
+
+	bool ReceiveInput();
+	bool SendOutput();
+	bool FillOutput();
+	void FlushOutput();
+	void Close();
+	void CloseOnError() throw();
+
+private:
+	struct SOutItem
+	{
+		CXMLNode* pXMLNode;
+		CStanzaTemplate* pTemplate;
+		CBuffer* pPayload;
+		bool isControl;
+		string peer;
+	};
+
+	void ScheduleOutItem(SOutItem* pOutItem);
+	void BuildOutItem(const SOutItem* pOutItem, CBufferChain* pBufferChain);
+	void DeleteOutItem(SOutItem* pOutItem);
+
+private:
+	struct SPendingIQ : public CTimer
+	{
+		CXMPPCore* pXMPPCore;
+		u32 slot;
+		CIQRequest* pRequest;
+		u32 sequence;
+		uint64_t deadline;
+		string from;
+
+		virtual void OnTimer();
+	};
 	
 private:
 	CJid Jid;
 	CTCPAddress TCPAddress;
 	CXMPPParser XMPPParser;
 	CTLSConnection TLSConnection;
+	u32 readSize;
+	u32 maxOutputDelay;
+	u32 maxQueuedSize;
+	u32 maxFlowQueuedSize;
+	volatile u32 queuedSize;
+	volatile u32 numOutputWaiter;
 	
-	vector<CHandler*> HandlerList;
-	vector<string> IDList;
-	vector<CXMLNode*> InQueue;
-	vector<CXMLNode*> OutQueue;
+	CHandlerIndex HandlerIndex;
+	map<pair<string, u32>, CHandler*> StreamDataRouteMap;
+	CRingQueue InQueue;
+	CRingQueue OutQueue;
+	COutScheduler OutScheduler;
+	CMutex MutexOutput;
 	CMutex MutexHandlerList;
-	CMutex MutexIDList;
-	CMutex MutexInQueue;
-	CMutex MutexOutQueue;
 	CThread ThreadInJob;
 	CThread ThreadOutJob;
+
+	// requests in flight are found by the slot written in their id, the
+	// sequence tells a late answer from the one for the current request
+	vector<SPendingIQ*> PendingIQList;
+	vector<u32> FreeIQList;
+	volatile u32 nextIQSequence;
+	CMutex MutexIQ;
+
+	// deadlines of the requests, XEPs schedule their own timers on it
+	CTimerWheel TimerWheel;
+
+	// with a reactor the socket is non blocking and no thread of our own
+	// runs, the bytes of a write cut short wait in OutputBuffer
+	CReactor* pReactor;
+	CBuffer OutputBuffer;
+	u32 outputOffset;
+	bool isInputWantWrite;
+	bool isOutputWantRead;
+	bool isOutputWantWrite;
 };
  
 class CXMPPCoreException : public CException
@@ -103,18 +208,36 @@ class CXMPPCoreException : public CException
 public:
 	enum XMPPCoreExceptionCode
 	{
+		XMPPCEC_SETREACTORERROR,
 		XMPPCEC_CONNECTERROR,
 		XMPPCEC_DISCONNECTERROR,
 		XMPPCEC_RECEIVEERROR,
 		XMPPCEC_SENDERROR,
+		XMPPCEC_WAITOUTPUTERROR,
 		XMPPCEC_REQUESTHANDLERERROR,
 		XMPPCEC_RECEIVEHANDLERERROR,	
 		XMPPCEC_COMMITHANDLERERROR,
+		XMPPCEC_SENDIQERROR,
+		XMPPCEC_CANCELIQERROR,
 		XMPPCEC_GENERATEIDERROR,
-		XMPPCEC_REMOVEIDERROR,
-		XMPPCEC_ISIDEXISTERROR,
+		XMPPCEC_ONEVENTERROR,
+		XMPPCEC_ROUTEIQERROR,
+		XMPPCEC_TAKEIQERROR,
+		XMPPCEC_EXPIREIQERROR,
+		XMPPCEC_FAILIQERROR,
 		XMPPCEC_SENDSTANZAERROR,
+		XMPPCEC_SENDBUFFERCHAINERROR,
+		XMPPCEC_SCHEDULEOUTITEMERROR,
+		XMPPCEC_SENDOUTITEMSERROR,
 		XMPPCEC_RECEIVESTANZAERROR,
+		XMPPCEC_PUSHSTANZAERROR,
+		XMPPCEC_RECEIVEINPUTERROR,
+		XMPPCEC_SENDOUTPUTERROR,
+		XMPPCEC_FILLOUTPUTERROR,
+		XMPPCEC_FLUSHOUTPUTERROR,
+		XMPPCEC_CLOSEERROR,
+		XMPPCEC_ROUTESTREAMDATAERROR,
+		XMPPCEC_CLEARQUEUESERROR,
 		XMPPCEC_NEGOCIATEERROR,
 		XMPPCEC_NEGOCIATESTARTTLSERROR,
 		XMPPCEC_NEGOCIATESASLERROR,
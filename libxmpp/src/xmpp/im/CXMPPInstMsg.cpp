@@ -29,6 +29,7 @@
 #include <common/xml/CXMLNode.h>
 
 #include <xmpp/core/CHandler.h>
+#include <xmpp/core/CIQFuture.h>
 #include <xmpp/core/CXMLFilter.h>
 #include <xmpp/im/CRoster.h>
 #include <xmpp/im/CRosterItem.h>
@@ -106,40 +107,22 @@ bool CXMPPInstMsg::SendPresenceToAll(const string& show, const string& status, c
 void CXMPPInstMsg::StartRosterEvent(CRoster* pRoster)
 {
 	CIQStanza IQStanza;
-	CHandler RosterHandler;
+	CIQFuture IQFuture;
 	CIQGetStanza IQGetStanza;
-	string id;
-	
-	// we generate a unique id
-	GenerateId(id);
-
-	// we build the iq request
-	IQGetStanza.SetId(id);
 	
+	// we build the iq request, its id is given by SendIQ()
 	CXMLNode* pXMLNode = new CXMLNode;
 	pXMLNode->SetName("query");
 	pXMLNode->SetNameSpace("jabber:iq:roster");
 
 	IQGetStanza.PushChild(pXMLNode);
 
-	// we build the filter handler adhoc
-	CXMLFilter* pXMLFilter = new CXMLFilter("iq");
-	pXMLFilter->SetAttribut("id", id);
-
-	RosterHandler.AddXMLFilter(pXMLFilter);
-	
-	// we request the filter
-	RequestHandler(&RosterHandler);
-	
-	if(!Send(&IQGetStanza))
+	if(!SendIQ(&IQGetStanza, &IQFuture))
 	throw CXMPPInstMsgException(CXMPPInstMsgException::XMPPIMEC_UPDATEROSTERERROR);
 	
-	if(!Receive(&RosterHandler, &IQStanza))
+	if(!IQFuture.Wait(&IQStanza))
 	throw CXMPPInstMsgException(CXMPPInstMsgException::XMPPIMEC_UPDATEROSTERERROR);
 	
-	CommitHandler(&RosterHandler);
-	RemoveId(id);
-	
 	if(IQStanza.GetKindOf() != CIQStanza::SIQKO_RESULT)
 	throw CXMPPInstMsgException(CXMPPInstMsgException::XMPPIMEC_UPDATEROSTERERROR);
 	
@@ -24,12 +24,26 @@
 #include <common/CObject.h>
 #include <common/CException.h>
 #include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
+#include <common/xml/CXMLAtom.h>
 #include <common/xml/CXMLNode.h>
 
 #include <xmpp/stanza/CStanza.h>
 
 using namespace std;
 
+static const CXMLAtom AtomOpen("stream:open");
+static const CXMLAtom AtomFeatures("stream:features");
+static const CXMLAtom AtomProceed("proceed");
+static const CXMLAtom AtomStarttls("starttls");
+static const CXMLAtom AtomIq("iq");
+static const CXMLAtom AtomMessage("message");
+static const CXMLAtom AtomPresence("presence");
+static const CXMLAtom AtomClose("stream:close");
+static const CXMLAtom AtomSuccess("success");
+static const CXMLAtom AtomChallenge("challenge");
+static const CXMLAtom AtomResponse("response");
+
 CStanza::CStanza()
 {
 	try
@@ -125,37 +139,39 @@ CObject::u32 CStanza::GetKindOf() const
 {
 	try
 	{
-		if(GetName() == "stream:open")
+		const CXMLAtom& rName = pXMLNode->GetNameAtom();
+
+		if(rName == AtomOpen)
 		return SKO_OPEN;
 
-		if(GetName() == "stream:features")
+		if(rName == AtomFeatures)
 		return SKO_FEATURES;
 
-		if(GetName() == "proceed")
+		if(rName == AtomProceed)
 		return SKO_PROCEED;
 
-		if(GetName() == "starttls")
+		if(rName == AtomStarttls)
 		return SKO_STARTTLS;
 
-		if(GetName() == "iq")
+		if(rName == AtomIq)
 		return SKO_IQ;
 
-		if(GetName() == "message")
+		if(rName == AtomMessage)
 		return SKO_MESSAGE;
 
-		if(GetName() == "presence")
+		if(rName == AtomPresence)
 		return SKO_PRESENCE;
 
-		if(GetName() == "stream:close")
+		if(rName == AtomClose)
 		return SKO_CLOSE;
 
-		if(GetName() == "success")
+		if(rName == AtomSuccess)
 		return SKO_SUCCESS;
 		
-		if(GetName() == "challenge")
+		if(rName == AtomChallenge)
 		return SKO_CHALLENGE;
 		
-		if(GetName() == "response")
+		if(rName == AtomResponse)
 		return SKO_RESPONSE;
 		
 		return SKO_UNKNOWN;
@@ -188,6 +204,23 @@ void CStanza::Build(CBuffer* pBuffer) const
 	}
 }
 
+void CStanza::Build(CBufferChain* pBufferChain) const
+{
+	try
+	{
+		pXMLNode->Build(pBufferChain);
+	}
+	
+	catch(CException& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CStanzaException(CStanzaException::SEC_BUILDERROR);
+	}
+}
+
 const string& CStanza::GetNameSpace() const
 {
 	try
@@ -26,6 +26,7 @@
 #include <common/CObject.h>
 #include <common/CException.h>
 #include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
 #include <common/xml/CXMLNode.h>
 
 using namespace std;
@@ -59,6 +60,7 @@ public:
 	
 	u32 GetKindOf() const;
 	virtual void Build(CBuffer* pBuffer) const;
+	virtual void Build(CBufferChain* pBufferChain) const;
 
 	const string& GetNameSpace() const;
 	const string& GetName() const;
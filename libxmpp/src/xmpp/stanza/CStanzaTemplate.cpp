@@ -0,0 +1,239 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+#include <iostream>
+#include <string>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
+#include <common/xml/CXMLNode.h>
+
+#include <xmpp/stanza/CStanza.h>
+#include <xmpp/stanza/CStanzaTemplate.h>
+
+using namespace std;
+
+static void AppendMarkup(CBuffer* pBuffer, const char* pData, CObject::u32 dataSize)
+{
+	if(dataSize == 0)
+	return;
+
+	if(!pBuffer->Append((const CObject::u8*) pData, dataSize))
+	throw CStanzaTemplateException(CStanzaTemplateException::STEC_CREATEERROR);
+}
+
+static void AppendMarkup(CBuffer* pBuffer, const string& data)
+{
+	AppendMarkup(pBuffer, data.data(), data.size());
+}
+
+CStanzaTemplate::CStanzaTemplate()
+{
+	isPayloadFound = false;
+	refCount = 1;
+	flow = 0;
+	weight = 1;
+	queuedSize = 0;
+}
+
+CStanzaTemplate::~CStanzaTemplate()
+{}
+
+CStanzaTemplate* CStanzaTemplate::Create(const CStanza* pStanza, const CXMLNode* pPayloadNode)
+{
+	CStanzaTemplate* pTemplate = NULL;
+
+	try
+	{
+		// the payload node must end the markup it opens, so no child
+		if(pPayloadNode->GetNumChild() != 0)
+		throw CStanzaTemplateException(CStanzaTemplateException::STEC_CREATEERROR);
+
+		pTemplate = new CStanzaTemplate;
+		pTemplate->BuildNode(pStanza->GetXMLNode(), pPayloadNode, &pTemplate->Prefix);
+
+		if(!pTemplate->isPayloadFound)
+		throw CStanzaTemplateException(CStanzaTemplateException::STEC_CREATEERROR);
+
+		pTemplate->Peer = pStanza->GetTo();
+
+		return pTemplate;
+	}
+
+	catch(exception& e)
+	{
+		if(pTemplate != NULL)
+		delete pTemplate;
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CStanzaTemplateException(CStanzaTemplateException::STEC_CREATEERROR);
+	}
+}
+
+void CStanzaTemplate::AddRef()
+{
+	__sync_add_and_fetch(&refCount, 1);
+}
+
+void CStanzaTemplate::Release()
+{
+	if(__sync_sub_and_fetch(&refCount, 1) == 0)
+	delete this;
+}
+
+CObject::u32 CStanzaTemplate::GetSize(u32 payloadSize) const
+{
+	return Prefix.GetBufferSize() + payloadSize + Suffix.GetBufferSize();
+}
+
+void CStanzaTemplate::Build(CBufferChain* pBufferChain, const u8* pPayload, u32 payloadSize) const
+{
+	try
+	{
+		pBufferChain->Reference(Prefix.GetBuffer(), Prefix.GetBufferSize());
+
+		if(payloadSize)
+		pBufferChain->Reference(pPayload, payloadSize);
+
+		pBufferChain->Reference(Suffix.GetBuffer(), Suffix.GetBufferSize());
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CStanzaTemplateException(CStanzaTemplateException::STEC_BUILDERROR);
+	}
+}
+
+const string& CStanzaTemplate::GetPeer() const
+{
+	return Peer;
+}
+
+CObject::u32 CStanzaTemplate::GetFlow() const
+{
+	return flow;
+}
+
+CObject::u32 CStanzaTemplate::GetWeight() const
+{
+	return weight;
+}
+
+CObject::u32 CStanzaTemplate::GetQueuedSize() const
+{
+	return queuedSize;
+}
+
+void CStanzaTemplate::SetFlow(u32 flow)
+{
+	this->flow = flow;
+}
+
+void CStanzaTemplate::SetWeight(u32 weight)
+{
+	// read by the writer thread without lock, a stale weight lasts one packet
+	this->weight = weight;
+}
+
+void CStanzaTemplate::AddQueuedSize(u32 size)
+{
+	__sync_add_and_fetch(&queuedSize, size);
+}
+
+void CStanzaTemplate::SubQueuedSize(u32 size)
+{
+	__sync_sub_and_fetch(&queuedSize, size);
+}
+
+void CStanzaTemplate::BuildNode(const CXMLNode* pXMLNode, const CXMLNode* pPayloadNode, CBuffer* pBuffer)
+{
+	// same markup as CXMLNode::BuildNode(), we switch to the suffix right
+	// where the payload node data goes
+	AppendMarkup(pBuffer, "<", 1);
+	AppendMarkup(pBuffer, pXMLNode->GetName());
+
+	for(u32 i = 0 ; i < pXMLNode->GetNumAttribut() ; i += 2)
+	{
+		AppendMarkup(pBuffer, " ", 1);
+		AppendMarkup(pBuffer, pXMLNode->GetAttribut(i));
+		AppendMarkup(pBuffer, "='", 2);
+		AppendMarkup(pBuffer, pXMLNode->GetAttribut(i + 1));
+		AppendMarkup(pBuffer, "'", 1);
+	}
+
+	if(pXMLNode != pPayloadNode && pXMLNode->GetNumChild() == 0 && pXMLNode->GetData().size() == 0)
+	{
+		AppendMarkup(pBuffer, "/>", 2);
+		return;
+	}
+
+	AppendMarkup(pBuffer, ">", 1);
+
+	if(pXMLNode == pPayloadNode)
+	{
+		isPayloadFound = true;
+		pBuffer = &Suffix;
+	}
+	else
+	{
+		AppendMarkup(pBuffer, pXMLNode->GetData());
+
+		for(u32 i = 0 ; i < pXMLNode->GetNumChild() ; i++)
+		{
+			BuildNode(pXMLNode->GetChild(i), pPayloadNode, pBuffer);
+
+			if(isPayloadFound)
+			pBuffer = &Suffix;
+		}
+	}
+
+	AppendMarkup(pBuffer, "</", 2);
+	AppendMarkup(pBuffer, pXMLNode->GetName());
+	AppendMarkup(pBuffer, ">", 1);
+}
+
+CStanzaTemplateException::CStanzaTemplateException(int code) : CException(code)
+{}
+
+CStanzaTemplateException::~CStanzaTemplateException() throw()
+{}
+	
+const char* CStanzaTemplateException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case STEC_CREATEERROR:
+		return "CStanzaTemplate::Create() error";
+
+	case STEC_BUILDERROR:
+		return "CStanzaTemplate::Build() error";
+		
+	default:
+		return "CStanzaTemplate: Unknown error";
+	}
+}
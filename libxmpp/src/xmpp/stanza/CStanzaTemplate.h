@@ -0,0 +1,95 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+#ifndef __CSTANZATEMPLATE_H__
+#define __CSTANZATEMPLATE_H__
+
+#include <string>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
+#include <common/xml/CXMLNode.h>
+
+#include <xmpp/stanza/CStanza.h>
+
+using namespace std;
+
+// serialized markup of a stanza whose only varying part is the data of one
+// node, the bytes around it are built once and each packet only supplies
+// the payload, references are taken by the owner and by each queued packet.
+// the peer and the flow tell the output scheduler whose share a packet uses,
+// the queued size is what the packets of the flow still hold in the output
+class CStanzaTemplate : public CObject
+{
+public:
+	static CStanzaTemplate* Create(const CStanza* pStanza, const CXMLNode* pPayloadNode);
+
+	void AddRef();
+	void Release();
+
+	u32 GetSize(u32 payloadSize) const;
+	void Build(CBufferChain* pBufferChain, const u8* pPayload, u32 payloadSize) const;
+
+	const string& GetPeer() const;
+	u32 GetFlow() const;
+	u32 GetWeight() const;
+	u32 GetQueuedSize() const;
+
+	void SetFlow(u32 flow);
+	void SetWeight(u32 weight);
+
+	void AddQueuedSize(u32 size);
+	void SubQueuedSize(u32 size);
+
+private:
+	CStanzaTemplate();
+	~CStanzaTemplate();
+
+	void BuildNode(const CXMLNode* pXMLNode, const CXMLNode* pPayloadNode, CBuffer* pBuffer);
+
+private:
+	CBuffer Prefix;
+	CBuffer Suffix;
+	bool isPayloadFound;
+	u32 refCount;
+	string Peer;
+	u32 flow;
+	u32 weight;
+	volatile u32 queuedSize;
+};
+
+class CStanzaTemplateException : public CException
+{
+public:
+	enum StanzaTemplateExceptionCode
+	{
+		STEC_CREATEERROR,
+		STEC_BUILDERROR
+	};
+
+public:
+	CStanzaTemplateException(int code);
+	virtual ~CStanzaTemplateException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif // __CSTANZATEMPLATE_H__
@@ -24,6 +24,7 @@
 #include <common/CObject.h>
 #include <common/CException.h>
 #include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
 #include <common/xml/CXMLNode.h>
 
 #include <xmpp/stanza/CStanza.h>
@@ -74,6 +75,26 @@ void CCloseStanza::Build(CBuffer* pBuffer) const
 		throw CCloseStanzaException(CCloseStanzaException::CSEC_BUILDERROR);
 	}
 }
+void CCloseStanza::Build(CBufferChain* pBufferChain) const
+{
+	try
+	{
+		CBuffer Buffer;
+		Build(&Buffer);
+
+		pBufferChain->Clear();
+		pBufferChain->Write((const char*) Buffer.GetBuffer(), Buffer.GetBufferSize());
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CCloseStanzaException(CCloseStanzaException::CSEC_BUILDERROR);
+	}
+}
 
 CCloseStanzaException::CCloseStanzaException(int code) : CException(code)
 {}
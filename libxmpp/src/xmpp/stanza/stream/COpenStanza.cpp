@@ -24,6 +24,7 @@
 #include <common/CObject.h>
 #include <common/CException.h>
 #include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
 #include <common/xml/CXMLNode.h>
 
 #include <xmpp/stanza/CStanza.h>
@@ -78,6 +79,26 @@ void COpenStanza::Build(CBuffer* pBuffer) const
 	}
 }
 
+void COpenStanza::Build(CBufferChain* pBufferChain) const
+{
+	try
+	{
+		CBuffer Buffer;
+		Build(&Buffer);
+
+		pBufferChain->Clear();
+		pBufferChain->Write((const char*) Buffer.GetBuffer(), Buffer.GetBufferSize());
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw COpenStanzaException(COpenStanzaException::OSEC_BUILDERROR);
+	}
+}
 
 COpenStanzaException::COpenStanzaException(int code) : CException(code)
 {}
@@ -26,6 +26,7 @@
 #include <common/CObject.h>
 #include <common/CException.h>
 #include <common/data/CBuffer.h>
+#include <common/data/CBufferChain.h>
 #include <common/xml/CXMLNode.h>
 
 #include <xmpp/stanza/CStanza.h>
@@ -40,6 +41,7 @@ public:
 
 	u32 GetKindOf() const;
 	virtual void Build(CBuffer* pBuffer) const;
+	virtual void Build(CBufferChain* pBufferChain) const;
 };
 
 class COpenStanzaException : public CException
@@ -32,6 +32,7 @@
 
 #include <xmpp/core/CXMLFilter.h>
 #include <xmpp/core/CHandler.h>
+#include <xmpp/core/CIQFuture.h>
 #include <xmpp/core/CXMPPCore.h>
 #include <xmpp/jid/CJid.h>
 #include <xmpp/stanza/iq/get/CIQGetStanza.h>
@@ -56,6 +57,13 @@ CXEPdisco::CXEPdisco()
 		pDiscoFilter->PushChild(pQueryFilter);
 
 		DiscoHandler.AddXMLFilter(pDiscoFilter);
+
+		// we advertise the protocols implemented by the library
+		FeatureList.push_back("http://jabber.org/protocol/disco#info");
+		FeatureList.push_back("http://jabber.org/protocol/xibb");
+		FeatureList.push_back("http://jabber.org/protocol/xibb#open");
+		FeatureList.push_back("http://jabber.org/protocol/xmpp-ssh");
+		FeatureList.push_back("http://jabber.org/protocol/xmpp-ssh#raw");
 	}
 
 	catch(exception& e)
@@ -127,49 +135,35 @@ void CXEPdisco::Detach()
 }
 
 
-void CXEPdisco::Disco(vector<string>* pFeaturesList)
+void CXEPdisco::Disco(vector<string>* pFeaturesList, u32 timeout)
 {
-	Disco(pXMPPCore->GetJid().GetHost(), pFeaturesList);
+	Disco(pXMPPCore->GetJid().GetHost(), pFeaturesList, timeout);
 }
 
-void CXEPdisco::Disco(const CJid& rJid, vector<string>* pFeaturesList)
+void CXEPdisco::Disco(const CJid& rJid, vector<string>* pFeaturesList, u32 timeout)
 {
 	try
 	{
-		CHandler Handler;
+		CIQFuture IQFuture;
 		CIQGetStanza IQGetStanza;
 		CIQResultStanza IQResultStanza;
-		string id;
-		
-		pXMPPCore->GenerateId(id);
-		
-		//we build and request the disco filter
-		CXMLFilter* pXMLFilter = new CXMLFilter("iq");
-		pXMLFilter->SetAttribut("id", id);
-		pXMLFilter->SetAttribut("type", "result");
-		pXMLFilter->SetAttribut("from", rJid.GetFull());
-		
-		Handler.AddXMLFilter(pXMLFilter);
 		
-		pXMPPCore->RequestHandler(&Handler);
-		
-		// we build the disco query request
+		// we build the disco query request, its id is given by SendIQ()
 		IQGetStanza.SetTo(rJid.GetFull());
-		IQGetStanza.SetId(id);
 		
 		CXMLNode* pXMLNode = new CXMLNode("query");
 		pXMLNode->SetNameSpace("http://jabber.org/protocol/disco#info");
 
 		IQGetStanza.PushChild(pXMLNode);
 
-		if(!pXMPPCore->Send(&IQGetStanza))
+		if(!pXMPPCore->SendIQ(&IQGetStanza, &IQFuture, timeout))
 		throw CXEPdiscoException(CXEPdiscoException::XEPDEC_DISCOERROR);
 		
-		if(!pXMPPCore->Receive(&Handler, &IQResultStanza))
+		if(!IQFuture.Wait(&IQResultStanza))
 		throw CXEPdiscoException(CXEPdiscoException::XEPDEC_DISCOERROR);
 
-		pXMPPCore->CommitHandler(&Handler);
-		pXMPPCore->RemoveId(id);
+		if(IQResultStanza.GetType() != "result")
+		throw CXEPdiscoException(CXEPdiscoException::XEPDEC_DISCOERROR);
 				
 		pFeaturesList->clear();
 		CXMLNode* pResultQuery = IQResultStanza.GetChild("query");
@@ -206,16 +200,15 @@ void* CXEPdisco::OnDiscoJob(void* pvThis) throw()
 			IQResultStanza.SetId(IQGetStanza.GetId());
 			
 			CXMLNode* pQueryNode = new CXMLNode("query");
-			CXMLNode* pFeatureDiscoNode = new CXMLNode("feature");
-			CXMLNode* pFeatureResoxNode = new CXMLNode("feature");
-			
 			pQueryNode->SetAttribut("xmlns", "http://jabber.org/protocol/disco#info");
-			pFeatureDiscoNode->SetAttribut("var", "http://jabber.org/protocol/disco#info");
-			pFeatureResoxNode->SetAttribut("var", "http://jabber.org/protocol/xibb");
-			pFeatureResoxNode->SetAttribut("var", "http://jabber.org/protocol/xmpp-ssh");
 
-			pQueryNode->PushChild(pFeatureDiscoNode);
-			pQueryNode->PushChild(pFeatureResoxNode);
+			for(u32 i = 0 ; i < pXEPdisco->FeatureList.size() ; i++)
+			{
+				CXMLNode* pFeatureNode = new CXMLNode("feature");
+				pFeatureNode->SetAttribut("var", pXEPdisco->FeatureList[i]);
+				pQueryNode->PushChild(pFeatureNode);
+			}
+
 			IQResultStanza.PushChild(pQueryNode);
 
 		
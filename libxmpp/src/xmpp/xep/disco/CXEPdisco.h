@@ -44,8 +44,8 @@ public:
 	void Attach(CXMPPCore* pXMPPCore);
 	void Detach();
 
-	void Disco(vector<string>* pFeaturesList);
-	void Disco(const CJid& rJid, vector<string>* pFeaturesList);
+	void Disco(vector<string>* pFeaturesList, u32 timeout = XMPPCORE_IQTIMEOUT);
+	void Disco(const CJid& rJid, vector<string>* pFeaturesList, u32 timeout = XMPPCORE_IQTIMEOUT);
 
 private:
 	static void* OnDiscoJob(void* pvThis) throw();
@@ -55,6 +55,8 @@ private:
 
 	CHandler DiscoHandler;
 	CThread ThreadOnDisco;
+
+	vector<string> FeatureList;
 };
  
 class CXEPdiscoException : public CException
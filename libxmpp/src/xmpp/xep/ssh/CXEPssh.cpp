@@ -21,6 +21,7 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <cstring>
 
 #include <string>
 #include <vector>
@@ -47,6 +48,8 @@ CXEPssh::CXEPssh()
 	try
 	{
 		pXMPPCore = NULL;
+		isRawData = false;
+		isShellOpen = false;
 	}
 	
 	catch(exception& e)
@@ -116,13 +119,24 @@ void CXEPssh::Detach()
 	}
 }
 
-void CXEPssh::ConnectToSSH(const CJid& rRemoteJid)
+void CXEPssh::ConnectToSSH(const CJid& rRemoteJid, bool isOpenShell, bool isRawData)
 {
 	try
 	{
 		RemoteJid = rRemoteJid;
-		
-		XEPxibb.OpenChannel(RemoteJid, &channelId);
+		isShellOpen = false;
+
+		if(!isOpenShell)
+		{
+			XEPxibb.OpenChannel(RemoteJid, &channelId);
+			return;
+		}
+
+		// the shell stream is opened along with the channel, Login() has
+		// nothing left to do
+		this->isRawData = isRawData;
+		XEPxibb.OpenChannelStream(RemoteJid, &channelId, &shellSid, 65535, 4096, 0, isRawData);
+		isShellOpen = true;
 	}
 	
 	catch(exception& e)
@@ -163,6 +177,12 @@ void CXEPssh::SendData(CBuffer* pBuffer)
 {
 	try
 	{
+		if(isRawData)
+		{
+			XEPxibb.SendStreamData(RemoteJid, channelId, shellSid, pBuffer->GetBuffer(), pBuffer->GetBufferSize());
+			return;
+		}
+
 		CBase64 Base64;
 		CBuffer Buffer, EncryptedBuffer;
 		string DataBase64;
@@ -185,10 +205,61 @@ void CXEPssh::SendData(CBuffer* pBuffer)
 	}
 }
 
+void CXEPssh::SendData(const u8* pData, u32 dataSize)
+{
+	try
+	{
+		if(isRawData)
+		{
+			XEPxibb.SendStreamData(RemoteJid, channelId, shellSid, pData, dataSize);
+			return;
+		}
+
+		CBuffer Buffer(dataSize);
+
+		Buffer.Write(pData, dataSize);
+		SendData(&Buffer);
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPsshException(CXEPsshException::XEPSSHEC_SENDDATAERROR);
+	}
+}
+
+bool CXEPssh::WaitSendData()
+{
+	try
+	{
+		// returns once the shell stream may queue more data, false when the
+		// connection is gone
+		return XEPxibb.WaitSendStreamData(RemoteJid, channelId, shellSid);
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPsshException(CXEPsshException::XEPSSHEC_WAITSENDDATAERROR);
+	}
+}
+
 void CXEPssh::ReceiveData(CBuffer* pBuffer)
 {
 	try
 	{
+		if(isRawData)
+		{
+			XEPxibb.ReceiveStreamData(RemoteJid, channelId, shellSid, pBuffer);
+			return;
+		}
+
 		CBase64 Base64;
 		CBuffer Buffer, EncryptedBuffer;
 		CSessionShellDataNode SessionShellDataNode;
@@ -209,12 +280,61 @@ void CXEPssh::ReceiveData(CBuffer* pBuffer)
 	}
 }
 
+CObject::u32 CXEPssh::ReceiveData(u8* pData, u32 dataSize)
+{
+	try
+	{
+		if(isRawData)
+		return XEPxibb.ReceiveStreamData(RemoteJid, channelId, shellSid, pData, dataSize);
+
+		CBuffer Buffer;
+
+		ReceiveData(&Buffer);
+
+		if(Buffer.GetBufferSize() > dataSize)
+		throw CXEPsshException(CXEPsshException::XEPSSHEC_RECEIVEDATAERROR);
+
+		memcpy(pData, Buffer.GetBuffer(), Buffer.GetBufferSize());
+		return Buffer.GetBufferSize();
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
 
-void CXEPssh::Login()
+		throw CXEPsshException(CXEPsshException::XEPSSHEC_RECEIVEDATAERROR);
+	}
+}
+
+CObject::u32 CXEPssh::GetPendingData()
 {
 	try
 	{
-		XEPxibb.OpenStream(RemoteJid, channelId, &shellSid);
+		return XEPxibb.GetPendingStreamData(RemoteJid, channelId, shellSid);
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPsshException(CXEPsshException::XEPSSHEC_GETPENDINGDATAERROR);
+	}
+}
+
+void CXEPssh::Login(bool isRawData)
+{
+	try
+	{
+		if(isShellOpen)
+		return;
+
+		// the raw data path is only requested when the peer advertised it
+		this->isRawData = isRawData;
+		XEPxibb.OpenStream(RemoteJid, channelId, &shellSid, 4096, 0, isRawData);
 	}
 	
 	catch(exception& e)
@@ -258,9 +378,15 @@ const char* CXEPsshException::what() const throw()
 	case XEPSSHEC_SENDDATAERROR:
 		return "CXEPssh::SendData() error";
 
+	case XEPSSHEC_WAITSENDDATAERROR:
+		return "CXEPssh::WaitSendData() error";
+
 	case XEPSSHEC_RECEIVEDATAERROR:
 		return "CXEPssh::ReceiveData() error";
 
+	case XEPSSHEC_GETPENDINGDATAERROR:
+		return "CXEPssh::GetPendingData() error";
+
 	case XEPSSHEC_SETSHELLSIZEERROR:
 		return "CXEPssh::SetShellSize() error";
 
@@ -43,14 +43,18 @@ public:
 	void Attach(CXMPPCore* pXMPPCore);
 	void Detach();
 
-	void ConnectToSSH(const CJid& rRemoteJid);
+	void ConnectToSSH(const CJid& rRemoteJid, bool isOpenShell = false, bool isRawData = false);
 	void Disconnect();
 
-	void Login();
+	void Login(bool isRawData = false);
 	
 	void SetShellSize(u32 row, u32 column, u32 xpixel, u32 ypixel);
 	void SendData(CBuffer* pBuffer);
+	void SendData(const u8* pData, u32 dataSize);
+	bool WaitSendData();
 	void ReceiveData(CBuffer* pBuffer);
+	u32 ReceiveData(u8* pData, u32 dataSize);
+	u32 GetPendingData();
 
 	const CJid& GetRemoteJid() const;
 
@@ -64,6 +68,8 @@ private:
 	CJid RemoteJid;
 	u16 channelId;
 	u16 shellSid;
+	bool isRawData;
+	bool isShellOpen;
 };
  
 class CXEPsshException : public CException
@@ -78,7 +84,9 @@ public:
 		XEPSSHEC_CONNECTTOSSHERROR,
 		XEPSSHEC_DISCONNECTERROR,
 		XEPSSHEC_SENDDATAERROR,
+		XEPSSHEC_WAITSENDDATAERROR,
 		XEPSSHEC_RECEIVEDATAERROR,
+		XEPSSHEC_GETPENDINGDATAERROR,
 		XEPSSHEC_SETSHELLSIZEERROR,
 		XEPSSHEC_SESSIONKEYEXCHANGEERROR,
 		XEPSSHEC_SESSIONAUTHSERVERERROR,
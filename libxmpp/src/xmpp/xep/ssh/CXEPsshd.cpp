@@ -21,15 +21,24 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 
+#include <set>
 #include <vector>
 
 #include <common/CException.h>
 #include <common/CObject.h>
 #include <common/data/CBuffer.h>
 #include <common/data/CBase64.h>
+#include <common/thread/CExecutor.h>
 #include <common/thread/CMutex.h>
+#include <common/thread/CRingQueue.h>
+#include <common/thread/CTask.h>
 #include <common/thread/CThread.h>
+#include <common/thread/CTimer.h>
+#include <common/tun/CTunRing.h>
 #include <common/xml/CXMLNode.h>
 #include <common/xml/CXMLParser.h>
 
@@ -49,6 +58,9 @@ CXEPsshd::CXEPsshd()
 	try
 	{
 		pXMPPCore = NULL;
+		isUring = false;
+		pLastShell = NULL;
+		isStopped = false;
 	}
 	
 	catch(exception& e)
@@ -87,6 +99,14 @@ void CXEPsshd::Attach(CXMPPCore* pXMPPCore, int pTunFd)
 		this->TunFd = pTunFd;
 		XEPxibb.Attach(pXMPPCore);
 
+		isStopped = false;
+		pLastShell = NULL;
+
+		// the thread count follows the processors, not the sessions
+		TunRing.Open(TunFd, TUNRING_DEPTH, isUring);
+		Executor.Start();
+
+		ThreadTunReaderJob.Run(TunReaderJob, this);
 		ThreadSessionManagerJob.Run(SessionManagerJob, this);
 	}
 	
@@ -106,9 +126,34 @@ void CXEPsshd::Detach()
 	{
 		if(pXMPPCore == NULL)
 		return;
-	
+
+		// every session closes its channel and leaves the set
+		MutexSessionList.Lock();
+
+		isStopped = true;
+
+		for(set<SSession*>::iterator it = SessionSet.begin() ; it != SessionSet.end() ; it++)
+		{
+			(*it)->isClosing = true;
+			Executor.Submit(*it);
+		}
+
+		MutexSessionList.Signal();
+
+		while(!SessionSet.empty())
+		MutexSessionList.Wait();
+
+		MutexSessionList.UnLock();
+
+		// the reader leaves its tun read
+		TunRing.Stop();
+		ThreadTunReaderJob.Wait();
+
 		XEPxibb.Detach();
 		ThreadSessionManagerJob.Wait();
+
+		Executor.Stop();
+		TunRing.Close();
 		
 		pXMPPCore = NULL;
 	}
@@ -123,154 +168,442 @@ void CXEPsshd::Detach()
 	}
 }
 
-void* CXEPsshd::SessionManagerJob(void* pvThis) throw()
+void CXEPsshd::SetUring(bool isUring)
+{
+	// applies from the next Attach()
+	this->isUring = isUring;
+}
+
+void CXEPsshd::StartSession(const CJid& rJid, u16 localCid) throw()
 {
 	try
 	{
-		CXEPsshd* pXEPsshd = (CXEPsshd*) pvThis;
-		int TunFd = pXEPsshd->TunFd;
-		CXEPxibb* pXEPxibb = &pXEPsshd->XEPxibb;
+		// the session sets itself up in its first run
+		SSession* pSession = new SSession(this, rJid, localCid);
 
-		while(true)
+		MutexSessionList.Lock();
+
+		// a channel opened while we stop is closed by the xibb Detach()
+		if(isStopped)
 		{
-			u16 maxStream;
-			u16 blockSize;
-			u32 byteRate;
+			MutexSessionList.UnLock();
+			delete pSession;
+			return;
+		}
+
+		SessionSet.insert(pSession);
+		Executor.Submit(pSession);
 
-			SSessionParam* pSessionParam = new SSessionParam;
+		MutexSessionList.UnLock();
+	}
 
-			pSessionParam->pXEPxibb = pXEPxibb;
-			pSessionParam->TunFd = TunFd;
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
 
-			pXEPxibb->WaitChannel(&pSessionParam->Jid, &pSessionParam->localCid, &maxStream, &blockSize, &byteRate);
-			CThread::RunDetached(SessionJob, pSessionParam);
+	}
+}
+
+bool CXEPsshd::RunSession(SSession* pSession)
+{
+	try
+	{
+		if(pSession->isClosing)
+		throw CXEPsshdException(CXEPsshdException::XEPSSHDEC_RUNSESSIONERROR);
+
+		// from now on the channel submits us when the stream is opened
+		if(!pSession->isStarted)
+		{
+			pSession->isStarted = true;
+			pXMPPCore->GetTimerWheel()->Arm(&pSession->StreamTimer, XEPSSHD_STREAMTIMEOUT);
+			XEPxibb.SetChannelTask(pSession->Jid, pSession->localCid, &Executor, pSession);
 		}
+
+		if(!pSession->isOpened && !OpenShell(pSession))
+		return true;
+
+		// a full batch may have left more behind, we come back after the
+		// others had their turn
+		bool isMoreIn = MoveIn(pSession);
+		bool isMoreOut = MoveOut(pSession);
+
+		if(isMoreIn || isMoreOut)
+		Executor.Submit(pSession);
+
+		return true;
 	}
-	
+
 	catch(exception& e)
 	{
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		return NULL;
+		// the session deletes itself, the executor forgets about it
+		CloseSession(pSession);
+		return false;
 	}
 }
 
-void* CXEPsshd::SessionJob(void* pvSSessionParam) throw()
+bool CXEPsshd::OpenShell(SSession* pSession)
 {
-	SSessionParam* pSessionParam = (SSessionParam*) pvSSessionParam;
-	
 	try
 	{
-		SessionShell(pSessionParam);
-		
-		pSessionParam->pXEPxibb->CloseChannel(pSessionParam->Jid, pSessionParam->localCid);
-		delete pSessionParam;
-		return NULL;
+		if(pSession->isTimedOut)
+		throw CXEPsshdException(CXEPsshdException::XEPSSHDEC_SESSIONAUTHCLIENTERROR);
+
+		u16 blockSize;
+		u32 byteRate;
+
+		// false until the peer opens the stream
+		if(!XEPxibb.AcceptStream(pSession->Jid, pSession->localCid, &pSession->shellSid, &blockSize, &byteRate, &pSession->isRawData))
+		return false;
+
+		pSession->StreamTimer.Cancel();
+		pSession->isOpened = true;
+
+		// data that came along with the stream is read by the caller
+		XEPxibb.SetStreamTask(pSession->Jid, pSession->localCid, pSession->shellSid, &Executor, pSession);
+
+		MutexSessionList.Lock();
+		ShellSet.insert(pSession);
+		MutexSessionList.Signal();
+		MutexSessionList.UnLock();
+
+		return true;
 	}
-	
+
 	catch(exception& e)
 	{
-		pSessionParam->pXEPxibb->CloseChannel(pSessionParam->Jid, pSessionParam->localCid);
-		delete pSessionParam;
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		return NULL;
+		throw CXEPsshdException(CXEPsshdException::XEPSSHDEC_OPENSHELLERROR);
 	}
 }
 
-void* CXEPsshd::InShellJob(void* pvSSessionParam) throw()
+bool CXEPsshd::MoveIn(SSession* pSession)
 {
-	SSessionParam* pSessionParam = (SSessionParam*) pvSSessionParam;
-	CXEPxibb* pXEPxibb = pSessionParam->pXEPxibb;
-	CJid Jid = pSessionParam->Jid;
-	u16 localCid = pSessionParam->localCid;
-	u16 shellSid = pSessionParam->shellSid;
-
-	int TunFd = pSessionParam->TunFd;
-	int nread;
-	char buffer[2000];
-	
 	try
 	{
-		
-		CBuffer DataBuffer;
-		
-		while(true)
+		u32 numPacket = 0;
+
+		// the packets of the peer are decoded first, they go to the tun
+		// together
+		while(numPacket < XEPSSHD_SESSIONBATCH)
 		{
-			CBase64 Base64;
-			CBuffer Buffer, EncryptedBuffer, Data;
-			CSessionShellDataNode SessionShellDataNode;
-			
-			pXEPxibb->ReceiveStreamData(Jid, localCid, shellSid, &Buffer);
-			CXMLParser::Parse(&Buffer, &SessionShellDataNode);
-			Base64.From64(SessionShellDataNode.GetData(), &Data);
-			Data.Write(buffer);
-
-			if (Data.GetBufferSize())
+			CBuffer* pData = &pSession->InList[numPacket];
+			pData->Resize(0);
+
+			if(pSession->isRawData)
 			{
-				nread = write(TunFd, Data.GetBuffer(), Data.GetBufferSize());
-				if(nread < 0) {
-					perror("Write to interface");
-					close(TunFd);
-					exit(1);
-				}
+				// the payload is the tun packet itself
+				if(!XEPxibb.TryReceiveStreamData(pSession->Jid, pSession->localCid, pSession->shellSid, pData))
+				break;
 			}
+
+			else
+			{
+				CSessionShellDataNode SessionShellDataNode;
+
+				if(!XEPxibb.TryReceiveStreamData(pSession->Jid, pSession->localCid, pSession->shellSid, &pSession->Buffer))
+				break;
+
+				CXMLParser::Parse(&pSession->Buffer, &SessionShellDataNode);
+				pSession->Base64.From64(SessionShellDataNode.GetData(), pData);
+			}
+
+			if(pData->GetBufferSize())
+			numPacket++;
 		}
-		
-		return NULL;
+
+		if(numPacket)
+		WriteTun(pSession, numPacket);
+
+		return numPacket == XEPSSHD_SESSIONBATCH;
 	}
-	
+
 	catch(exception& e)
 	{
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		return NULL;
+		throw CXEPsshdException(CXEPsshdException::XEPSSHDEC_MOVEINERROR);
 	}
 }
 
-void* CXEPsshd::OutShellJob(void* pvSSessionParam) throw()
-{	
-	SSessionParam* pSessionParam = (SSessionParam*) pvSSessionParam;
-	CXEPxibb* pXEPxibb = pSessionParam->pXEPxibb;
-	CJid Jid = pSessionParam->Jid;
-	u16 localCid = pSessionParam->localCid;
-	u16 shellSid = pSessionParam->shellSid;
-	int TunFd = pSessionParam->TunFd;
-	int nread;
-	char buffer[2000];
+bool CXEPsshd::MoveOut(SSession* pSession)
+{
+	try
+	{
+		for(u32 i = 0 ; i < XEPSSHD_SESSIONBATCH ; i++)
+		{
+			// a packet the last run could not send goes first
+			if(pSession->pOutPacket == NULL)
+			{
+				void* pvPacket;
+
+				if(!pSession->OutQueue.TryPop(&pvPacket))
+				return false;
+
+				pSession->pOutPacket = (CBuffer*) pvPacket;
+			}
+
+			CBuffer* pPacket = pSession->pOutPacket;
+			u32 status;
+			u32 delay;
+
+			if(pSession->isRawData)
+			status = XEPxibb.TrySendStreamData(pSession->Jid, pSession->localCid, pSession->shellSid, pPacket->GetBuffer(), pPacket->GetBufferSize(), &delay);
+
+			else
+			{
+				CSessionShellDataNode SessionShellDataNode;
+				string& DataBase64 = pSession->DataBase64;
+
+				DataBase64.resize(CBase64::GetTo64Size(pPacket->GetBufferSize()));
+				DataBase64.resize(pSession->Base64.To64(pPacket->GetBuffer(), pPacket->GetBufferSize(), &DataBase64[0]));
+				SessionShellDataNode.SwapData(DataBase64);
+				SessionShellDataNode.Build(&pSession->Buffer);
+
+				status = XEPxibb.TrySendStreamData(pSession->Jid, pSession->localCid, pSession->shellSid, &pSession->Buffer, &delay);
+			}
+
+			// the worker goes to the other sessions, the timer brings us
+			// back once the pacing delay is over or the output had time to
+			// drain
+			if(status != CXEPxibb::XEPXSS_SENT)
+			{
+				if(status == CXEPxibb::XEPXSS_FULL)
+				delay = XEPSSHD_RETRYDELAY;
+
+				pXMPPCore->GetTimerWheel()->Arm(&pSession->OutTimer, delay);
+				return false;
+			}
+
+			delete pPacket;
+			pSession->pOutPacket = NULL;
+		}
+
+		return pSession->OutQueue.GetSize() > 0;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPsshdException(CXEPsshdException::XEPSSHDEC_MOVEOUTERROR);
+	}
+}
+
+void CXEPsshd::WriteTun(SSession* pSession, u32 numPacket)
+{
+	MutexTunWrite.Lock();
 
 	try
 	{
-		while(true)
+		// the batch goes to the kernel in one submit, the last write
+		// submits whatever the others left
+		for(u32 i = 0 ; i < numPacket ; i++)
+		TunRing.Write(pSession->InList[i].GetBuffer(), pSession->InList[i].GetBufferSize(), i + 1 < numPacket);
+
+		MutexTunWrite.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexTunWrite.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPsshdException(CXEPsshdException::XEPSSHDEC_WRITETUNERROR);
+	}
+}
+
+void CXEPsshd::CloseSession(SSession* pSession)
+{
+	try
+	{
+		// the reader does not submit us anymore
+		MutexSessionList.Lock();
+
+		ShellSet.erase(pSession);
+
+		if(pLastShell == pSession)
+		pLastShell = NULL;
+
+		MutexSessionList.UnLock();
+
+		// nor do the timers, a callback on its way is waited for
+		pSession->StreamTimer.Cancel();
+		pXMPPCore->GetTimerWheel()->Wait(&pSession->StreamTimer);
+
+		pSession->OutTimer.Cancel();
+		pXMPPCore->GetTimerWheel()->Wait(&pSession->OutTimer);
+
+		// the handlers of the channel are gone once it is closed, a task
+		// does not wait for the peer to answer
+		XEPxibb.CloseChannel(pSession->Jid, pSession->localCid, false);
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+	}
+
+	// Detach() waits for the last one to leave before it detaches xibb
+	MutexSessionList.Lock();
+	SessionSet.erase(pSession);
+	MutexSessionList.Signal();
+	MutexSessionList.UnLock();
+
+	delete pSession;
+}
+
+bool CXEPsshd::PickSession(SSession** ppSession, CJid* pJid, u16* pLocalCid, u16* pShellSid)
+{
+	MutexSessionList.Lock();
+
+	try
+	{
+		// false once we are stopped
+		while(!isStopped && ShellSet.empty())
+		MutexSessionList.Wait();
+
+		if(isStopped)
+		{
+			MutexSessionList.UnLock();
+			return false;
+		}
+
+		// the first shell after the last one served whose output has room,
+		// the next one in turn when none has
+		set<SSession*>::iterator it = ShellSet.upper_bound(pLastShell);
+		SSession* pSession = NULL;
+		SSession* pNext = NULL;
+
+		for(u32 i = 0 ; i < ShellSet.size() ; i++, it++)
 		{
-			CBuffer Buffer, EncryptedBuffer, Data;
-			string DataBase64;
-			CBase64 Base64;
-			CSessionShellDataNode SessionShellDataNode;
-
-			nread = read(TunFd,buffer,sizeof(buffer));
-			if(nread < 0) {
-				perror("Reading from interface");
-				close(TunFd);
-				exit(1);
+			if(it == ShellSet.end())
+			it = ShellSet.begin();
+
+			if(pNext == NULL)
+			pNext = *it;
+
+			try
+			{
+				if(!XEPxibb.IsStreamOutputFull((*it)->Jid, (*it)->localCid, (*it)->shellSid))
+				{
+					pSession = *it;
+					break;
+				}
 			}
 
-			Data.Create((u32)nread);
-			Data.Write((const u8*)buffer, (u32)nread);
-			Base64.To64(&Data, DataBase64);
-			SessionShellDataNode.SetData(DataBase64.c_str(), DataBase64.size());
-			SessionShellDataNode.Build(&Buffer);
+			// a stream being closed, its session is on its way out
+			catch(exception& e)
+			{}
+		}
+
+		if(pSession == NULL)
+		pSession = pNext;
+
+		pLastShell = pSession;
+
+		*ppSession = pSession;
+		*pJid = pSession->Jid;
+		*pLocalCid = pSession->localCid;
+		*pShellSid = pSession->shellSid;
+
+		MutexSessionList.UnLock();
+
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		MutexSessionList.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPsshdException(CXEPsshdException::XEPSSHDEC_PICKSESSIONERROR);
+	}
+}
+
+void CXEPsshd::HandPacket(SSession* pSession, const u8* pPacket, u32 packetSize)
+{
+	CBuffer* pBuffer = NULL;
+
+	MutexSessionList.Lock();
 
-			pXEPxibb->SendStreamData(Jid, localCid, shellSid, &Buffer);
+	try
+	{
+		// the session may have gone since it was picked, the packet is
+		// then dropped as the kernel would
+		if(ShellSet.count(pSession) == 0 || packetSize == 0)
+		{
+			MutexSessionList.UnLock();
+			return;
 		}
 
-		return NULL;
+		pBuffer = new CBuffer;
+		pBuffer->Append(pPacket, packetSize);
+
+		if(!pSession->OutQueue.TryPush(pBuffer))
+		delete pBuffer;
+		else
+		Executor.Submit(pSession);
+
+		pBuffer = NULL;
+
+		MutexSessionList.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexSessionList.UnLock();
+
+		if(pBuffer != NULL)
+		delete pBuffer;
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPsshdException(CXEPsshdException::XEPSSHDEC_HANDPACKETERROR);
+	}
+}
+
+void* CXEPsshd::SessionManagerJob(void* pvThis) throw()
+{
+	try
+	{
+		CXEPsshd* pXEPsshd = (CXEPsshd*) pvThis;
+		CXEPxibb* pXEPxibb = &pXEPsshd->XEPxibb;
+
+		while(true)
+		{
+			CJid Jid;
+			u16 localCid;
+			u16 maxStream;
+			u16 blockSize;
+			u32 byteRate;
+
+			pXEPxibb->WaitChannel(&Jid, &localCid, &maxStream, &blockSize, &byteRate);
+			pXEPsshd->StartSession(Jid, localCid);
+		}
 	}
 	
 	catch(exception& e)
@@ -283,38 +616,102 @@ void* CXEPsshd::OutShellJob(void* pvSSessionParam) throw()
 	}
 }
 
-
-void CXEPsshd::SessionShell(SSessionParam* pSessionParam)
+void* CXEPsshd::TunReaderJob(void* pvThis) throw()
 {
 	try
 	{
-		CXEPxibb* pXEPxibb = pSessionParam->pXEPxibb;
-		CJid Jid = pSessionParam->Jid;
-		u16 localCid = pSessionParam->localCid;
+		CXEPsshd* pXEPsshd = (CXEPsshd*) pvThis;
+		CXEPxibb* pXEPxibb = &pXEPsshd->XEPxibb;
 
-		CThread ThreadInJob;
-		CThread ThreadOutJob;
-		u16 blockSize;
-		u32 byteRate;
+		SSession* pSession;
+		CJid Jid;
+		u16 localCid;
+		u16 shellSid;
 
-		pXEPxibb->WaitStream(Jid, localCid, &pSessionParam->shellSid, &blockSize, &byteRate);
+		while(pXEPsshd->PickSession(&pSession, &Jid, &localCid, &shellSid))
+		{
+			// we only read the tun once the output has room, meanwhile the
+			// kernel queue holds or drops the packets. a session that
+			// fails here is told by its channel
+			try
+			{
+				if(!pXEPxibb->WaitSendStreamData(Jid, localCid, shellSid))
+				break;
+			}
 
-		ThreadInJob.Run(InShellJob, pSessionParam);
-		ThreadOutJob.Run(OutShellJob, pSessionParam);
-		
-		ThreadInJob.Wait();
-		ThreadOutJob.Wait();
+			catch(exception& e)
+			{
+				continue;
+			}
+
+			// the packet stays in the ring buffer until the next read, NULL
+			// once Detach() stopped the ring
+			u32 packetSize;
+			const u8* pPacket = pXEPsshd->TunRing.Read(&packetSize);
+
+			if(pPacket == NULL)
+			break;
+
+			pXEPsshd->HandPacket(pSession, pPacket, packetSize);
+		}
+
+		return NULL;
 	}
-	
+
 	catch(exception& e)
 	{
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXEPsshdException(CXEPsshdException::XEPSSHDEC_SESSIONAUTHCLIENTERROR);
+		return NULL;
 	}
+}
+
+CXEPsshd::SSession::SSession(CXEPsshd* pXEPsshd, const CJid& rJid, u16 localCid) : OutQueue(XEPSSHD_OUTQUEUESIZE, true), InList(XEPSSHD_SESSIONBATCH)
+{
+	this->pXEPsshd = pXEPsshd;
+	Jid = rJid;
+	this->localCid = localCid;
+	shellSid = 0;
+	isRawData = false;
+
+	isStarted = false;
+	isOpened = false;
+	pOutPacket = NULL;
+	isTimedOut = false;
+	isClosing = false;
+
+	StreamTimer.pSession = this;
+	StreamTimer.isDeadline = true;
+	OutTimer.pSession = this;
+	OutTimer.isDeadline = false;
+}
+
+CXEPsshd::SSession::~SSession()
+{
+	void* pvPacket;
+
+	if(pOutPacket != NULL)
+	delete pOutPacket;
+
+	while(OutQueue.TryPop(&pvPacket))
+	delete (CBuffer*) pvPacket;
+}
+
+bool CXEPsshd::SSession::Run()
+{
+	return pXEPsshd->RunSession(this);
+}
+
+void CXEPsshd::SSession::SSessionTimer::OnTimer()
+{
+	// past its deadline the session closes itself unless the stream came
+	// meanwhile, otherwise it sends what it kept
+	if(isDeadline)
+	pSession->isTimedOut = true;
 
+	pSession->pXEPsshd->Executor.Submit(pSession);
 }
 
 
@@ -340,11 +737,26 @@ const char* CXEPsshdException::what() const throw()
 	case XEPSSHDEC_DETACHERROR:
 		return "CXEPsshd::Detach() error";
 		
-	case XEPSSHDEC_INSHELLJOBERROR:
-		return "CXEPsshd::InShellJob() error";
+	case XEPSSHDEC_RUNSESSIONERROR:
+		return "CXEPsshd::RunSession() error";
+
+	case XEPSSHDEC_OPENSHELLERROR:
+		return "CXEPsshd::OpenShell() error";
+
+	case XEPSSHDEC_MOVEINERROR:
+		return "CXEPsshd::MoveIn() error";
+
+	case XEPSSHDEC_MOVEOUTERROR:
+		return "CXEPsshd::MoveOut() error";
+
+	case XEPSSHDEC_WRITETUNERROR:
+		return "CXEPsshd::WriteTun() error";
+
+	case XEPSSHDEC_PICKSESSIONERROR:
+		return "CXEPsshd::PickSession() error";
 
-	case XEPSSHDEC_OUTSHELLJOBERROR:
-		return "CXEPsshd::OutShellJob() error";
+	case XEPSSHDEC_HANDPACKETERROR:
+		return "CXEPsshd::HandPacket() error";
 
 	default:
 		return "CXEPsshd: Unknown error";
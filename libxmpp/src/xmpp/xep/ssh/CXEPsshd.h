@@ -21,12 +21,21 @@
 #ifndef __CXEPSSHD_H__
 #define __CXEPSSHD_H__
 
+#include <set>
 #include <string>
 #include <vector>
 
 #include <common/CException.h>
 #include <common/CObject.h>
+#include <common/data/CBase64.h>
+#include <common/data/CBuffer.h>
+#include <common/thread/CExecutor.h>
+#include <common/thread/CMutex.h>
+#include <common/thread/CRingQueue.h>
+#include <common/thread/CTask.h>
 #include <common/thread/CThread.h>
+#include <common/thread/CTimer.h>
+#include <common/tun/CTunRing.h>
 
 #include <xmpp/core/CXMPPCore.h>
 #include <xmpp/jid/CJid.h>
@@ -34,16 +43,66 @@
 
 using namespace std;
 
+// in microseconds, a channel whose shell stream is not opened in time is closed
+#define XEPSSHD_STREAMTIMEOUT (30 * 1000000)
+
+// packets a session moves each way in one run before it lets the others run
+#define XEPSSHD_SESSIONBATCH 16
+
+// tun packets handed to a session and not sent yet, more are dropped
+#define XEPSSHD_OUTQUEUESIZE 64
+
+// in microseconds, a session whose output is full tries again after it
+#define XEPSSHD_RETRYDELAY 2000
+
+// sessions are tasks of an executor with a thread per processor, a session
+// runs when its peer opens the shell stream or sends data, when the tun
+// reader hands it packets and when its stream does not come in time. a
+// session never sleeps, a packet that is paced or finds the output full
+// is kept for its timer to submit the session again. a single thread
+// reads the tun, each packet goes to the next shell whose output has room
 class CXEPsshd : public CObject
 {
 private:
-	struct SSessionParam
+	struct SSession : public CTask
 	{
-		CXEPxibb* pXEPxibb;
+		struct SSessionTimer : public CTimer
+		{
+			virtual void OnTimer();
+
+			SSession* pSession;
+			bool isDeadline;
+		};
+
+		SSession(CXEPsshd* pXEPsshd, const CJid& rJid, u16 localCid);
+		virtual ~SSession();
+
+		virtual bool Run();
+
+		CXEPsshd* pXEPsshd;
 		CJid Jid;
 		u16 localCid;
 		u16 shellSid;
-		int TunFd;
+		bool isRawData;
+
+		// only touched by Run()
+		bool isStarted;
+		bool isOpened;
+		CBuffer* pOutPacket;
+
+		// set from other threads, Run() is submitted right after
+		volatile bool isTimedOut;
+		volatile bool isClosing;
+
+		SSessionTimer StreamTimer;
+		SSessionTimer OutTimer;
+		CRingQueue OutQueue;
+
+		// storage reused from one run to the next
+		vector<CBuffer> InList;
+		CBuffer Buffer;
+		CBase64 Base64;
+		string DataBase64;
 	};
 
 public:
@@ -53,26 +112,48 @@ public:
 	void Attach(CXMPPCore* pXMPPCore, int TunFd);
 	void Detach();
 
+	void SetUring(bool isUring);
+
 protected:
 	void StartSession(const CJid& rJid, u16 localCid) throw();
 	
 private:
-	static void* SessionManagerJob(void* pvThis) throw();
-	static void* SessionJob(void* pvSSessionParam) throw();
+	bool RunSession(SSession* pSession);
+	bool OpenShell(SSession* pSession);
+	bool MoveIn(SSession* pSession);
+	bool MoveOut(SSession* pSession);
+	void WriteTun(SSession* pSession, u32 numPacket);
+	void CloseSession(SSession* pSession);
 
-	static void* InShellJob(void* pvSSessionParam) throw();
-	static void* OutShellJob(void* pvSSessionParam) throw();
+	bool PickSession(SSession** ppSession, CJid* pJid, u16* pLocalCid, u16* pShellSid);
+	void HandPacket(SSession* pSession, const u8* pPacket, u32 packetSize);
 
-	static void SessionShell(SSessionParam* pSessionParam);
+	static void* SessionManagerJob(void* pvThis) throw();
+	static void* TunReaderJob(void* pvThis) throw();
 	
 private:
 	CThread ThreadSessionManagerJob;
-	CThread ThreadSessionJob;
+	CThread ThreadTunReaderJob;
 
 private:
 	CXMPPCore* pXMPPCore;
 	CXEPxibb XEPxibb;
 	int TunFd;
+	bool isUring;
+
+	CExecutor Executor;
+
+	// the reader reads, the sessions write one at a time
+	CTunRing TunRing;
+	CMutex MutexTunWrite;
+
+	// every session, and the ones whose shell is opened that the reader
+	// hands packets to, in turn after the last one served
+	set<SSession*> SessionSet;
+	set<SSession*> ShellSet;
+	SSession* pLastShell;
+	bool isStopped;
+	CMutex MutexSessionList;
 };
  
 class CXEPsshdException : public CException
@@ -89,8 +170,13 @@ public:
 		XEPSSHDEC_SESSIONAUTHSERVERERROR,
 		XEPSSHDEC_SESSIONAUTHCLIENTERROR,
 		XEPSSHDEC_SESSIONMANAGERJOBERROR,
-		XEPSSHDEC_INSHELLJOBERROR,
-		XEPSSHDEC_OUTSHELLJOBERROR
+		XEPSSHDEC_RUNSESSIONERROR,
+		XEPSSHDEC_OPENSHELLERROR,
+		XEPSSHDEC_MOVEINERROR,
+		XEPSSHDEC_MOVEOUTERROR,
+		XEPSSHDEC_WRITETUNERROR,
+		XEPSSHDEC_PICKSESSIONERROR,
+		XEPSSHDEC_HANDPACKETERROR
 	};
 
 public:
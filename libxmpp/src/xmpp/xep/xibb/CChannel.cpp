@@ -30,21 +30,32 @@
 #include <common/CException.h>
 #include <common/CObject.h>
 #include <common/thread/CMutex.h>
+#include <common/thread/CTokenBucket.h>
 
 #include <xmpp/core/CHandler.h>
 #include <xmpp/core/CXMLFilter.h>
 #include <xmpp/jid/CJid.h>
+#include <xmpp/stanza/CStanzaTemplate.h>
 #include <xmpp/xep/xibb/CChannel.h>
 #include <xmpp/xep/xibb/CStream.h>
+#include <xmpp/xep/xibb/stanza/CChannelDataStanza.h>
 
 using namespace std;
 
+#define CHANNEL_DATAFLOW	0xFFFF
+
+// the channel may send this many blocks at once before it gets paced
+#define CHANNEL_BURSTBLOCKS	4
+
 CChannel::CChannel()
 {
+	pChannelDataTemplate = NULL;
 }
 
 CChannel::CChannel(const CJid& rRemoteJid, u16 remoteCid, u16 maxStream, u16 blockSize, u32 byteRate)
 {
+	pChannelDataTemplate = NULL;
+
 	try
 	{
 		Init(rRemoteJid, remoteCid, maxStream, blockSize, byteRate);
@@ -68,6 +79,9 @@ CChannel::~CChannel()
 			if(StreamList[i] != NULL)
 			delete StreamList[i];
 		}
+
+		if(pChannelDataTemplate != NULL)
+		pChannelDataTemplate->Release();
 	}
 	
 	catch(exception& e)
@@ -89,12 +103,26 @@ void CChannel::Init(const CJid& rRemoteJid, u16 remoteCid, u16 maxStream, u16 bl
 		StreamList.resize(maxStream);
 		this->blockSize = blockSize;
 		this->byteRate = byteRate;
+
+		// the rate bounds the channel data and all its streams together
+		TokenBucket.Init(byteRate, CHANNEL_BURSTBLOCKS * blockSize);
 		
 		for(u16 i = 0 ; i < StreamList.size() ; i++)
 		StreamList[i] = NULL;
 		
 		ChannelDataHandler.Init(rRemoteJid, remoteCid);
 		StreamOpenHandler.Init(rRemoteJid, remoteCid);
+
+		CChannelDataStanza ChannelDataStanza(rRemoteJid, remoteCid);
+		CStanzaTemplate* pTemplate = CStanzaTemplate::Create(&ChannelDataStanza, ChannelDataStanza.GetChild("channel-data"));
+
+		// the channel data goes as one more flow next to its streams
+		pTemplate->SetFlow((remoteCid << 16) | CHANNEL_DATAFLOW);
+
+		if(pChannelDataTemplate != NULL)
+		pChannelDataTemplate->Release();
+
+		pChannelDataTemplate = pTemplate;
 	}
 	
 	catch(exception& e)
@@ -132,6 +160,11 @@ CObject::u32 CChannel::GetByteRate() const
 	return byteRate;
 }
 
+CTokenBucket* CChannel::GetTokenBucket()
+{
+	return &TokenBucket;
+}
+
 CChannelDataHandler* CChannel::GetChannelDataHandler()
 {
 	return &ChannelDataHandler;
@@ -141,6 +174,11 @@ CStreamOpenHandler* CChannel::GetStreamOpenHandler()
 {
 	return &StreamOpenHandler;
 }
+
+CStanzaTemplate* CChannel::GetChannelDataTemplate()
+{
+	return pChannelDataTemplate;
+}
 	
 CStream* CChannel::GetStreamByLocalSid(u16 localSid)
 {
@@ -259,6 +297,47 @@ void CChannel::RemoveStreamByRemoteSid(u16 remoteSid)
 	}
 }
 
+void CChannel::PushOpenedStream(u16 localSid, bool isRawData)
+{
+	try
+	{
+		OpenedStreamList.push_back(make_pair(localSid, isRawData));
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CChannelException(CChannelException::CEC_PUSHOPENEDSTREAMERROR);
+	}
+}
+
+bool CChannel::PopOpenedStream(u16* pLocalSid, bool* pIsRawData)
+{
+	try
+	{
+		if(OpenedStreamList.empty())
+		return false;
+
+		*pLocalSid = OpenedStreamList.front().first;
+		*pIsRawData = OpenedStreamList.front().second;
+
+		OpenedStreamList.erase(OpenedStreamList.begin());
+		return true;
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CChannelException(CChannelException::CEC_POPOPENEDSTREAMERROR);
+	}
+}
+
 CChannelException::CChannelException(int code) : CException(code)
 {}
 
@@ -292,6 +371,12 @@ const char* CChannelException::what() const throw()
 		
 	case CEC_REMOVESTREAMBYREMOTESIDERROR:
 		return "CChannel::RemoveStreamByRemoteSid() error";
+
+	case CEC_PUSHOPENEDSTREAMERROR:
+		return "CChannel::PushOpenedStream() error";
+
+	case CEC_POPOPENEDSTREAMERROR:
+		return "CChannel::PopOpenedStream() error";
 		
 	default:
 		return "CChannel: Unknown error";
@@ -22,12 +22,15 @@
 #define __CCHANNEL_H__
 
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <common/CException.h>
 #include <common/CObject.h>
+#include <common/thread/CTokenBucket.h>
 
 #include <xmpp/jid/CJid.h>
+#include <xmpp/stanza/CStanzaTemplate.h>
 #include <xmpp/xep/xibb/CStream.h>
 #include <xmpp/xep/xibb/handler/CChannelDataHandler.h>
 #include <xmpp/xep/xibb/handler/CStreamOpenHandler.h>
@@ -49,10 +52,11 @@ public:
 	u16 GetMaxStream() const;
 	u16 GetBlockSize() const;
 	u32 GetByteRate() const;
-
+	CTokenBucket* GetTokenBucket();
 
 	CChannelDataHandler* GetChannelDataHandler();
 	CStreamOpenHandler* GetStreamOpenHandler();
+	CStanzaTemplate* GetChannelDataTemplate();
 	
 	u16 AddStream(CStream* pStream);
 
@@ -62,16 +66,25 @@ public:
 	void RemoveStreamByLocalSid(u16 localSid);
 	void RemoveStreamByRemoteSid(u16 remoteSid);
 
+	void PushOpenedStream(u16 localSid, bool isRawData);
+	bool PopOpenedStream(u16* pLocalSid, bool* pIsRawData);
+
 private:
 	CJid RemoteJid;
 	u16 remoteCid;
 	u16 blockSize;
 	u32 byteRate;
+	CTokenBucket TokenBucket;
 	
 	CChannelDataHandler ChannelDataHandler;
 	CStreamOpenHandler StreamOpenHandler;
+	CStanzaTemplate* pChannelDataTemplate;
 			
 	vector<CStream*> StreamList;
+
+	// streams opened along with the channel, WaitStream() returns them
+	// before it waits for a stream:open
+	vector<pair<u16, bool> > OpenedStreamList;
 };
  
 class CChannelException : public CException
@@ -87,7 +100,9 @@ public:
 		CEC_GETSTREAMBYREMOTESIDERROR,
 		CEC_REMOVESTREAMBYLOCALSIDERROR,
 		CEC_REMOVESTREAMBYREMOTESIDERROR,
-		CEC_GETLOCALSIDERROR
+		CEC_GETLOCALSIDERROR,
+		CEC_PUSHOPENEDSTREAMERROR,
+		CEC_POPOPENEDSTREAMERROR
 	};
 
 public:
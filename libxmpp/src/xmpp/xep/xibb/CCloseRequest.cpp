@@ -0,0 +1,107 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <iostream>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/xml/CXMLNode.h>
+
+#include <xmpp/core/CIQRequest.h>
+#include <xmpp/core/CXMPPCore.h>
+#include <xmpp/stanza/CStanza.h>
+#include <xmpp/xep/xibb/CCloseRequest.h>
+
+using namespace std;
+
+CCloseRequest::CCloseRequest()
+{
+	// one for the sender, one for the answer
+	numRef = 2;
+}
+
+CCloseRequest::~CCloseRequest()
+{}
+
+bool CCloseRequest::Send(CXMPPCore* pXMPPCore, CStanza* pStanza, u32 timeout)
+{
+	CCloseRequest* pRequest = new CCloseRequest;
+	bool isSent;
+
+	try
+	{
+		isSent = pXMPPCore->SendIQ(pStanza, pRequest, timeout);
+	}
+
+	catch(exception& e)
+	{
+		// the core only calls OnResult() on a request it took to answer
+		if(!pRequest->IsAnswered())
+		pRequest->Release();
+
+		pRequest->Release();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CCloseRequestException(CCloseRequestException::CREC_SENDERROR);
+	}
+
+	// not sent means taken back before OnResult() could run
+	if(!isSent)
+	pRequest->Release();
+
+	pRequest->Release();
+	return isSent;
+}
+
+void CCloseRequest::OnResult(CXMLNode* pXMLNode)
+{
+	// the answer, an error or none at all, changes nothing anymore
+	if(pXMLNode != NULL)
+	delete pXMLNode;
+
+	Release();
+}
+
+void CCloseRequest::Release()
+{
+	if(__sync_sub_and_fetch(&numRef, 1) == 0)
+	delete this;
+}
+
+CCloseRequestException::CCloseRequestException(int code) : CException(code)
+{}
+
+CCloseRequestException::~CCloseRequestException() throw()
+{}
+	
+const char* CCloseRequestException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case CREC_SENDERROR:
+		return "CCloseRequest::Send() error";
+
+	default:
+		return "CCloseRequest: Unknown error";
+	}
+}
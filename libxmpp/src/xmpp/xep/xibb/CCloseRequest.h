@@ -0,0 +1,67 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CCLOSEREQUEST_H__
+#define __CCLOSEREQUEST_H__
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/xml/CXMLNode.h>
+
+#include <xmpp/core/CIQRequest.h>
+#include <xmpp/core/CXMPPCore.h>
+#include <xmpp/stanza/CStanza.h>
+
+// a close nobody waits for, the channel is already gone on our side. the
+// request owns itself, it is freed by whichever of its sender and its
+// answer is done with it last
+class CCloseRequest : public CIQRequest
+{
+public:
+	static bool Send(CXMPPCore* pXMPPCore, CStanza* pStanza, u32 timeout);
+
+	virtual void OnResult(CXMLNode* pXMLNode);
+
+private:
+	CCloseRequest();
+	virtual ~CCloseRequest();
+
+	void Release();
+
+private:
+	volatile u32 numRef;
+};
+
+class CCloseRequestException : public CException
+{
+public:
+	enum CloseRequestExceptionCode
+	{
+		CREC_SENDERROR
+	};
+
+public:
+	CCloseRequestException(int code);
+	virtual ~CCloseRequestException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif // __CCLOSEREQUEST_H__
@@ -0,0 +1,226 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <iostream>
+#include <string>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CMutex.h>
+#include <common/xml/CXMLNode.h>
+
+#include <xmpp/core/CIQRequest.h>
+#include <xmpp/core/CXMPPCore.h>
+#include <xmpp/stanza/iq/get/CIQGetStanza.h>
+#include <xmpp/xep/xibb/CPingRequest.h>
+#include <xmpp/xep/xibb/CRateControl.h>
+
+using namespace std;
+
+CPingRequest::CPingRequest()
+{
+	pRateControl = NULL;
+	probeId = 0;
+	isDone = true;
+}
+
+CPingRequest::~CPingRequest()
+{
+	try
+	{
+		Stop();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+	}
+}
+
+void CPingRequest::Init(CRateControl* pRateControl)
+{
+	this->pRateControl = pRateControl;
+}
+
+bool CPingRequest::Send(CXMPPCore* pXMPPCore, const string& to, u32 probeId)
+{
+	Mutex.Lock();
+
+	try
+	{
+		// a ping still waiting is given up, one being answered keeps the
+		// request and the rate control times this probe out
+		if(!Cancel() && IsAnswered() && !isDone)
+		{
+			Mutex.UnLock();
+			return false;
+		}
+
+		this->probeId = probeId;
+		isDone = false;
+
+		Mutex.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		Mutex.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CPingRequestException(CPingRequestException::PREC_SENDERROR);
+	}
+
+	try
+	{
+		// the ping goes ahead of queued data as any iq, its round trip is
+		// the delay along the path to the server and in its queues
+		CIQGetStanza IQGetStanza;
+		IQGetStanza.SetTo(to);
+
+		CXMLNode* pXMLNode = new CXMLNode("ping");
+		pXMLNode->SetNameSpace("urn:xmpp:ping");
+
+		IQGetStanza.PushChild(pXMLNode);
+
+		// not sent means taken back before OnResult() could run
+		if(pXMPPCore->SendIQ(&IQGetStanza, this, RATECONTROL_PROBETIMEOUT))
+		return true;
+
+		Mutex.Lock();
+		isDone = true;
+		Mutex.UnLock();
+
+		return false;
+	}
+
+	catch(exception& e)
+	{
+		Mutex.Lock();
+
+		if(!IsAnswered())
+		isDone = true;
+
+		Mutex.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CPingRequestException(CPingRequestException::PREC_SENDERROR);
+	}
+}
+
+void CPingRequest::Stop()
+{
+	try
+	{
+		// an answer already on its way is waited for, it would reach a
+		// rate control that is gone
+		if(!Cancel() && IsAnswered())
+		{
+			Mutex.Lock();
+
+			while(!isDone)
+			Mutex.Wait();
+
+			Mutex.UnLock();
+		}
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CPingRequestException(CPingRequestException::PREC_STOPERROR);
+	}
+}
+
+void CPingRequest::OnResult(CXMLNode* pXMLNode)
+{
+	Mutex.Lock();
+
+	try
+	{
+		// NULL when the ping timed out or the connection went away, the
+		// rate control gives up on the probe by itself
+		if(pXMLNode != NULL)
+		{
+			delete pXMLNode;
+			pXMLNode = NULL;
+
+			if(pRateControl != NULL)
+			pRateControl->OnProbe(probeId);
+		}
+
+		isDone = true;
+
+		Mutex.Signal();
+		Mutex.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		if(pXMLNode != NULL)
+		delete pXMLNode;
+
+		isDone = true;
+
+		Mutex.Signal();
+		Mutex.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CPingRequestException(CPingRequestException::PREC_ONRESULTERROR);
+	}
+}
+
+CPingRequestException::CPingRequestException(int code) : CException(code)
+{}
+
+CPingRequestException::~CPingRequestException() throw()
+{}
+	
+const char* CPingRequestException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case PREC_SENDERROR:
+		return "CPingRequest::Send() error";
+
+	case PREC_STOPERROR:
+		return "CPingRequest::Stop() error";
+
+	case PREC_ONRESULTERROR:
+		return "CPingRequest::OnResult() error";
+
+	default:
+		return "CPingRequest: Unknown error";
+	}
+}
@@ -0,0 +1,77 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CPINGREQUEST_H__
+#define __CPINGREQUEST_H__
+
+#include <string>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CMutex.h>
+#include <common/xml/CXMLNode.h>
+
+#include <xmpp/core/CIQRequest.h>
+#include <xmpp/core/CXMPPCore.h>
+#include <xmpp/xep/xibb/CRateControl.h>
+
+using namespace std;
+
+// the ping of the rate control, sent through the iq table of the core so
+// that only its own answer comes back to it. one ping is out at a time,
+// an error answer is as good a round trip as a result
+class CPingRequest : public CIQRequest
+{
+public:
+	CPingRequest();
+	virtual ~CPingRequest();
+
+	void Init(CRateControl* pRateControl);
+
+	bool Send(CXMPPCore* pXMPPCore, const string& to, u32 probeId);
+	void Stop();
+
+	virtual void OnResult(CXMLNode* pXMLNode);
+
+private:
+	CRateControl* pRateControl;
+	u32 probeId;
+	bool isDone;
+	CMutex Mutex;
+};
+
+class CPingRequestException : public CException
+{
+public:
+	enum PingRequestExceptionCode
+	{
+		PREC_SENDERROR,
+		PREC_STOPERROR,
+		PREC_ONRESULTERROR
+	};
+
+public:
+	CPingRequestException(int code);
+	virtual ~CPingRequestException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif // __CPINGREQUEST_H__
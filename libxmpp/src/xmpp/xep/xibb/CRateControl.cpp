@@ -0,0 +1,308 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <ctime>
+#include <iostream>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CMutex.h>
+#include <common/thread/CTokenBucket.h>
+
+#include <xmpp/xep/xibb/CRateControl.h>
+
+using namespace std;
+
+#define RATECONTROL_TARGETDELAY		100000
+#define RATECONTROL_PROBEINTERVAL	200000
+
+// each slot of the base history keeps the lowest round trip of a minute
+#define RATECONTROL_BASEINTERVAL	60
+#define RATECONTROL_NORTT		0xFFFFFFFF
+
+#define RATECONTROL_INITRATE		131072
+#define RATECONTROL_MINRATE		8192
+#define RATECONTROL_MAXRATE		(64 * 1024 * 1024)
+#define RATECONTROL_MINDEPTH		16384
+#define RATECONTROL_GAIN		0.1
+
+CRateControl::CRateControl()
+{
+	targetDelay = RATECONTROL_TARGETDELAY;
+	rtt = 0;
+
+	for(u32 i = 0 ; i < RATECONTROL_BASEHISTORY ; i++)
+	baseRttList[i] = RATECONTROL_NORTT;
+
+	baseRttIndex = 0;
+	clock_gettime(CLOCK_MONOTONIC, &BaseStart);
+
+	nextProbeId = 1;
+	probeId = 0;
+	isProbing = false;
+	isAnswered = false;
+	numPaced = 0;
+	ProbeStart = BaseStart;
+
+	rate = RATECONTROL_INITRATE;
+	TokenBucket.Init(rate, rate / 10 > RATECONTROL_MINDEPTH ? rate / 10 : RATECONTROL_MINDEPTH);
+}
+
+CRateControl::~CRateControl()
+{}
+
+void CRateControl::SetTargetDelay(u32 targetDelay)
+{
+	MutexRateControl.Lock();
+
+	try
+	{
+		// 0 stops pacing and probing
+		this->targetDelay = targetDelay;
+
+		MutexRateControl.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexRateControl.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CRateControlException(CRateControlException::RCEC_SETTARGETDELAYERROR);
+	}
+}
+
+CObject::u32 CRateControl::Reserve(u32 size)
+{
+	if(targetDelay == 0)
+	return 0;
+
+	return TokenBucket.Reserve(size);
+}
+
+CObject::u32 CRateControl::GetDelay()
+{
+	if(targetDelay == 0)
+	return 0;
+
+	return TokenBucket.GetDelay();
+}
+
+bool CRateControl::StartProbe(u32* pProbeId)
+{
+	if(targetDelay == 0)
+	return false;
+
+	MutexRateControl.Lock();
+
+	try
+	{
+		struct timespec Now;
+		clock_gettime(CLOCK_MONOTONIC, &Now);
+
+		u32 elapsed = GetElapsed(&ProbeStart, &Now);
+
+		if(isProbing)
+		{
+			if(elapsed < RATECONTROL_PROBETIMEOUT)
+			{
+				MutexRateControl.UnLock();
+				return false;
+			}
+
+			// no answer in time, a server that answered before is taken as
+			// congested, one that never did as ignoring our pings
+			isProbing = false;
+
+			if(isAnswered)
+			Update(elapsed);
+		}
+		else if(elapsed < RATECONTROL_PROBEINTERVAL)
+		{
+			MutexRateControl.UnLock();
+			return false;
+		}
+
+		probeId = nextProbeId++;
+		isProbing = true;
+		ProbeStart = Now;
+		numPaced = TokenBucket.GetNumPaced();
+
+		*pProbeId = probeId;
+
+		MutexRateControl.UnLock();
+
+		return true;
+	}
+
+	catch(exception& e)
+	{
+		MutexRateControl.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CRateControlException(CRateControlException::RCEC_STARTPROBEERROR);
+	}
+}
+
+void CRateControl::OnProbe(u32 probeId)
+{
+	MutexRateControl.Lock();
+
+	try
+	{
+		// late answers to probes we gave up on are ignored
+		if(isProbing && probeId == this->probeId)
+		{
+			struct timespec Now;
+			clock_gettime(CLOCK_MONOTONIC, &Now);
+
+			isProbing = false;
+			isAnswered = true;
+
+			Update(GetElapsed(&ProbeStart, &Now));
+		}
+
+		MutexRateControl.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexRateControl.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CRateControlException(CRateControlException::RCEC_ONPROBEERROR);
+	}
+}
+
+CObject::u32 CRateControl::GetRate() const
+{
+	return targetDelay ? rate : 0;
+}
+
+CObject::u32 CRateControl::GetRtt() const
+{
+	return rtt;
+}
+
+CObject::u32 CRateControl::GetBaseRtt() const
+{
+	u32 baseRtt = RATECONTROL_NORTT;
+
+	for(u32 i = 0 ; i < RATECONTROL_BASEHISTORY ; i++)
+	{
+		if(baseRttList[i] < baseRtt)
+		baseRtt = baseRttList[i];
+	}
+
+	return baseRtt == RATECONTROL_NORTT ? 0 : baseRtt;
+}
+
+void CRateControl::Update(u32 rtt)
+{
+	// the lock is held by the caller, a first sample has no trend yet
+	u32 lastRtt = this->rtt ? this->rtt : rtt;
+	this->rtt = rtt;
+
+	struct timespec Now;
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+
+	if(Now.tv_sec - BaseStart.tv_sec >= RATECONTROL_BASEINTERVAL)
+	{
+		baseRttIndex = (baseRttIndex + 1) % RATECONTROL_BASEHISTORY;
+		baseRttList[baseRttIndex] = RATECONTROL_NORTT;
+		BaseStart = Now;
+	}
+
+	if(rtt < baseRttList[baseRttIndex])
+	baseRttList[baseRttIndex] = rtt;
+
+	// a queue that grows since the last probe counts against us before it
+	// reaches the target, that damps the swing a late answer brings
+	double queueDelay = rtt - GetBaseRtt();
+	double queueTrend = (double) rtt - lastRtt;
+	double offTarget = (targetDelay - queueDelay - queueTrend) / targetDelay;
+
+	if(offTarget < -1)
+	offTarget = -1;
+
+	// the rate only grows when it held some data back during the probe,
+	// an idle or slow sender says nothing about what the path could take
+	if(offTarget > 0 && TokenBucket.GetNumPaced() == numPaced)
+	return;
+
+	double newRate = rate * (1 + RATECONTROL_GAIN * offTarget);
+
+	if(newRate < RATECONTROL_MINRATE)
+	newRate = RATECONTROL_MINRATE;
+
+	if(newRate > RATECONTROL_MAXRATE)
+	newRate = RATECONTROL_MAXRATE;
+
+	SetRate((u32) newRate);
+}
+
+void CRateControl::SetRate(u32 rate)
+{
+	// about a tenth of a second of data may go at once
+	this->rate = rate;
+
+	TokenBucket.SetRate(rate);
+	TokenBucket.SetDepth(rate / 10 > RATECONTROL_MINDEPTH ? rate / 10 : RATECONTROL_MINDEPTH);
+}
+
+CObject::u32 CRateControl::GetElapsed(const struct timespec* pStart, const struct timespec* pNow)
+{
+	double elapsed = (pNow->tv_sec - pStart->tv_sec) * 1e6 + (pNow->tv_nsec - pStart->tv_nsec) / 1e3;
+
+	return elapsed < RATECONTROL_NORTT ? (u32) elapsed : RATECONTROL_NORTT - 1;
+}
+
+CRateControlException::CRateControlException(int code) : CException(code)
+{}
+
+CRateControlException::~CRateControlException() throw()
+{}
+
+const char* CRateControlException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case RCEC_SETTARGETDELAYERROR:
+		return "CRateControl::SetTargetDelay() error";
+
+	case RCEC_STARTPROBEERROR:
+		return "CRateControl::StartProbe() error";
+
+	case RCEC_ONPROBEERROR:
+		return "CRateControl::OnProbe() error";
+
+	default:
+		return "CRateControl: Unknown error";
+	}
+}
@@ -0,0 +1,104 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CRATECONTROL_H__
+#define __CRATECONTROL_H__
+
+#include <ctime>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/thread/CMutex.h>
+#include <common/thread/CTokenBucket.h>
+
+#define RATECONTROL_BASEHISTORY 10
+
+// in microseconds, a ping not answered by then is given up
+#define RATECONTROL_PROBETIMEOUT 2000000
+
+// paces all the data we send over the connection to a rate that keeps the
+// queueing delay along the path near a target, LEDBAT style. the delay is
+// sampled by pinging the server while data flows: the lowest round trip of
+// the last minutes is the base, what goes beyond it is queueing. the rate
+// grows while the queueing delay stays under the target and we are using
+// the rate, and shrinks in proportion as it goes over. delays and round
+// trips are in microseconds, rates in bytes per second
+class CRateControl : public CObject
+{
+public:
+	CRateControl();
+	virtual ~CRateControl();
+
+	void SetTargetDelay(u32 targetDelay);
+
+	u32 Reserve(u32 size);
+	u32 GetDelay();
+
+	bool StartProbe(u32* pProbeId);
+	void OnProbe(u32 probeId);
+
+	u32 GetRate() const;
+	u32 GetRtt() const;
+	u32 GetBaseRtt() const;
+
+private:
+	void Update(u32 rtt);
+	void SetRate(u32 rate);
+
+	static u32 GetElapsed(const struct timespec* pStart, const struct timespec* pNow);
+
+private:
+	u32 targetDelay;
+	u32 rate;
+	u32 rtt;
+
+	u32 baseRttList[RATECONTROL_BASEHISTORY];
+	u32 baseRttIndex;
+	struct timespec BaseStart;
+
+	u32 nextProbeId;
+	u32 probeId;
+	bool isProbing;
+	bool isAnswered;
+	u32 numPaced;
+	struct timespec ProbeStart;
+
+	CTokenBucket TokenBucket;
+	CMutex MutexRateControl;
+};
+
+class CRateControlException : public CException
+{
+public:
+	enum RateControlExceptionCode
+	{
+		RCEC_SETTARGETDELAYERROR,
+		RCEC_STARTPROBEERROR,
+		RCEC_ONPROBEERROR
+	};
+
+public:
+	CRateControlException(int code);
+	virtual ~CRateControlException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif // __CRATECONTROL_H__
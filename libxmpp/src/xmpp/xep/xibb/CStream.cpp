@@ -29,19 +29,30 @@
 
 #include <common/CException.h>
 #include <common/CObject.h>
+#include <common/thread/CTokenBucket.h>
 
+#include <xmpp/core/CIQFuture.h>
 #include <xmpp/jid/CJid.h>
+#include <xmpp/stanza/CStanzaTemplate.h>
 #include <xmpp/xep/xibb/CStream.h>
 #include <xmpp/xep/xibb/handler/CStreamDataHandler.h>
+#include <xmpp/xep/xibb/stanza/CStreamDataStanza.h>
 
 using namespace std;
 
+// the stream may send this many blocks at once before it gets paced
+#define STREAM_BURSTBLOCKS	4
+
 CStream::CStream()
 {
+	pStreamDataTemplate = NULL;
+	weight = 1;
 }
 
 CStream::CStream(const CJid& rRemoteJid, u16 remoteCid, u16 remoteSid, u16 blockSize, u32 byteRate)
 {
+	pStreamDataTemplate = NULL;
+	weight = 1;
 	Init(rRemoteJid, remoteCid, remoteSid, blockSize, byteRate);
 }
 
@@ -49,6 +60,9 @@ CStream::~CStream()
 {
 	try
 	{
+		// packets still queued keep their own reference
+		if(pStreamDataTemplate != NULL)
+		pStreamDataTemplate->Release();
 	}
 	
 	catch(exception& e)
@@ -70,7 +84,20 @@ void CStream::Init(const CJid& rRemoteJid, u16 remoteCid, u16 remoteSid, u16 blo
 		this->blockSize = blockSize;
 		this->byteRate = byteRate;
 
+		TokenBucket.Init(byteRate, STREAM_BURSTBLOCKS * blockSize);
+
 		StreamDataHandler.Init(rRemoteJid, remoteCid, remoteSid);
+
+		// everything but the payload is the same for the stream lifetime
+		CStreamDataStanza StreamDataStanza(rRemoteJid, remoteCid, remoteSid);
+		CStanzaTemplate* pTemplate = CStanzaTemplate::Create(&StreamDataStanza, StreamDataStanza.GetChild("stream-data"));
+		pTemplate->SetFlow((remoteCid << 16) | remoteSid);
+		pTemplate->SetWeight(weight);
+
+		if(pStreamDataTemplate != NULL)
+		pStreamDataTemplate->Release();
+
+		pStreamDataTemplate = pTemplate;
 	}
 	
 	catch(exception& e)
@@ -108,12 +135,40 @@ CObject::u32 CStream::GetByteRate() const
 	return byteRate;
 }
 
+CObject::u32 CStream::GetWeight() const
+{
+	return weight;
+}
+
+void CStream::SetWeight(u32 weight)
+{
+	// share of its peer's output the stream gets against the other flows
+	this->weight = weight;
+
+	if(pStreamDataTemplate != NULL)
+	pStreamDataTemplate->SetWeight(weight);
+}
+
+CTokenBucket* CStream::GetTokenBucket()
+{
+	return &TokenBucket;
+}
 
 CStreamDataHandler* CStream::GetStreamDataHandler()
 {
 	return &StreamDataHandler;
 }
 
+CStanzaTemplate* CStream::GetStreamDataTemplate()
+{
+	return pStreamDataTemplate;
+}
+
+CIQFuture* CStream::GetOpenFuture()
+{
+	return &OpenFuture;
+}
+
 CStreamException::CStreamException(int code) : CException(code)
 {}
 
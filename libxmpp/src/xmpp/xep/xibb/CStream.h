@@ -26,8 +26,11 @@
 
 #include <common/CException.h>
 #include <common/CObject.h>
+#include <common/thread/CTokenBucket.h>
 
+#include <xmpp/core/CIQFuture.h>
 #include <xmpp/jid/CJid.h>
+#include <xmpp/stanza/CStanzaTemplate.h>
 #include <xmpp/xep/xibb/handler/CStreamDataHandler.h>
 
 using namespace std;
@@ -47,8 +50,14 @@ public:
 	u16 GetRemoteSid() const;
 	u16 GetBlockSize() const;
 	u32 GetByteRate() const;
+	u32 GetWeight() const;
+	CTokenBucket* GetTokenBucket();
+
+	void SetWeight(u32 weight);
 	
 	CStreamDataHandler* GetStreamDataHandler();
+	CStanzaTemplate* GetStreamDataTemplate();
+	CIQFuture* GetOpenFuture();
 	
 private:
 	CJid RemoteJid;
@@ -56,7 +65,13 @@ private:
 	u16 remoteSid;
 	u16 blockSize;
 	u32 byteRate;
+	u32 weight;
+	CTokenBucket TokenBucket;
 	CStreamDataHandler StreamDataHandler;
+	CStanzaTemplate* pStreamDataTemplate;
+
+	// the answer to our stream:open, see CXEPxibb::BeginOpenStream()
+	CIQFuture OpenFuture;
 };
  
 class CStreamException : public CException
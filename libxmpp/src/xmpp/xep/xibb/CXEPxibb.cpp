@@ -33,18 +33,24 @@
 #include <common/data/CBase64.h>
 #include <common/thread/CMutex.h>
 #include <common/thread/CThread.h>
+#include <common/thread/CTokenBucket.h>
 #include <common/xml/CXMLNode.h>
 
 #include <xmpp/core/CHandler.h>
+#include <xmpp/core/CIQFuture.h>
 #include <xmpp/core/CXMLFilter.h>
 #include <xmpp/core/CXMPPCore.h>
 #include <xmpp/jid/CJid.h>
+#include <xmpp/stanza/CStanzaTemplate.h>
 #include <xmpp/stanza/iq/get/CIQGetStanza.h>
 #include <xmpp/stanza/iq/set/CIQSetStanza.h>
 #include <xmpp/stanza/iq/result/CIQResultStanza.h>
 #include <xmpp/stanza/presence/CPresenceStanza.h>
 #include <xmpp/xep/xibb/CChannel.h>
 #include <xmpp/xep/xibb/CChannelManager.h>
+#include <xmpp/xep/xibb/CCloseRequest.h>
+#include <xmpp/xep/xibb/CPingRequest.h>
+#include <xmpp/xep/xibb/CRateControl.h>
 #include <xmpp/xep/xibb/CXEPxibb.h>
 #include <xmpp/xep/xibb/handler/CChannelOpenHandler.h>
 #include <xmpp/xep/xibb/handler/CChannelCloseHandler.h>
@@ -56,6 +62,7 @@
 #include <xmpp/xep/xibb/stanza/CStreamCloseStanza.h>
 #include <xmpp/xep/xibb/stanza/CStreamDataStanza.h>
 #include <xmpp/xep/xibb/stanza/CStreamOpenStanza.h>
+#include <xmpp/xml/CStreamDataRecord.h>
 
 using namespace std;
 
@@ -66,9 +73,12 @@ CXEPxibb::CXEPxibb(u16 maxRemoteJid, u16 maxChannel)
 		pXMPPCore = NULL;
 		ChannelManagerList.resize(maxRemoteJid);
 		this->maxChannel = maxChannel;
+		iqTimeout = XMPPCORE_IQTIMEOUT;
 		
 		for(u16 i = 0 ; i < maxRemoteJid ; i++)
 		ChannelManagerList[i] = NULL;
+
+		PingRequest.Init(&RateControl);
 	}
 	
 	catch(exception& e)
@@ -134,6 +144,7 @@ void CXEPxibb::Detach()
 		pXMPPCore->CommitHandler(&ChannelCloseHandler);
 		pXMPPCore->CommitHandler(&StreamCloseHandler);
 		pXMPPCore->CommitHandler(&PresenceHandler);
+		PingRequest.Stop();
 	
 		ThreadOnChannelCloseJob.Wait();
 		ThreadOnStreamCloseJob.Wait();
@@ -196,15 +207,24 @@ CObject::u16 CXEPxibb::GetMaxChannel() const
 {
 	return maxChannel;
 }
+void CXEPxibb::SetIQTimeout(u32 iqTimeout)
+{
+	// in microseconds, how long the peer has to answer our requests
+	this->iqTimeout = iqTimeout;
+}
 
-
-void CXEPxibb::WaitChannel(CJid* pJid, u16* pLocalCid, u16* pMaxStream, u16* pBlockSize, u32* pByteRate)
+bool CXEPxibb::WaitChannel(CJid* pJid, u16* pLocalCid, u16* pMaxStream, u16* pBlockSize, u32* pByteRate, u32 timeout)
 {
-	// we receive a channel open stanza
+	// we receive a channel open stanza, false when none came in time
 	CChannelOpenStanza ChannelOpenStanza;
 
-	if(!pXMPPCore->Receive(&ChannelOpenHandler, &ChannelOpenStanza))
-	throw CXEPxibbException(CXEPxibbException::XEPXEC_WAITCHANNELERROR);
+	if(!pXMPPCore->Receive(&ChannelOpenHandler, &ChannelOpenStanza, timeout))
+	{
+		if(timeout != 0 && pXMPPCore->IsConnected())
+		return false;
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_WAITCHANNELERROR);
+	}
 
 	// we are looking for if it already exists or building it otherwise
 	MutexOnChannelManager.Lock();
@@ -236,6 +256,34 @@ void CXEPxibb::WaitChannel(CJid* pJid, u16* pLocalCid, u16* pMaxStream, u16* pBl
 		pXMPPCore->RequestHandler(pChannel->GetChannelDataHandler());
 		pXMPPCore->RequestHandler(pChannel->GetStreamOpenHandler());
 
+		// the first stream and its first data may come along with the
+		// channel (see OpenChannelStream()), the stream is routed before
+		// we answer as the peer sends more data right after our answer
+		if(ChannelOpenStanza.IsExistChild("stream-open"))
+		{
+			CStreamOpenStanza StreamOpenStanza;
+			StreamOpenStanza.PushChild(ChannelOpenStanza.PopChild("stream-open"));
+
+			CStream* pStream = new CStream(ChannelOpenStanza.GetFrom(),
+											pChannel->GetRemoteCid(),
+											StreamOpenStanza.GetStreamId(),
+											StreamOpenStanza.GetBlockSize(),
+											StreamOpenStanza.GetByteRate());
+
+			u16 localSid = pChannel->AddStream(pStream);
+
+			pXMPPCore->RequestHandler(pStream->GetStreamDataHandler());
+			pChannel->PushOpenedStream(localSid, StreamOpenStanza.IsRawData());
+
+			if(ChannelOpenStanza.IsExistChild("stream-data"))
+			{
+				CXMLNode* pXMLNode = new CXMLNode("message");
+				pXMLNode->PushChild(ChannelOpenStanza.PopChild("stream-data"));
+
+				pStream->GetStreamDataHandler()->PushXMLNode(pXMLNode);
+			}
+		}
+
 		*pJid = ChannelOpenStanza.GetFrom();
 		*pLocalCid = localCid;
 	}
@@ -260,9 +308,93 @@ void CXEPxibb::WaitChannel(CJid* pJid, u16* pLocalCid, u16* pMaxStream, u16* pBl
 
 	if(!pXMPPCore->Send(&IQResultStanza))
 	throw CXEPxibbException(CXEPxibbException::XEPXEC_WAITCHANNELERROR);		
+
+	return true;
+}
+
+bool CXEPxibb::WaitStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16* pBlockSize, u32* pByteRate, bool* pIsRawData, u32 timeout)
+{
+	return ReceiveStream(rJid, localCid, pLocalSid, pBlockSize, pByteRate, pIsRawData, timeout, true);
+}
+
+bool CXEPxibb::AcceptStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16* pBlockSize, u32* pByteRate, bool* pIsRawData)
+{
+	try
+	{
+		// false at once when the peer did not open a stream yet, the task
+		// set by SetChannelTask() is submitted when it does
+		return ReceiveStream(rJid, localCid, pLocalSid, pBlockSize, pByteRate, pIsRawData, 0, false);
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_ACCEPTSTREAMERROR);
+	}
+}
+
+void CXEPxibb::SetChannelTask(const CJid& rJid, u16 localCid, CExecutor* pExecutor, CTask* pTask)
+{
+	MutexOnChannelManager.Lock();
+
+	try
+	{
+		// submitted when a stream is opened and when the channel is closed
+		CChannel* pChannel = GetChannel(rJid, localCid);
+
+		if(pChannel == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SETCHANNELTASKERROR);
+
+		pChannel->GetStreamOpenHandler()->SetTask(pExecutor, pTask);
+
+		MutexOnChannelManager.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexOnChannelManager.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SETCHANNELTASKERROR);
+	}
+}
+
+void CXEPxibb::SetStreamTask(const CJid& rJid, u16 localCid, u16 localSid, CExecutor* pExecutor, CTask* pTask)
+{
+	MutexOnChannelManager.Lock();
+
+	try
+	{
+		// submitted when data comes in and when the stream is closed
+		CStream* pStream = GetStream(rJid, localCid, localSid);
+
+		if(pStream == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SETSTREAMTASKERROR);
+
+		pStream->GetStreamDataHandler()->SetTask(pExecutor, pTask);
+
+		MutexOnChannelManager.UnLock();
+	}
+
+	catch(exception& e)
+	{
+		MutexOnChannelManager.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SETSTREAMTASKERROR);
+	}
 }
 
-void CXEPxibb::WaitStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16* pBlockSize, u32* pByteRate)
+bool CXEPxibb::ReceiveStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16* pBlockSize, u32* pByteRate, bool* pIsRawData, u32 timeout, bool isBlocking)
 {
 	CChannelManager* pChannelManager;
 	CStreamOpenHandler* pStreamOpenHandler;
@@ -286,6 +418,23 @@ void CXEPxibb::WaitStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16* p
 		throw CXEPxibbException(CXEPxibbException::XEPXEC_WAITSTREAMERROR);
 
 		pStreamOpenHandler = pChannel->GetStreamOpenHandler();
+
+		// a stream opened along with the channel was answered already
+		bool isRawData;
+
+		if(pChannel->PopOpenedStream(pLocalSid, &isRawData))
+		{
+			pStream = pChannel->GetStreamByLocalSid(*pLocalSid);
+
+			*pBlockSize = pStream->GetBlockSize();
+			*pByteRate = pStream->GetByteRate();
+
+			if(pIsRawData != NULL)
+			*pIsRawData = isRawData;
+
+			MutexOnChannelManager.UnLock();
+			return true;
+		}
 	}
 	
 	catch(exception& e)
@@ -300,11 +449,22 @@ void CXEPxibb::WaitStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16* p
 	
 	MutexOnChannelManager.UnLock();
 
-	// we receive a stream open stanza
+	// we receive a stream open stanza, false when none came in time or,
+	// without blocking, when none is there yet
 	CStreamOpenStanza StreamOpenStanza;
+
+	bool isReceived = isBlocking ? pXMPPCore->Receive(pStreamOpenHandler, &StreamOpenStanza, timeout) : pXMPPCore->TryReceive(pStreamOpenHandler, &StreamOpenStanza);
 		
-	if(!pXMPPCore->Receive(pStreamOpenHandler, &StreamOpenStanza))
-	throw CXEPxibbException(CXEPxibbException::XEPXEC_WAITSTREAMERROR);
+	if(!isReceived)
+	{
+		if(!isBlocking && pXMPPCore->IsConnected() && !pStreamOpenHandler->IsDestroyed())
+		return false;
+
+		if(timeout != 0 && pXMPPCore->IsConnected())
+		return false;
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_WAITSTREAMERROR);
+	}
 
 	MutexOnChannelManager.Lock();
 
@@ -313,6 +473,9 @@ void CXEPxibb::WaitStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16* p
 		*pBlockSize = StreamOpenStanza.GetBlockSize();
 		*pByteRate = StreamOpenStanza.GetByteRate();
 
+		if(pIsRawData != NULL)
+		*pIsRawData = StreamOpenStanza.IsRawData();
+
 		pStream = new CStream(rJid, pChannel->GetRemoteCid(), StreamOpenStanza.GetStreamId(), *pBlockSize, *pByteRate);
 		u16 localSid = pChannel->AddStream(pStream);
 
@@ -341,6 +504,8 @@ void CXEPxibb::WaitStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16* p
 
 	if(!pXMPPCore->Send(&IQResultStanza))
 	throw CXEPxibbException(CXEPxibbException::XEPXEC_WAITSTREAMERROR);		
+
+	return true;
 }
 
 void CXEPxibb::OpenChannel(const CJid& rJid, u16* pLocalCid, u16 maxStream, u16 blockSize, u32 byteRate)
@@ -387,72 +552,167 @@ void CXEPxibb::OpenChannel(const CJid& rJid, u16* pLocalCid, u16 maxStream, u16
 
 	MutexOnChannelManager.UnLock();
 
-	// we build the channel:open iqstanza
-	string id;
-	CHandler IQHandler;
-	CXMLFilter* pXMLFilter;
-	CIQStanza IQStanza;
-	CChannelOpenStanza ChannelOpenStanza;
+	try
+	{
+		// we build the channel:open iqstanza, its id is given by SendIQ()
+		CIQFuture IQFuture;
+		CIQStanza IQStanza;
+		CChannelOpenStanza ChannelOpenStanza;
+
+		ChannelOpenStanza.Init(rJid, localCid, maxStream, blockSize, byteRate, "");
+
+		// we send the channel:open iqstanza
+		if(!pXMPPCore->SendIQ(&ChannelOpenStanza, &IQFuture, iqTimeout))
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELERROR);
+
+		// we receive the iq result
+		if(!IQFuture.Wait(&IQStanza))
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELERROR);
+
+		if(IQStanza.GetKindOf() != CIQStanza::SIQKO_RESULT)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELERROR);
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
 
-	pXMPPCore->GenerateId(id);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELERROR);
+	}
+}
 
+void CXEPxibb::OpenStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16 blockSize, u32 byteRate, bool isRawData)
+{
 	try
 	{
-		ChannelOpenStanza.Init(rJid, localCid, maxStream, blockSize, byteRate, id);				
-		
-		// we build the handler associate to the iqstanza response
-		pXMLFilter = new CXMLFilter("iq");
-		pXMLFilter->SetAttribut("from", rJid.GetFull());
-		pXMLFilter->SetAttribut("id", id);			
-		IQHandler.AddXMLFilter(pXMLFilter);
+		BeginOpenStream(rJid, localCid, pLocalSid, blockSize, byteRate, isRawData);
+		EndOpenStream(rJid, localCid, *pLocalSid);
 	}
 	
 	catch(exception& e)
 	{
-		pXMPPCore->RemoveId(id);
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENSTREAMERROR);
+	}
+}
+
+void CXEPxibb::OpenChannelStream(const CJid& rJid, u16* pLocalCid, u16* pLocalSid, u16 maxStream, u16 blockSize, u32 byteRate, bool isRawData, const u8* pData, u32 dataSize)
+{
+	CChannelManager* pChannelManager;
+	CChannel* pChannel;
+	CStream* pStream;
+	u16 localCid;
+	u16 localSid;
+	
+	MutexOnChannelManager.Lock();
+
+	try
+	{		
+		// we are looking for the channelmanager associate to the Jid 		
+		pChannelManager = GetChannelManager(rJid);
+				
+		if(pChannelManager == NULL)
+		{
+			pChannelManager = new CChannelManager(rJid, maxChannel);
+			AddChannelManager(pChannelManager);
+		}
 		
+		// we build the associate channel and its first stream
+		pChannel = new CChannel();
+
+		localCid = pChannelManager->AddChannel(pChannel);
+		pChannel->Init(rJid, localCid, maxStream, blockSize, byteRate);
+
+		pStream = new CStream();
+		localSid = pChannel->AddStream(pStream);
+		pStream->Init(rJid, localCid, localSid, blockSize, byteRate);
+	
+		pXMPPCore->RequestHandler(pChannel->GetChannelDataHandler());
+		pXMPPCore->RequestHandler(pChannel->GetStreamOpenHandler());
+		pXMPPCore->RequestHandler(pStream->GetStreamDataHandler());
+
+		*pLocalCid = localCid;
+		*pLocalSid = localSid;
+	}
+	
+	catch(exception& e)
+	{
+		MutexOnChannelManager.UnLock();
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELSTREAMERROR);
 	}
 
-	pXMPPCore->RequestHandler(&IQHandler);
+	MutexOnChannelManager.UnLock();
+
+	CBuffer* pPayload = NULL;
 
 	try
 	{
+		// a single iq opens the channel, its stream and carries the first
+		// block, the peer must advertise xibb#open (see CXEPdisco)
+		CIQFuture IQFuture;
+		CIQStanza IQStanza;
+		CChannelOpenStanza ChannelOpenStanza;
+		CStreamOpenStanza StreamOpenStanza;
+
+		ChannelOpenStanza.Init(rJid, localCid, maxStream, blockSize, byteRate, "");
+		StreamOpenStanza.Init(rJid, localCid, localSid, blockSize, byteRate, "", isRawData);
+
+		ChannelOpenStanza.PushChild(StreamOpenStanza.PopChild("stream-open"));
+
+		if(dataSize)
+		{
+			CStreamDataStanza StreamDataStanza(rJid, localCid, localSid);
+			CXMLNode* pXMLNode = StreamDataStanza.PopChild("stream-data");
+
+			pPayload = EncodePayload(pData, dataSize);
+			pXMLNode->SetData((const char*) pPayload->GetBuffer(), pPayload->GetBufferSize());
+
+			ChannelOpenStanza.PushChild(pXMLNode);
+		}
+
 		// we send the channel:open iqstanza
-		if(!pXMPPCore->Send(&ChannelOpenStanza))
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELERROR);
+		if(!pXMPPCore->SendIQ(&ChannelOpenStanza, &IQFuture, iqTimeout))
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELSTREAMERROR);
 
-		// we receive the iq result
-		if(!pXMPPCore->Receive(&IQHandler, &IQStanza))
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELERROR);
+		if(pPayload != NULL)
+		{
+			delete pPayload;
+			pPayload = NULL;
+		}
+
+		// we receive the iq result, more data may only follow it
+		if(!IQFuture.Wait(&IQStanza))
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELSTREAMERROR);
 
 		if(IQStanza.GetKindOf() != CIQStanza::SIQKO_RESULT)
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELSTREAMERROR);
 	}
 	
 	catch(exception& e)
 	{
-		pXMPPCore->CommitHandler(&IQHandler);
-		pXMPPCore->RemoveId(id);
-		
+		if(pPayload != NULL)
+		delete pPayload;
+
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELSTREAMERROR);
 	}
-
-	pXMPPCore->CommitHandler(&IQHandler);
-	pXMPPCore->RemoveId(id);
-
 }
 
-void CXEPxibb::OpenStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16 blockSize, u32 byteRate)
+void CXEPxibb::BeginOpenStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16 blockSize, u32 byteRate, bool isRawData)
 {
+	CIQFuture* pOpenFuture;
 	u16 localSid;
 	
 	MutexOnChannelManager.Lock();
@@ -463,13 +723,13 @@ void CXEPxibb::OpenStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16 bl
 		CChannelManager* pChannelManager = GetChannelManager(rJid);
 				
 		if(pChannelManager == NULL)
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENSTREAMERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_BEGINOPENSTREAMERROR);
 		
 		// we are looking for the channel associate to the localCid
 		CChannel* pChannel = pChannelManager->GetChannelByLocalCid(localCid);
 
 		if(pChannel == NULL)
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENSTREAMERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_BEGINOPENSTREAMERROR);
 
 		// we build and add the new stream
 		CStream* pStream = new CStream();
@@ -477,6 +737,7 @@ void CXEPxibb::OpenStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16 bl
 		pStream->Init(rJid, pChannel->GetRemoteCid(), localSid, blockSize, byteRate);
 
 		pXMPPCore->RequestHandler(pStream->GetStreamDataHandler());
+		pOpenFuture = pStream->GetOpenFuture();
 		
 		*pLocalSid = localSid;
 	}
@@ -488,77 +749,641 @@ void CXEPxibb::OpenStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16 bl
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_BEGINOPENSTREAMERROR);
 	}
 	
 	MutexOnChannelManager.UnLock();
 
-	// we build the stream:open iqstanza
-	string id;
-	CHandler IQHandler;
-	CIQStanza IQStanza;
+	try
+	{
+		// we build the stream:open iqstanza, its id is given by SendIQ()
+		CStreamOpenStanza StreamOpenStanza;
 
-	CXMLFilter* pXMLFilter;
-	CStreamOpenStanza StreamOpenStanza;
-	pXMPPCore->GenerateId(id);
+		StreamOpenStanza.Init(rJid, localCid, localSid, blockSize, byteRate, "", isRawData);
+
+		// we send the stream:open iqstanza, the answer is waited for in
+		// EndOpenStream() so that many opens may be in flight
+		if(!pXMPPCore->SendIQ(&StreamOpenStanza, pOpenFuture, iqTimeout))
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_BEGINOPENSTREAMERROR);
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_BEGINOPENSTREAMERROR);
+	}
+}
+
+void CXEPxibb::EndOpenStream(const CJid& rJid, u16 localCid, u16 localSid)
+{
+	CIQFuture* pOpenFuture;
+
+	MutexOnChannelManager.Lock();
 
 	try
 	{
-		StreamOpenStanza.Init(rJid, localCid, localSid, blockSize, byteRate, id);				
-	
-		// we build the handler associate to the iqstanza response
-		pXMLFilter = new CXMLFilter("iq");
-		pXMLFilter->SetAttribut("from", rJid.GetFull());
-		pXMLFilter->SetAttribut("id", id);			
-		IQHandler.AddXMLFilter(pXMLFilter);
+		CStream* pStream = GetStream(rJid, localCid, localSid);
+
+		if(pStream == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_ENDOPENSTREAMERROR);
+
+		pOpenFuture = pStream->GetOpenFuture();
 	}
 
 	catch(exception& e)
 	{
-		pXMPPCore->RemoveId(id);
-		
+		MutexOnChannelManager.UnLock();
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_ENDOPENSTREAMERROR);
 	}
-
-	pXMPPCore->RequestHandler(&IQHandler);
+	
+	MutexOnChannelManager.UnLock();
 
 	try
 	{
-		// we send the stream:open iqstanza
-		if(!pXMPPCore->Send(&StreamOpenStanza))
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENSTREAMERROR);
+		// the stream may not be closed while we wait for its answer
+		CIQStanza IQStanza;
 
-		// we receive the iq result
-		if(!pXMPPCore->Receive(&IQHandler, &IQStanza))
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENSTREAMERROR);
+		if(!pOpenFuture->Wait(&IQStanza))
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_ENDOPENSTREAMERROR);
 
 		if(IQStanza.GetKindOf() != CIQStanza::SIQKO_RESULT)
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENSTREAMERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_ENDOPENSTREAMERROR);
 	}
 	
 	catch(exception& e)
 	{
-		pXMPPCore->CommitHandler(&IQHandler);
-		pXMPPCore->RemoveId(id);
-
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_OPENCHANNELERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_ENDOPENSTREAMERROR);
 	}
+}
+
+void CXEPxibb::SendChannelData(const CJid& rJid, u16 localCid, CBuffer* pBuffer)
+{
+	// the payload is encoded before we hold the channel managers
+	CBuffer* pPayload = EncodePayload(pBuffer->GetBuffer(), pBuffer->GetBufferSize());
+	CStanzaTemplate* pTemplate;
+	u32 delay;
+
+	MutexOnChannelManager.Lock();
+
+	try
+	{
+		// we are looking for the channelmanager associate to the Jid 
+		
+		CChannelManager* pChannelManager = GetChannelManager(rJid);
+				
+		if(pChannelManager == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDCHANNELDATAERROR);
+		
+		// we are looking for the channel associate to the localCid
+		CChannel* pChannel = pChannelManager->GetChannelByLocalCid(localCid);
+
+		if(pChannel == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDCHANNELDATAERROR);
+		
+		// the packet keeps the template alive if the channel closes meanwhile
+		pTemplate = pChannel->GetChannelDataTemplate();
+		pTemplate->AddRef();
+
+		// the negotiated rate is paced on the stanza bytes, that is what
+		// the server shapes, the path rate then bounds all channels together
+		u32 size = pTemplate->GetSize(pPayload->GetBufferSize());
+		u32 pathDelay = RateControl.Reserve(size);
 
-	pXMPPCore->CommitHandler(&IQHandler);
-	pXMPPCore->RemoveId(id);
+		delay = pChannel->GetTokenBucket()->Reserve(size);
+
+		if(pathDelay > delay)
+		delay = pathDelay;
+	}
+	
+	catch(exception& e)
+	{
+		MutexOnChannelManager.UnLock();
+		delete pPayload;
+		
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDCHANNELDATAERROR);
+	}
+		
+	MutexOnChannelManager.UnLock();
+
+	if(delay)
+	CTokenBucket::Sleep(delay);
+
+	if(!pXMPPCore->Send(pTemplate, pPayload))
+	throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDCHANNELDATAERROR);
+
+	Probe();
+}
+
+void CXEPxibb::SendStreamData(const CJid& rJid, u16 localCid, u16 localSid, CBuffer* pBuffer)
+{
+	SendStreamData(rJid, localCid, localSid, pBuffer->GetBuffer(), pBuffer->GetBufferSize());
+}
+
+void CXEPxibb::SendStreamData(const CJid& rJid, u16 localCid, u16 localSid, const u8* pData, u32 dataSize)
+{
+	// the payload is encoded before we hold the channel managers
+	CBuffer* pPayload = EncodePayload(pData, dataSize);
+	CStanzaTemplate* pTemplate;
+	u32 delay;
+
+	MutexOnChannelManager.Lock();
+
+	try
+	{
+		// we are looking for the channelmanager associate to the Jid 
+		
+		CChannelManager* pChannelManager = GetChannelManager(rJid);
+				
+		if(pChannelManager == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDSTREAMDATAERROR);
+		
+		// we are looking for the channel associate to the localCid
+		CChannel* pChannel = pChannelManager->GetChannelByLocalCid(localCid);
+
+		if(pChannel == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDSTREAMDATAERROR);
+				
+		// we are looking for the stream associate to the localSid
+		CStream* pStream = pChannel->GetStreamByLocalSid(localSid);
+
+		if(pStream == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDSTREAMDATAERROR);
+
+		// the packet keeps the template alive if the stream closes meanwhile
+		pTemplate = pStream->GetStreamDataTemplate();
+		pTemplate->AddRef();
+
+		// the stream, its channel and the path all pace the packet, we wait
+		// for the slowest of them
+		u32 size = pTemplate->GetSize(pPayload->GetBufferSize());
+		u32 pathDelay = RateControl.Reserve(size);
+		u32 channelDelay = pChannel->GetTokenBucket()->Reserve(size);
+
+		delay = pStream->GetTokenBucket()->Reserve(size);
+
+		if(channelDelay > delay)
+		delay = channelDelay;
+
+		if(pathDelay > delay)
+		delay = pathDelay;
+	}
+	
+	catch(exception& e)
+	{
+		MutexOnChannelManager.UnLock();
+		delete pPayload;
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDSTREAMDATAERROR);
+	}
+	
+	MutexOnChannelManager.UnLock();
+
+	if(delay)
+	CTokenBucket::Sleep(delay);
+
+	if(!pXMPPCore->Send(pTemplate, pPayload))
+	throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDSTREAMDATAERROR);
+
+	Probe();
+}
+
+CObject::u32 CXEPxibb::TrySendStreamData(const CJid& rJid, u16 localCid, u16 localSid, CBuffer* pBuffer, u32* pDelay)
+{
+	return TrySendStreamData(rJid, localCid, localSid, pBuffer->GetBuffer(), pBuffer->GetBufferSize(), pDelay);
+}
+
+CObject::u32 CXEPxibb::TrySendStreamData(const CJid& rJid, u16 localCid, u16 localSid, const u8* pData, u32 dataSize, u32* pDelay)
+{
+	CStanzaTemplate* pTemplate;
+
+	MutexOnChannelManager.Lock();
+
+	try
+	{
+		CChannel* pChannel = GetChannel(rJid, localCid);
+
+		if(pChannel == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_TRYSENDSTREAMDATAERROR);
+
+		CStream* pStream = pChannel->GetStreamByLocalSid(localSid);
+
+		if(pStream == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_TRYSENDSTREAMDATAERROR);
+
+		pTemplate = pStream->GetStreamDataTemplate();
+
+		if(pXMPPCore->IsOutputFull(pTemplate))
+		{
+			MutexOnChannelManager.UnLock();
+			return XEPXSS_FULL;
+		}
+
+		// what SendStreamData() would sleep, the debt of the packets
+		// before this one. once it is repaid the packet goes and runs the
+		// buckets into debt for the next one
+		u32 delay = pStream->GetTokenBucket()->GetDelay();
+		u32 channelDelay = pChannel->GetTokenBucket()->GetDelay();
+		u32 pathDelay = RateControl.GetDelay();
+
+		if(channelDelay > delay)
+		delay = channelDelay;
+
+		if(pathDelay > delay)
+		delay = pathDelay;
+
+		if(delay)
+		{
+			MutexOnChannelManager.UnLock();
+			*pDelay = delay;
+			return XEPXSS_PACED;
+		}
+
+		u32 size = pTemplate->GetSize(CBase64::GetTo64Size(dataSize));
+		RateControl.Reserve(size);
+		pChannel->GetTokenBucket()->Reserve(size);
+		pStream->GetTokenBucket()->Reserve(size);
+
+		// the packet keeps the template alive if the stream closes meanwhile
+		pTemplate->AddRef();
+	}
+
+	catch(exception& e)
+	{
+		MutexOnChannelManager.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_TRYSENDSTREAMDATAERROR);
+	}
+
+	MutexOnChannelManager.UnLock();
+
+	CBuffer* pPayload;
+
+	try
+	{
+		pPayload = EncodePayload(pData, dataSize);
+	}
+
+	catch(exception& e)
+	{
+		pTemplate->Release();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_TRYSENDSTREAMDATAERROR);
+	}
+
+	// the output may have filled up since we checked it, the packet is
+	// then refused rather than waited for
+	if(!pXMPPCore->Send(pTemplate, pPayload, false))
+	{
+		if(!pXMPPCore->IsConnected())
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_TRYSENDSTREAMDATAERROR);
+
+		return XEPXSS_FULL;
+	}
+
+	Probe();
+
+	return XEPXSS_SENT;
+}
+
+bool CXEPxibb::WaitSendStreamData(const CJid& rJid, u16 localCid, u16 localSid)
+{
+	CStanzaTemplate* pTemplate;
+
+	MutexOnChannelManager.Lock();
+
+	try
+	{
+		CStream* pStream = GetStream(rJid, localCid, localSid);
+
+		if(pStream == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_WAITSENDSTREAMDATAERROR);
+
+		pTemplate = pStream->GetStreamDataTemplate();
+		pTemplate->AddRef();
+	}
+
+	catch(exception& e)
+	{
+		MutexOnChannelManager.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_WAITSENDSTREAMDATAERROR);
+	}
+
+	MutexOnChannelManager.UnLock();
+
+	// callers wait here before they read their source, what they cannot
+	// send yet stays where it came from
+	try
+	{
+		bool isOpen = pXMPPCore->IsOutputFull(pTemplate) ? pXMPPCore->WaitOutput(pTemplate) : true;
+		pTemplate->Release();
+
+		return isOpen;
+	}
+
+	catch(exception& e)
+	{
+		pTemplate->Release();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_WAITSENDSTREAMDATAERROR);
+	}
+}
+
+bool CXEPxibb::IsStreamOutputFull(const CJid& rJid, u16 localCid, u16 localSid)
+{
+	MutexOnChannelManager.Lock();
+
+	try
+	{
+		// what WaitSendStreamData() would wait for, without waiting
+		CStream* pStream = GetStream(rJid, localCid, localSid);
+
+		if(pStream == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_ISSTREAMOUTPUTFULLERROR);
+
+		bool isFull = pXMPPCore->IsOutputFull(pStream->GetStreamDataTemplate());
+
+		MutexOnChannelManager.UnLock();
+		return isFull;
+	}
+
+	catch(exception& e)
+	{
+		MutexOnChannelManager.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_ISSTREAMOUTPUTFULLERROR);
+	}
+}
+
+void CXEPxibb::SetStreamWeight(const CJid& rJid, u16 localCid, u16 localSid, u32 weight)
+{
+	MutexOnChannelManager.Lock();
+
+	try
+	{
+		// the stream gets weight times the share of a default stream of the same peer
+		CStream* pStream = GetStream(rJid, localCid, localSid);
+
+		if(pStream == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SETSTREAMWEIGHTERROR);
+
+		pStream->SetWeight(weight);
+	}
+
+	catch(exception& e)
+	{
+		MutexOnChannelManager.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SETSTREAMWEIGHTERROR);
+	}
+
+	MutexOnChannelManager.UnLock();
+}
+
+void CXEPxibb::SetChannelBurst(const CJid& rJid, u16 localCid, u32 burst)
+{
+	MutexOnChannelManager.Lock();
+
+	try
+	{
+		// in bytes the channel may send at once before it gets paced
+		CChannel* pChannel = GetChannel(rJid, localCid);
+
+		if(pChannel == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SETCHANNELBURSTERROR);
+
+		pChannel->GetTokenBucket()->SetDepth(burst);
+	}
+
+	catch(exception& e)
+	{
+		MutexOnChannelManager.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SETCHANNELBURSTERROR);
+	}
+
+	MutexOnChannelManager.UnLock();
+}
+
+void CXEPxibb::SetStreamBurst(const CJid& rJid, u16 localCid, u16 localSid, u32 burst)
+{
+	MutexOnChannelManager.Lock();
+
+	try
+	{
+		CStream* pStream = GetStream(rJid, localCid, localSid);
+
+		if(pStream == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SETSTREAMBURSTERROR);
+
+		pStream->GetTokenBucket()->SetDepth(burst);
+	}
+
+	catch(exception& e)
+	{
+		MutexOnChannelManager.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SETSTREAMBURSTERROR);
+	}
+
+	MutexOnChannelManager.UnLock();
+}
+
+void CXEPxibb::GetChannelPacing(const CJid& rJid, u16 localCid, u32* pNumPaced, u32* pPacedTime)
+{
+	MutexOnChannelManager.Lock();
+
+	try
+	{
+		// how many sends had to wait for the channel rate and for how long
+		// in all, in milliseconds
+		CChannel* pChannel = GetChannel(rJid, localCid);
+
+		if(pChannel == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_GETCHANNELPACINGERROR);
+
+		*pNumPaced = pChannel->GetTokenBucket()->GetNumPaced();
+		*pPacedTime = pChannel->GetTokenBucket()->GetPacedTime();
+	}
+
+	catch(exception& e)
+	{
+		MutexOnChannelManager.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_GETCHANNELPACINGERROR);
+	}
+
+	MutexOnChannelManager.UnLock();
+}
+
+void CXEPxibb::GetStreamPacing(const CJid& rJid, u16 localCid, u16 localSid, u32* pNumPaced, u32* pPacedTime)
+{
+	MutexOnChannelManager.Lock();
+
+	try
+	{
+		CStream* pStream = GetStream(rJid, localCid, localSid);
+
+		if(pStream == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_GETSTREAMPACINGERROR);
+
+		*pNumPaced = pStream->GetTokenBucket()->GetNumPaced();
+		*pPacedTime = pStream->GetTokenBucket()->GetPacedTime();
+	}
+
+	catch(exception& e)
+	{
+		MutexOnChannelManager.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_GETSTREAMPACINGERROR);
+	}
+
+	MutexOnChannelManager.UnLock();
+}
+
+void CXEPxibb::SetTargetDelay(u32 targetDelay)
+{
+	try
+	{
+		// the queueing delay in microseconds we accept along the path, 0
+		// leaves the sending rate to the negotiated byte rates only
+		RateControl.SetTargetDelay(targetDelay);
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_SETTARGETDELAYERROR);
+	}
+}
+
+CObject::u32 CXEPxibb::GetSendRate() const
+{
+	return RateControl.GetRate();
+}
+
+CObject::u32 CXEPxibb::GetRtt() const
+{
+	return RateControl.GetRtt();
+}
+
+void CXEPxibb::Probe()
+{
+	u32 probeId;
+
+	if(!RateControl.StartProbe(&probeId))
+	return;
+
+	try
+	{
+		PingRequest.Send(pXMPPCore, pXMPPCore->GetJid().GetHost(), probeId);
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_PROBEERROR);
+	}
+}
+
+CBuffer* CXEPxibb::EncodePayload(const u8* pData, u32 dataSize)
+{
+	CBuffer* pPayload = new CBuffer;
+
+	try
+	{
+		if(dataSize)
+		{
+			if(!pPayload->Create(CBase64::GetTo64Size(dataSize)))
+			throw CXEPxibbException(CXEPxibbException::XEPXEC_ENCODEPAYLOADERROR);
+
+			CBase64 Base64;
+			Base64.To64(pData, dataSize, (char*) pPayload->GetBuffer());
+		}
+
+		return pPayload;
+	}
+
+	catch(exception& e)
+	{
+		delete pPayload;
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_ENCODEPAYLOADERROR);
+	}
 }
 
-void CXEPxibb::SendChannelData(const CJid& rJid, u16 localCid, CBuffer* pBuffer)
+void CXEPxibb::ReceiveChannelData(const CJid& rJid, u16 localCid, CBuffer* pBuffer)
 {
-	u16 remoteCid;
+	CChannelDataHandler* pChannelDataHandler;
+	
 	MutexOnChannelManager.Lock();
 
 	try
@@ -568,74 +1393,67 @@ void CXEPxibb::SendChannelData(const CJid& rJid, u16 localCid, CBuffer* pBuffer)
 		CChannelManager* pChannelManager = GetChannelManager(rJid);
 				
 		if(pChannelManager == NULL)
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDCHANNELDATAERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVECHANNELDATAERROR);
 		
 		// we are looking for the channel associate to the localCid
 		CChannel* pChannel = pChannelManager->GetChannelByLocalCid(localCid);
 
 		if(pChannel == NULL)
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDCHANNELDATAERROR);
-		
-		remoteCid = pChannel->GetRemoteCid();
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVECHANNELDATAERROR);
+
+		pChannelDataHandler = pChannel->GetChannelDataHandler();
+
 	}
 	
 	catch(exception& e)
 	{
 		MutexOnChannelManager.UnLock();
-		
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDCHANNELDATAERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVECHANNELDATAERROR);
 	}
-		
+
 	MutexOnChannelManager.UnLock();
-	
-	CChannelDataStanza ChannelDataStanza(rJid, remoteCid);
+
+	CChannelDataStanza ChannelDataStanza;
+
+	if(!pXMPPCore->Receive(pChannelDataHandler, &ChannelDataStanza))
+	throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVECHANNELDATAERROR);
 	
 	CXMLNode* pData = ChannelDataStanza.GetChild("channel-data");
-	
-	string data;
-	CBase64 Base64;
-	
-	Base64.To64(pBuffer, data);
-	pData->SetData(data.c_str(), data.size());
 
-	if(!pXMPPCore->Send(&ChannelDataStanza))
-	throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDCHANNELDATAERROR);
+	CBase64 Base64;		
+	Base64.From64(pData->GetData(), pBuffer);
 }
 
-void CXEPxibb::SendStreamData(const CJid& rJid, u16 localCid, u16 localSid, CBuffer* pBuffer)
+void CXEPxibb::ReceiveStreamData(const CJid& rJid, u16 localCid, u16 localSid, CBuffer* pBuffer)
 {
-	u16 remoteCid;
-	u16 remoteSid;
+	CStreamDataHandler* pStreamDataHandler;
 	MutexOnChannelManager.Lock();
 
 	try
 	{
-		// we are looking for the channelmanager associate to the Jid 
-		
+		// we are looking for the channelmanager associate to the Jid 		
 		CChannelManager* pChannelManager = GetChannelManager(rJid);
 				
 		if(pChannelManager == NULL)
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDSTREAMDATAERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
 		
 		// we are looking for the channel associate to the localCid
 		CChannel* pChannel = pChannelManager->GetChannelByLocalCid(localCid);
 
 		if(pChannel == NULL)
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDSTREAMDATAERROR);
-				
-		remoteCid = pChannel->GetRemoteCid();
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
 
 		// we are looking for the stream associate to the localSid
 		CStream* pStream = pChannel->GetStreamByLocalSid(localSid);
 
 		if(pStream == NULL)
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDSTREAMDATAERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
 
-		remoteSid = pStream->GetRemoteSid();
+		pStreamDataHandler = pStream->GetStreamDataHandler();
 	}
 	
 	catch(exception& e)
@@ -645,48 +1463,66 @@ void CXEPxibb::SendStreamData(const CJid& rJid, u16 localCid, u16 localSid, CBuf
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDSTREAMDATAERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
 	}
-	
+
 	MutexOnChannelManager.UnLock();
 
-	CStreamDataStanza StreamDataStanza(rJid, remoteCid, remoteSid);
+	// the parser hands the payload over without building any stanza
+	CStreamDataRecord* pStreamData = NULL;
 
-	CXMLNode* pData = StreamDataStanza.GetChild("stream-data");
-	
-	string data;
-	CBase64 Base64;
-	
-	Base64.To64(pBuffer, data);
-	pData->SetData(data.c_str(), data.size());
+	if(pXMPPCore->IsConnected())
+	pStreamData = pStreamDataHandler->PopStreamData();
 
-	if(!pXMPPCore->Send(&StreamDataStanza))
-	throw CXEPxibbException(CXEPxibbException::XEPXEC_SENDSTREAMDATAERROR);
+	if(pStreamData == NULL)
+	throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
+
+	try
+	{
+		CBase64 Base64;		
+		Base64.From64(pStreamData->GetPayload(), pBuffer);
+	}
+
+	catch(exception& e)
+	{
+		delete pStreamData;
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
+	}
+
+	delete pStreamData;
 }
 
-void CXEPxibb::ReceiveChannelData(const CJid& rJid, u16 localCid, CBuffer* pBuffer)
+CObject::u32 CXEPxibb::ReceiveStreamData(const CJid& rJid, u16 localCid, u16 localSid, u8* pData, u32 dataSize)
 {
-	CChannelDataHandler* pChannelDataHandler;
-	
+	CStreamDataHandler* pStreamDataHandler;
 	MutexOnChannelManager.Lock();
 
 	try
 	{
-		// we are looking for the channelmanager associate to the Jid 
-		
+		// we are looking for the channelmanager associate to the Jid 		
 		CChannelManager* pChannelManager = GetChannelManager(rJid);
 				
 		if(pChannelManager == NULL)
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVECHANNELDATAERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
 		
 		// we are looking for the channel associate to the localCid
 		CChannel* pChannel = pChannelManager->GetChannelByLocalCid(localCid);
 
 		if(pChannel == NULL)
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVECHANNELDATAERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
 
-		pChannelDataHandler = pChannel->GetChannelDataHandler();
+		// we are looking for the stream associate to the localSid
+		CStream* pStream = pChannel->GetStreamByLocalSid(localSid);
+
+		if(pStream == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
 
+		pStreamDataHandler = pStream->GetStreamDataHandler();
 	}
 	
 	catch(exception& e)
@@ -696,50 +1532,68 @@ void CXEPxibb::ReceiveChannelData(const CJid& rJid, u16 localCid, CBuffer* pBuff
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVECHANNELDATAERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
 	}
 
 	MutexOnChannelManager.UnLock();
 
-	CChannelDataStanza ChannelDataStanza;
+	CStreamDataRecord* pStreamData = NULL;
 
-	if(!pXMPPCore->Receive(pChannelDataHandler, &ChannelDataStanza))
-	throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVECHANNELDATAERROR);
-	
-	CXMLNode* pData = ChannelDataStanza.GetChild("channel-data");
+	if(pXMPPCore->IsConnected())
+	pStreamData = pStreamDataHandler->PopStreamData();
 
-	CBase64 Base64;		
-	Base64.From64(pData->GetData(), pBuffer);
+	if(pStreamData == NULL)
+	throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
+
+	const CBuffer* pPayload = pStreamData->GetPayload();
+	const char* data = (const char*) pPayload->GetBuffer();
+	u32 size = pPayload->GetBufferSize();
+
+	// we decode straight into the caller memory
+	if(CBase64::GetFrom64Size(data, size) > dataSize)
+	{
+		delete pStreamData;
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
+	}
+
+	u32 decodedSize;
+
+	try
+	{
+		CBase64 Base64;		
+		decodedSize = Base64.From64(data, size, pData);
+	}
+
+	catch(exception& e)
+	{
+		delete pStreamData;
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
+	}
+
+	delete pStreamData;
+	return decodedSize;
 }
 
-void CXEPxibb::ReceiveStreamData(const CJid& rJid, u16 localCid, u16 localSid, CBuffer* pBuffer)
+bool CXEPxibb::TryReceiveStreamData(const CJid& rJid, u16 localCid, u16 localSid, CBuffer* pBuffer)
 {
 	CStreamDataHandler* pStreamDataHandler;
 	MutexOnChannelManager.Lock();
 
 	try
 	{
-		// we are looking for the channelmanager associate to the Jid 		
-		CChannelManager* pChannelManager = GetChannelManager(rJid);
-				
-		if(pChannelManager == NULL)
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
-		
-		// we are looking for the channel associate to the localCid
-		CChannel* pChannel = pChannelManager->GetChannelByLocalCid(localCid);
-
-		if(pChannel == NULL)
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
-
-		// we are looking for the stream associate to the localSid
-		CStream* pStream = pChannel->GetStreamByLocalSid(localSid);
+		CStream* pStream = GetStream(rJid, localCid, localSid);
 
 		if(pStream == NULL)
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_TRYRECEIVESTREAMDATAERROR);
 
 		pStreamDataHandler = pStream->GetStreamDataHandler();
 	}
-	
+
 	catch(exception& e)
 	{
 		MutexOnChannelManager.UnLock();
@@ -747,23 +1601,79 @@ void CXEPxibb::ReceiveStreamData(const CJid& rJid, u16 localCid, u16 localSid, C
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
-		throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_TRYRECEIVESTREAMDATAERROR);
 	}
 
 	MutexOnChannelManager.UnLock();
 
-	CStreamDataStanza StreamDataStanza;
+	// false at once when nothing is queued, the task set by SetStreamTask()
+	// is submitted when something comes in, a closed stream throws
+	CStreamDataRecord* pStreamData = NULL;
 
-	if(!pXMPPCore->Receive(pStreamDataHandler, &StreamDataStanza))
-	throw CXEPxibbException(CXEPxibbException::XEPXEC_RECEIVESTREAMDATAERROR);
-	
-	CXMLNode* pData = StreamDataStanza.GetChild("stream-data");
+	if(pXMPPCore->IsConnected())
+	pStreamData = pStreamDataHandler->TryPopStreamData();
 
-	CBase64 Base64;		
-	Base64.From64(pData->GetData(), pBuffer);
+	if(pStreamData == NULL)
+	{
+		if(pXMPPCore->IsConnected() && !pStreamDataHandler->IsDestroyed())
+		return false;
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_TRYRECEIVESTREAMDATAERROR);
+	}
+
+	try
+	{
+		CBase64 Base64;		
+		Base64.From64(pStreamData->GetPayload(), pBuffer);
+	}
+
+	catch(exception& e)
+	{
+		delete pStreamData;
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_TRYRECEIVESTREAMDATAERROR);
+	}
+
+	delete pStreamData;
+	return true;
 }
 
-void CXEPxibb::CloseChannel(const CJid& rJid, u16 localCid)
+CObject::u32 CXEPxibb::GetPendingStreamData(const CJid& rJid, u16 localCid, u16 localSid)
+{
+	MutexOnChannelManager.Lock();
+
+	try
+	{
+		// the records received and not yet read, a reader may batch its
+		// output while more are waiting
+		CStream* pStream = GetStream(rJid, localCid, localSid);
+
+		if(pStream == NULL)
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_GETPENDINGSTREAMDATAERROR);
+
+		u32 numPending = pStream->GetStreamDataHandler()->GetPendingStreamData();
+
+		MutexOnChannelManager.UnLock();
+		return numPending;
+	}
+
+	catch(exception& e)
+	{
+		MutexOnChannelManager.UnLock();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_GETPENDINGSTREAMDATAERROR);
+	}
+}
+
+void CXEPxibb::CloseChannel(const CJid& rJid, u16 localCid, bool isWait)
 {
 	CChannel* pChannel;
 	u16 remoteCid;
@@ -815,49 +1725,41 @@ void CXEPxibb::CloseChannel(const CJid& rJid, u16 localCid)
 
 	MutexOnChannelManager.UnLock();
 
-	// we build the iq request
-	string id;
-	pXMPPCore->GenerateId(id);
-	
 	try
 	{
+		// we build the iq request, its id is given by SendIQ()
+		CChannelCloseStanza ChannelCloseStanza(rJid, remoteCid, "");
 
-		CChannelCloseStanza ChannelCloseStanza(rJid, remoteCid, id);
-
-		// we build the handler associate to the iq request
-		CIQResultStanza IQResultStanza;
-		CHandler IQResultHandler;
+		// a caller that may not block leaves the answer to a request that
+		// frees itself
+		if(!isWait)
+		{
+			if(!CCloseRequest::Send(pXMPPCore, &ChannelCloseStanza, iqTimeout))
+			throw CXEPxibbException(CXEPxibbException::XEPXEC_CLOSECHANNELERROR);
 
-		CXMLFilter* pXMLFilter = new CXMLFilter("iq");
-		pXMLFilter->SetAttribut("from", rJid.GetFull());
-		pXMLFilter->SetAttribut("id", id);
+			return;
+		}
 
-		IQResultHandler.AddXMLFilter(pXMLFilter);
-		
-		pXMPPCore->RequestHandler(&IQResultHandler);
+		CIQResultStanza IQResultStanza;
+		CIQFuture IQFuture;
 
 		// we send the iq request
-		if(!pXMPPCore->Send(&ChannelCloseStanza))
+		if(!pXMPPCore->SendIQ(&ChannelCloseStanza, &IQFuture, iqTimeout))
 		throw CXEPxibbException(CXEPxibbException::XEPXEC_CLOSECHANNELERROR);
 
 		// we receive the iq result
-		if(!pXMPPCore->Receive(&IQResultHandler, &IQResultStanza))
+		if(!IQFuture.Wait(&IQResultStanza))
 		throw CXEPxibbException(CXEPxibbException::XEPXEC_CLOSECHANNELERROR);
-
-		pXMPPCore->CommitHandler(&IQResultHandler);
 	}
 	
 	catch(exception& e)
 	{
-		pXMPPCore->RemoveId(id);
 		#ifdef __DEBUG__
 		cerr << e.what() << endl;
 		#endif //__DEBUG__
 
 		throw CXEPxibbException(CXEPxibbException::XEPXEC_CLOSECHANNELERROR);
 	}
-
-	pXMPPCore->RemoveId(id);
 }
 
 void CXEPxibb::CloseStream(const CJid& rJid, u16 localCid, u16 localSid)
@@ -907,34 +1809,18 @@ void CXEPxibb::CloseStream(const CJid& rJid, u16 localCid, u16 localSid)
 
 	MutexOnChannelManager.UnLock();
 
-	// we build the iq request
-	string id;
-	pXMPPCore->GenerateId(id);
-	
-	CStreamCloseStanza StreamCloseStanza(rJid, remoteCid, remoteSid, id);
-
-	// we build the handler associate to the iq request
+	// we build the iq request, its id is given by SendIQ()
+	CStreamCloseStanza StreamCloseStanza(rJid, remoteCid, remoteSid, "");
 	CIQResultStanza IQResultStanza;
-	CHandler IQResultHandler;
-
-	CXMLFilter* pXMLFilter = new CXMLFilter("iq");
-	pXMLFilter->SetAttribut("from", rJid.GetFull());
-	pXMLFilter->SetAttribut("id", id);
-
-	IQResultHandler.AddXMLFilter(pXMLFilter);
-	
-	pXMPPCore->RequestHandler(&IQResultHandler);
+	CIQFuture IQFuture;
 
 	// we send the iq request
-	if(!pXMPPCore->Send(&StreamCloseStanza))
+	if(!pXMPPCore->SendIQ(&StreamCloseStanza, &IQFuture, iqTimeout))
 	throw CXEPxibbException(CXEPxibbException::XEPXEC_CLOSESTREAMERROR);
 
 	// we receive the iq result
-	if(!pXMPPCore->Receive(&IQResultHandler, &IQResultStanza))
+	if(!IQFuture.Wait(&IQResultStanza))
 	throw CXEPxibbException(CXEPxibbException::XEPXEC_CLOSESTREAMERROR);
-
-	pXMPPCore->CommitHandler(&IQResultHandler);
-	pXMPPCore->RemoveId(id);
 }
 
 void CXEPxibb::AddChannelManager(CChannelManager* pChannelManager)
@@ -989,6 +1875,51 @@ CChannelManager* CXEPxibb::GetChannelManager(const CJid& rJid)
 	}
 }
 
+CChannel* CXEPxibb::GetChannel(const CJid& rJid, u16 localCid)
+{
+	try
+	{
+		// the channel managers must be held, NULL when there is no such channel
+		CChannelManager* pChannelManager = GetChannelManager(rJid);
+
+		if(pChannelManager == NULL)
+		return NULL;
+
+		return pChannelManager->GetChannelByLocalCid(localCid);
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_GETCHANNELERROR);
+	}
+}
+
+CStream* CXEPxibb::GetStream(const CJid& rJid, u16 localCid, u16 localSid)
+{
+	try
+	{
+		CChannel* pChannel = GetChannel(rJid, localCid);
+
+		if(pChannel == NULL)
+		return NULL;
+
+		return pChannel->GetStreamByLocalSid(localSid);
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXEPxibbException(CXEPxibbException::XEPXEC_GETSTREAMERROR);
+	}
+}
+
 void CXEPxibb::RemoveChannelManager(const CJid& rJid)
 {
 	try
@@ -1234,16 +2165,67 @@ const char* CXEPxibbException::what() const throw()
 
 	case XEPXEC_WAITSTREAMERROR:
 		return "CXEPxibb::WaitStream() error";
+
+	case XEPXEC_ACCEPTSTREAMERROR:
+		return "CXEPxibb::AcceptStream() error";
+
+	case XEPXEC_SETCHANNELTASKERROR:
+		return "CXEPxibb::SetChannelTask() error";
+
+	case XEPXEC_SETSTREAMTASKERROR:
+		return "CXEPxibb::SetStreamTask() error";
 	
 	case XEPXEC_OPENSTREAMERROR:
 		return "CXEPxibb::OpenStream() error";
+
+	case XEPXEC_OPENCHANNELSTREAMERROR:
+		return "CXEPxibb::OpenChannelStream() error";
+
+	case XEPXEC_BEGINOPENSTREAMERROR:
+		return "CXEPxibb::BeginOpenStream() error";
+
+	case XEPXEC_ENDOPENSTREAMERROR:
+		return "CXEPxibb::EndOpenStream() error";
 	
 	case XEPXEC_SENDSTREAMDATAERROR:
 		return "CXEPxibb::SendStreamData() error";
 
+	case XEPXEC_TRYSENDSTREAMDATAERROR:
+		return "CXEPxibb::TrySendStreamData() error";
+
+	case XEPXEC_WAITSENDSTREAMDATAERROR:
+		return "CXEPxibb::WaitSendStreamData() error";
+
+	case XEPXEC_ISSTREAMOUTPUTFULLERROR:
+		return "CXEPxibb::IsStreamOutputFull() error";
+
+	case XEPXEC_SETSTREAMWEIGHTERROR:
+		return "CXEPxibb::SetStreamWeight() error";
+
+	case XEPXEC_SETCHANNELBURSTERROR:
+		return "CXEPxibb::SetChannelBurst() error";
+
+	case XEPXEC_SETSTREAMBURSTERROR:
+		return "CXEPxibb::SetStreamBurst() error";
+
+	case XEPXEC_GETCHANNELPACINGERROR:
+		return "CXEPxibb::GetChannelPacing() error";
+
+	case XEPXEC_GETSTREAMPACINGERROR:
+		return "CXEPxibb::GetStreamPacing() error";
+
+	case XEPXEC_SETTARGETDELAYERROR:
+		return "CXEPxibb::SetTargetDelay() error";
+
 	case XEPXEC_RECEIVESTREAMDATAERROR:
 		return "CXEPxibb::ReceiveStreamData() error";
 
+	case XEPXEC_TRYRECEIVESTREAMDATAERROR:
+		return "CXEPxibb::TryReceiveStreamData() error";
+
+	case XEPXEC_GETPENDINGSTREAMDATAERROR:
+		return "CXEPxibb::GetPendingStreamData() error";
+
 	case XEPXEC_CLOSESTREAMERROR:
 		return "CXEPxibb::CloseStream() error";
 		
@@ -1253,9 +2235,21 @@ const char* CXEPxibbException::what() const throw()
 	case XEPXEC_GETCHANNELMANAGERERROR:
 		return "CXEPxibb::GetChannelManager() error";
 
+	case XEPXEC_GETCHANNELERROR:
+		return "CXEPxibb::GetChannel() error";
+
+	case XEPXEC_GETSTREAMERROR:
+		return "CXEPxibb::GetStream() error";
+
 	case XEPXEC_REMOVECHANNELMANAGERERROR:
 		return "CXEPxibb::RemoveChannelManager() error";
 
+	case XEPXEC_PROBEERROR:
+		return "CXEPxibb::Probe() error";
+
+	case XEPXEC_ENCODEPAYLOADERROR:
+		return "CXEPxibb::EncodePayload() error";
+
 	default:
 		return "CXEPxibb: Unknown error";
 	}
@@ -27,13 +27,17 @@
 #include <common/CException.h>
 #include <common/CObject.h>
 #include <common/data/CBuffer.h>
+#include <common/thread/CExecutor.h>
 #include <common/thread/CMutex.h>
+#include <common/thread/CTask.h>
 #include <common/thread/CThread.h>
 #include <common/xml/CXMLNode.h>
 
 #include <xmpp/core/CXMPPCore.h>
 #include <xmpp/jid/CJid.h>
 #include <xmpp/xep/xibb/CChannelManager.h>
+#include <xmpp/xep/xibb/CPingRequest.h>
+#include <xmpp/xep/xibb/CRateControl.h>
 #include <xmpp/xep/xibb/handler/CChannelOpenHandler.h>
 #include <xmpp/xep/xibb/handler/CChannelCloseHandler.h>
 #include <xmpp/xep/xibb/handler/CStreamCloseHandler.h>
@@ -43,6 +47,16 @@ using namespace std;
 
 class CXEPxibb : public CObject
 {
+public:
+	// outcome of TrySendStreamData(), a paced or full send is to be retried
+	// with the same data, nothing of it was sent
+	enum XEPxibbSendStatus
+	{
+		XEPXSS_SENT,
+		XEPXSS_PACED,
+		XEPXSS_FULL
+	};
+
 public:
 	CXEPxibb(u16 MaxRemoteJid = 65535, u16 maxChannel = 65535);
 	virtual ~CXEPxibb();
@@ -53,26 +67,61 @@ public:
 	u16 GetMaxRemoteJid() const;
 	u16 GetMaxChannel() const;
 
-	void WaitChannel(CJid* pJid, u16* pLocalCid, u16* pMaxStream, u16* pBlockSize, u32* pByteRate);
-	void WaitStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16* pBlockSize, u32* pByteRate);
+	void SetIQTimeout(u32 iqTimeout);
+
+	bool WaitChannel(CJid* pJid, u16* pLocalCid, u16* pMaxStream, u16* pBlockSize, u32* pByteRate, u32 timeout = 0);
+	bool WaitStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16* pBlockSize, u32* pByteRate, bool* pIsRawData = NULL, u32 timeout = 0);
+	bool AcceptStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16* pBlockSize, u32* pByteRate, bool* pIsRawData = NULL);
+
+	void SetChannelTask(const CJid& rJid, u16 localCid, CExecutor* pExecutor, CTask* pTask);
+	void SetStreamTask(const CJid& rJid, u16 localCid, u16 localSid, CExecutor* pExecutor, CTask* pTask);
 
 	void OpenChannel(const CJid& rJid, u16* pLocalCid, u16 maxStream = 65535, u16 blockSize = 4096, u32 byteRate = 0);
-	void OpenStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16 blockSize = 4096, u32 byteRate = 0);
+	void OpenStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16 blockSize = 4096, u32 byteRate = 0, bool isRawData = false);
+	void OpenChannelStream(const CJid& rJid, u16* pLocalCid, u16* pLocalSid, u16 maxStream = 65535, u16 blockSize = 4096, u32 byteRate = 0, bool isRawData = false, const u8* pData = NULL, u32 dataSize = 0);
+	void BeginOpenStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16 blockSize = 4096, u32 byteRate = 0, bool isRawData = false);
+	void EndOpenStream(const CJid& rJid, u16 localCid, u16 localSid);
 
 	void SendChannelData(const CJid& rJid, u16 localCid, CBuffer* pBuffer);
 	void SendStreamData(const CJid& rJid, u16 localCid, u16 localSid, CBuffer* pBuffer);
+	void SendStreamData(const CJid& rJid, u16 localCid, u16 localSid, const u8* pData, u32 dataSize);
+	u32 TrySendStreamData(const CJid& rJid, u16 localCid, u16 localSid, CBuffer* pBuffer, u32* pDelay);
+	u32 TrySendStreamData(const CJid& rJid, u16 localCid, u16 localSid, const u8* pData, u32 dataSize, u32* pDelay);
+	bool WaitSendStreamData(const CJid& rJid, u16 localCid, u16 localSid);
+	bool IsStreamOutputFull(const CJid& rJid, u16 localCid, u16 localSid);
+	void SetStreamWeight(const CJid& rJid, u16 localCid, u16 localSid, u32 weight);
+
+	void SetChannelBurst(const CJid& rJid, u16 localCid, u32 burst);
+	void SetStreamBurst(const CJid& rJid, u16 localCid, u16 localSid, u32 burst);
+	void GetChannelPacing(const CJid& rJid, u16 localCid, u32* pNumPaced, u32* pPacedTime);
+	void GetStreamPacing(const CJid& rJid, u16 localCid, u16 localSid, u32* pNumPaced, u32* pPacedTime);
+
+	void SetTargetDelay(u32 targetDelay);
+	u32 GetSendRate() const;
+	u32 GetRtt() const;
 
 	void ReceiveChannelData(const CJid& rJid, u16 localCid, CBuffer* pBuffer);
 	void ReceiveStreamData(const CJid& rJid, u16 localCid, u16 localSid, CBuffer* pBuffer);
+	u32 ReceiveStreamData(const CJid& rJid, u16 localCid, u16 localSid, u8* pData, u32 dataSize);
+	bool TryReceiveStreamData(const CJid& rJid, u16 localCid, u16 localSid, CBuffer* pBuffer);
+	u32 GetPendingStreamData(const CJid& rJid, u16 localCid, u16 localSid);
 
-	void CloseChannel(const CJid& rJid, u16 localCid);
+	void CloseChannel(const CJid& rJid, u16 localCid, bool isWait = true);
 	void CloseStream(const CJid& rJid, u16 localCid, u16 localSid);
 
 private:
 	void AddChannelManager(CChannelManager* pChannelManager);
 	CChannelManager* GetChannelManager(const CJid& rJid);
+	CChannel* GetChannel(const CJid& rJid, u16 localCid);
+	CStream* GetStream(const CJid& rJid, u16 localCid, u16 localSid);
 	void RemoveChannelManager(const CJid& rJid);
 
+	bool ReceiveStream(const CJid& rJid, u16 localCid, u16* pLocalSid, u16* pBlockSize, u32* pByteRate, bool* pIsRawData, u32 timeout, bool isBlocking);
+
+	void Probe();
+
+	static CBuffer* EncodePayload(const u8* pData, u32 dataSize);
+
 	static void* OnChannelCloseJob(void* pvThis) throw();
 	static void* OnStreamCloseJob(void* pvThis) throw();
 	static void* OnPresenceJob(void* pvThis) throw();
@@ -81,6 +130,7 @@ private:
 	CXMPPCore* pXMPPCore;
 
 	u16 maxChannel;
+	u32 iqTimeout;
 	
 	CThread ThreadOnChannelCloseJob;
 	CThread ThreadOnStreamCloseJob;
@@ -93,6 +143,9 @@ private:
 	CChannelCloseHandler ChannelCloseHandler;
 	CStreamCloseHandler StreamCloseHandler;
 	CPresenceHandler PresenceHandler;
+
+	CRateControl RateControl;
+	CPingRequest PingRequest;
 };
  
 class CXEPxibbException : public CException
@@ -110,13 +163,34 @@ public:
 		XEPXEC_RECEIVECHANNELDATAERROR,
 		XEPXEC_CLOSECHANNELERROR,
 		XEPXEC_WAITSTREAMERROR,
+		XEPXEC_ACCEPTSTREAMERROR,
+		XEPXEC_SETCHANNELTASKERROR,
+		XEPXEC_SETSTREAMTASKERROR,
 		XEPXEC_OPENSTREAMERROR,
+		XEPXEC_OPENCHANNELSTREAMERROR,
+		XEPXEC_BEGINOPENSTREAMERROR,
+		XEPXEC_ENDOPENSTREAMERROR,
 		XEPXEC_SENDSTREAMDATAERROR,
+		XEPXEC_TRYSENDSTREAMDATAERROR,
+		XEPXEC_WAITSENDSTREAMDATAERROR,
+		XEPXEC_ISSTREAMOUTPUTFULLERROR,
+		XEPXEC_SETSTREAMWEIGHTERROR,
+		XEPXEC_SETCHANNELBURSTERROR,
+		XEPXEC_SETSTREAMBURSTERROR,
+		XEPXEC_GETCHANNELPACINGERROR,
+		XEPXEC_GETSTREAMPACINGERROR,
+		XEPXEC_SETTARGETDELAYERROR,
 		XEPXEC_RECEIVESTREAMDATAERROR,
+		XEPXEC_TRYRECEIVESTREAMDATAERROR,
+		XEPXEC_GETPENDINGSTREAMDATAERROR,
 		XEPXEC_CLOSESTREAMERROR,
 		XEPXEC_ADDCHANNELMANAGERERROR,
 		XEPXEC_GETCHANNELMANAGERERROR,
-		XEPXEC_REMOVECHANNELMANAGERERROR
+		XEPXEC_GETCHANNELERROR,
+		XEPXEC_GETSTREAMERROR,
+		XEPXEC_REMOVECHANNELMANAGERERROR,
+		XEPXEC_PROBEERROR,
+		XEPXEC_ENCODEPAYLOADERROR
 	};
 
 public:
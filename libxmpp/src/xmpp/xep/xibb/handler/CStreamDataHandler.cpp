@@ -24,17 +24,23 @@
 
 #include <common/CException.h>
 #include <common/CObject.h>
+#include <common/thread/CRingQueue.h>
+#include <common/xml/CSharedXMLNode.h>
+#include <common/xml/CXMLNode.h>
 
 #include <xmpp/core/CHandler.h>
 #include <xmpp/xep/xibb/handler/CStreamDataHandler.h>
+#include <xmpp/xml/CStreamDataRecord.h>
 
 using namespace std;
 
-CStreamDataHandler::CStreamDataHandler()
+CStreamDataHandler::CStreamDataHandler() : StreamDataQueue(STREAMDATAHANDLER_QUEUESIZE, false)
 {
+	channelId = 0;
+	streamId = 0;
 }
 
-CStreamDataHandler::CStreamDataHandler(const CJid& rJid, u16 channelId, u16 streamId)
+CStreamDataHandler::CStreamDataHandler(const CJid& rJid, u16 channelId, u16 streamId) : StreamDataQueue(STREAMDATAHANDLER_QUEUESIZE, false)
 {
 	try
 	{
@@ -74,6 +80,11 @@ void CStreamDataHandler::Init(const CJid& rJid, u16 channelId, u16 streamId)
 		pDataFilter->PushChild(pSubDataFilter);
 
 		AddXMLFilter(pDataFilter);
+
+		// the same triple lets the core route parser records to us
+		From = rJid.GetFull();
+		this->channelId = channelId;
+		this->streamId = streamId;
 	}
 	
 	catch(exception& e)
@@ -88,6 +99,222 @@ void CStreamDataHandler::Init(const CJid& rJid, u16 channelId, u16 streamId)
 
 CStreamDataHandler::~CStreamDataHandler()
 {
+	try
+	{
+		Destroy();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+	}
+}
+
+void CStreamDataHandler::PushXMLNode(CXMLNode* pXMLNode)
+{
+	try
+	{
+		// a stanza that missed the parser fast path is folded into a record
+		// so that readers only ever see one kind of item
+		CStreamDataRecord* pStreamData = FoldXMLNode(pXMLNode);
+
+		delete pXMLNode;
+		pXMLNode = NULL;
+
+		PushStreamData(pStreamData);
+	}
+
+	catch(exception& e)
+	{
+		if(pXMLNode != NULL)
+		delete pXMLNode;
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CStreamDataHandlerException(CStreamDataHandlerException::SDHEC_PUSHXMLNODEERROR);
+	}
+}
+
+void CStreamDataHandler::PushSharedXMLNode(CSharedXMLNode* pSharedXMLNode)
+{
+	try
+	{
+		// we only read the payload, a shared stanza is never copied for us
+		CStreamDataRecord* pStreamData = FoldXMLNode(pSharedXMLNode->GetXMLNode());
+
+		pSharedXMLNode->Release();
+		pSharedXMLNode = NULL;
+
+		PushStreamData(pStreamData);
+	}
+
+	catch(exception& e)
+	{
+		if(pSharedXMLNode != NULL)
+		pSharedXMLNode->Release();
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CStreamDataHandlerException(CStreamDataHandlerException::SDHEC_PUSHSHAREDXMLNODEERROR);
+	}
+}
+
+void CStreamDataHandler::SignalDestroy()
+{
+	try
+	{
+		Destroy();
+		CHandler::SignalDestroy();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CStreamDataHandlerException(CStreamDataHandlerException::SDHEC_SIGNALDESTROYERROR);
+	}
+}
+
+bool CStreamDataHandler::GetStreamDataRoute(string* pFrom, u16* pChannelId, u16* pStreamId) const
+{
+	if(From.empty())
+	return false;
+
+	*pFrom = From;
+	*pChannelId = channelId;
+	*pStreamId = streamId;
+
+	return true;
+}
+
+void CStreamDataHandler::PushStreamData(CStreamDataRecord* pStreamData)
+{
+	try
+	{
+		// only the core input thread pushes, the ring never blocks it
+		if(!StreamDataQueue.Push(pStreamData))
+		{
+			delete pStreamData;
+			return;
+		}
+
+		Notify();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CStreamDataHandlerException(CStreamDataHandlerException::SDHEC_PUSHSTREAMDATAERROR);
+	}
+}
+
+CStreamDataRecord* CStreamDataHandler::PopStreamData()
+{
+	try
+	{
+		void* pvStreamData;
+
+		if(!StreamDataQueue.Pop(&pvStreamData))
+		return NULL;
+	
+		return (CStreamDataRecord*) pvStreamData;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CStreamDataHandlerException(CStreamDataHandlerException::SDHEC_POPSTREAMDATAERROR);
+	}
+}
+
+CStreamDataRecord* CStreamDataHandler::TryPopStreamData()
+{
+	try
+	{
+		void* pvStreamData;
+
+		// NULL at once when nothing is queued, see IsDestroyed()
+		if(!StreamDataQueue.TryPop(&pvStreamData))
+		return NULL;
+
+		return (CStreamDataRecord*) pvStreamData;
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CStreamDataHandlerException(CStreamDataHandlerException::SDHEC_POPSTREAMDATAERROR);
+	}
+}
+
+CObject::u32 CStreamDataHandler::GetPendingStreamData() const
+{
+	return StreamDataQueue.GetSize();
+}
+
+CStreamDataRecord* CStreamDataHandler::FoldXMLNode(const CXMLNode* pXMLNode)
+{
+	CStreamDataRecord* pStreamData = NULL;
+
+	try
+	{
+		const string& data = pXMLNode->GetChild("stream-data")->GetData();
+
+		// the message attributes go along so that it unfolds the same
+		static const char* attrList[] = {"to", "id", "type"};
+		string valueList[3];
+
+		for(u32 i = 0 ; i < 3 ; i++)
+		{
+			if(pXMLNode->IsExistAttribut(attrList[i]))
+			valueList[i] = pXMLNode->GetAttribut(attrList[i]);
+		}
+
+		pStreamData = new CStreamDataRecord;
+		pStreamData->Init(From, valueList[0], valueList[1], valueList[2], channelId, streamId);
+		pStreamData->AppendPayload(data.data(), data.size());
+
+		return pStreamData;
+	}
+
+	catch(exception& e)
+	{
+		if(pStreamData != NULL)
+		delete pStreamData;
+
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CStreamDataHandlerException(CStreamDataHandlerException::SDHEC_FOLDXMLNODEERROR);
+	}
+}
+
+void CStreamDataHandler::Destroy()
+{
+	void* pvStreamData;
+
+	StreamDataQueue.Close();
+
+	while(StreamDataQueue.TryPop(&pvStreamData))
+	delete (CStreamDataRecord*) pvStreamData;
 }
 
 CStreamDataHandlerException::CStreamDataHandlerException(int code) : CException(code)
@@ -106,6 +333,24 @@ const char* CStreamDataHandlerException::what() const throw()
 	case SDHEC_INITERROR:
 		return "CStreamDataHandler::Init() error";
 						
+	case SDHEC_PUSHXMLNODEERROR:
+		return "CStreamDataHandler::PushXMLNode() error";
+						
+	case SDHEC_PUSHSHAREDXMLNODEERROR:
+		return "CStreamDataHandler::PushSharedXMLNode() error";
+
+	case SDHEC_FOLDXMLNODEERROR:
+		return "CStreamDataHandler::FoldXMLNode() error";
+
+	case SDHEC_SIGNALDESTROYERROR:
+		return "CStreamDataHandler::SignalDestroy() error";
+						
+	case SDHEC_PUSHSTREAMDATAERROR:
+		return "CStreamDataHandler::PushStreamData() error";
+						
+	case SDHEC_POPSTREAMDATAERROR:
+		return "CStreamDataHandler::PopStreamData() error";
+						
 	default:
 		return "CStreamDataHandler: Unknown error";
 	}
@@ -26,12 +26,18 @@
 
 #include <common/CException.h>
 #include <common/CObject.h>
+#include <common/thread/CRingQueue.h>
+#include <common/xml/CSharedXMLNode.h>
+#include <common/xml/CXMLNode.h>
 
 #include <xmpp/core/CHandler.h>
 #include <xmpp/jid/CJid.h>
+#include <xmpp/xml/CStreamDataRecord.h>
 
 using namespace std;
 
+#define STREAMDATAHANDLER_QUEUESIZE 64
+
 class CStreamDataHandler : public CHandler
 {
 public:
@@ -40,6 +46,27 @@ public:
 	virtual ~CStreamDataHandler();
 	
 	void Init(const CJid& rJid, u16 channelId, u16 streamId);
+
+	virtual void PushXMLNode(CXMLNode* pXMLNode);
+	virtual void PushSharedXMLNode(CSharedXMLNode* pSharedXMLNode);
+	virtual void SignalDestroy();
+
+	virtual bool GetStreamDataRoute(string* pFrom, u16* pChannelId, u16* pStreamId) const;
+	virtual void PushStreamData(CStreamDataRecord* pStreamData);
+	CStreamDataRecord* PopStreamData();
+	CStreamDataRecord* TryPopStreamData();
+	u32 GetPendingStreamData() const;
+
+private:
+	CStreamDataRecord* FoldXMLNode(const CXMLNode* pXMLNode);
+	void Destroy();
+
+private:
+	string From;
+	u16 channelId;
+	u16 streamId;
+
+	CRingQueue StreamDataQueue;
 };
  
 class CStreamDataHandlerException : public CException
@@ -48,7 +75,13 @@ public:
 	enum StreamDataHandlerExceptionCode
 	{
 		SDHEC_CONSTRUCTORERROR,
-		SDHEC_INITERROR
+		SDHEC_INITERROR,
+		SDHEC_PUSHXMLNODEERROR,
+		SDHEC_PUSHSHAREDXMLNODEERROR,
+		SDHEC_FOLDXMLNODEERROR,
+		SDHEC_SIGNALDESTROYERROR,
+		SDHEC_PUSHSTREAMDATAERROR,
+		SDHEC_POPSTREAMDATAERROR
 	};
 
 public:
@@ -35,11 +35,11 @@ CStreamOpenStanza::CStreamOpenStanza()
 {
 }
 
-CStreamOpenStanza::CStreamOpenStanza(const CJid& rRemoteJid, u16 channelId, u16 streamId, u16 blockSize, u32 byteRate, const string& id)
+CStreamOpenStanza::CStreamOpenStanza(const CJid& rRemoteJid, u16 channelId, u16 streamId, u16 blockSize, u32 byteRate, const string& id, bool isRawData)
 {
 	try
 	{
-		Init(rRemoteJid, channelId, streamId, blockSize, byteRate, id);
+		Init(rRemoteJid, channelId, streamId, blockSize, byteRate, id, isRawData);
 	}
 	
 	catch(exception& e)
@@ -52,7 +52,7 @@ CStreamOpenStanza::CStreamOpenStanza(const CJid& rRemoteJid, u16 channelId, u16
 	}
 }
 
-void CStreamOpenStanza::Init(const CJid& rRemoteJid, u16 channelId, u16 streamId, u16 blockSize, u32 byteRate, const string& id)
+void CStreamOpenStanza::Init(const CJid& rRemoteJid, u16 channelId, u16 streamId, u16 blockSize, u32 byteRate, const string& id, bool isRawData)
 {
 	try
 	{
@@ -87,6 +87,11 @@ void CStreamOpenStanza::Init(const CJid& rRemoteJid, u16 channelId, u16 streamId
 		pSubNode->SetAttribut("sid", SidConvertor.str());
 		pSubNode->SetAttribut("block-size", BlockSizeConvertor.str());
 		pSubNode->SetAttribut("byte-rate", ByteRateConvertor.str());
+
+		// the payload is carried without the xmpp-ssh node, peers which
+		// do not know this attribute never receive it (see CXEPdisco)
+		if(isRawData)
+		pSubNode->SetAttribut("data", "raw");
 	}
 	
 	catch(exception& e)
@@ -207,6 +212,23 @@ CObject::u32 CStreamOpenStanza::GetByteRate() const
 	}
 }
 
+bool CStreamOpenStanza::IsRawData() const
+{
+	try
+	{
+		return GetChild("stream-open")->IsExistAttribut("data", "raw");
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CStreamOpenStanzaException(CStreamOpenStanzaException::SOSEC_ISRAWDATAERROR);
+	}
+}
+
 
 CStreamOpenStanzaException::CStreamOpenStanzaException(int code) : CException(code)
 {}
@@ -239,6 +261,9 @@ const char* CStreamOpenStanzaException::what() const throw()
 	case SOSEC_GETBYTERATEERROR:
 		return "CStreamOpenStanza::GetByteRate() error";
 
+	case SOSEC_ISRAWDATAERROR:
+		return "CStreamOpenStanza::IsRawData() error";
+
 	default:
 		return "CStreamOpenStanza: Unknown error";
 	}
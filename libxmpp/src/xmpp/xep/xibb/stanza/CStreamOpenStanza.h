@@ -36,10 +36,10 @@ class CStreamOpenStanza : public CIQSetStanza
 {
 public:
 	CStreamOpenStanza();	
-	CStreamOpenStanza(const CJid& rRemoteJid, u16 channelId, u16 streamId, u16 blockSize, u32 byteRate, const string& id);
+	CStreamOpenStanza(const CJid& rRemoteJid, u16 channelId, u16 streamId, u16 blockSize, u32 byteRate, const string& id, bool isRawData = false);
 	virtual ~CStreamOpenStanza();
 	
-	void Init(const CJid& rRemoteJid, u16 channelId, u16 streamId, u16 blockSize, u32 byteRate, const string& id);
+	void Init(const CJid& rRemoteJid, u16 channelId, u16 streamId, u16 blockSize, u32 byteRate, const string& id, bool isRawData = false);
 	
 	const string& GetRemoteJid() const;
 
@@ -47,6 +47,7 @@ public:
 	u16 GetStreamId() const;
 	u16 GetBlockSize() const;
 	u32 GetByteRate() const;	
+	bool IsRawData() const;
 };
  
 class CStreamOpenStanzaException : public CException
@@ -60,7 +61,8 @@ public:
 		SOSEC_GETCHANNELIDERROR,
 		SOSEC_GETSTREAMIDERROR,
 		SOSEC_GETBLOCKSIZEERROR,
-		SOSEC_GETBYTERATEERROR
+		SOSEC_GETBYTERATEERROR,
+		SOSEC_ISRAWDATAERROR
 	};
 
 public:
@@ -0,0 +1,201 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/data/CBuffer.h>
+#include <common/data/CBufferPool.h>
+#include <common/xml/CXMLNode.h>
+
+#include <xmpp/xml/CStreamDataRecord.h>
+
+using namespace std;
+
+CStreamDataRecord::CStreamDataRecord()
+{
+	channelId = 0;
+	streamId = 0;
+}
+
+CStreamDataRecord::~CStreamDataRecord()
+{}
+
+void* CStreamDataRecord::operator new(size_t size)
+{
+	u32 capacity;
+	return CBufferPool::Allocate(size, &capacity);
+}
+
+void CStreamDataRecord::operator delete(void* pvStreamData, size_t size)
+{
+	CBufferPool::Release(pvStreamData, size);
+}
+
+bool CStreamDataRecord::ParseId(const char* id, u16* pId)
+{
+	u32 value = 0;
+	u32 len = 0;
+
+	// only the canonical decimal form, so that the id prints back the same
+	for( ; id[len] >= '0' && id[len] <= '9' ; len++)
+	{
+		value = 10 * value + (id[len] - '0');
+
+		if(len >= 5 || value > 0xFFFF)
+		return false;
+	}
+
+	if(len == 0 || id[len] != '\0' || (len > 1 && id[0] == '0'))
+	return false;
+
+	*pId = (u16) value;
+
+	return true;
+}
+
+void CStreamDataRecord::Init(const string& rFrom, const string& rTo, const string& rId, const string& rType, u16 channelId, u16 streamId)
+{
+	From = rFrom;
+	To = rTo;
+	Id = rId;
+	Type = rType;
+	this->channelId = channelId;
+	this->streamId = streamId;
+}
+
+const string& CStreamDataRecord::GetFrom() const
+{
+	return From;
+}
+
+CObject::u16 CStreamDataRecord::GetChannelId() const
+{
+	return channelId;
+}
+
+CObject::u16 CStreamDataRecord::GetStreamId() const
+{
+	return streamId;
+}
+
+CBuffer* CStreamDataRecord::GetPayload()
+{
+	return &Payload;
+}
+
+const CBuffer* CStreamDataRecord::GetPayload() const
+{
+	return &Payload;
+}
+
+void CStreamDataRecord::AppendPayload(const char data[], u32 len)
+{
+	if(len == 0)
+	return;
+
+	if(!Payload.Append((const u8*) data, len))
+	throw CStreamDataRecordException(CStreamDataRecordException::SDREC_APPENDPAYLOADERROR);
+}
+
+void CStreamDataRecord::BuildStreamDataNode(CXMLNode* pXMLNode) const
+{
+	try
+	{
+		ostringstream CidConvertor;
+		ostringstream SidConvertor;
+		
+		CidConvertor << channelId;
+		SidConvertor << streamId;
+
+		pXMLNode->SetName("stream-data");
+		pXMLNode->SetAttribut("xmlns", "http://jabber.org/protocol/xibb");
+		pXMLNode->SetAttribut("cid", CidConvertor.str());
+		pXMLNode->SetAttribut("sid", SidConvertor.str());
+
+		if(Payload.GetBufferSize())
+		pXMLNode->SetData((const char*) Payload.GetBuffer(), Payload.GetBufferSize());
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CStreamDataRecordException(CStreamDataRecordException::SDREC_BUILDERROR);
+	}
+}
+
+void CStreamDataRecord::BuildMessageNode(CXMLNode* pXMLNode) const
+{
+	try
+	{
+		pXMLNode->SetName("message");
+		pXMLNode->SetAttribut("from", From);
+
+		if(!To.empty())
+		pXMLNode->SetAttribut("to", To);
+
+		if(!Id.empty())
+		pXMLNode->SetAttribut("id", Id);
+
+		if(!Type.empty())
+		pXMLNode->SetAttribut("type", Type);
+
+		CXMLNode* pStreamDataNode = new CXMLNode;
+		pXMLNode->PushChild(pStreamDataNode);
+
+		BuildStreamDataNode(pStreamDataNode);
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CStreamDataRecordException(CStreamDataRecordException::SDREC_BUILDERROR);
+	}
+}
+
+CStreamDataRecordException::CStreamDataRecordException(int code) : CException(code)
+{}
+
+CStreamDataRecordException::~CStreamDataRecordException() throw()
+{}
+	
+const char* CStreamDataRecordException::what() const throw()
+{
+	switch(GetCode())
+	{
+	case SDREC_APPENDPAYLOADERROR:
+		return "CStreamDataRecord::AppendPayload() error";
+
+	case SDREC_BUILDERROR:
+		return "CStreamDataRecord::Build() error";
+		
+	default:
+		return "CStreamDataRecord: Unknown error";
+	}
+}
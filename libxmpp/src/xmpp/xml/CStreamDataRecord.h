@@ -0,0 +1,89 @@
+/*
+ *  XMPP-SSH is a XMPP protocol extension to provide several secure shell
+ *  streams over the XMPP protocol between two Jabber entities using
+ *  strong authentication, end-To-end encryption (RSA/AES) and X11
+ *  forwarding.
+ *
+ *  Copyright (C) 2007 Adrien Pinet
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CSTREAMDATARECORD_H__
+#define __CSTREAMDATARECORD_H__
+
+#include <cstddef>
+#include <string>
+
+#include <common/CException.h>
+#include <common/CObject.h>
+#include <common/data/CBuffer.h>
+#include <common/xml/CXMLNode.h>
+
+using namespace std;
+
+// compact form of <message from [to] [id] [type]><stream-data xmlns cid sid>BASE64</stream-data></message>
+// built by CXMPPParser without any DOM, records come from CBufferPool and so
+// does their payload
+class CStreamDataRecord : public CObject
+{
+public:
+	CStreamDataRecord();
+	virtual ~CStreamDataRecord();
+
+	static void* operator new(size_t size);
+	static void operator delete(void* pvStreamData, size_t size);
+
+	static bool ParseId(const char* id, u16* pId);
+
+	void Init(const string& rFrom, const string& rTo, const string& rId, const string& rType, u16 channelId, u16 streamId);
+
+	const string& GetFrom() const;
+	u16 GetChannelId() const;
+	u16 GetStreamId() const;
+
+	CBuffer* GetPayload();
+	const CBuffer* GetPayload() const;
+	void AppendPayload(const char data[], u32 len);
+
+	void BuildStreamDataNode(CXMLNode* pXMLNode) const;
+	void BuildMessageNode(CXMLNode* pXMLNode) const;
+
+private:
+	// attributes of the message, an empty one was absent
+	string From;
+	string To;
+	string Id;
+	string Type;
+
+	u16 channelId;
+	u16 streamId;
+	CBuffer Payload;
+};
+
+class CStreamDataRecordException : public CException
+{
+public:
+	enum StreamDataRecordExceptionCode
+	{
+		SDREC_APPENDPAYLOADERROR,
+		SDREC_BUILDERROR
+	};
+
+public:
+	CStreamDataRecordException(int code);
+	virtual ~CStreamDataRecordException() throw();
+
+	virtual const char* what() const throw();
+};
+
+#endif // __CSTREAMDATARECORD_H__
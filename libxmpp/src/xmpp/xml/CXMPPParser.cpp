@@ -19,21 +19,26 @@
  */
 
 #include <expat.h>
+#include <cstring>
 #include <iostream>
 #include <queue>
+#include <string>
 
 #include <common/CObject.h>
 #include <common/CException.h>
 #include <common/data/CBuffer.h>
 #include <common/thread/CMutex.h>
+#include <common/xml/CXMLArena.h>
 #include <common/xml/CXMLNode.h>
 
+#include <xmpp/xml/CStreamDataRecord.h>
 #include <xmpp/xml/CXMPPParser.h>
 
 using namespace std;
 
 CXMPPParser::CXMPPParser()
 {
+	parser = NULL;
 	Init();
 }
 
@@ -60,8 +65,23 @@ void CXMPPParser::Init()
 		
 		pCurrentNode = NULL;
 		pRootNode = NULL;
+		pArena = NULL;
+		PendingData.clear();
+
+		depth = 0;
+		isStreamDataMessage = false;
+		isStreamDataOpen = false;
+		pStreamData = NULL;
 		
+		// a new stream reuses the expat parser and its buffers
+		if(parser == NULL)
 		parser = XML_ParserCreate(NULL);
+		else
+		if(!XML_ParserReset(parser, NULL))
+		{
+			XML_ParserFree(parser);
+			parser = XML_ParserCreate(NULL);
+		}
 
 		if(parser == NULL)
 		throw CXMPPParserException(CXMPPParserException::XPEC_CREATINGERROR);
@@ -69,6 +89,13 @@ void CXMPPParser::Init()
 		XML_SetUserData(parser, this);
 		XML_SetElementHandler(parser, EventStartElement, EventEndElement);
 		XML_SetCharacterDataHandler(parser, EventDataElement);
+
+		#ifdef __EXPAT_REPARSEDEFERRAL__
+		// stanzas must come out as soon as their last byte is read, not
+		// when expat decides the next read is large enough
+		XML_SetReparseDeferralEnabled(parser, XML_FALSE);
+		#endif //__EXPAT_REPARSEDEFERRAL__
+
 		Mutex.UnLock();
 	}
 
@@ -94,18 +121,8 @@ void CXMPPParser::Destroy()
 			XML_ParserFree(parser);
 			parser = NULL;
 		}
-		
-		if(pRootNode != NULL)
-		{
-			delete pRootNode;
-			pRootNode = NULL;
-		}
-		
-		while(!XMLNodeQueue.empty())
-		{
-			delete XMLNodeQueue.front();
-			XMLNodeQueue.pop();
-		}
+
+		Clear();
 		
 		Mutex.UnLock();
 	}
@@ -123,8 +140,51 @@ void CXMPPParser::Destroy()
 
 void CXMPPParser::ReInit()
 {
-	Destroy();
-	Init();
+	try
+	{
+		Mutex.Lock();
+		Clear();
+		Mutex.UnLock();
+
+		Init();
+	}
+
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPParserException(CXMPPParserException::XPEC_CREATINGERROR);
+	}
+}
+
+void CXMPPParser::Clear()
+{
+	if(pRootNode != NULL)
+	{
+		delete pRootNode;
+		pRootNode = NULL;
+	}
+
+	if(pArena != NULL)
+	{
+		pArena->Release();
+		pArena = NULL;
+	}
+	
+	if(pStreamData != NULL)
+	{
+		delete pStreamData;
+		pStreamData = NULL;
+	}
+	
+	while(!ParsedItemQueue.empty())
+	{
+		delete ParsedItemQueue.front().pXMLNode;
+		delete ParsedItemQueue.front().pStreamData;
+		ParsedItemQueue.pop();
+	}
 }
 
 void CXMPPParser::Write(const CBuffer* pBuffer)
@@ -148,20 +208,96 @@ void CXMPPParser::Write(const CBuffer* pBuffer)
 	}
 }
 
+CObject::u8* CXMPPParser::GetWriteBuffer(u32 size)
+{
+	try
+	{
+		// the caller fills expat memory directly, WriteBuffer() parses it
+		Mutex.Lock();
+		u8* pData = (u8*) XML_GetBuffer(parser, size);
+		Mutex.UnLock();
+
+		if(pData == NULL)
+		throw CXMPPParserException(CXMPPParserException::XPEC_PARSINGERROR);
+
+		return pData;
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPParserException(CXMPPParserException::XPEC_PARSINGERROR);
+	}
+}
+
+void CXMPPParser::WriteBuffer(u32 size)
+{
+	try
+	{
+		Mutex.Lock();
+		if(XML_ParseBuffer(parser, size, 0) == XML_STATUS_ERROR)
+		throw CXMPPParserException(CXMPPParserException::XPEC_PARSINGERROR);
+		Mutex.UnLock();
+	}
+	
+	catch(exception& e)
+	{
+		Mutex.UnLock();
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPParserException(CXMPPParserException::XPEC_PARSINGERROR);
+	}
+}
+
 CXMLNode* CXMPPParser::GetXMLNode()
+{
+	try
+	{
+		CXMLNode* pXMLNode;
+		CStreamDataRecord* pStreamData;
+
+		GetNext(&pXMLNode, &pStreamData);
+
+		// callers of the DOM only get the record unfolded into a message
+		if(pStreamData != NULL)
+		{
+			pXMLNode = new CXMLNode;
+			pStreamData->BuildMessageNode(pXMLNode);
+			delete pStreamData;
+		}
+
+		return pXMLNode;
+	}
+	
+	catch(exception& e)
+	{
+		#ifdef __DEBUG__
+		cerr << e.what() << endl;
+		#endif //__DEBUG__
+
+		throw CXMPPParserException(CXMPPParserException::XPEC_GETSTANZAERROR);
+	}
+}
+
+void CXMPPParser::GetNext(CXMLNode** ppXMLNode, CStreamDataRecord** ppStreamData)
 {
 	try
 	{
 		Mutex.Lock();
 
-		while(XMLNodeQueue.empty())
+		while(ParsedItemQueue.empty())
 		Mutex.Wait();
 
-		CXMLNode* pXMLNode = XMLNodeQueue.front();
-		XMLNodeQueue.pop();
+		*ppXMLNode = ParsedItemQueue.front().pXMLNode;
+		*ppStreamData = ParsedItemQueue.front().pStreamData;
+		ParsedItemQueue.pop();
 
 		Mutex.UnLock();
-		return pXMLNode;
 	}
 	
 	catch(exception& e)
@@ -177,7 +313,7 @@ CXMLNode* CXMPPParser::GetXMLNode()
 CObject::u32 CXMPPParser::GetNumXMLNode()
 {
 	Mutex.Lock();
-	u32 size = XMLNodeQueue.size();
+	u32 size = ParsedItemQueue.size();
 	Mutex.UnLock();
 
 	return size;
@@ -189,6 +325,8 @@ void CXMPPParser::EventStartElement(void* pvThis, const char* name, const char**
 	try
 	{
 		CXMPPParser* This = (CXMPPParser*) pvThis;
+
+		This->depth++;
 		
 		if(This->pCurrentNode == NULL)
 		{
@@ -198,15 +336,53 @@ void CXMPPParser::EventStartElement(void* pvThis, const char* name, const char**
 		}
 		else
 		{
-			pXMLNode = new CXMLNode();
+			This->FlushData();
+
+			// anything below stream-data sends the record back to the DOM
+			if(This->isStreamDataOpen)
+			This->UnfoldStreamData();
+
+			if(This->isStreamDataMessage && This->depth == 3)
+			{
+				u16 channelId;
+				u16 streamId;
+
+				// the payload goes to a record, no node is built for it
+				if(This->pStreamData == NULL && This->IsStreamDataNode(name, atts, &channelId, &streamId))
+				{
+					This->pStreamData = new CStreamDataRecord;
+					This->pStreamData->Init(This->StreamDataFrom, This->StreamDataTo, This->StreamDataId, This->StreamDataType, channelId, streamId);
+					This->isStreamDataOpen = true;
+					return;
+				}
+
+				This->UnfoldStreamData();
+			}
+
+			// each stanza gets an arena, released with its last node
+			if(This->pArena == NULL)
+			This->pArena = CXMLArena::Create();
+
+			pXMLNode = new(This->pArena) CXMLNode(This->pArena);
 			This->pCurrentNode->PushChild(pXMLNode);
 			This->pCurrentNode = pXMLNode;
+
+			if(This->depth == 2)
+			This->isStreamDataMessage = strcmp(name, "message") == 0 && This->IsStreamDataMessage(atts);
 		}
 		
-		pXMLNode->SetName(name);
+		// the peer does not get to grow the atom table
+		pXMLNode->SetName(name, false);
+
+		u32 numAttribut = 0;
+
+		while(atts[2 * numAttribut] != NULL)
+		numAttribut++;
+
+		pXMLNode->ReserveAttribut(numAttribut);
 
 		for(int i = 0 ; atts[i] != NULL ; i += 2)
-		pXMLNode->SetAttribut(atts[i], atts[i + 1]);
+		pXMLNode->SetAttribut(atts[i], atts[i + 1], false);
 	}
 	
 	catch(exception& e)
@@ -228,8 +404,22 @@ void CXMPPParser::EventDataElement(void* pvThis, const char* data, int len)
 	{
 		CXMPPParser* This = (CXMPPParser*) pvThis;
 
-		if(len > 0)
-		This->pCurrentNode->AppendData(data, len);	
+		if(len <= 0)
+		return;
+
+		if(This->isStreamDataOpen)
+		{
+			This->pStreamData->AppendPayload(data, len);
+			return;
+		}
+
+		// text of the message itself is not part of the fast path shape
+		if(This->isStreamDataMessage)
+		This->UnfoldStreamData();
+
+		// the stream root gets no data, we only gather inside stanzas
+		if(This->pCurrentNode != This->pRootNode)
+		This->PendingData.append(data, len);	
 	}
 
 	catch(exception& e)
@@ -247,7 +437,19 @@ void CXMPPParser::EventEndElement(void* pvThis, const char* name)
 	try
 	{
 		CXMPPParser* This = (CXMPPParser*) pvThis;
+
+		This->depth--;
+
+		// the stream-data element had no node, the message is still current
+		if(This->isStreamDataOpen)
+		{
+			This->isStreamDataOpen = false;
+			return;
+		}
+
 		CXMLNode* pParent = This->pCurrentNode->GetParent();
+
+		This->FlushData();
 		
 		if(pParent == NULL)
 		{
@@ -260,9 +462,34 @@ void CXMPPParser::EventEndElement(void* pvThis, const char* name)
 		{
 			This->pCurrentNode->Detach();
 
-			This->XMLNodeQueue.push(This->pCurrentNode);
+			SParsedItem ParsedItem;
+
+			if(This->isStreamDataMessage && This->pStreamData != NULL)
+			{
+				// the message had the exact shape, only the record is kept
+				delete This->pCurrentNode;
+
+				ParsedItem.pXMLNode = NULL;
+				ParsedItem.pStreamData = This->pStreamData;
+			}
+			else
+			{
+				This->UnfoldStreamData();
+
+				ParsedItem.pXMLNode = This->pCurrentNode;
+				ParsedItem.pStreamData = NULL;
+			}
+
+			This->pStreamData = NULL;
+			This->isStreamDataMessage = false;
+
+			This->ParsedItemQueue.push(ParsedItem);
 			This->Mutex.Signal();
 
+			// the stanza nodes keep the arena alive
+			This->pArena->Release();
+			This->pArena = NULL;
+
 			This->pCurrentNode = pParent;
 		}
 		else
@@ -282,6 +509,99 @@ void CXMPPParser::EventEndElement(void* pvThis, const char* name)
 	}
 }
 
+void CXMPPParser::FlushData()
+{
+	if(PendingData.empty())
+	return;
+
+	pCurrentNode->AppendData(PendingData.data(), PendingData.size());
+	PendingData.clear();
+}
+
+bool CXMPPParser::IsStreamDataMessage(const char** atts)
+{
+	string* pValue;
+
+	StreamDataFrom.clear();
+	StreamDataTo.clear();
+	StreamDataId.clear();
+	StreamDataType.clear();
+
+	// the record keeps these attributes only, an empty value could not be
+	// told from an absent one so the message then goes through the DOM
+	for(int i = 0 ; atts[i] != NULL ; i += 2)
+	{
+		if(strcmp(atts[i], "from") == 0)
+		pValue = &StreamDataFrom;
+		else
+		if(strcmp(atts[i], "to") == 0)
+		pValue = &StreamDataTo;
+		else
+		if(strcmp(atts[i], "id") == 0)
+		pValue = &StreamDataId;
+		else
+		if(strcmp(atts[i], "type") == 0 && strcmp(atts[i + 1], "error") != 0)
+		pValue = &StreamDataType;
+		else
+		return false;
+
+		if(atts[i + 1][0] == '\0')
+		return false;
+
+		pValue->assign(atts[i + 1]);
+	}
+
+	return !StreamDataFrom.empty();
+}
+
+bool CXMPPParser::IsStreamDataNode(const char* name, const char** atts, u16* pChannelId, u16* pStreamId) const
+{
+	bool isXmlns = false;
+	bool isCid = false;
+	bool isSid = false;
+
+	if(strcmp(name, "stream-data") != 0)
+	return false;
+
+	for(int i = 0 ; atts[i] != NULL ; i += 2)
+	{
+		if(strcmp(atts[i], "xmlns") == 0)
+		isXmlns = strcmp(atts[i + 1], "http://jabber.org/protocol/xibb") == 0;
+		else
+		if(strcmp(atts[i], "cid") == 0)
+		isCid = CStreamDataRecord::ParseId(atts[i + 1], pChannelId);
+		else
+		if(strcmp(atts[i], "sid") == 0)
+		isSid = CStreamDataRecord::ParseId(atts[i + 1], pStreamId);
+		else
+		return false;
+	}
+
+	return isXmlns && isCid && isSid;
+}
+
+void CXMPPParser::UnfoldStreamData()
+{
+	// we leave the fast path, the record becomes a node of the message again
+	if(pStreamData != NULL)
+	{
+		CXMLNode* pXMLNode = new(pArena) CXMLNode(pArena);
+		pCurrentNode->PushChild(pXMLNode);
+		pStreamData->BuildStreamDataNode(pXMLNode);
+
+		delete pStreamData;
+		pStreamData = NULL;
+
+		if(isStreamDataOpen)
+		{
+			pCurrentNode = pXMLNode;
+			isStreamDataOpen = false;
+		}
+	}
+
+	isStreamDataMessage = false;
+}
+
 CXMPPParserException::CXMPPParserException(int code) : CException(code)
 {}
 
@@ -23,13 +23,17 @@
 
 #include <expat.h>
 #include <queue>
+#include <string>
 
 #include <common/CObject.h>
 #include <common/CException.h>
 #include <common/data/CBuffer.h>
 #include <common/thread/CMutex.h>
+#include <common/xml/CXMLArena.h>
 #include <common/xml/CXMLNode.h>
 
+#include <xmpp/xml/CStreamDataRecord.h>
+
 using namespace std;
 
 class CXMPPParser : CObject
@@ -43,7 +47,11 @@ public:
 	void Destroy();
 
 	void Write(const CBuffer* pBuffer);
+	u8* GetWriteBuffer(u32 size);
+	void WriteBuffer(u32 size);
+
 	CXMLNode* GetXMLNode();
+	void GetNext(CXMLNode** ppXMLNode, CStreamDataRecord** ppStreamData);
 	u32 GetNumXMLNode();
 
 protected:
@@ -51,12 +59,42 @@ protected:
 	static void EventStartElement(void* pvThis, const char* name, const char** atts);
 	static void EventEndElement(void* pvThis, const char* name);
 
+	void Clear();
+	void FlushData();
+
+	bool IsStreamDataMessage(const char** atts);
+	bool IsStreamDataNode(const char* name, const char** atts, u16* pChannelId, u16* pStreamId) const;
+	void UnfoldStreamData();
+
+private:
+	// a parsed stanza, or a stream-data message taken on the fast path
+	struct SParsedItem
+	{
+		CXMLNode* pXMLNode;
+		CStreamDataRecord* pStreamData;
+	};
+
 private:
 	XML_Parser parser;
 	CXMLNode* pCurrentNode;
 	CXMLNode* pRootNode;
+
+	// arena of the stanza being parsed and its pending character data
+	CXMLArena* pArena;
+	string PendingData;
+
+	// stream-data fast path state of the stanza being parsed
+	u32 depth;
+	bool isStreamDataMessage;
+	bool isStreamDataOpen;
+	string StreamDataFrom;
+	string StreamDataTo;
+	string StreamDataId;
+	string StreamDataType;
+	CStreamDataRecord* pStreamData;
+
 	CMutex Mutex;
-	queue<CXMLNode*> XMLNodeQueue;
+	queue<SParsedItem> ParsedItemQueue;
 };
 
 class CXMPPParserException : public CException